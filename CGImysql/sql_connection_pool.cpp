@@ -10,7 +10,7 @@ connection_pool* connection_pool::GetInstance()
     return &connPool;
 }
 
-connection_pool::connection_pool()
+connection_pool::connection_pool() : lock("db_pool")
 {
     this->CurConn = 0;
     this->FreeConn = 0;
@@ -52,7 +52,7 @@ void connection_pool::init(string url, string User, string PassWord, string Data
         connList.push_back(con);
         ++FreeConn;
     }
-    reserve = sem(FreeConn);
+    reserve.post(FreeConn);
 
     this->MaxConn = FreeConn;
 }
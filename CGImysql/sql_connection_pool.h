@@ -34,9 +34,9 @@ private:
     unsigned int FreeConn;  /* 当前空闲的连接数 */
 
 private:
-    locker lock;
+    futex_mutex lock;
     list<MYSQL*> connList;  /* 连接池 */
-    sem reserve;
+    futex_sem reserve;      /* 空闲连接数，取连接时在这里等待 */
 
 private:
     string url;             /* 主机地址 */
@@ -0,0 +1,295 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+#include "cpu_topology.h"
+
+/* set_mempolicy 的模式，libnuma 的 numaif.h 中有同样的定义 */
+#define MPOL_PREFERRED 1
+
+/* 读取 sysfs 中的一行 CPU 或节点列表 */
+static bool read_list(const char* path, cpu_set_t* set)
+{
+    FILE* fp = fopen(path, "r");
+    if(!fp)
+    {
+        return false;
+    }
+    char line[4096];
+    bool ok = fgets(line, sizeof(line), fp) != NULL;
+    fclose(fp);
+    return ok && cpu_topology::parse_cpu_list(line, set);
+}
+
+cpu_topology::cpu_topology()
+{
+    CPU_ZERO(&m_allowed);
+    if(sched_getaffinity(0, sizeof(m_allowed), &m_allowed) != 0)
+    {
+        for(long i = 0; i < sysconf(_SC_NPROCESSORS_ONLN) && i < CPU_SETSIZE; ++i)
+        {
+            CPU_SET(i, &m_allowed);
+        }
+    }
+
+    /* 节点编号可能不连续，按 online 列表逐个读取 */
+    cpu_set_t online;
+    if(read_list("/sys/devices/system/node/online", &online))
+    {
+        for(int node = 0; node < CPU_SETSIZE; ++node)
+        {
+            if(!CPU_ISSET(node, &online))
+            {
+                continue;
+            }
+            char path[128];
+            cpu_set_t cpus;
+            snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+            if(!read_list(path, &cpus))
+            {
+                continue;
+            }
+            CPU_AND(&cpus, &cpus, &m_allowed);
+            /* 下标即节点编号，没有可用 CPU 的节点（纯内存节点或被限制）保留为空集 */
+            while ((int)m_nodes.size() < node)
+            {
+                cpu_set_t empty;
+                CPU_ZERO(&empty);
+                m_nodes.push_back(empty);
+            }
+            m_nodes.push_back(cpus);
+        }
+    }
+    if(m_nodes.empty())
+    {
+        m_nodes.push_back(m_allowed);
+    }
+}
+
+int cpu_topology::node_of(int cpu) const
+{
+    for(size_t node = 0; node < m_nodes.size(); ++node)
+    {
+        if(CPU_ISSET(cpu, &m_nodes[node]))
+        {
+            return (int)node;
+        }
+    }
+    return -1;
+}
+
+int cpu_topology::node_of(const cpu_set_t& cpus) const
+{
+    int found = -1;
+    for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    {
+        if(!CPU_ISSET(cpu, &cpus))
+        {
+            continue;
+        }
+        int node = node_of(cpu);
+        if(node < 0 || (found >= 0 && node != found))
+        {
+            return -1;
+        }
+        found = node;
+    }
+    return found;
+}
+
+bool cpu_topology::parse_cpu_list(const char* list, cpu_set_t* set)
+{
+    CPU_ZERO(set);
+    const char* p = list;
+    while (*p)
+    {
+        while (isspace((unsigned char)*p) || *p == ',')
+        {
+            ++p;
+        }
+        if(!*p)
+        {
+            break;
+        }
+        if(!isdigit((unsigned char)*p))
+        {
+            return false;
+        }
+        char* end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+        p = end;
+        if(*p == '-')
+        {
+            ++p;
+            if(!isdigit((unsigned char)*p))
+            {
+                return false;
+            }
+            last = strtol(p, &end, 10);
+            p = end;
+        }
+        if(first > last || last >= CPU_SETSIZE)
+        {
+            return false;
+        }
+        for(long cpu = first; cpu <= last; ++cpu)
+        {
+            CPU_SET(cpu, set);
+        }
+        if(*p && *p != ',' && !isspace((unsigned char)*p))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void cpu_topology::format_cpu_list(const cpu_set_t& set, char* buf, int len)
+{
+    int n = 0;
+    buf[0] = '\0';
+    for(int cpu = 0; cpu < CPU_SETSIZE && n < len; ++cpu)
+    {
+        if(!CPU_ISSET(cpu, &set))
+        {
+            continue;
+        }
+        int last = cpu;
+        while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, &set))
+        {
+            ++last;
+        }
+        if(last == cpu)
+        {
+            n += snprintf(buf + n, len - n, "%s%d", n ? "," : "", cpu);
+        }
+        else
+        {
+            n += snprintf(buf + n, len - n, "%s%d-%d", n ? "," : "", cpu, last);
+        }
+        cpu = last;
+    }
+}
+
+bool cpu_topology::plan_one(const char* spec, const cpu_set_t& auto_set, bool auto_pin,
+                            bool* pin, cpu_set_t* set) const
+{
+    if(!spec || !*spec)
+    {
+        *pin = auto_pin;
+        *set = auto_set;
+        return true;
+    }
+    if(strcmp(spec, "none") == 0)
+    {
+        *pin = false;
+        return true;
+    }
+    if(!parse_cpu_list(spec, set))
+    {
+        return false;
+    }
+    CPU_AND(set, set, &m_allowed);
+    *pin = true;
+    return CPU_COUNT(set) > 0;
+}
+
+bool cpu_topology::plan(const char* reactor, const char* workers, const char* log,
+                        cpu_layout* layout) const
+{
+    /* 单节点机器上默认不绑定，交给调度器均衡 */
+    bool auto_pin = node_count() > 1;
+
+    /* 主循环所在的节点：显式配置时取其第一个 CPU 所在的节点，否则取第一个有可用 CPU 的节点 */
+    int home = -1;
+    cpu_set_t explicit_reactor;
+    if(reactor && *reactor && strcmp(reactor, "none") != 0 &&
+        parse_cpu_list(reactor, &explicit_reactor))
+    {
+        CPU_AND(&explicit_reactor, &explicit_reactor, &m_allowed);
+        for(int cpu = 0; cpu < CPU_SETSIZE && home < 0; ++cpu)
+        {
+            if(CPU_ISSET(cpu, &explicit_reactor))
+            {
+                home = node_of(cpu);
+            }
+        }
+    }
+    for(int node = 0; node < node_count() && home < 0; ++node)
+    {
+        if(CPU_COUNT(&m_nodes[node]) > 0)
+        {
+            home = node;
+        }
+    }
+    if(home < 0)
+    {
+        home = 0;
+    }
+    const cpu_set_t& home_cpus = m_nodes[home];
+
+    /* 默认布局：主循环独占节点的第一个 CPU，其余 CPU 给工作线程和日志线程 */
+    cpu_set_t auto_reactor;
+    CPU_ZERO(&auto_reactor);
+    for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    {
+        if(CPU_ISSET(cpu, &home_cpus))
+        {
+            CPU_SET(cpu, &auto_reactor);
+            break;
+        }
+    }
+    cpu_set_t auto_workers;
+    CPU_XOR(&auto_workers, &home_cpus, &auto_reactor);
+    if(CPU_COUNT(&auto_workers) == 0)
+    {
+        auto_workers = home_cpus;
+    }
+
+    if(!plan_one(reactor, auto_reactor, auto_pin, &layout->pin_reactor, &layout->reactor) ||
+        !plan_one(workers, auto_workers, auto_pin, &layout->pin_workers, &layout->workers) ||
+        !plan_one(log, auto_workers, auto_pin, &layout->pin_log, &layout->log))
+    {
+        return false;
+    }
+
+    /* 新线程继承创建者的绑定，主循环绑定后，不绑定的线程要显式放开到所有允许的 CPU */
+    if(layout->pin_reactor)
+    {
+        if(!layout->pin_workers)
+        {
+            layout->pin_workers = true;
+            layout->workers = m_allowed;
+        }
+        if(!layout->pin_log)
+        {
+            layout->pin_log = true;
+            layout->log = m_allowed;
+        }
+    }
+    return true;
+}
+
+bool cpu_topology::bind_self(const cpu_set_t& cpus) const
+{
+    if(pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0)
+    {
+        return false;
+    }
+
+    /* 内核默认就在线程运行的节点上分配首次访问的页，绑定到单个节点后再显式设置优先节点，
+        避免该节点内存暂时不足或绑定前被调度到其他节点时分配到远端 */
+    int node = node_of(cpus);
+    if(node_count() > 1 && node >= 0 && node < (int)(sizeof(unsigned long) * 8))
+    {
+        unsigned long mask = 1UL << node;
+        /* 内核不支持或容器中没有权限时失败，只影响内存位置，忽略 */
+        syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask, sizeof(mask) * 8 + 1);
+    }
+    return true;
+}
@@ -0,0 +1,70 @@
+#ifndef CPU_TOPOLOGY_H
+#define CPU_TOPOLOGY_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <sched.h>
+#include <vector>
+
+/* 各线程绑定的 CPU 集合，pin_* 为 false 表示不绑定 */
+struct cpu_layout
+{
+    bool pin_reactor;
+    bool pin_workers;
+    bool pin_log;
+    cpu_set_t reactor;  /* 主循环 */
+    cpu_set_t workers;  /* 线程池的工作线程（数据库查询也在工作线程中同步执行） */
+    cpu_set_t log;      /* 异步日志的写线程 */
+};
+
+/* CPU 和 NUMA 拓扑
+   从 /sys/devices/system/node 读取每个节点的 CPU 列表，没有该目录时视为单节点。
+   只考虑本进程允许使用的 CPU（sched_getaffinity），例如被 taskset 或 cgroup 限制时 */
+class cpu_topology
+{
+public:
+    static cpu_topology* get_instance()
+    {
+        static cpu_topology instance;
+        return &instance;
+    }
+
+    /* NUMA 节点数，至少为 1 */
+    int node_count() const { return (int)m_nodes.size(); }
+    /* 节点上本进程允许使用的 CPU */
+    const cpu_set_t& node_cpus(int node) const { return m_nodes[node]; }
+    /* CPU 所在的节点，不在任何节点中时返回 -1 */
+    int node_of(int cpu) const;
+    /* cpus 全部属于同一个节点时返回该节点，否则返回 -1 */
+    int node_of(const cpu_set_t& cpus) const;
+    /* 本进程允许使用的 CPU */
+    const cpu_set_t& allowed() const { return m_allowed; }
+
+    /* 计算各线程的布局。每项配置为 CPU 列表（如 "0-3,8"）、空串（按拓扑的默认布局）
+        或 "none"（不绑定，可以运行在所有允许的 CPU 上）。
+        默认布局：单节点机器上不绑定；多节点机器上主循环绑定到其所在节点（默认节点 0）的第一个 CPU，
+        工作线程和日志线程绑定到同一节点的其余 CPU，连接对象、缓冲区和处理它们的线程都在同一节点上。
+        配置格式错误或不含任何允许的 CPU 时返回 false */
+    bool plan(const char* reactor, const char* workers, const char* log, cpu_layout* layout) const;
+
+    /* 解析 CPU 列表，格式错误时返回 false */
+    static bool parse_cpu_list(const char* list, cpu_set_t* set);
+    /* 把调用线程绑定到 cpus；cpus 属于同一个节点时，该线程此后的内存分配也优先使用该节点 */
+    bool bind_self(const cpu_set_t& cpus) const;
+    /* 把 CPU 集合格式化为列表，用于日志 */
+    static void format_cpu_list(const cpu_set_t& set, char* buf, int len);
+
+private:
+    cpu_topology();
+
+    /* 解析一项配置，auto_set 为默认布局的结果 */
+    bool plan_one(const char* spec, const cpu_set_t& auto_set, bool auto_pin,
+                    bool* pin, cpu_set_t* set) const;
+
+private:
+    cpu_set_t m_allowed;
+    std::vector<cpu_set_t> m_nodes;
+};
+
+#endif
@@ -0,0 +1,144 @@
+#ifndef HDR_HISTOGRAM_H
+#define HDR_HISTOGRAM_H
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+/* HdrHistogram 风格的延迟直方图
+   数值按 2 的幂分段，每段再线性细分为 SUB_BUCKETS / 2 个桶，任意数值的相对误差不超过 1/1024，
+   记录只是一次下标计算和自增，分位数按桶累计得到。数值单位由使用者决定（压测中为微秒） */
+class hdr_histogram
+{
+public:
+    /* 每段的子桶数，决定精度 */
+    static const int SUB_BITS = 11;
+    static const int SUB_BUCKETS = 1 << SUB_BITS;
+    static const int HALF_BUCKETS = SUB_BUCKETS / 2;
+    /* 可记录的最大数值为 2^MAX_BITS - 1，更大的数值按最大值记录 */
+    static const int MAX_BITS = 40;
+
+public:
+    hdr_histogram()
+        : m_counts(SUB_BUCKETS + (MAX_BITS - SUB_BITS) * HALF_BUCKETS, 0),
+          m_total(0), m_sum(0), m_min(0), m_max(0)
+    {
+    }
+
+    void record(uint64_t value)
+    {
+        if(value >= ((uint64_t)1 << MAX_BITS))
+        {
+            value = ((uint64_t)1 << MAX_BITS) - 1;
+        }
+        ++m_counts[index_of(value)];
+        if(m_total == 0 || value < m_min)
+        {
+            m_min = value;
+        }
+        if(value > m_max)
+        {
+            m_max = value;
+        }
+        ++m_total;
+        m_sum += value;
+    }
+
+    /* 合并另一个直方图的记录 */
+    void merge(const hdr_histogram& other)
+    {
+        if(other.m_total == 0)
+        {
+            return;
+        }
+        for(size_t i = 0; i < m_counts.size(); ++i)
+        {
+            m_counts[i] += other.m_counts[i];
+        }
+        if(m_total == 0 || other.m_min < m_min)
+        {
+            m_min = other.m_min;
+        }
+        if(other.m_max > m_max)
+        {
+            m_max = other.m_max;
+        }
+        m_total += other.m_total;
+        m_sum += other.m_sum;
+    }
+
+    void reset()
+    {
+        memset(&m_counts[0], 0, m_counts.size() * sizeof(uint64_t));
+        m_total = m_sum = m_min = m_max = 0;
+    }
+
+    /* 百分位数，p 取值 0 ~ 100，返回所在桶的上界（不超过最大值） */
+    uint64_t percentile(double p) const
+    {
+        if(m_total == 0)
+        {
+            return 0;
+        }
+        uint64_t rank = (uint64_t)(p / 100.0 * m_total + 0.5);
+        if(rank < 1)
+        {
+            rank = 1;
+        }
+        if(rank > m_total)
+        {
+            rank = m_total;
+        }
+
+        uint64_t seen = 0;
+        for(size_t i = 0; i < m_counts.size(); ++i)
+        {
+            seen += m_counts[i];
+            if(seen >= rank)
+            {
+                uint64_t value = upper_of(i);
+                return value < m_max ? value : m_max;
+            }
+        }
+        return m_max;
+    }
+
+    uint64_t count() const { return m_total; }
+    uint64_t min() const { return m_min; }
+    uint64_t max() const { return m_max; }
+    double mean() const { return m_total ? (double)m_sum / m_total : 0.0; }
+
+private:
+    /* 小于 SUB_BUCKETS 的数值每个一个桶；更大的数值按最高位所在的段，取次高的 SUB_BITS - 1 位作为段内下标 */
+    static int index_of(uint64_t value)
+    {
+        if(value < (uint64_t)SUB_BUCKETS)
+        {
+            return (int)value;
+        }
+        int msb = 63 - __builtin_clzll(value);
+        int shift = msb - (SUB_BITS - 1);
+        return SUB_BUCKETS + (shift - 1) * HALF_BUCKETS + (int)((value >> shift) - HALF_BUCKETS);
+    }
+
+    /* 桶内的最大数值 */
+    static uint64_t upper_of(size_t index)
+    {
+        if(index < (size_t)SUB_BUCKETS)
+        {
+            return index;
+        }
+        int shift = (int)((index - SUB_BUCKETS) / HALF_BUCKETS) + 1;
+        uint64_t sub = (index - SUB_BUCKETS) % HALF_BUCKETS + HALF_BUCKETS;
+        return ((sub + 1) << shift) - 1;
+    }
+
+private:
+    std::vector<uint64_t> m_counts;
+    uint64_t m_total;
+    uint64_t m_sum;
+    uint64_t m_min;
+    uint64_t m_max;
+};
+
+#endif
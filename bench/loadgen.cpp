@@ -0,0 +1,796 @@
+/* HTTP 压测工具
+   按配置的比例发送 GET /、GET /5（图片页）、GET /6（视频页）、GET /test1.jpg（图片文件）、
+   POST /2CGISQL.cgi（登录）和 POST /3CGISQL.cgi（注册）请求，统计吞吐量和延迟分布。
+   -b 1 时请求带上浏览器常见的请求头（User-Agent、Accept 等），默认只有 Host 和 Connection。
+   每个线程一个 epoll，连接与服务器一样常驻边缘触发注册，由连接状态决定收发。
+   闭环模式：每个连接收到应答后立即发送下一个请求，并发度等于连接数。
+   开环模式（-r）：按固定速率安排请求，不受应答快慢影响；延迟从计划发送时刻算起，
+   服务器变慢时排队等待的时间也计入延迟，避免协调遗漏（coordinated omission）导致延迟偏低。
+
+   用法：loadgen [-a 地址] [-p 端口] [-c 连接数] [-t 线程数] [-d 秒数] [-w 预热秒数]
+                 [-r 每秒请求数] [-m 比例] [-k 0|1] [-b 0|1] [-u 用户名] [-P 密码] [-T 超时毫秒]
+   比例格式：index:70,picture:10,video:5,image:0,login:10,register:5 */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <string>
+#include <vector>
+#include <deque>
+
+#include "hdr_histogram.h"
+
+/* 请求类型 */
+enum REQ_KIND
+{
+    REQ_INDEX = 0,
+    REQ_PICTURE,
+    REQ_VIDEO,
+    REQ_IMAGE,
+    REQ_LOGIN,
+    REQ_REGISTER,
+    REQ_KIND_COUNT
+};
+
+static const char* kind_names[REQ_KIND_COUNT] = {
+    "index", "picture", "video", "image", "login", "register"
+};
+
+/* 命令行配置 */
+struct options
+{
+    const char* host;
+    int port;
+    int conns;              /* 总连接数 */
+    int threads;
+    int duration;           /* 统计时长（秒），不含预热 */
+    int warmup;             /* 预热时长（秒），期间的请求不计入结果 */
+    int rate;               /* 开环模式的总请求速率，0 为闭环模式 */
+    bool keepalive;
+    bool browser;           /* 带上浏览器常见的请求头 */
+    int timeout_ms;         /* 单个请求的超时 */
+    int weights[REQ_KIND_COUNT];
+    const char* user;
+    const char* password;
+};
+
+static options opt;
+static sockaddr_in server_addr;
+/* 各类请求的完整报文 */
+static std::string requests[REQ_KIND_COUNT];
+
+static long long now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* 单个连接 */
+struct bench_conn
+{
+    enum STATE
+    {
+        CLOSED = 0,
+        CONNECTING,
+        IDLE,
+        WRITING,
+        READING
+    };
+
+    int fd;
+    STATE state;
+    int kind;                   /* 当前请求类型 */
+    long long start_us;         /* 请求的计时起点 */
+    size_t out_off;             /* 请求报文已发送的字节数 */
+    std::vector<char> head;     /* 已收到的应答头 */
+    long long body_left;        /* 应答体还需读取的字节数，-1 表示应答头还没收完 */
+    int status;
+    bool server_close;          /* 服务器要求关闭连接 */
+};
+
+/* 一个线程的统计结果 */
+struct thread_stats
+{
+    hdr_histogram latency;
+    hdr_histogram kind_latency[REQ_KIND_COUNT];
+    long long completed;
+    long long bytes;
+    long long status_2xx;
+    long long status_other;
+    long long connect_errors;
+    long long io_errors;
+    long long timeouts;
+    long long scheduled;        /* 开环模式下计划的请求数 */
+    long long max_backlog;      /* 开环模式下等待空闲连接的最大请求数 */
+
+    thread_stats()
+        : completed(0), bytes(0), status_2xx(0), status_other(0), connect_errors(0),
+          io_errors(0), timeouts(0), scheduled(0), max_backlog(0)
+    {
+    }
+};
+
+/* 压测线程 */
+class bench_thread
+{
+public:
+    bench_thread(int id, int conns, double rate)
+        : m_id(id), m_conns(conns), m_rate(rate), m_epollfd(-1),
+          m_seed(0x9e3779b9u * (id + 1)), m_recording(false), m_stopping(false)
+    {
+    }
+
+    void run(long long warmup_end, long long end);
+    const thread_stats& stats() const { return m_stats; }
+
+private:
+    int pick_kind();
+    void open_conn(bench_conn* c);
+    void close_conn(bench_conn* c);
+    void start_request(bench_conn* c, long long start_us);
+    void on_event(bench_conn* c);
+    bool do_write(bench_conn* c);
+    bool do_read(bench_conn* c);
+    bool parse_head(bench_conn* c);
+    void finish(bench_conn* c);
+    void fail(bench_conn* c, long long& counter, bool reconnect = true);
+    void check_timeouts(long long now);
+
+private:
+    int m_id;
+    int m_conns;
+    double m_rate;              /* 本线程的请求速率 */
+    int m_epollfd;
+    unsigned m_seed;
+    bool m_recording;
+    bool m_stopping;
+    std::vector<bench_conn> m_pool;
+    std::vector<bench_conn*> m_idle;
+    std::deque<long long> m_backlog;    /* 开环模式下已到计划时刻、还没发出的请求 */
+    thread_stats m_stats;
+};
+
+int bench_thread::pick_kind()
+{
+    int total = 0;
+    for(int i = 0; i < REQ_KIND_COUNT; ++i)
+    {
+        total += opt.weights[i];
+    }
+    int r = rand_r(&m_seed) % total;
+    for(int i = 0; i < REQ_KIND_COUNT; ++i)
+    {
+        if(r < opt.weights[i])
+        {
+            return i;
+        }
+        r -= opt.weights[i];
+    }
+    return REQ_INDEX;
+}
+
+void bench_thread::open_conn(bench_conn* c)
+{
+    c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    c->head.clear();
+    c->state = bench_conn::CONNECTING;
+
+    epoll_event event;
+    event.data.ptr = c;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLET | EPOLLRDHUP;
+    epoll_ctl(m_epollfd, EPOLL_CTL_ADD, c->fd, &event);
+
+    if(connect(c->fd, (sockaddr*)&server_addr, sizeof(server_addr)) < 0 && errno != EINPROGRESS)
+    {
+        fail(c, m_stats.connect_errors, false);
+    }
+}
+
+void bench_thread::close_conn(bench_conn* c)
+{
+    if(c->fd >= 0)
+    {
+        close(c->fd);
+        c->fd = -1;
+    }
+    c->state = bench_conn::CLOSED;
+}
+
+/* 连接出错：计数、关闭并重连，进行中的请求作废。
+    连接失败时不立即重连，由 check_timeouts() 定期重连，服务器不可用时不会空转 */
+void bench_thread::fail(bench_conn* c, long long& counter, bool reconnect)
+{
+    if(m_recording)
+    {
+        ++counter;
+    }
+    close_conn(c);
+    if(reconnect && !m_stopping)
+    {
+        open_conn(c);
+    }
+}
+
+void bench_thread::start_request(bench_conn* c, long long start_us)
+{
+    c->kind = pick_kind();
+    c->start_us = start_us;
+    c->out_off = 0;
+    c->head.clear();
+    c->body_left = -1;
+    c->status = 0;
+    c->server_close = false;
+    c->state = bench_conn::WRITING;
+    if(!do_write(c))
+    {
+        fail(c, m_stats.io_errors);
+    }
+}
+
+bool bench_thread::do_write(bench_conn* c)
+{
+    const std::string& req = requests[c->kind];
+    while (c->out_off < req.size())
+    {
+        ssize_t n = send(c->fd, req.data() + c->out_off, req.size() - c->out_off, MSG_NOSIGNAL);
+        if(n < 0)
+        {
+            return errno == EAGAIN;
+        }
+        c->out_off += n;
+    }
+    c->state = bench_conn::READING;
+    return true;
+}
+
+/* 解析应答头：状态码、Content-Length 和 Connection */
+bool bench_thread::parse_head(bench_conn* c)
+{
+    c->head.push_back('\0');
+    const char* text = &c->head[0];
+    if(strncmp(text, "HTTP/1.", 7) != 0)
+    {
+        return false;
+    }
+    c->status = atoi(text + 9);
+
+    long long length = 0;
+    for(const char* line = strstr(text, "\r\n"); line; line = strstr(line, "\r\n"))
+    {
+        line += 2;
+        if(strncasecmp(line, "Content-Length:", 15) == 0)
+        {
+            length = atoll(line + 15);
+        }
+        else if(strncasecmp(line, "Connection:", 11) == 0)
+        {
+            const char* v = line + 11;
+            v += strspn(v, " \t");
+            c->server_close = strncasecmp(v, "close", 5) == 0;
+        }
+    }
+    c->head.pop_back();
+    c->body_left = length;
+    return true;
+}
+
+bool bench_thread::do_read(bench_conn* c)
+{
+    char buf[16384];
+    while (true)
+    {
+        ssize_t n = recv(c->fd, buf, sizeof(buf), 0);
+        if(n < 0)
+        {
+            return errno == EAGAIN;
+        }
+        if(n == 0)
+        {
+            return false;
+        }
+        if(m_recording)
+        {
+            m_stats.bytes += n;
+        }
+
+        size_t body = n;
+        /* 应答头还没收完，先在 head 中找空行 */
+        if(c->body_left < 0)
+        {
+            size_t old = c->head.size();
+            c->head.insert(c->head.end(), buf, buf + n);
+            const char* begin = &c->head[0];
+            const char* end = (const char*)memmem(begin, c->head.size(), "\r\n\r\n", 4);
+            if(!end)
+            {
+                if(c->head.size() > 16384)
+                {
+                    return false;
+                }
+                continue;
+            }
+            size_t head_len = end + 4 - begin;
+            c->head.resize(head_len);
+            if(!parse_head(c))
+            {
+                return false;
+            }
+            body = old + n - head_len;
+        }
+
+        c->body_left -= body;
+        if(c->body_left < 0)
+        {
+            /* 服务器发来了多于 Content-Length 的数据 */
+            return false;
+        }
+        if(c->body_left == 0)
+        {
+            finish(c);
+            return true;
+        }
+    }
+}
+
+/* 一个请求完成 */
+void bench_thread::finish(bench_conn* c)
+{
+    if(m_recording)
+    {
+        long long latency = now_us() - c->start_us;
+        m_stats.latency.record(latency);
+        m_stats.kind_latency[c->kind].record(latency);
+        ++m_stats.completed;
+        if(c->status >= 200 && c->status < 300)
+        {
+            ++m_stats.status_2xx;
+        }
+        else
+        {
+            ++m_stats.status_other;
+        }
+    }
+
+    if(c->server_close || !opt.keepalive)
+    {
+        close_conn(c);
+        if(!m_stopping)
+        {
+            open_conn(c);
+        }
+        return;
+    }
+    c->state = bench_conn::IDLE;
+    m_idle.push_back(c);
+}
+
+void bench_thread::on_event(bench_conn* c)
+{
+    switch (c->state)
+    {
+    case bench_conn::CONNECTING:
+    {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if(err != 0)
+        {
+            fail(c, m_stats.connect_errors, false);
+            return;
+        }
+        /* 同一批事件中可能有连接重建前的旧事件，确认连接确实已建立 */
+        sockaddr_in peer;
+        socklen_t peer_len = sizeof(peer);
+        if(getpeername(c->fd, (sockaddr*)&peer, &peer_len) < 0)
+        {
+            return;
+        }
+        c->state = bench_conn::IDLE;
+        m_idle.push_back(c);
+        return;
+    }
+    case bench_conn::WRITING:
+    {
+        if(!do_write(c))
+        {
+            fail(c, m_stats.io_errors);
+            return;
+        }
+        if(c->state != bench_conn::READING)
+        {
+            return;
+        }
+        /* 发完后应答可能已经到达，边缘触发不会再通知，直接读（继续执行下一个分支） */
+    }
+    case bench_conn::READING:
+    {
+        if(!do_read(c))
+        {
+            fail(c, m_stats.io_errors);
+        }
+        return;
+    }
+    default:
+    {
+        /* 空闲的保活连接被服务器关闭 */
+        char b;
+        if(recv(c->fd, &b, 1, MSG_PEEK) == 0)
+        {
+            for(size_t i = 0; i < m_idle.size(); ++i)
+            {
+                if(m_idle[i] == c)
+                {
+                    m_idle[i] = m_idle.back();
+                    m_idle.pop_back();
+                    break;
+                }
+            }
+            close_conn(c);
+            if(!m_stopping)
+            {
+                open_conn(c);
+            }
+        }
+        return;
+    }
+    }
+}
+
+void bench_thread::check_timeouts(long long now)
+{
+    for(size_t i = 0; i < m_pool.size(); ++i)
+    {
+        bench_conn* c = &m_pool[i];
+        if((c->state == bench_conn::WRITING || c->state == bench_conn::READING) &&
+            now - c->start_us > (long long)opt.timeout_ms * 1000)
+        {
+            fail(c, m_stats.timeouts);
+        }
+        else if(c->state == bench_conn::CLOSED)
+        {
+            open_conn(c);
+        }
+    }
+}
+
+void bench_thread::run(long long warmup_end, long long end)
+{
+    m_epollfd = epoll_create1(EPOLL_CLOEXEC);
+    m_stopping = false;
+    m_pool.resize(m_conns);
+    for(int i = 0; i < m_conns; ++i)
+    {
+        m_pool[i].fd = -1;
+        open_conn(&m_pool[i]);
+    }
+
+    long long interval = m_rate > 0 ? (long long)(1000000.0 / m_rate) : 0;
+    long long next_due = now_us();
+    long long last_check = next_due;
+    epoll_event events[256];
+
+    while (true)
+    {
+        long long now = now_us();
+        m_recording = now >= warmup_end && now < end;
+        if(now >= end)
+        {
+            break;
+        }
+
+        /* 开环模式：到计划时刻的请求进入积压队列，由空闲连接依次发出，计时起点为计划时刻 */
+        if(interval > 0)
+        {
+            while (next_due <= now)
+            {
+                m_backlog.push_back(next_due);
+                next_due += interval;
+                if(m_recording)
+                {
+                    ++m_stats.scheduled;
+                }
+            }
+            while (!m_backlog.empty() && !m_idle.empty())
+            {
+                bench_conn* c = m_idle.back();
+                m_idle.pop_back();
+                start_request(c, m_backlog.front());
+                m_backlog.pop_front();
+            }
+            if(m_recording && (long long)m_backlog.size() > m_stats.max_backlog)
+            {
+                m_stats.max_backlog = m_backlog.size();
+            }
+        }
+        /* 闭环模式：空闲连接立即发送下一个请求 */
+        else
+        {
+            while (!m_idle.empty())
+            {
+                bench_conn* c = m_idle.back();
+                m_idle.pop_back();
+                start_request(c, now);
+            }
+        }
+
+        if(now - last_check > 100000)
+        {
+            check_timeouts(now);
+            last_check = now;
+        }
+
+        int timeout = 100;
+        if(interval > 0)
+        {
+            long long wait = (next_due - now + 999) / 1000;
+            timeout = wait < timeout ? (int)wait : timeout;
+        }
+        int number = epoll_wait(m_epollfd, events, 256, timeout);
+        for(int i = 0; i < number; ++i)
+        {
+            on_event((bench_conn*)events[i].data.ptr);
+        }
+    }
+
+    m_stopping = true;
+    for(int i = 0; i < m_conns; ++i)
+    {
+        close_conn(&m_pool[i]);
+    }
+    close(m_epollfd);
+}
+
+struct thread_arg
+{
+    bench_thread* thread;
+    long long warmup_end;
+    long long end;
+};
+
+static void* thread_main(void* arg)
+{
+    thread_arg* a = (thread_arg*)arg;
+    a->thread->run(a->warmup_end, a->end);
+    return NULL;
+}
+
+static bool parse_mix(const char* mix)
+{
+    memset(opt.weights, 0, sizeof(opt.weights));
+    std::string s(mix);
+    size_t pos = 0;
+    while (pos < s.size())
+    {
+        size_t comma = s.find(',', pos);
+        std::string item = s.substr(pos, comma == std::string::npos ? std::string::npos : comma - pos);
+        size_t colon = item.find(':');
+        if(colon == std::string::npos)
+        {
+            return false;
+        }
+        std::string name = item.substr(0, colon);
+        int k = 0;
+        for(; k < REQ_KIND_COUNT; ++k)
+        {
+            if(name == kind_names[k])
+            {
+                break;
+            }
+        }
+        if(k == REQ_KIND_COUNT)
+        {
+            return false;
+        }
+        opt.weights[k] = atoi(item.c_str() + colon + 1);
+        if(comma == std::string::npos)
+        {
+            break;
+        }
+        pos = comma + 1;
+    }
+    int total = 0;
+    for(int i = 0; i < REQ_KIND_COUNT; ++i)
+    {
+        total += opt.weights[i];
+    }
+    return total > 0;
+}
+
+static void build_requests()
+{
+    std::string host = std::string(opt.host) + ":" + std::to_string(opt.port);
+    std::string conn = opt.keepalive ? "keep-alive" : "close";
+    const char* paths[REQ_KIND_COUNT] = {
+        "/", "/5", "/6", "/test1.jpg", "/2CGISQL.cgi", "/3CGISQL.cgi"
+    };
+
+    for(int i = 0; i < REQ_KIND_COUNT; ++i)
+    {
+        bool post = i == REQ_LOGIN || i == REQ_REGISTER;
+        std::string body;
+        if(post)
+        {
+            body = std::string("user=") + opt.user + "&password=" + opt.password;
+        }
+        requests[i] = std::string(post ? "POST " : "GET ") + paths[i] + " HTTP/1.1\r\n"
+                        "Host: " + host + "\r\n"
+                        "Connection: " + conn + "\r\n";
+        if(opt.browser)
+        {
+            requests[i] += "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:128.0) Gecko/20100101 Firefox/128.0\r\n"
+                            "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+                            "Accept-Language: zh-CN,zh;q=0.8,en-US;q=0.5,en;q=0.3\r\n"
+                            "Accept-Encoding: gzip, deflate\r\n"
+                            "Referer: http://" + host + "/\r\n"
+                            "Upgrade-Insecure-Requests: 1\r\n";
+        }
+        if(post)
+        {
+            requests[i] += "Content-Type: application/x-www-form-urlencoded\r\n"
+                            "Content-Length: " + std::to_string(body.size()) + "\r\n";
+        }
+        requests[i] += "\r\n" + body;
+    }
+}
+
+static void usage(const char* prog)
+{
+    printf("usage: %s [-a host] [-p port] [-c connections] [-t threads] [-d seconds]\n"
+           "          [-w warmup_seconds] [-r requests_per_second] [-m mix] [-k 0|1] [-b 0|1]\n"
+           "          [-u user] [-P password] [-T timeout_ms]\n"
+           "  mix: index:70,picture:10,video:5,image:0,login:10,register:5\n"
+           "  -b 1 adds browser-like request headers\n"
+           "  -r 0 (default) runs closed loop, otherwise open loop at the given rate\n", prog);
+}
+
+int main(int argc, char* argv[])
+{
+    opt.host = "127.0.0.1";
+    opt.port = 9006;
+    opt.conns = 64;
+    opt.threads = 2;
+    opt.duration = 10;
+    opt.warmup = 2;
+    opt.rate = 0;
+    opt.keepalive = true;
+    opt.browser = false;
+    opt.timeout_ms = 10000;
+    opt.user = "bench";
+    opt.password = "bench";
+    parse_mix("index:70,picture:10,video:5,login:10,register:5");
+
+    int c;
+    while ((c = getopt(argc, argv, "a:p:c:t:d:w:r:m:k:b:u:P:T:h")) != -1)
+    {
+        switch (c)
+        {
+        case 'a': opt.host = optarg; break;
+        case 'p': opt.port = atoi(optarg); break;
+        case 'c': opt.conns = atoi(optarg); break;
+        case 't': opt.threads = atoi(optarg); break;
+        case 'd': opt.duration = atoi(optarg); break;
+        case 'w': opt.warmup = atoi(optarg); break;
+        case 'r': opt.rate = atoi(optarg); break;
+        case 'k': opt.keepalive = atoi(optarg) != 0; break;
+        case 'b': opt.browser = atoi(optarg) != 0; break;
+        case 'u': opt.user = optarg; break;
+        case 'P': opt.password = optarg; break;
+        case 'T': opt.timeout_ms = atoi(optarg); break;
+        case 'm':
+            if(!parse_mix(optarg))
+            {
+                printf("bad mix: %s\n", optarg);
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if(opt.threads <= 0 || opt.conns < opt.threads || opt.duration <= 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(opt.port);
+    if(inet_pton(AF_INET, opt.host, &server_addr.sin_addr) != 1)
+    {
+        printf("bad address: %s\n", opt.host);
+        return 1;
+    }
+    build_requests();
+
+    /* 连接和速率平均分给各线程 */
+    std::vector<bench_thread*> threads;
+    std::vector<thread_arg> args(opt.threads);
+    std::vector<pthread_t> tids(opt.threads);
+    long long start = now_us();
+    long long warmup_end = start + (long long)opt.warmup * 1000000;
+    long long end = warmup_end + (long long)opt.duration * 1000000;
+    for(int i = 0; i < opt.threads; ++i)
+    {
+        int conns = opt.conns / opt.threads + (i < opt.conns % opt.threads ? 1 : 0);
+        threads.push_back(new bench_thread(i, conns, (double)opt.rate / opt.threads));
+        args[i].thread = threads[i];
+        args[i].warmup_end = warmup_end;
+        args[i].end = end;
+        pthread_create(&tids[i], NULL, thread_main, &args[i]);
+    }
+
+    thread_stats total;
+    for(int i = 0; i < opt.threads; ++i)
+    {
+        pthread_join(tids[i], NULL);
+        const thread_stats& s = threads[i]->stats();
+        total.latency.merge(s.latency);
+        for(int k = 0; k < REQ_KIND_COUNT; ++k)
+        {
+            total.kind_latency[k].merge(s.kind_latency[k]);
+        }
+        total.completed += s.completed;
+        total.bytes += s.bytes;
+        total.status_2xx += s.status_2xx;
+        total.status_other += s.status_other;
+        total.connect_errors += s.connect_errors;
+        total.io_errors += s.io_errors;
+        total.timeouts += s.timeouts;
+        total.scheduled += s.scheduled;
+        total.max_backlog += s.max_backlog;
+        delete threads[i];
+    }
+
+    double secs = opt.duration;
+    printf("%s loop, %d connections, %d threads, %ds (+%ds warmup), keep-alive %s\n",
+            opt.rate > 0 ? "open" : "closed", opt.conns, opt.threads, opt.duration, opt.warmup,
+            opt.keepalive ? "on" : "off");
+    if(opt.rate > 0)
+    {
+        printf("target rate    %d req/s, scheduled %lld, max backlog %lld\n",
+                opt.rate, total.scheduled, total.max_backlog);
+    }
+    printf("requests       %lld (%lld 2xx, %lld other)\n",
+            total.completed, total.status_2xx, total.status_other);
+    printf("errors         connect %lld, io %lld, timeout %lld\n",
+            total.connect_errors, total.io_errors, total.timeouts);
+    printf("throughput     %.1f req/s, %.2f MB/s\n",
+            total.completed / secs, total.bytes / secs / 1048576.0);
+    printf("latency (us)   min %llu  mean %.0f  p50 %llu  p90 %llu  p99 %llu  p99.9 %llu  max %llu\n",
+            (unsigned long long)total.latency.min(), total.latency.mean(),
+            (unsigned long long)total.latency.percentile(50),
+            (unsigned long long)total.latency.percentile(90),
+            (unsigned long long)total.latency.percentile(99),
+            (unsigned long long)total.latency.percentile(99.9),
+            (unsigned long long)total.latency.max());
+    for(int k = 0; k < REQ_KIND_COUNT; ++k)
+    {
+        const hdr_histogram& h = total.kind_latency[k];
+        if(h.count() == 0)
+        {
+            continue;
+        }
+        printf("  %-12s %10llu  p50 %llu  p99 %llu  p99.9 %llu\n", kind_names[k],
+                (unsigned long long)h.count(),
+                (unsigned long long)h.percentile(50),
+                (unsigned long long)h.percentile(99),
+                (unsigned long long)h.percentile(99.9));
+    }
+    return 0;
+}
@@ -0,0 +1,776 @@
+/* 核心数据结构和解析函数的微基准测试
+   覆盖 http_conn::parse_line/process_read、time_heap 的 add/adjust/tick、block_queue 与无锁 ring_queue 的 push/pop（逐个和批量）、
+   threadpool::append 和 Log::write_log。每个用例先预热一轮，再重复若干轮取中位数，
+   多线程用例按给定的各个线程数分别测量。结果可以输出为文本、JSON 或 CSV，
+   也可以与保存的基线（JSON 或 CSV）比较，中位数变慢超过阈值的用例视为退化。
+
+   用法：microbench [--filter 子串] [--threads 1,2,4] [--reps 5] [--scale 1.0]
+                    [--format text|json|csv] [--out 文件] [--baseline 文件] [--threshold 5] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <math.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "../http/http_conn.h"
+#include "../timer/min_heap.h"
+#include "../timer/coarse_clock.h"
+#include "../log/log.h"
+#include "../log/block_queue.h"
+#include "../lock/ring_queue.h"
+#include "../threadpool/threadpool.h"
+#include "../memory/buffer_pool.h"
+
+static long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* 用例函数：用 threads 个线程完成 ops 次操作，返回耗时（纳秒） */
+typedef long long (*bench_fn)(int threads, long long ops);
+
+struct bench_case
+{
+    const char* name;
+    bench_fn fn;
+    bool threaded;      /* 是否按线程数分别测量 */
+    long long ops;      /* 每轮的操作次数 */
+};
+
+struct bench_result
+{
+    std::string name;
+    int threads;
+    double ns_per_op;       /* 各轮的中位数 */
+    double min_ns_per_op;
+    double spread;          /* 各轮的相对标准差（百分比） */
+    long long ops;
+};
+
+/* 多线程用例的公共部分：所有线程在屏障处就绪后同时开始 */
+struct thread_group
+{
+    pthread_barrier_t barrier;
+};
+
+/* ---------------- http_conn ---------------- */
+
+static const char* sample_request =
+    "GET /nonexistent.html HTTP/1.1\r\n"
+    "Host: localhost:9006\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:109.0) Gecko/20100101 Firefox/115.0\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Connection: keep-alive\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "\r\n";
+
+/* 直接驱动 http_conn 的私有解析函数 */
+class http_conn_bench
+{
+public:
+    http_conn_bench()
+    {
+        m_len = strlen(sample_request);
+        m_conn.init();
+        m_conn.m_read_buf = buffer_pool::get_instance()->acquire(http_conn::READ_BUFFER_SIZE);
+        m_conn.m_read_size = buffer_pool::class_size(
+                                buffer_pool::class_of(http_conn::READ_BUFFER_SIZE));
+        m_conn.m_real_file[http_conn::FILENAME_LEN - 1] = '\0';
+    }
+
+    /* 解析会把 \r\n 改写为 \0，每次都重新装入请求 */
+    void load()
+    {
+        m_conn.init();
+        memcpy(m_conn.m_read_buf, sample_request, m_len + 1);
+        m_conn.m_read_idx = m_len;
+    }
+
+    int parse_lines()
+    {
+        int lines = 0;
+        while (m_conn.parse_line() == http_conn::LINE_OK)
+        {
+            m_conn.m_start_line = m_conn.m_checked_idx;
+            ++lines;
+        }
+        return lines;
+    }
+
+    int process_read()
+    {
+        return m_conn.process_read();
+    }
+
+private:
+    http_conn m_conn;
+    int m_len;
+};
+
+static long long bench_parse_line(int, long long ops)
+{
+    http_conn_bench b;
+    int lines = 0;
+    long long start = now_ns();
+    for(long long i = 0; i < ops; ++i)
+    {
+        b.load();
+        lines += b.parse_lines();
+    }
+    long long elapsed = now_ns() - start;
+    if(lines != ops * 9)
+    {
+        fprintf(stderr, "parse_line: unexpected line count %d\n", lines);
+    }
+    return elapsed;
+}
+
+/* 请求的文件不存在，do_request 只有一次 stat，不会 mmap */
+static long long bench_process_read(int, long long ops)
+{
+    http_conn_bench b;
+    long long start = now_ns();
+    for(long long i = 0; i < ops; ++i)
+    {
+        b.load();
+        b.process_read();
+    }
+    return now_ns() - start;
+}
+
+/* ---------------- time_heap ---------------- */
+
+/* 伪随机的到期时间，保证各轮相同 */
+static long long expire_of(long long i, long long range)
+{
+    return (long long)((unsigned long long)(i + 1) * 2654435761u % range);
+}
+
+static long long bench_heap_add(int, long long ops)
+{
+    std::vector<heap_timer> timers(ops);
+    time_heap heap(64);
+    long long base = coarse_clock::get_instance()->now_ms() + 1000000;
+    for(long long i = 0; i < ops; ++i)
+    {
+        timers[i].expire = base + expire_of(i, ops);
+    }
+
+    long long start = now_ns();
+    for(long long i = 0; i < ops; ++i)
+    {
+        heap.add_timer(&timers[i]);
+    }
+    return now_ns() - start;
+}
+
+/* 保活连接的典型操作：把已在堆中的定时器推迟 */
+static long long bench_heap_adjust(int, long long ops)
+{
+    std::vector<heap_timer> timers(ops);
+    time_heap heap(ops);
+    long long base = coarse_clock::get_instance()->now_ms() + 1000000;
+    for(long long i = 0; i < ops; ++i)
+    {
+        timers[i].expire = base + expire_of(i, ops);
+        heap.add_timer(&timers[i]);
+    }
+
+    long long start = now_ns();
+    for(long long i = 0; i < ops; ++i)
+    {
+        timers[i].expire += ops;
+        heap.adjust(&timers[i]);
+    }
+    return now_ns() - start;
+}
+
+/* 所有定时器都已到期，一次 tick 全部取出 */
+static long long bench_heap_tick(int, long long ops)
+{
+    std::vector<heap_timer> timers(ops);
+    time_heap heap(ops);
+    long long now = coarse_clock::get_instance()->now_ms();
+    for(long long i = 0; i < ops; ++i)
+    {
+        timers[i].expire = now - expire_of(i, ops) - 1;
+        heap.add_timer(&timers[i]);
+    }
+
+    long long start = now_ns();
+    heap.tick();
+    long long elapsed = now_ns() - start;
+    if(!heap.empty())
+    {
+        fprintf(stderr, "time_heap tick: %d timers left\n", heap.size());
+    }
+    return elapsed;
+}
+
+/* ---------------- block_queue / ring_queue ---------------- */
+
+template <class Q>
+struct queue_arg
+{
+    thread_group* group;
+    Q* queue;
+    long long ops;
+};
+
+template <class Q>
+static void* queue_producer(void* arg)
+{
+    queue_arg<Q>* a = (queue_arg<Q>*)arg;
+    std::string item("2024-01-01 00:00:00.000000 [info] microbench log line\n");
+    pthread_barrier_wait(&a->group->barrier);
+    for(long long i = 0; i < a->ops; ++i)
+    {
+        /* 队列满时 push 返回 false，重试 */
+        while (!a->queue->push(item))
+        {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+/* threads 个生产者，一个消费者（与异步日志相同），消费者每次最多取 batch 个 */
+template <class Q>
+static long long run_queue(int threads, long long ops, int batch)
+{
+    Q queue(1000);
+    thread_group group;
+    pthread_barrier_init(&group.barrier, NULL, threads + 1);
+
+    std::vector<pthread_t> tids(threads);
+    std::vector<queue_arg<Q> > args(threads);
+    for(int i = 0; i < threads; ++i)
+    {
+        args[i].group = &group;
+        args[i].queue = &queue;
+        args[i].ops = ops / threads;
+        pthread_create(&tids[i], NULL, queue_producer<Q>, &args[i]);
+    }
+
+    pthread_barrier_wait(&group.barrier);
+    long long start = now_ns();
+    std::vector<std::string> items(batch);
+    for(long long left = ops / threads * threads; left > 0; )
+    {
+        left -= queue.pop(&items[0], batch);
+    }
+    long long elapsed = now_ns() - start;
+
+    for(int i = 0; i < threads; ++i)
+    {
+        pthread_join(tids[i], NULL);
+    }
+    pthread_barrier_destroy(&group.barrier);
+    return elapsed;
+}
+
+static long long bench_queue(int threads, long long ops)
+{
+    return run_queue<block_queue<std::string> >(threads, ops, 1);
+}
+
+static long long bench_queue_batch(int threads, long long ops)
+{
+    return run_queue<block_queue<std::string> >(threads, ops, 64);
+}
+
+static long long bench_ring_mpsc(int threads, long long ops)
+{
+    return run_queue<ring_queue<std::string, mpsc_ring<std::string> > >(threads, ops, 1);
+}
+
+static long long bench_ring_mpsc_batch(int threads, long long ops)
+{
+    return run_queue<ring_queue<std::string, mpsc_ring<std::string> > >(threads, ops, 64);
+}
+
+/* 单生产者队列只测一个生产者 */
+static long long bench_ring_spsc(int, long long ops)
+{
+    return run_queue<ring_queue<std::string, spsc_ring<std::string> > >(1, ops, 1);
+}
+
+static long long bench_ring_spsc_batch(int, long long ops)
+{
+    return run_queue<ring_queue<std::string, spsc_ring<std::string> > >(1, ops, 64);
+}
+
+/* ---------------- threadpool ---------------- */
+
+/* 空任务，只计数 */
+struct bench_task
+{
+    MYSQL* mysql;
+    void process();
+};
+
+static std::atomic<long long> tasks_done(0);
+
+void bench_task::process()
+{
+    tasks_done.fetch_add(1, std::memory_order_relaxed);
+}
+
+/* 线程池只创建一次，未初始化的连接池取到的数据库连接为 NULL */
+static threadpool<bench_task>* task_pool = NULL;
+
+struct append_arg
+{
+    thread_group* group;
+    bench_task* tasks;
+    long long ops;
+};
+
+static void* append_producer(void* arg)
+{
+    append_arg* a = (append_arg*)arg;
+    pthread_barrier_wait(&a->group->barrier);
+    for(long long i = 0; i < a->ops; ++i)
+    {
+        while (!task_pool->append(&a->tasks[i]))
+        {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+/* threads 个线程向 8 个工作线程的线程池提交任务，计时到所有任务执行完 */
+static long long bench_append(int threads, long long ops)
+{
+    if(!task_pool)
+    {
+        task_pool = new threadpool<bench_task>(connection_pool::GetInstance(), 8, 100000);
+    }
+    std::vector<bench_task> tasks(ops);
+    long long per_thread = ops / threads;
+    long long total = per_thread * threads;
+    tasks_done.store(0);
+
+    thread_group group;
+    pthread_barrier_init(&group.barrier, NULL, threads + 1);
+    std::vector<pthread_t> tids(threads);
+    std::vector<append_arg> args(threads);
+    for(int i = 0; i < threads; ++i)
+    {
+        args[i].group = &group;
+        args[i].tasks = &tasks[i * per_thread];
+        args[i].ops = per_thread;
+        pthread_create(&tids[i], NULL, append_producer, &args[i]);
+    }
+
+    pthread_barrier_wait(&group.barrier);
+    long long start = now_ns();
+    for(int i = 0; i < threads; ++i)
+    {
+        pthread_join(tids[i], NULL);
+    }
+    while (tasks_done.load() < total)
+    {
+        sched_yield();
+    }
+    long long elapsed = now_ns() - start;
+    pthread_barrier_destroy(&group.barrier);
+    return elapsed;
+}
+
+/* ---------------- Log ---------------- */
+
+static char log_dir[64];
+
+struct log_arg
+{
+    thread_group* group;
+    long long ops;
+};
+
+static void* log_writer(void* arg)
+{
+    log_arg* a = (log_arg*)arg;
+    pthread_barrier_wait(&a->group->barrier);
+    for(long long i = 0; i < a->ops; ++i)
+    {
+        LOG_INFO("[microbench] request %lld from %s:%d\n", i, "127.0.0.1", 9006);
+    }
+    return NULL;
+}
+
+/* 与服务器默认配置相同的异步日志，日志写在临时目录中，结束时删除 */
+static long long bench_log(int threads, long long ops)
+{
+    thread_group group;
+    pthread_barrier_init(&group.barrier, NULL, threads + 1);
+    std::vector<pthread_t> tids(threads);
+    std::vector<log_arg> args(threads);
+    for(int i = 0; i < threads; ++i)
+    {
+        args[i].group = &group;
+        args[i].ops = ops / threads;
+        pthread_create(&tids[i], NULL, log_writer, &args[i]);
+    }
+
+    pthread_barrier_wait(&group.barrier);
+    long long start = now_ns();
+    for(int i = 0; i < threads; ++i)
+    {
+        pthread_join(tids[i], NULL);
+    }
+    long long elapsed = now_ns() - start;
+    Log::get_instance()->flush();
+    pthread_barrier_destroy(&group.barrier);
+    return elapsed;
+}
+
+static void remove_log_dir()
+{
+    DIR* dir = opendir(log_dir);
+    if(!dir)
+    {
+        return;
+    }
+    while (struct dirent* e = readdir(dir))
+    {
+        if(e->d_name[0] != '.')
+        {
+            std::string path = std::string(log_dir) + "/" + e->d_name;
+            unlink(path.c_str());
+        }
+    }
+    closedir(dir);
+    rmdir(log_dir);
+}
+
+/* ---------------- 运行和输出 ---------------- */
+
+static bench_case cases[] = {
+    { "http_parse_line",     bench_parse_line,        false, 500000 },
+    { "http_process_read",   bench_process_read,      false, 100000 },
+    { "time_heap_add",       bench_heap_add,          false, 1000000 },
+    { "time_heap_adjust",    bench_heap_adjust,       false, 1000000 },
+    { "time_heap_tick",      bench_heap_tick,         false, 200000 },
+    { "block_queue",         bench_queue,             true,  200000 },
+    { "block_queue_batch",   bench_queue_batch,       true,  200000 },
+    { "ring_mpsc",           bench_ring_mpsc,         true,  200000 },
+    { "ring_mpsc_batch",     bench_ring_mpsc_batch,   true,  200000 },
+    { "ring_spsc",           bench_ring_spsc,         false, 200000 },
+    { "ring_spsc_batch",     bench_ring_spsc_batch,   false, 200000 },
+    { "threadpool_append",   bench_append,            true,  200000 },
+    { "log_write_log",       bench_log,               true,  100000 },
+};
+
+static bench_result run_case(const bench_case& c, int threads, int reps, double scale)
+{
+    long long ops = (long long)(c.ops * scale);
+    if(ops < threads)
+    {
+        ops = threads;
+    }
+    /* 预热：填充缓存、触发缺页、创建线程池等 */
+    c.fn(threads, ops / 10 > threads ? ops / 10 : threads);
+
+    std::vector<double> samples;
+    for(int r = 0; r < reps; ++r)
+    {
+        samples.push_back((double)c.fn(threads, ops) / ops);
+    }
+    std::sort(samples.begin(), samples.end());
+
+    double mean = 0;
+    for(size_t i = 0; i < samples.size(); ++i)
+    {
+        mean += samples[i];
+    }
+    mean /= samples.size();
+    double var = 0;
+    for(size_t i = 0; i < samples.size(); ++i)
+    {
+        var += (samples[i] - mean) * (samples[i] - mean);
+    }
+
+    bench_result res;
+    res.name = c.name;
+    res.threads = threads;
+    res.ns_per_op = samples[samples.size() / 2];
+    res.min_ns_per_op = samples[0];
+    res.spread = mean > 0 ? sqrt(var / samples.size()) / mean * 100 : 0;
+    res.ops = ops;
+    return res;
+}
+
+static void write_results(FILE* fp, const std::vector<bench_result>& results, const std::string& format)
+{
+    if(format == "json")
+    {
+        fprintf(fp, "[\n");
+        for(size_t i = 0; i < results.size(); ++i)
+        {
+            const bench_result& r = results[i];
+            fprintf(fp, "  {\"name\": \"%s\", \"threads\": %d, \"ns_per_op\": %.2f, "
+                        "\"min_ns_per_op\": %.2f, \"spread_pct\": %.1f, \"ops\": %lld}%s\n",
+                        r.name.c_str(), r.threads, r.ns_per_op, r.min_ns_per_op, r.spread, r.ops,
+                        i + 1 < results.size() ? "," : "");
+        }
+        fprintf(fp, "]\n");
+    }
+    else if(format == "csv")
+    {
+        fprintf(fp, "name,threads,ns_per_op,min_ns_per_op,spread_pct,ops\n");
+        for(size_t i = 0; i < results.size(); ++i)
+        {
+            const bench_result& r = results[i];
+            fprintf(fp, "%s,%d,%.2f,%.2f,%.1f,%lld\n", r.name.c_str(), r.threads,
+                        r.ns_per_op, r.min_ns_per_op, r.spread, r.ops);
+        }
+    }
+    else
+    {
+        fprintf(fp, "%-20s %7s %12s %12s %8s %12s\n", "benchmark", "threads", "ns/op", "min ns/op",
+                    "spread", "ops/s");
+        for(size_t i = 0; i < results.size(); ++i)
+        {
+            const bench_result& r = results[i];
+            fprintf(fp, "%-20s %7d %12.1f %12.1f %7.1f%% %12.0f\n", r.name.c_str(), r.threads,
+                        r.ns_per_op, r.min_ns_per_op, r.spread,
+                        r.ns_per_op > 0 ? 1e9 / r.ns_per_op : 0);
+        }
+    }
+}
+
+/* 读取之前用 --format json 或 csv 保存的结果 */
+static bool read_baseline(const char* path, std::vector<bench_result>& baseline)
+{
+    FILE* fp = fopen(path, "r");
+    if(!fp)
+    {
+        return false;
+    }
+    char line[512];
+    while (fgets(line, sizeof(line), fp))
+    {
+        char name[128];
+        bench_result r;
+        if(sscanf(line, " {\"name\": \"%127[^\"]\", \"threads\": %d, \"ns_per_op\": %lf",
+                    name, &r.threads, &r.ns_per_op) == 3 ||
+            sscanf(line, "%127[^,],%d,%lf", name, &r.threads, &r.ns_per_op) == 3)
+        {
+            r.name = name;
+            baseline.push_back(r);
+        }
+    }
+    fclose(fp);
+    return true;
+}
+
+/* 与基线比较，返回退化的用例数 */
+static int compare(const std::vector<bench_result>& results,
+                    const std::vector<bench_result>& baseline, double threshold)
+{
+    int regressions = 0;
+    printf("\n%-20s %7s %12s %12s %9s\n", "benchmark", "threads", "baseline", "current", "change");
+    for(size_t i = 0; i < results.size(); ++i)
+    {
+        const bench_result& r = results[i];
+        const bench_result* b = NULL;
+        for(size_t j = 0; j < baseline.size(); ++j)
+        {
+            if(baseline[j].name == r.name && baseline[j].threads == r.threads)
+            {
+                b = &baseline[j];
+                break;
+            }
+        }
+        if(!b)
+        {
+            printf("%-20s %7d %12s %12.1f %9s\n", r.name.c_str(), r.threads, "-", r.ns_per_op, "new");
+            continue;
+        }
+        double change = (r.ns_per_op - b->ns_per_op) / b->ns_per_op * 100;
+        const char* mark = "";
+        if(change > threshold)
+        {
+            mark = "  REGRESSED";
+            ++regressions;
+        }
+        else if(change < -threshold)
+        {
+            mark = "  improved";
+        }
+        printf("%-20s %7d %12.1f %12.1f %+8.1f%%%s\n", r.name.c_str(), r.threads,
+                b->ns_per_op, r.ns_per_op, change, mark);
+    }
+    return regressions;
+}
+
+static void usage(const char* prog)
+{
+    printf("usage: %s [--filter substr] [--threads 1,2,4] [--reps 5] [--scale 1.0]\n"
+           "          [--format text|json|csv] [--out file] [--baseline file] [--threshold 5]\n"
+           "  --baseline compares against results saved with --format json or csv and\n"
+           "  exits with status 2 when a benchmark is slower by more than --threshold percent\n",
+           prog);
+}
+
+int main(int argc, char* argv[])
+{
+    const char* filter = NULL;
+    std::vector<int> thread_counts;
+    int reps = 5;
+    double scale = 1.0;
+    std::string format = "text";
+    const char* out = NULL;
+    const char* baseline_path = NULL;
+    double threshold = 5.0;
+
+    for(int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if(i + 1 >= argc)
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        const char* val = argv[++i];
+        if(arg == "--filter")
+        {
+            filter = val;
+        }
+        else if(arg == "--threads")
+        {
+            for(const char* p = val; *p; )
+            {
+                thread_counts.push_back(atoi(p));
+                p += strcspn(p, ",");
+                p += *p == ',';
+            }
+        }
+        else if(arg == "--reps")
+        {
+            reps = atoi(val);
+        }
+        else if(arg == "--scale")
+        {
+            scale = atof(val);
+        }
+        else if(arg == "--format")
+        {
+            format = val;
+        }
+        else if(arg == "--out")
+        {
+            out = val;
+        }
+        else if(arg == "--baseline")
+        {
+            baseline_path = val;
+        }
+        else if(arg == "--threshold")
+        {
+            threshold = atof(val);
+        }
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if(thread_counts.empty())
+    {
+        thread_counts.push_back(1);
+        thread_counts.push_back(2);
+        thread_counts.push_back(4);
+    }
+    if(reps <= 0 || scale <= 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    strcpy(log_dir, "/tmp/microbench.XXXXXX");
+    if(!mkdtemp(log_dir))
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+    std::string log_file = std::string(log_dir) + "/bench";
+    Log::get_instance()->init(log_file.c_str(), 2000, 800000000, 8);
+
+    /* 解析请求头时会把不认识的头部 printf 到标准输出，测量期间把标准输出指向 /dev/null */
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, STDOUT_FILENO);
+    close(devnull);
+
+    std::vector<bench_result> results;
+    for(size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i)
+    {
+        if(filter && !strstr(cases[i].name, filter))
+        {
+            continue;
+        }
+        for(size_t t = 0; t < thread_counts.size(); ++t)
+        {
+            if(!cases[i].threaded && t > 0)
+            {
+                break;
+            }
+            int threads = cases[i].threaded ? thread_counts[t] : 1;
+            results.push_back(run_case(cases[i], threads, reps, scale));
+            fprintf(stderr, "%s/%d done\n", cases[i].name, threads);
+        }
+    }
+    remove_log_dir();
+
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+
+    FILE* fp = stdout;
+    if(out)
+    {
+        fp = fopen(out, "w");
+        if(!fp)
+        {
+            perror(out);
+            return 1;
+        }
+    }
+    write_results(fp, results, format);
+    if(out)
+    {
+        fclose(fp);
+    }
+
+    if(baseline_path)
+    {
+        std::vector<bench_result> baseline;
+        if(!read_baseline(baseline_path, baseline))
+        {
+            perror(baseline_path);
+            return 1;
+        }
+        if(compare(results, baseline, threshold) > 0)
+        {
+            return 2;
+        }
+    }
+    return 0;
+}
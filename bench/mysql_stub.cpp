@@ -0,0 +1,201 @@
+/* 内存中的 MySQL 替身
+   实现服务器用到的几个 libmysqlclient 函数，按 <mysql/mysql.h> 中的声明编译，链接时代替 -lmysqlclient，
+   服务器的其余代码与正式构建完全相同。用于 PGO 训练（make pgo）和没有 MySQL 的机器上压测。
+   只认识服务器发出的两种语句：SELECT username,passwd FROM user 返回所有用户，
+   INSERT INTO user(username, passwd) VALUES('名字', '密码') 添加用户；其余语句成功但没有结果。
+   环境变量：
+     TWS_STUB_USERS     初始用户，"名字:密码,名字:密码"，默认 "bench:bench"（与 loadgen 的默认用户相同）
+     TWS_STUB_DELAY_US  每条语句的模拟延迟（微秒），默认 0 */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <mysql/mysql.h>
+#include <map>
+#include <string>
+#include <vector>
+
+/* 一次查询的结果，MYSQL_RES* 实际指向它 */
+struct stub_result
+{
+    std::vector<std::string> cells;     /* 按行依次存放 username、passwd */
+    size_t next;                        /* 下一行的下标 */
+    char* row[2];
+};
+
+static pthread_mutex_t stub_lock = PTHREAD_MUTEX_INITIALIZER;
+static std::map<std::string, std::string>* stub_users = NULL;
+/* 每个连接最近一次查询的结果，由 mysql_store_result 取走 */
+static std::map<MYSQL*, stub_result*> stub_pending;
+static int stub_delay_us = 0;
+
+/* 调用时已持有 stub_lock */
+static void load_users()
+{
+    if(stub_users)
+    {
+        return;
+    }
+    stub_users = new std::map<std::string, std::string>();
+    const char* env = getenv("TWS_STUB_USERS");
+    std::string spec = env ? env : "bench:bench";
+    size_t pos = 0;
+    while (pos < spec.size())
+    {
+        size_t comma = spec.find(',', pos);
+        std::string item = spec.substr(pos, comma == std::string::npos ? std::string::npos : comma - pos);
+        size_t colon = item.find(':');
+        if(colon != std::string::npos)
+        {
+            (*stub_users)[item.substr(0, colon)] = item.substr(colon + 1);
+        }
+        if(comma == std::string::npos)
+        {
+            break;
+        }
+        pos = comma + 1;
+    }
+    const char* delay = getenv("TWS_STUB_DELAY_US");
+    stub_delay_us = delay ? atoi(delay) : 0;
+}
+
+/* 取出 s 中 from 之后第一对单引号之间的内容，返回结束引号之后的位置，找不到返回 NULL */
+static const char* quoted(const char* from, std::string* out)
+{
+    const char* begin = strchr(from, '\'');
+    if(!begin)
+    {
+        return NULL;
+    }
+    const char* end = strchr(begin + 1, '\'');
+    if(!end)
+    {
+        return NULL;
+    }
+    out->assign(begin + 1, end - begin - 1);
+    return end + 1;
+}
+
+MYSQL* mysql_init(MYSQL* mysql)
+{
+    if(!mysql)
+    {
+        mysql = (MYSQL*)calloc(1, sizeof(MYSQL));
+    }
+    return mysql;
+}
+
+MYSQL* mysql_real_connect(MYSQL* mysql, const char*, const char*, const char*, const char*,
+                            unsigned int, const char*, unsigned long)
+{
+    pthread_mutex_lock(&stub_lock);
+    load_users();
+    pthread_mutex_unlock(&stub_lock);
+    return mysql;
+}
+
+unsigned int mysql_errno(MYSQL*)
+{
+    return 0;
+}
+
+const char* mysql_error(MYSQL*)
+{
+    return "";
+}
+
+void mysql_close(MYSQL* mysql)
+{
+    pthread_mutex_lock(&stub_lock);
+    std::map<MYSQL*, stub_result*>::iterator it = stub_pending.find(mysql);
+    if(it != stub_pending.end())
+    {
+        delete it->second;
+        stub_pending.erase(it);
+    }
+    pthread_mutex_unlock(&stub_lock);
+    /* 连接池总是用 mysql_init(NULL) 分配 */
+    free(mysql);
+}
+
+int mysql_query(MYSQL* mysql, const char* q)
+{
+    if(stub_delay_us > 0)
+    {
+        usleep(stub_delay_us);
+    }
+
+    stub_result* res = new stub_result;
+    res->next = 0;
+
+    pthread_mutex_lock(&stub_lock);
+    load_users();
+    if(strncasecmp(q, "SELECT", 6) == 0)
+    {
+        for(std::map<std::string, std::string>::const_iterator it = stub_users->begin();
+            it != stub_users->end(); ++it)
+        {
+            res->cells.push_back(it->first);
+            res->cells.push_back(it->second);
+        }
+    }
+    else if(strncasecmp(q, "INSERT", 6) == 0)
+    {
+        const char* values = strstr(q, "VALUES");
+        std::string name, passwd;
+        const char* p = values ? quoted(values, &name) : NULL;
+        if(p && quoted(p, &passwd))
+        {
+            (*stub_users)[name] = passwd;
+        }
+    }
+    stub_result*& slot = stub_pending[mysql];
+    delete slot;
+    slot = res;
+    pthread_mutex_unlock(&stub_lock);
+    return 0;
+}
+
+MYSQL_RES* mysql_store_result(MYSQL* mysql)
+{
+    pthread_mutex_lock(&stub_lock);
+    stub_result* res = NULL;
+    std::map<MYSQL*, stub_result*>::iterator it = stub_pending.find(mysql);
+    if(it != stub_pending.end())
+    {
+        res = it->second;
+        stub_pending.erase(it);
+    }
+    pthread_mutex_unlock(&stub_lock);
+    return (MYSQL_RES*)res;
+}
+
+unsigned int mysql_num_fields(MYSQL_RES*)
+{
+    return 2;
+}
+
+MYSQL_FIELD* mysql_fetch_fields(MYSQL_RES*)
+{
+    static MYSQL_FIELD fields[2];
+    return fields;
+}
+
+MYSQL_ROW mysql_fetch_row(MYSQL_RES* result)
+{
+    stub_result* res = (stub_result*)result;
+    if(!res || res->next >= res->cells.size())
+    {
+        return NULL;
+    }
+    res->row[0] = (char*)res->cells[res->next].c_str();
+    res->row[1] = (char*)res->cells[res->next + 1].c_str();
+    res->next += 2;
+    return res->row;
+}
+
+void mysql_free_result(MYSQL_RES* result)
+{
+    delete (stub_result*)result;
+}
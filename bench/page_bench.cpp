@@ -0,0 +1,452 @@
+/* 页面加载压测工具，比较 HTTP/1.1 多连接和 HTTP/2 单连接加载同一个页面
+   每个线程循环模拟一次冷启动的页面加载：先请求页面（-u），再请求页面引用的资源（-r，逗号分隔）。
+   HTTP/1.1（默认）按浏览器的做法每个页面最多开 -c 个保活连接，每个连接同一时刻只有一个请求；
+   HTTP/2（-2）只开一个连接（先验知识，明文），资源作为并发的流一次发出。
+   加载完成后关闭所有连接，统计每秒页面数、页面加载时间的分位数以及每个页面建立的连接数。
+
+   用法：page_bench [-a 地址] [-p 端口] [-t 线程数] [-d 秒数] [-c 连接数] [-2] [-u 页面] [-r 资源列表] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "hdr_histogram.h"
+#include "../http2/hpack.h"
+
+/* 命令行配置 */
+struct options
+{
+    const char* host;
+    int port;
+    int threads;
+    int duration;
+    int conns;              /* HTTP/1.1 每个页面的最大连接数 */
+    bool http2;
+    const char* page;
+    std::vector<std::string> resources;
+};
+
+/* 一个线程的统计结果 */
+struct thread_stats
+{
+    long long pages;
+    long long requests;
+    long long connections;
+    long long bytes;
+    long long errors;
+    hdr_histogram latency;  /* 页面加载时间（微秒） */
+
+    thread_stats() : pages(0), requests(0), connections(0), bytes(0), errors(0) { }
+};
+
+static options opt;
+static sockaddr_in server_addr;
+static std::atomic<bool> stopping(false);
+
+static long long now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int open_conn(thread_stats& st)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if(connect(fd, (sockaddr*)&server_addr, sizeof(server_addr)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    ++st.connections;
+    return fd;
+}
+
+static bool send_all(int fd, const std::string& data)
+{
+    size_t sent = 0;
+    while (sent < data.size())
+    {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if(n <= 0)
+        {
+            return false;
+        }
+        sent += n;
+    }
+    return true;
+}
+
+/* HTTP/1.1 连接：同一时刻只有一个请求，应答按 Content-Length 判断结束 */
+struct h1_conn
+{
+    int fd;
+    bool busy;
+    std::string head;
+    long long body_left;    /* -1 表示还在读应答头 */
+
+    h1_conn() : fd(-1), busy(false), body_left(-1) { }
+};
+
+static bool h1_send(h1_conn& c, const std::string& path)
+{
+    std::string request = "GET " + path + " HTTP/1.1\r\n"
+                            "Host: " + opt.host + "\r\n"
+                            "Connection: keep-alive\r\n\r\n";
+    c.busy = true;
+    c.head.clear();
+    c.body_left = -1;
+    return send_all(c.fd, request);
+}
+
+/* 读到 n 字节后推进应答的解析，应答读完返回 1，出错返回 -1 */
+static int h1_feed(h1_conn& c, const char* data, ssize_t n, thread_stats& st)
+{
+    if(c.body_left < 0)
+    {
+        c.head.append(data, n);
+        size_t end = c.head.find("\r\n\r\n");
+        if(end == std::string::npos)
+        {
+            return 0;
+        }
+        const char* cl = strcasestr(c.head.c_str(), "Content-Length:");
+        if(!cl || cl > c.head.c_str() + end)
+        {
+            return -1;
+        }
+        long long body = c.head.size() - (end + 4);
+        c.body_left = atoll(cl + strlen("Content-Length:")) - body;
+        st.bytes += body;
+    }
+    else
+    {
+        c.body_left -= n;
+        st.bytes += n;
+    }
+    if(c.body_left > 0)
+    {
+        return 0;
+    }
+    c.busy = false;
+    ++st.requests;
+    return 1;
+}
+
+/* HTTP/1.1 加载一个页面：先在第一个连接上取页面，资源再分到最多 opt.conns 个连接上 */
+static bool load_h1(thread_stats& st)
+{
+    std::vector<h1_conn> conns(1);
+    conns[0].fd = open_conn(st);
+    bool ok = conns[0].fd >= 0 && h1_send(conns[0], opt.page);
+    size_t next = 0;
+    bool page_done = false;
+    char buf[65536];
+
+    while (ok)
+    {
+        /* 页面到达后才知道要取哪些资源，按需建立新连接 */
+        for(size_t i = 0; page_done && ok && i < conns.size() && next < opt.resources.size(); ++i)
+        {
+            if(!conns[i].busy)
+            {
+                ok = h1_send(conns[i], opt.resources[next++]);
+            }
+        }
+        while (page_done && ok && next < opt.resources.size() && (int)conns.size() < opt.conns)
+        {
+            h1_conn c;
+            c.fd = open_conn(st);
+            conns.push_back(c);
+            ok = c.fd >= 0 && h1_send(conns.back(), opt.resources[next++]);
+        }
+
+        std::vector<pollfd> fds;
+        std::vector<size_t> owners;
+        for(size_t i = 0; i < conns.size(); ++i)
+        {
+            if(conns[i].busy)
+            {
+                pollfd p = { conns[i].fd, POLLIN, 0 };
+                fds.push_back(p);
+                owners.push_back(i);
+            }
+        }
+        if(!ok || fds.empty())
+        {
+            break;
+        }
+        if(poll(&fds[0], fds.size(), 5000) <= 0)
+        {
+            ok = false;
+            break;
+        }
+        for(size_t k = 0; ok && k < fds.size(); ++k)
+        {
+            if(!fds[k].revents)
+            {
+                continue;
+            }
+            h1_conn& c = conns[owners[k]];
+            ssize_t n = recv(c.fd, buf, sizeof(buf), 0);
+            int done = n > 0 ? h1_feed(c, buf, n, st) : -1;
+            if(done < 0)
+            {
+                ok = false;
+            }
+            else if(done > 0 && owners[k] == 0)
+            {
+                page_done = true;
+            }
+        }
+    }
+
+    for(size_t i = 0; i < conns.size(); ++i)
+    {
+        if(conns[i].fd >= 0)
+        {
+            close(conns[i].fd);
+        }
+    }
+    return ok && page_done && next == opt.resources.size();
+}
+
+static void append_frame(std::string& out, uint8_t type, uint8_t flags, uint32_t id, const std::string& payload)
+{
+    uint32_t len = payload.size();
+    char header[9] = { (char)(len >> 16), (char)(len >> 8), (char)len, (char)type, (char)flags,
+                        (char)(id >> 24), (char)(id >> 16), (char)(id >> 8), (char)id };
+    out.append(header, sizeof(header));
+    out.append(payload);
+}
+
+static std::string u32(uint32_t v)
+{
+    char b[4] = { (char)(v >> 24), (char)(v >> 16), (char)(v >> 8), (char)v };
+    return std::string(b, 4);
+}
+
+/* 一个 GET 请求的 HEADERS 帧。只用静态表和不索引的字面值，不需要维护编码器的动态表 */
+static void h2_request(std::string& out, uint32_t id, const std::string& path)
+{
+    std::string block;
+    block.push_back((char)0x82);    /* :method GET */
+    block.push_back((char)0x86);    /* :scheme http */
+    hpack::encode_int(block, 4, 4, 0x00);   /* :path */
+    hpack::encode_string(block, path.data(), path.size(), true);
+    hpack::encode_int(block, 1, 4, 0x00);   /* :authority */
+    hpack::encode_string(block, opt.host, strlen(opt.host), true);
+    append_frame(out, 0x1, 0x4 | 0x1, id, block);
+}
+
+/* 读帧直到 open 个流全部结束，对方的 SETTINGS 回复 ACK */
+static bool h2_wait(int fd, std::string& in, int open, thread_stats& st)
+{
+    char buf[65536];
+    while (open > 0)
+    {
+        while (in.size() >= 9)
+        {
+            const uint8_t* h = (const uint8_t*)in.data();
+            uint32_t len = (h[0] << 16) | (h[1] << 8) | h[2];
+            if(in.size() < 9 + len)
+            {
+                break;
+            }
+            uint8_t type = h[3];
+            uint8_t flags = h[4];
+            if(type == 0x0)
+            {
+                st.bytes += len;
+            }
+            if((type == 0x0 || type == 0x1) && (flags & 0x1))
+            {
+                --open;
+                ++st.requests;
+            }
+            else if(type == 0x3 || type == 0x7)
+            {
+                return false;
+            }
+            else if(type == 0x4 && !(flags & 0x1) && !send_all(fd, std::string("\0\0\0\x04\x01\0\0\0\0", 9)))
+            {
+                return false;
+            }
+            in.erase(0, 9 + len);
+        }
+        if(open == 0)
+        {
+            break;
+        }
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if(n <= 0)
+        {
+            return false;
+        }
+        in.append(buf, n);
+    }
+    return true;
+}
+
+/* HTTP/2 加载一个页面：一个连接，页面到达后所有资源同时发出。
+    初始窗口设为最大，不必在读的过程中发送 WINDOW_UPDATE */
+static bool load_h2(thread_stats& st)
+{
+    int fd = open_conn(st);
+    if(fd < 0)
+    {
+        return false;
+    }
+
+    std::string out("PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n");
+    append_frame(out, 0x4, 0, 0, std::string("\0\x04", 2) + u32(0x7fffffff));
+    append_frame(out, 0x8, 0, 0, u32(0x7fffffff - 65535));
+    h2_request(out, 1, opt.page);
+
+    std::string in;
+    bool ok = send_all(fd, out) && h2_wait(fd, in, 1, st);
+    if(ok && !opt.resources.empty())
+    {
+        out.clear();
+        for(size_t i = 0; i < opt.resources.size(); ++i)
+        {
+            h2_request(out, 3 + 2 * i, opt.resources[i]);
+        }
+        ok = send_all(fd, out) && h2_wait(fd, in, opt.resources.size(), st);
+    }
+    close(fd);
+    return ok;
+}
+
+static void* page_thread(void* arg)
+{
+    thread_stats* st = (thread_stats*)arg;
+    while (!stopping.load(std::memory_order_relaxed))
+    {
+        long long start = now_us();
+        if(opt.http2 ? load_h2(*st) : load_h1(*st))
+        {
+            ++st->pages;
+            st->latency.record(now_us() - start);
+        }
+        else
+        {
+            ++st->errors;
+        }
+    }
+    return NULL;
+}
+
+static void usage(const char* prog)
+{
+    printf("usage: %s [-a host] [-p port] [-t threads] [-d seconds] [-c conns] [-2] [-u page] [-r res1,res2,...]\n"
+           "  default: HTTP/1.1, up to -c keep-alive connections per page (default 6)\n"
+           "  -2: HTTP/2 with prior knowledge, one connection per page\n", prog);
+}
+
+int main(int argc, char* argv[])
+{
+    opt.host = "127.0.0.1";
+    opt.port = 9006;
+    opt.threads = 2;
+    opt.duration = 10;
+    opt.conns = 6;
+    opt.http2 = false;
+    opt.page = "/picture.html";
+    const char* resources = "/frame.jpg,/test1.jpg,/login.gif,/loginnew.gif,/register.gif,"
+                            "/registernew.gif,/favicon.ico";
+
+    int c;
+    while ((c = getopt(argc, argv, "a:p:t:d:c:2u:r:h")) != -1)
+    {
+        switch (c)
+        {
+        case 'a': opt.host = optarg; break;
+        case 'p': opt.port = atoi(optarg); break;
+        case 't': opt.threads = atoi(optarg); break;
+        case 'd': opt.duration = atoi(optarg); break;
+        case 'c': opt.conns = atoi(optarg); break;
+        case '2': opt.http2 = true; break;
+        case 'u': opt.page = optarg; break;
+        case 'r': resources = optarg; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if(opt.threads <= 0 || opt.duration <= 0 || opt.conns <= 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    for(const char* p = resources; *p; )
+    {
+        const char* end = strchr(p, ',');
+        size_t len = end ? (size_t)(end - p) : strlen(p);
+        if(len > 0)
+        {
+            opt.resources.push_back(std::string(p, len));
+        }
+        p += len + (end ? 1 : 0);
+    }
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(opt.port);
+    if(inet_pton(AF_INET, opt.host, &server_addr.sin_addr) != 1)
+    {
+        printf("bad address: %s\n", opt.host);
+        return 1;
+    }
+
+    std::vector<thread_stats> stats(opt.threads);
+    std::vector<pthread_t> tids(opt.threads);
+    long long start = now_us();
+    for(int i = 0; i < opt.threads; ++i)
+    {
+        pthread_create(&tids[i], NULL, page_thread, &stats[i]);
+    }
+    sleep(opt.duration);
+    stopping.store(true);
+    for(int i = 0; i < opt.threads; ++i)
+    {
+        pthread_join(tids[i], NULL);
+    }
+    double seconds = (now_us() - start) / 1e6;
+
+    thread_stats total;
+    for(int i = 0; i < opt.threads; ++i)
+    {
+        total.pages += stats[i].pages;
+        total.requests += stats[i].requests;
+        total.connections += stats[i].connections;
+        total.bytes += stats[i].bytes;
+        total.errors += stats[i].errors;
+        total.latency.merge(stats[i].latency);
+    }
+
+    printf("%s, %d threads, %.1fs, page %s + %zu resources\n",
+            opt.http2 ? "http/2" : "http/1.1", opt.threads, seconds, opt.page, opt.resources.size());
+    printf("pages          %lld, %.1f/s, errors %lld\n", total.pages, total.pages / seconds, total.errors);
+    printf("connections    %.2f per page\n", total.pages ? (double)total.connections / total.pages : 0.0);
+    printf("requests       %lld, %.1f/s, %.2f MB/s\n", total.requests, total.requests / seconds,
+            total.bytes / seconds / 1e6);
+    printf("load time (us) p50 %llu  p90 %llu  p99 %llu  max %llu\n",
+            (unsigned long long)total.latency.percentile(50), (unsigned long long)total.latency.percentile(90),
+            (unsigned long long)total.latency.percentile(99), (unsigned long long)total.latency.max());
+    return 0;
+}
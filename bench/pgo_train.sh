@@ -0,0 +1,58 @@
+#!/bin/bash
+# PGO 训练负载
+# 用法：bench/pgo_train.sh 服务器程序 [端口] [每阶段秒数]
+# 由 make pgo 调用。服务器应是插桩构建（make instrumented），它链接 bench/mysql_stub.cpp，不需要 MySQL。
+# 用 bench/loadgen 依次跑几个阶段，覆盖首页、图片页、视频页、图片文件、登录和注册，
+# 保活连接和短连接，精简请求头和浏览器请求头；最后发送 SIGTERM，服务器正常退出时写出 .gcda 剖析数据。
+# 训练的比例决定优化的侧重，线上负载差别很大时可按实际情况修改下面的 -m
+
+SERVER=${1:?usage: $0 server [port] [seconds]}
+PORT=${2:-9016}
+SECONDS_PER_PHASE=${3:-3}
+cd "$(dirname "$0")/.."
+ROOT=$(pwd)
+SERVER=$(realpath "$SERVER")
+LOADGEN=$ROOT/bench/loadgen
+
+if [ ! -x "$SERVER" ]; then
+    echo "$SERVER not found, build it with: make instrumented"
+    exit 1
+fi
+if [ ! -x "$LOADGEN" ]; then
+    echo "$LOADGEN not found, build it with: make loadgen"
+    exit 1
+fi
+
+# 服务器的日志写在当前目录，放到临时目录里
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+(cd "$WORK" && exec "$SERVER" -p "$PORT" --doc_root="$ROOT/root" --backlog=1024 \
+    > server.out 2>&1) &
+SERVER_PID=$!
+
+for ((i = 0; i < 50; i++)); do
+    (echo > "/dev/tcp/127.0.0.1/$PORT") 2> /dev/null && break
+    sleep 0.1
+done
+
+MIX=index:25,picture:10,video:5,image:25,login:25,register:10
+run() {
+    echo "pgo_train: $*"
+    "$LOADGEN" -p "$PORT" -d "$SECONDS_PER_PHASE" -w 0 "$@" | grep -E "^(requests|errors|throughput)"
+}
+
+# 浏览器访问：保活连接、完整的请求头
+run -c 32 -m "$MIX" -b 1 -k 1
+# 每个请求一个连接，覆盖 accept、关闭和定时器
+run -c 16 -m "$MIX" -b 1 -k 0
+# 压测工具式的精简请求，注册新用户覆盖插入成功的分支
+run -c 64 -m "$MIX" -k 1 -u "pgo$$" -P pgo
+
+kill -TERM $SERVER_PID
+wait $SERVER_PID
+STATUS=$?
+if [ $STATUS -ne 0 ]; then
+    echo "pgo_train: server exited with $STATUS"
+    cat "$WORK/server.out"
+    exit 1
+fi
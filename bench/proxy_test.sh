@@ -0,0 +1,231 @@
+#!/bin/bash
+# 反向代理的端到端检查
+# 用法：bench/proxy_test.sh [服务器程序] [端口]
+# 先 make 和 make upstream_stub（make proxy_test 编译两者后运行本脚本）。脚本在 端口+1 起的几个端口和一个 unix socket 上启动 bench/upstream_stub，
+# 覆盖保活、分块编码、回显、延迟和不应答几种模式，再以对应的 proxy_routes 启动服务器，用 curl 检查：
+# 转发的状态码和正文、保活连接的复用、轮流和最少连接的选择、主动健康检查的摘除和恢复、
+# 上游不可用时的 502 和应答超时的 504，以及 Content-Length 有误和分块编码的请求得到 400。
+# 每项检查打印 ok 或 FAIL，有失败时以非 0 退出
+
+SERVER=${1:-./tinywebserver}
+PORT=${2:-9026}
+cd "$(dirname "$0")/.."
+ROOT=$(pwd)
+SERVER=$(realpath "$SERVER")
+STUB=$ROOT/bench/upstream_stub
+
+if [ ! -x "$SERVER" ]; then
+    echo "$SERVER not found, build it with: make"
+    exit 1
+fi
+if [ ! -x "$STUB" ]; then
+    echo "$STUB not found, build it with: make upstream_stub"
+    exit 1
+fi
+
+# 服务器的日志写在当前目录，放到临时目录里
+WORK=$(mktemp -d)
+PIDS=()
+cleanup() {
+    kill "${PIDS[@]}" 2> /dev/null
+    wait 2> /dev/null
+    rm -rf "$WORK"
+}
+trap cleanup EXIT
+
+URL=http://127.0.0.1:$PORT
+P_A=$((PORT + 1))       # 保活，正文 1000 字节
+P_B=$((PORT + 2))       # 同上，与 A 组成轮流选择的路由
+P_CHUNKED=$((PORT + 3)) # 分块编码，正文 100000 字节
+P_SLOW=$((PORT + 4))    # 延迟超过 proxy_timeout，应答 504
+P_DROP=$((PORT + 5))    # 收到请求后直接关闭，应答 502
+P_BUSY=$((PORT + 6))    # 延迟 1 秒，最少连接选择时被占用的服务器
+P_H1=$((PORT + 7))      # 健康检查时被停掉再恢复的服务器
+P_H2=$((PORT + 8))
+P_DEAD=$((PORT + 9))    # 没有监听
+ECHO_SOCK=$WORK/echo.sock
+
+# 启动一个桩服务器，pid 记在 STUB_PID 中
+start_stub() {
+    "$STUB" "$@" > /dev/null 2>&1 &
+    STUB_PID=$!
+    PIDS+=($STUB_PID)
+}
+
+wait_port() {
+    for ((i = 0; i < 50; i++)); do
+        (echo > "/dev/tcp/127.0.0.1/$1") 2> /dev/null && return 0
+        sleep 0.1
+    done
+    echo "proxy_test: nothing listening on port $1"
+    exit 1
+}
+
+start_stub -p $P_A -n A
+start_stub -p $P_B -n B
+start_stub -p $P_CHUNKED -n chunked -c -s 100000
+start_stub -u "$ECHO_SOCK" -n echo -e
+start_stub -p $P_SLOW -n slow -d 4000
+start_stub -p $P_DROP -n drop -x
+start_stub -p $P_BUSY -n busy -d 1000
+start_stub -p $P_H2 -n H2
+start_stub -p $P_H1 -n H1
+H1_PID=$STUB_PID
+for p in $P_A $P_B $P_CHUNKED $P_SLOW $P_DROP $P_BUSY $P_H1 $P_H2; do
+    wait_port $p
+done
+
+# /lc/ 和 /busy/ 共用 busy 服务器，/busy/ 上的请求占着它时 /lc/ 应全部选 B
+ROUTES="/a/=127.0.0.1:$P_A"
+ROUTES+=";/lb/=127.0.0.1:$P_A,127.0.0.1:$P_B"
+ROUTES+=";/chunked/=127.0.0.1:$P_CHUNKED"
+ROUTES+=";/echo/=unix:$ECHO_SOCK"
+ROUTES+=";/slow/=127.0.0.1:$P_SLOW"
+ROUTES+=";/drop/=127.0.0.1:$P_DROP"
+ROUTES+=";/busy/=127.0.0.1:$P_BUSY"
+ROUTES+=";/lc/=127.0.0.1:$P_BUSY,127.0.0.1:$P_B"
+ROUTES+=";/ha/=127.0.0.1:$P_H1,127.0.0.1:$P_H2"
+ROUTES+=";/dead/=127.0.0.1:$P_DEAD"
+
+# 健康检查的间隔（毫秒）和等待检查生效的时间（秒）
+HEALTH_INTERVAL=200
+HEALTH_WAIT=1
+(cd "$WORK" && exec "$SERVER" -p "$PORT" --doc_root="$ROOT/root" "--proxy_routes=$ROUTES" \
+    --proxy_timeout=2000 --proxy_health_interval=$HEALTH_INTERVAL > server.out 2>&1) &
+PIDS+=($!)
+wait_port $PORT
+
+FAILED=0
+check() {
+    if [ "$2" == "$3" ]; then
+        echo "ok    $1"
+    else
+        echo "FAIL  $1: expected '$2', got '$3'"
+        FAILED=$((FAILED + 1))
+    fi
+}
+
+# 请求 url，其余参数交给 curl；状态码在 STATUS 中，应答头和正文在 $WORK/head、$WORK/body 中
+fetch() {
+    STATUS=$(curl -s -D "$WORK/head" -o "$WORK/body" -w "%{http_code}" "$@")
+}
+# 最后一个应答中某个应答头的值
+header() {
+    grep -i "^$1:" "$WORK/head" | tail -n 1 | cut -d ' ' -f 2 | tr -d '\r'
+}
+metric() {
+    curl -s "$URL/metrics" | grep "^$1 " | cut -d ' ' -f 2
+}
+md5() {
+    md5sum < "$1" | cut -d ' ' -f 1
+}
+# 在新连接上发送原始请求 $1（printf 的格式），读到服务器关闭连接为止，状态码在 STATUS 中。
+# 服务器看完请求头就应答并关闭，请求里不带消息体，免得未读的数据使连接被重置
+raw() {
+    exec 3<> "/dev/tcp/127.0.0.1/$PORT"
+    (trap '' PIPE; printf "$1" >&3) 2> /dev/null
+    STATUS=$(timeout 5 cat <&3 | head -n 1 | cut -d ' ' -f 2)
+    exec 3<&-
+}
+
+# 转发：状态码、正文与直接请求上游相同，上游的应答头原样带回
+curl -s -o "$WORK/direct" "http://127.0.0.1:$P_A/a/x"
+fetch "$URL/a/x"
+check "forward status" 200 "$STATUS"
+check "forward body" "$(md5 "$WORK/direct")" "$(md5 "$WORK/body")"
+check "forward upstream" A "$(header X-Upstream)"
+
+# 保活连接：同一个 curl 的两个请求之间上游连接回到连接池，第二个请求取用它
+fetch "$URL/a/1" "$URL/a/2"
+COUNT=$(header X-Request-Count)
+check "pooled connection reused" yes "$([ "${COUNT:-0}" -gt 1 ] && echo yes || echo "no (X-Request-Count $COUNT)")"
+POOLED=$(metric 'tws_proxy_upstream_connections_total{source="pool"}')
+check "pooled connects counted" yes "$([ "${POOLED:-0}" -gt 0 ] && echo yes || echo no)"
+
+# 分块编码的正文原样转发，HEAD 只有应答头
+curl -s -o "$WORK/direct" "http://127.0.0.1:$P_CHUNKED/chunked/x"
+fetch "$URL/chunked/x"
+check "chunked status" 200 "$STATUS"
+check "chunked body" "$(md5 "$WORK/direct")" "$(md5 "$WORK/body")"
+fetch -I "$URL/chunked/x"
+check "chunked HEAD" 200 "$STATUS"
+
+# 经 unix socket 回显 2MB 的消息体
+head -c 2000000 /dev/urandom > "$WORK/upload"
+fetch -H "Expect:" --data-binary @"$WORK/upload" "$URL/echo/x"
+check "echo status" 200 "$STATUS"
+check "echo body" "$(md5 "$WORK/upload")" "$(md5 "$WORK/body")"
+
+# 都空闲时轮流选择，两台服务器都被选到
+SEEN=""
+for ((i = 0; i < 6; i++)); do
+    fetch "$URL/lb/x"
+    SEEN+=$(header X-Upstream)
+done
+check "round robin" yes "$([[ $SEEN == *A* && $SEEN == *B* ]] && echo yes || echo "no ($SEEN)")"
+
+# 最少连接：busy 正在处理一个请求，/lc/ 的请求都应选另一台
+curl -s -o /dev/null "$URL/busy/x" &
+sleep 0.3
+SEEN=""
+for ((i = 0; i < 4; i++)); do
+    fetch "$URL/lc/x"
+    SEEN+=$(header X-Upstream)
+done
+check "least connections" BBBB "$SEEN"
+wait %%
+
+# 主动健康检查：停掉 H1 后不等请求到来就摘除，请求都落到 H2；重新启动后恢复选用
+sleep $HEALTH_WAIT
+HEALTHY=$(metric tws_proxy_upstreams_healthy)
+kill $H1_PID
+wait $H1_PID 2> /dev/null
+sleep $HEALTH_WAIT
+check "health check removes stopped upstream" $((HEALTHY - 1)) "$(metric tws_proxy_upstreams_healthy)"
+SEEN=""
+for ((i = 0; i < 4; i++)); do
+    fetch "$URL/ha/x"
+    SEEN+="$STATUS$(header X-Upstream) "
+done
+check "failover" "200H2 200H2 200H2 200H2 " "$SEEN"
+start_stub -p $P_H1 -n H1
+wait_port $P_H1
+sleep $HEALTH_WAIT
+check "health check restores upstream" "$HEALTHY" "$(metric tws_proxy_upstreams_healthy)"
+SEEN=""
+for ((i = 0; i < 4; i++)); do
+    fetch "$URL/ha/x"
+    SEEN+=$(header X-Upstream)
+done
+check "restored upstream selected" yes "$([[ $SEEN == *H1* ]] && echo yes || echo "no ($SEEN)")"
+
+# 上游不可用和应答超时，放在健康检查之后，被动检查的摘除不影响上面的健康服务器数
+fetch "$URL/dead/x"
+check "unreachable upstream" 502 "$STATUS"
+fetch "$URL/drop/x"
+check "upstream closes without response" 502 "$STATUS"
+fetch --data-binary "a=1" "$URL/drop/x"
+check "upstream closes without response (POST)" 502 "$STATUS"
+fetch "$URL/slow/x"
+check "upstream timeout" 504 "$STATUS"
+
+# 无法确定消息体边界的请求应答 400 并关闭连接，不转发，服务器照常工作
+raw 'POST /a/x HTTP/1.1\r\nHost: x\r\nContent-Length: -5\r\n\r\n'
+check "negative Content-Length" 400 "$STATUS"
+raw 'POST /a/x HTTP/1.1\r\nHost: x\r\nContent-Length: 99999999999999999999\r\n\r\n'
+check "overflowing Content-Length" 400 "$STATUS"
+raw 'POST /a/x HTTP/1.1\r\nHost: x\r\nContent-Length: 12abc\r\n\r\n'
+check "non-numeric Content-Length" 400 "$STATUS"
+raw 'POST /2CGISQL.cgi HTTP/1.1\r\nHost: x\r\nContent-Length: -5\r\n\r\n'
+check "negative Content-Length (not proxied)" 400 "$STATUS"
+raw 'POST /echo/x HTTP/1.1\r\nHost: x\r\nTransfer-Encoding: chunked\r\n\r\n'
+check "chunked request body" 400 "$STATUS"
+fetch "$URL/a/x"
+check "forward after bad requests" 200 "$STATUS"
+
+if [ $FAILED -ne 0 ]; then
+    echo "proxy_test: $FAILED check(s) failed"
+    tail -n 20 "$WORK/server.out"
+    exit 1
+fi
+echo "proxy_test: all checks passed"
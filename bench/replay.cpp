@@ -0,0 +1,332 @@
+/* 请求处理流程的重放工具
+   通过内存传输层（http/memory_transport.h）把脚本化的请求字节流送入 http_conn 的状态机并截获应答，
+   不经过 socket 和 epoll。
+   分片检查：每个请求按整段、逐字节、固定大小和随机边界切分后分批到达，应答必须与整段到达时相同，
+             用于确定性地重放让 parse_line 出错或变慢的分片方式。
+   吞吐测量：单线程反复处理请求，得到不含内核开销的每核处理能力。
+
+   用法：replay [-f 请求文件]... [-s 分片大小] [-r 随机种子] [-n 随机分片轮数] [-i 吞吐测量次数] [-v]
+   请求文件是一个完整请求的原始字节；不指定时使用内置的请求集合 */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string>
+#include <vector>
+
+#include "../http/http_conn.h"
+#include "../http/memory_transport.h"
+
+/* 一个请求脚本 */
+struct script
+{
+    std::string name;
+    std::string bytes;
+};
+
+/* 一次重放的结果 */
+struct outcome
+{
+    std::string response;
+    bool closed;        /* 服务器关闭了连接 */
+};
+
+/* 连接使用的假 fd，内存传输层不使用它 */
+static const int FAKE_FD = 1000;
+
+static long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* 注册请求会访问数据库，重放时没有数据库连接，内置集合中不包含 */
+static void builtin_scripts(std::vector<script>& scripts)
+{
+    const char* login_body = "user=replay&password=replay";
+    char login[512];
+    snprintf(login, sizeof(login),
+                "POST /2CGISQL.cgi HTTP/1.1\r\n"
+                "Host: localhost\r\n"
+                "Connection: keep-alive\r\n"
+                "Content-Length: %d\r\n"
+                "\r\n%s", (int)strlen(login_body), login_body);
+
+    script s;
+    s.name = "get_index";
+    s.bytes = "GET / HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n";
+    scripts.push_back(s);
+
+    s.name = "get_picture";
+    s.bytes = "GET /5 HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n";
+    scripts.push_back(s);
+
+    s.name = "get_close";
+    s.bytes = "GET /6 HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+    scripts.push_back(s);
+
+    s.name = "browser_headers";
+    s.bytes = "GET / HTTP/1.1\r\n"
+              "Host: localhost:9006\r\n"
+              "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:109.0) Gecko/20100101 Firefox/115.0\r\n"
+              "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+              "Accept-Language: en-US,en;q=0.5\r\n"
+              "Accept-Encoding: gzip, deflate\r\n"
+              "Connection: keep-alive\r\n"
+              "\r\n";
+    scripts.push_back(s);
+
+    s.name = "post_login";
+    s.bytes = login;
+    scripts.push_back(s);
+
+    s.name = "bad_request";
+    s.bytes = "BREW /pot HTCPCP/1.0\r\n\r\n";
+    scripts.push_back(s);
+}
+
+/* 工作线程处理完后待处理的事件会交还主线程，重放时在这里收回 */
+static bool drain_handoff(http_conn& conn)
+{
+    std::vector<http_conn*> handed;
+    http_conn::take_handoff(handed);
+    bool close = false;
+    for(size_t i = 0; i < handed.size(); ++i)
+    {
+        if(handed[i]->take_events() & http_conn::EV_CLOSE)
+        {
+            close = true;
+        }
+        handed[i]->release();
+    }
+    if(conn.try_acquire())
+    {
+        close = close || (conn.take_events() & http_conn::EV_CLOSE);
+        conn.release();
+    }
+    return close;
+}
+
+/* 按 chunks 给出的分片依次送入请求，每片到达后与主循环一样先读再交给 process() */
+static outcome replay(http_conn& conn, memory_transport& mt, const std::string& bytes,
+                        const std::vector<size_t>& chunks)
+{
+    outcome out;
+    out.closed = false;
+    mt.reset();
+    conn.set_transport(&mt);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    conn.init(FAKE_FD, addr);
+
+    size_t pos = 0;
+    for(size_t i = 0; i < chunks.size() && pos < bytes.size() && !out.closed; ++i)
+    {
+        size_t n = chunks[i] < bytes.size() - pos ? chunks[i] : bytes.size() - pos;
+        mt.feed(bytes.data() + pos, n);
+        pos += n;
+
+        if(!conn.try_acquire())
+        {
+            break;
+        }
+        if(!conn.read_once<TRIGGER_ET>())
+        {
+            conn.release();
+            out.closed = true;
+            break;
+        }
+        conn.process();
+        out.closed = drain_handoff(conn);
+    }
+
+    out.response = mt.output();
+    conn.close_conn();
+    return out;
+}
+
+static std::vector<size_t> fixed_chunks(size_t total, size_t size)
+{
+    std::vector<size_t> chunks;
+    if(size == 0)
+    {
+        size = total;
+    }
+    for(size_t pos = 0; pos < total; pos += size)
+    {
+        chunks.push_back(size);
+    }
+    return chunks;
+}
+
+static std::vector<size_t> random_chunks(size_t total, unsigned* seed)
+{
+    std::vector<size_t> chunks;
+    for(size_t pos = 0; pos < total; )
+    {
+        size_t n = 1 + rand_r(seed) % 64;
+        chunks.push_back(n);
+        pos += n;
+    }
+    return chunks;
+}
+
+static std::string describe(const std::vector<size_t>& chunks)
+{
+    std::string s;
+    for(size_t i = 0; i < chunks.size() && i < 16; ++i)
+    {
+        s += (i ? "," : "") + std::to_string(chunks[i]);
+    }
+    if(chunks.size() > 16)
+    {
+        s += ",...";
+    }
+    return s;
+}
+
+static std::string status_of(const std::string& response)
+{
+    size_t eol = response.find("\r\n");
+    return eol == std::string::npos ? response.substr(0, 40) : response.substr(0, eol);
+}
+
+static bool read_file(const char* path, std::string& bytes)
+{
+    FILE* fp = fopen(path, "rb");
+    if(!fp)
+    {
+        return false;
+    }
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+    {
+        bytes.append(buf, n);
+    }
+    fclose(fp);
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<script> scripts;
+    size_t split = 7;
+    unsigned seed = 1;
+    int rounds = 100;
+    long long iterations = 200000;
+    bool verbose = false;
+
+    int c;
+    while ((c = getopt(argc, argv, "f:s:r:n:i:v")) != -1)
+    {
+        switch (c)
+        {
+        case 'f':
+        {
+            script s;
+            s.name = optarg;
+            if(!read_file(optarg, s.bytes))
+            {
+                perror(optarg);
+                return 1;
+            }
+            scripts.push_back(s);
+            break;
+        }
+        case 's': split = atoi(optarg); break;
+        case 'r': seed = atoi(optarg); break;
+        case 'n': rounds = atoi(optarg); break;
+        case 'i': iterations = atoll(optarg); break;
+        case 'v': verbose = true; break;
+        default:
+            printf("usage: %s [-f request_file]... [-s split_size] [-r seed] [-n random_rounds]"
+                   " [-i iterations] [-v]\n", argv[0]);
+            return 1;
+        }
+    }
+    if(scripts.empty())
+    {
+        builtin_scripts(scripts);
+    }
+
+    /* 解析请求头时会把不认识的头部 printf 到标准输出，重放期间把标准输出指向 /dev/null */
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    int devnull = open("/dev/null", O_WRONLY);
+
+    http_conn* conn = new http_conn;
+    memory_transport mt;
+    int mismatches = 0;
+
+    for(size_t i = 0; i < scripts.size(); ++i)
+    {
+        const std::string& bytes = scripts[i].bytes;
+        dup2(devnull, STDOUT_FILENO);
+        outcome whole = replay(*conn, mt, bytes, fixed_chunks(bytes.size(), 0));
+
+        /* 逐字节、固定大小和若干轮随机分片 */
+        std::vector<std::vector<size_t> > plans;
+        plans.push_back(fixed_chunks(bytes.size(), 1));
+        plans.push_back(fixed_chunks(bytes.size(), split));
+        unsigned s = seed + i;
+        for(int r = 0; r < rounds; ++r)
+        {
+            plans.push_back(random_chunks(bytes.size(), &s));
+        }
+
+        int bad = 0;
+        std::string first_bad;
+        for(size_t p = 0; p < plans.size(); ++p)
+        {
+            outcome o = replay(*conn, mt, bytes, plans[p]);
+            if(o.response != whole.response || o.closed != whole.closed)
+            {
+                if(bad++ == 0)
+                {
+                    first_bad = describe(plans[p]) + " -> " + status_of(o.response);
+                }
+            }
+        }
+        fflush(stdout);
+        dup2(saved_stdout, STDOUT_FILENO);
+
+        mismatches += bad;
+        printf("%-20s %5zu bytes  %-28s %6zu bytes%s  %d/%zu splits differ\n",
+                scripts[i].name.c_str(), bytes.size(), status_of(whole.response).c_str(),
+                whole.response.size(), whole.closed ? ", closed" : "", bad, plans.size());
+        if(bad && verbose)
+        {
+            printf("    first mismatch with chunks %s\n", first_bad.c_str());
+        }
+        fflush(stdout);
+    }
+
+    /* 单线程吞吐：各请求轮流整段到达 */
+    dup2(devnull, STDOUT_FILENO);
+    long long start = now_ns();
+    for(long long n = 0; n < iterations; ++n)
+    {
+        const std::string& bytes = scripts[n % scripts.size()].bytes;
+        std::vector<size_t> whole(1, bytes.size());
+        replay(*conn, mt, bytes, whole);
+    }
+    long long elapsed = now_ns() - start;
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(devnull);
+    close(saved_stdout);
+
+    if(iterations > 0)
+    {
+        printf("throughput: %.0f requests/s on one core, %.0f ns/request\n",
+                iterations * 1e9 / elapsed, (double)elapsed / iterations);
+    }
+    delete conn;
+    return mismatches ? 2 : 0;
+}
@@ -0,0 +1,39 @@
+#!/bin/bash
+# 测量每个请求的系统调用次数
+# 用法：bench/syscall_bench.sh [端口] [请求数]
+# 先以 make SYSCALL_STATS=1 编译，脚本启动服务器后用同一个保活连接发送若干请求，
+# 再发送 SIGHUP 让服务器打印各系统调用的总次数和平均每个请求的次数
+
+PORT=${1:-9006}
+REQUESTS=${2:-1000}
+cd "$(dirname "$0")/.."
+
+if [ ! -x ./tinywebserver ]; then
+    echo "./tinywebserver not found, build it with: make SYSCALL_STATS=1"
+    exit 1
+fi
+
+./tinywebserver "$PORT" > syscall_bench.out 2>&1 &
+SERVER=$!
+sleep 1
+
+# 预热后清零计数，只统计下面的请求
+curl -s -o /dev/null "http://127.0.0.1:$PORT/"
+kill -HUP $SERVER
+sleep 0.5
+: > syscall_bench.out
+
+# curl 对同一主机的多个 URL 复用同一个连接
+URLS=()
+for ((i = 0; i < REQUESTS; i++)); do
+    URLS+=("http://127.0.0.1:$PORT/")
+done
+curl -s -H "Connection: keep-alive" "${URLS[@]}" > /dev/null
+
+kill -HUP $SERVER
+sleep 0.5
+grep -a syscall_stats syscall_bench.out
+
+kill $SERVER
+wait $SERVER 2>/dev/null
+rm -f syscall_bench.out
@@ -0,0 +1,327 @@
+/* TLS 压测工具
+   握手模式（默认）：每个线程循环建立新连接，握手后发送一个请求（-u，默认 /），读完应答即关闭，统计每秒握手数。
+   -r 1 时每个新连接复用本线程上一个连接的会话，测量会话恢复（服务端会话缓存或会话票据，取决于服务器配置）。
+   吞吐模式（-b）：每个线程一个保活连接，反复请求 -u 指定的文件，统计应答字节的吞吐量，
+   用于比较用户态加密和内核 TLS（服务器 ktls 配置项）。
+   使用阻塞 socket，每个线程同一时刻只有一个连接；不校验服务器证书。
+
+   用法：tls_bench [-a 地址] [-p 端口] [-t 线程数] [-d 秒数] [-r 0|1] [-b] [-u 路径]
+   测试证书：openssl req -x509 -newkey ec -pkeyopt ec_paramgen_curve:prime256v1 -nodes \
+                -keyout key.pem -out cert.pem -days 365 -subj /CN=localhost */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+/* 命令行配置 */
+struct options
+{
+    const char* host;
+    int port;
+    int threads;
+    int duration;
+    bool resume;            /* 握手模式下复用上一个连接的会话 */
+    bool bulk;              /* 吞吐模式 */
+    const char* path;
+};
+
+/* 一个线程的统计结果 */
+struct thread_stats
+{
+    long long handshakes;
+    long long resumed;
+    long long requests;
+    long long bytes;
+    long long errors;
+    long long handshake_us;     /* 握手耗时的总和 */
+
+    thread_stats() : handshakes(0), resumed(0), requests(0), bytes(0), errors(0), handshake_us(0) { }
+};
+
+static options opt;
+static sockaddr_in server_addr;
+static SSL_CTX* ctx = NULL;
+static std::string request;
+static std::atomic<bool> stopping(false);
+/* 第一个连接协商的协议和密码套件，用于输出 */
+static pthread_mutex_t negotiated_lock = PTHREAD_MUTEX_INITIALIZER;
+static std::string negotiated;
+
+static long long now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* 建立 TCP 连接并完成 TLS 握手，session 非空时尝试恢复该会话 */
+static SSL* open_tls(SSL_SESSION* session, thread_stats& st)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if(connect(fd, (sockaddr*)&server_addr, sizeof(server_addr)) < 0)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    SSL* ssl = SSL_new(ctx);
+    SSL_set_fd(ssl, fd);
+    if(session)
+    {
+        SSL_set_session(ssl, session);
+    }
+    long long start = now_us();
+    if(SSL_connect(ssl) != 1)
+    {
+        ERR_clear_error();
+        SSL_free(ssl);
+        close(fd);
+        return NULL;
+    }
+    st.handshake_us += now_us() - start;
+    ++st.handshakes;
+    if(SSL_session_reused(ssl))
+    {
+        ++st.resumed;
+    }
+
+    pthread_mutex_lock(&negotiated_lock);
+    if(negotiated.empty())
+    {
+        negotiated = std::string(SSL_get_version(ssl)) + " " + SSL_get_cipher_name(ssl);
+    }
+    pthread_mutex_unlock(&negotiated_lock);
+    return ssl;
+}
+
+static void close_tls(SSL* ssl)
+{
+    int fd = SSL_get_fd(ssl);
+    SSL_shutdown(ssl);
+    SSL_free(ssl);
+    close(fd);
+}
+
+/* 发送请求并读完应答，返回应答体的字节数，出错返回 -1 */
+static long long do_request(SSL* ssl)
+{
+    if(SSL_write(ssl, request.data(), (int)request.size()) <= 0)
+    {
+        return -1;
+    }
+
+    static thread_local char buf[65536];
+    std::string head;
+    long long body_left = -1;
+    long long body = 0;
+    while (body_left != 0)
+    {
+        int n = SSL_read(ssl, buf, sizeof(buf));
+        if(n <= 0)
+        {
+            return -1;
+        }
+        if(body_left >= 0)
+        {
+            body_left -= n;
+            body += n;
+            continue;
+        }
+        head.append(buf, n);
+        size_t end = head.find("\r\n\r\n");
+        if(end == std::string::npos)
+        {
+            continue;
+        }
+        const char* cl = strcasestr(head.c_str(), "Content-Length:");
+        if(!cl || cl > head.c_str() + end)
+        {
+            return -1;
+        }
+        long long length = atoll(cl + strlen("Content-Length:"));
+        body = head.size() - (end + 4);
+        body_left = length - body;
+    }
+    return body;
+}
+
+static void* handshake_thread(void* arg)
+{
+    thread_stats* st = (thread_stats*)arg;
+    SSL_SESSION* session = NULL;
+    while (!stopping.load(std::memory_order_relaxed))
+    {
+        SSL* ssl = open_tls(opt.resume ? session : NULL, *st);
+        if(!ssl)
+        {
+            ++st->errors;
+            continue;
+        }
+        long long n = do_request(ssl);
+        if(n < 0)
+        {
+            ++st->errors;
+        }
+        else
+        {
+            ++st->requests;
+            st->bytes += n;
+        }
+        /* TLS 1.3 的会话票据在握手之后才到达，读完应答后再取会话 */
+        if(opt.resume)
+        {
+            if(session)
+            {
+                SSL_SESSION_free(session);
+            }
+            session = SSL_get1_session(ssl);
+        }
+        close_tls(ssl);
+    }
+    if(session)
+    {
+        SSL_SESSION_free(session);
+    }
+    return NULL;
+}
+
+static void* bulk_thread(void* arg)
+{
+    thread_stats* st = (thread_stats*)arg;
+    SSL* ssl = NULL;
+    while (!stopping.load(std::memory_order_relaxed))
+    {
+        if(!ssl && !(ssl = open_tls(NULL, *st)))
+        {
+            ++st->errors;
+            continue;
+        }
+        long long n = do_request(ssl);
+        if(n < 0)
+        {
+            ++st->errors;
+            close_tls(ssl);
+            ssl = NULL;
+            continue;
+        }
+        ++st->requests;
+        st->bytes += n;
+    }
+    if(ssl)
+    {
+        close_tls(ssl);
+    }
+    return NULL;
+}
+
+static void usage(const char* prog)
+{
+    printf("usage: %s [-a host] [-p port] [-t threads] [-d seconds] [-r 0|1] [-b] [-u path]\n"
+           "  default: new connection per request, reports handshakes/s (-r 1 resumes sessions)\n"
+           "  -b: one keep-alive connection per thread, reports response throughput\n", prog);
+}
+
+int main(int argc, char* argv[])
+{
+    opt.host = "127.0.0.1";
+    opt.port = 9443;
+    opt.threads = 2;
+    opt.duration = 10;
+    opt.resume = false;
+    opt.bulk = false;
+    opt.path = "/";
+
+    int c;
+    while ((c = getopt(argc, argv, "a:p:t:d:r:bu:h")) != -1)
+    {
+        switch (c)
+        {
+        case 'a': opt.host = optarg; break;
+        case 'p': opt.port = atoi(optarg); break;
+        case 't': opt.threads = atoi(optarg); break;
+        case 'd': opt.duration = atoi(optarg); break;
+        case 'r': opt.resume = atoi(optarg) != 0; break;
+        case 'b': opt.bulk = true; break;
+        case 'u': opt.path = optarg; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if(opt.threads <= 0 || opt.duration <= 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(opt.port);
+    if(inet_pton(AF_INET, opt.host, &server_addr.sin_addr) != 1)
+    {
+        printf("bad address: %s\n", opt.host);
+        return 1;
+    }
+
+    ctx = SSL_CTX_new(TLS_client_method());
+    SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, NULL);
+    /* 会话由各线程自己保存，不用客户端的会话缓存 */
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+
+    request = std::string("GET ") + opt.path + " HTTP/1.1\r\n"
+                "Host: " + opt.host + "\r\n"
+                "Connection: " + (opt.bulk ? "keep-alive" : "close") + "\r\n\r\n";
+
+    std::vector<thread_stats> stats(opt.threads);
+    std::vector<pthread_t> tids(opt.threads);
+    long long start = now_us();
+    for(int i = 0; i < opt.threads; ++i)
+    {
+        pthread_create(&tids[i], NULL, opt.bulk ? bulk_thread : handshake_thread, &stats[i]);
+    }
+    sleep(opt.duration);
+    stopping.store(true);
+    for(int i = 0; i < opt.threads; ++i)
+    {
+        pthread_join(tids[i], NULL);
+    }
+    double seconds = (now_us() - start) / 1e6;
+
+    thread_stats total;
+    for(int i = 0; i < opt.threads; ++i)
+    {
+        total.handshakes += stats[i].handshakes;
+        total.resumed += stats[i].resumed;
+        total.requests += stats[i].requests;
+        total.bytes += stats[i].bytes;
+        total.errors += stats[i].errors;
+        total.handshake_us += stats[i].handshake_us;
+    }
+
+    printf("%s, %d threads, %.1fs, %s\n", opt.bulk ? "bulk" : (opt.resume ? "resume" : "handshake"),
+            opt.threads, seconds, negotiated.empty() ? "no connection" : negotiated.c_str());
+    printf("handshakes     %lld (%lld resumed), %.1f/s, mean %.0f us\n", total.handshakes,
+            total.resumed, total.handshakes / seconds,
+            total.handshakes ? (double)total.handshake_us / total.handshakes : 0.0);
+    printf("requests       %lld, %.1f/s, errors %lld\n", total.requests, total.requests / seconds,
+            total.errors);
+    printf("throughput     %.2f MB/s\n", total.bytes / seconds / 1e6);
+
+    SSL_CTX_free(ctx);
+    return 0;
+}
@@ -0,0 +1,385 @@
+/* 反向代理的上游桩服务器
+   单线程 epoll 的 HTTP/1.1 服务器，监听 TCP 端口或 Unix socket，支持保活和流水线，用来在本机验证和压测 proxy_routes。
+   每个应答带 X-Upstream（-n 给出的名字，看负载如何分配）、X-Request-Count（该连接上的第几个请求，大于 1 说明连接被复用）
+   和 X-Body-Bytes（收到的消息体字节数）。默认应答 -s 字节的正文，-c 改用分块编码，-e 把消息体原样作为正文返回；
+   -k 每个应答后关闭连接，-d 收到完整请求后延迟若干毫秒再应答（测超时），-x 收到请求后直接关闭连接不应答（测失败重试）。
+   HEAD 请求只回应答头。
+
+   用法：upstream_stub [-p 端口 | -u unix socket 路径] [-n 名字] [-s 正文字节数] [-c] [-e] [-k] [-d 延迟毫秒] [-x] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/un.h>
+#include <map>
+#include <string>
+
+/* 命令行配置 */
+struct options
+{
+    int port;
+    const char* unix_path;
+    const char* name;
+    long long size;
+    bool chunked;
+    bool echo;
+    bool close_after;
+    int delay;
+    bool drop;
+};
+
+/* 一个客户（代理）连接 */
+struct stub_conn
+{
+    int fd;
+    std::string in;
+    /* 当前请求：请求头是否已收完、是否为 HEAD、还要读的消息体字节数 */
+    bool head_done;
+    bool head_method;
+    long long body_left;
+    long long body_bytes;
+    std::string body;
+    /* 请求已完整，等到该时刻再应答，0 表示没有等待中的应答 */
+    long long respond_at;
+    std::string out;
+    size_t out_off;
+    int requests;
+    bool closing;
+};
+
+static options opt;
+static std::map<int, stub_conn*> conns;
+/* 默认应答的正文 */
+static std::string payload;
+
+static long long now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void close_conn(stub_conn* c)
+{
+    conns.erase(c->fd);
+    close(c->fd);
+    delete c;
+}
+
+static void build_response(stub_conn* c)
+{
+    const std::string& body = opt.echo ? c->body : payload;
+    char head[512];
+    int len = snprintf(head, sizeof(head),
+                        "HTTP/1.1 200 OK\r\n"
+                        "Content-Type: application/octet-stream\r\n"
+                        "X-Upstream: %s\r\n"
+                        "X-Request-Count: %d\r\n"
+                        "X-Body-Bytes: %lld\r\n"
+                        "%s",
+                        opt.name, c->requests, c->body_bytes, opt.close_after ? "Connection: close\r\n" : "");
+    c->out.append(head, len);
+    if(opt.chunked)
+    {
+        c->out.append("Transfer-Encoding: chunked\r\n\r\n");
+        if(!c->head_method)
+        {
+            /* 4K 一块，最后一块带一个尾部字段 */
+            for(size_t off = 0; off < body.size(); off += 4096)
+            {
+                size_t n = body.size() - off < 4096 ? body.size() - off : 4096;
+                len = snprintf(head, sizeof(head), "%zx;ext=1\r\n", n);
+                c->out.append(head, len);
+                c->out.append(body, off, n);
+                c->out.append("\r\n");
+            }
+            c->out.append("0\r\nX-Trailer: done\r\n\r\n");
+        }
+    }
+    else
+    {
+        len = snprintf(head, sizeof(head), "Content-Length: %zu\r\n\r\n", body.size());
+        c->out.append(head, len);
+        if(!c->head_method)
+        {
+            c->out.append(body);
+        }
+    }
+    c->closing = opt.close_after;
+}
+
+/* 解析已收到的数据，返回 false 表示应关闭连接 */
+static bool parse(stub_conn* c)
+{
+    while (c->respond_at == 0)
+    {
+        if(!c->head_done)
+        {
+            size_t end = c->in.find("\r\n\r\n");
+            if(end == std::string::npos)
+            {
+                return c->in.size() < 65536;
+            }
+            c->head_done = true;
+            c->head_method = strncasecmp(c->in.c_str(), "HEAD ", 5) == 0;
+            c->body_left = 0;
+            c->body_bytes = 0;
+            c->body.clear();
+            size_t pos = c->in.find("\r\n");
+            while (pos < end)
+            {
+                size_t next = c->in.find("\r\n", pos + 2);
+                if(strncasecmp(c->in.c_str() + pos + 2, "Content-Length:", 15) == 0)
+                {
+                    c->body_left = atoll(c->in.c_str() + pos + 17);
+                }
+                pos = next;
+            }
+            c->in.erase(0, end + 4);
+        }
+        /* 消息体可能很大，不回显时只计数 */
+        size_t n = (long long)c->in.size() < c->body_left ? c->in.size() : c->body_left;
+        if(opt.echo)
+        {
+            c->body.append(c->in, 0, n);
+        }
+        c->in.erase(0, n);
+        c->body_left -= n;
+        c->body_bytes += n;
+        if(c->body_left > 0)
+        {
+            return true;
+        }
+        if(opt.drop)
+        {
+            return false;
+        }
+        c->head_done = false;
+        ++c->requests;
+        c->respond_at = now_ms() + opt.delay;
+    }
+    return true;
+}
+
+/* 发出到期的应答，返回 false 表示应关闭连接 */
+static bool flush(stub_conn* c, long long now)
+{
+    while (true)
+    {
+        if(c->out_off == c->out.size())
+        {
+            c->out.clear();
+            c->out_off = 0;
+            if(c->closing)
+            {
+                return false;
+            }
+            if(c->respond_at == 0 || c->respond_at > now)
+            {
+                return true;
+            }
+            build_response(c);
+            c->respond_at = 0;
+            /* 流水线上的下一个请求 */
+            if(!parse(c))
+            {
+                return false;
+            }
+        }
+        ssize_t n = send(c->fd, c->out.data() + c->out_off, c->out.size() - c->out_off, MSG_NOSIGNAL);
+        if(n < 0)
+        {
+            return errno == EAGAIN;
+        }
+        c->out_off += n;
+    }
+}
+
+static void on_readable(stub_conn* c)
+{
+    char buf[65536];
+    while (true)
+    {
+        ssize_t n = recv(c->fd, buf, sizeof(buf), 0);
+        if(n > 0)
+        {
+            c->in.append(buf, n);
+            if(!parse(c))
+            {
+                close_conn(c);
+                return;
+            }
+            continue;
+        }
+        if(n < 0 && errno == EAGAIN)
+        {
+            break;
+        }
+        close_conn(c);
+        return;
+    }
+    if(!flush(c, now_ms()))
+    {
+        close_conn(c);
+    }
+}
+
+static int open_listener()
+{
+    int fd;
+    if(opt.unix_path)
+    {
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        struct sockaddr_un addr;
+        memset(&addr, '\0', sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, opt.unix_path, sizeof(addr.sun_path) - 1);
+        unlink(opt.unix_path);
+        if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+        {
+            perror("bind");
+            exit(1);
+        }
+    }
+    else
+    {
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        int reuse = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        struct sockaddr_in addr;
+        memset(&addr, '\0', sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(opt.port);
+        if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+        {
+            perror("bind");
+            exit(1);
+        }
+    }
+    listen(fd, 1024);
+    return fd;
+}
+
+int main(int argc, char* argv[])
+{
+    opt.port = 8081;
+    opt.unix_path = NULL;
+    opt.name = "stub";
+    opt.size = 1024;
+    opt.chunked = false;
+    opt.echo = false;
+    opt.close_after = false;
+    opt.delay = 0;
+    opt.drop = false;
+
+    int ch;
+    while ((ch = getopt(argc, argv, "p:u:n:s:cekd:x")) != -1)
+    {
+        switch (ch)
+        {
+        case 'p': opt.port = atoi(optarg); break;
+        case 'u': opt.unix_path = optarg; break;
+        case 'n': opt.name = optarg; break;
+        case 's': opt.size = atoll(optarg); break;
+        case 'c': opt.chunked = true; break;
+        case 'e': opt.echo = true; break;
+        case 'k': opt.close_after = true; break;
+        case 'd': opt.delay = atoi(optarg); break;
+        case 'x': opt.drop = true; break;
+        default:
+            fprintf(stderr, "usage: %s [-p port | -u unix_path] [-n name] [-s bytes] [-c] [-e] [-k] [-d ms] [-x]\n", argv[0]);
+            return 1;
+        }
+    }
+    signal(SIGPIPE, SIG_IGN);
+    payload.resize(opt.size);
+    for(long long i = 0; i < opt.size; ++i)
+    {
+        payload[i] = 'a' + i % 26;
+    }
+
+    int lfd = open_listener();
+    int epfd = epoll_create1(0);
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = lfd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, lfd, &ev);
+
+    struct epoll_event events[256];
+    while (true)
+    {
+        /* 有延迟应答时按最早的到期时刻醒来 */
+        long long now = now_ms();
+        int timeout = -1;
+        for(std::map<int, stub_conn*>::iterator it = conns.begin(); it != conns.end(); ++it)
+        {
+            if(it->second->respond_at > 0)
+            {
+                long long wait = it->second->respond_at > now ? it->second->respond_at - now : 0;
+                if(timeout < 0 || wait < timeout)
+                {
+                    timeout = (int)wait;
+                }
+            }
+        }
+        int n = epoll_wait(epfd, events, 256, timeout);
+        for(int i = 0; i < n; ++i)
+        {
+            int fd = events[i].data.fd;
+            if(fd == lfd)
+            {
+                int cfd;
+                while ((cfd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK)) >= 0)
+                {
+                    if(!opt.unix_path)
+                    {
+                        int flag = 1;
+                        setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+                    }
+                    stub_conn* c = new stub_conn();
+                    c->fd = cfd;
+                    c->head_done = false;
+                    c->head_method = false;
+                    c->body_left = 0;
+                    c->body_bytes = 0;
+                    c->respond_at = 0;
+                    c->out_off = 0;
+                    c->requests = 0;
+                    c->closing = false;
+                    conns[cfd] = c;
+                    ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+                    ev.data.fd = cfd;
+                    epoll_ctl(epfd, EPOLL_CTL_ADD, cfd, &ev);
+                }
+                continue;
+            }
+            std::map<int, stub_conn*>::iterator it = conns.find(fd);
+            if(it != conns.end())
+            {
+                on_readable(it->second);
+            }
+        }
+        /* 到期的延迟应答 */
+        now = now_ms();
+        for(std::map<int, stub_conn*>::iterator it = conns.begin(); it != conns.end(); )
+        {
+            stub_conn* c = (it++)->second;
+            if(c->respond_at > 0 && c->respond_at <= now && !flush(c, now))
+            {
+                close_conn(c);
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,461 @@
+/* WebSocket 广播扇出压测工具
+   先建立 -c 个订阅连接（默认一万个），再用一个发布连接每隔 -i 毫秒发送一个消息，共 -m 个。
+   服务器需以 ws_relay = 1 启动，把发布者的每个消息广播给其他所有连接，max_conn 要大于 -c。
+   载荷开头是消息序号和发送时刻（单调时钟，只能在同一台机器上压测），-t 个接收线程各自用 epoll 管理一部分订阅连接，
+   记录每次送达的延迟，以及每个消息送达最后一个订阅者的时刻，统计单次送达延迟和整个扇出完成时间的分位数。
+   订阅连接数超过 fd 上限时先尝试调高 RLIMIT_NOFILE。
+
+   用法：ws_bench [-a 地址] [-p 端口] [-c 订阅连接数] [-t 接收线程数] [-m 消息数] [-i 间隔毫秒] [-s 载荷字节数] [-u 路径] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "hdr_histogram.h"
+
+/* 命令行配置 */
+struct options
+{
+    const char* host;
+    int port;
+    int clients;
+    int threads;
+    int messages;
+    int interval;
+    int size;
+    const char* path;
+};
+
+/* 一个订阅连接 */
+struct subscriber
+{
+    int fd;
+    std::string in;
+};
+
+/* 接收线程 */
+struct receiver
+{
+    pthread_t tid;
+    int epfd;
+    std::vector<subscriber> subs;
+    hdr_histogram latency;
+    long long received;
+    long long errors;
+};
+
+static options opt;
+static sockaddr_in server_addr;
+static std::atomic<bool> stopping(false);
+/* 每个消息的送达次数和最后一次送达的时刻 */
+static std::atomic<int>* delivered;
+static std::atomic<long long>* last_arrival;
+static std::vector<long long> sent_at;
+
+static long long now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static bool send_all(int fd, const std::string& data)
+{
+    size_t sent = 0;
+    while (sent < data.size())
+    {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if(n <= 0)
+        {
+            return false;
+        }
+        sent += n;
+    }
+    return true;
+}
+
+/* 客户端发出的帧必须带掩码，压测不在乎掩码是否随机 */
+static std::string client_frame(int opcode, const std::string& payload)
+{
+    std::string out;
+    out.push_back((char)(0x80 | opcode));
+    size_t len = payload.size();
+    if(len < 126)
+    {
+        out.push_back((char)(0x80 | len));
+    }
+    else if(len <= 0xffff)
+    {
+        out.push_back((char)(0x80 | 126));
+        out.push_back((char)(len >> 8));
+        out.push_back((char)len);
+    }
+    else
+    {
+        out.push_back((char)(0x80 | 127));
+        for(int i = 7; i >= 0; --i)
+        {
+            out.push_back((char)((uint64_t)len >> (8 * i)));
+        }
+    }
+    static const char mask[4] = { 0x12, 0x34, 0x56, 0x78 };
+    out.append(mask, 4);
+    for(size_t i = 0; i < len; ++i)
+    {
+        out.push_back(payload[i] ^ mask[i & 3]);
+    }
+    return out;
+}
+
+/* 建立连接并完成握手，握手应答之后已收到的数据留在 rest 中 */
+static int open_ws(std::string& rest)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(fd < 0)
+    {
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if(connect(fd, (sockaddr*)&server_addr, sizeof(server_addr)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    char request[256];
+    int len = snprintf(request, sizeof(request),
+                        "GET %s HTTP/1.1\r\nHost: %s\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                        "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n",
+                        opt.path, opt.host);
+    std::string in;
+    if(!send_all(fd, std::string(request, len)))
+    {
+        close(fd);
+        return -1;
+    }
+    size_t end;
+    while ((end = in.find("\r\n\r\n")) == std::string::npos)
+    {
+        char buf[1024];
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if(n <= 0)
+        {
+            close(fd);
+            return -1;
+        }
+        in.append(buf, n);
+    }
+    if(in.compare(0, 12, "HTTP/1.1 101") != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    rest = in.substr(end + 4);
+    return fd;
+}
+
+/* 处理订阅连接上收到的帧：数据帧记录送达，ping 回应 pong，返回 false 表示连接出错或被关闭 */
+static bool on_frames(receiver* r, subscriber& s)
+{
+    size_t off = 0;
+    while (s.in.size() - off >= 2)
+    {
+        const uint8_t* h = (const uint8_t*)s.in.data() + off;
+        int opcode = h[0] & 0x0f;
+        uint64_t len = h[1] & 0x7f;
+        size_t hlen = 2;
+        if(len == 126)
+        {
+            hlen = 4;
+            if(s.in.size() - off < hlen)
+                break;
+            len = ((uint64_t)h[2] << 8) | h[3];
+        }
+        else if(len == 127)
+        {
+            hlen = 10;
+            if(s.in.size() - off < hlen)
+                break;
+            len = 0;
+            for(int i = 0; i < 8; ++i)
+                len = (len << 8) | h[2 + i];
+        }
+        if(s.in.size() - off < hlen + len)
+        {
+            break;
+        }
+        const char* payload = (const char*)h + hlen;
+        if(opcode == 0x8)
+        {
+            return false;
+        }
+        if(opcode == 0x9)
+        {
+            send_all(s.fd, client_frame(0xa, std::string(payload, len)));
+        }
+        else if((opcode == 0x1 || opcode == 0x2) && len >= 16)
+        {
+            uint64_t seq, at;
+            memcpy(&seq, payload, 8);
+            memcpy(&at, payload + 8, 8);
+            long long now = now_us();
+            r->latency.record(now - (long long)at);
+            ++r->received;
+            if(seq < (uint64_t)opt.messages)
+            {
+                delivered[seq].fetch_add(1, std::memory_order_relaxed);
+                long long prev = last_arrival[seq].load(std::memory_order_relaxed);
+                while (prev < now && !last_arrival[seq].compare_exchange_weak(prev, now))
+                {
+                }
+            }
+        }
+        off += hlen + len;
+    }
+    s.in.erase(0, off);
+    return true;
+}
+
+static void* receiver_thread(void* arg)
+{
+    receiver* r = (receiver*)arg;
+    epoll_event events[256];
+    char buf[65536];
+    while (!stopping.load(std::memory_order_relaxed))
+    {
+        int n = epoll_wait(r->epfd, events, 256, 100);
+        for(int i = 0; i < n; ++i)
+        {
+            subscriber& s = r->subs[events[i].data.u32];
+            while (true)
+            {
+                ssize_t got = recv(s.fd, buf, sizeof(buf), 0);
+                if(got > 0)
+                {
+                    s.in.append(buf, got);
+                    continue;
+                }
+                if(got == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+                {
+                    epoll_ctl(r->epfd, EPOLL_CTL_DEL, s.fd, NULL);
+                    ++r->errors;
+                    s.in.clear();
+                }
+                break;
+            }
+            if(!s.in.empty() && !on_frames(r, s))
+            {
+                epoll_ctl(r->epfd, EPOLL_CTL_DEL, s.fd, NULL);
+                ++r->errors;
+            }
+        }
+    }
+    return NULL;
+}
+
+static void usage(const char* prog)
+{
+    printf("usage: %s [-a addr] [-p port] [-c subscribers] [-t threads] [-m messages] [-i interval_ms] "
+           "[-s payload_bytes] [-u path]\n", prog);
+}
+
+int main(int argc, char* argv[])
+{
+    opt.host = "127.0.0.1";
+    opt.port = 9006;
+    opt.clients = 10000;
+    opt.threads = 4;
+    opt.messages = 100;
+    opt.interval = 50;
+    opt.size = 64;
+    opt.path = "/ws";
+
+    int c;
+    while ((c = getopt(argc, argv, "a:p:c:t:m:i:s:u:h")) != -1)
+    {
+        switch (c)
+        {
+        case 'a': opt.host = optarg; break;
+        case 'p': opt.port = atoi(optarg); break;
+        case 'c': opt.clients = atoi(optarg); break;
+        case 't': opt.threads = atoi(optarg); break;
+        case 'm': opt.messages = atoi(optarg); break;
+        case 'i': opt.interval = atoi(optarg); break;
+        case 's': opt.size = atoi(optarg); break;
+        case 'u': opt.path = optarg; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if(opt.clients <= 0 || opt.threads <= 0 || opt.messages <= 0 || opt.interval < 0 || opt.size < 16)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(opt.port);
+    if(inet_pton(AF_INET, opt.host, &server_addr.sin_addr) != 1)
+    {
+        printf("bad address: %s\n", opt.host);
+        return 1;
+    }
+
+    /* 每个连接一个 fd，另外留一些给 epoll 和标准输入输出 */
+    struct rlimit rl;
+    getrlimit(RLIMIT_NOFILE, &rl);
+    rlim_t need = opt.clients + 64 + opt.threads;
+    if(rl.rlim_cur < need)
+    {
+        rl.rlim_cur = need < rl.rlim_max ? need : rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+        if(rl.rlim_cur < need)
+        {
+            printf("fd limit %llu is too low for %d subscribers\n", (unsigned long long)rl.rlim_cur, opt.clients);
+            return 1;
+        }
+    }
+
+    delivered = new std::atomic<int>[opt.messages];
+    last_arrival = new std::atomic<long long>[opt.messages];
+    for(int i = 0; i < opt.messages; ++i)
+    {
+        delivered[i].store(0);
+        last_arrival[i].store(0);
+    }
+    sent_at.resize(opt.messages, 0);
+
+    /* 握手逐个完成，再按轮转分给接收线程 */
+    std::vector<receiver> receivers(opt.threads);
+    for(int i = 0; i < opt.threads; ++i)
+    {
+        receivers[i].epfd = epoll_create1(0);
+        receivers[i].received = 0;
+        receivers[i].errors = 0;
+    }
+    long long connect_start = now_us();
+    for(int i = 0; i < opt.clients; ++i)
+    {
+        subscriber s;
+        s.fd = open_ws(s.in);
+        if(s.fd < 0)
+        {
+            printf("subscriber %d failed to connect\n", i);
+            return 1;
+        }
+        fcntl(s.fd, F_SETFL, fcntl(s.fd, F_GETFL) | O_NONBLOCK);
+        receivers[i % opt.threads].subs.push_back(s);
+    }
+    double connect_seconds = (now_us() - connect_start) / 1e6;
+    for(int i = 0; i < opt.threads; ++i)
+    {
+        receiver& r = receivers[i];
+        for(size_t j = 0; j < r.subs.size(); ++j)
+        {
+            epoll_event ev;
+            ev.events = EPOLLIN;
+            ev.data.u32 = j;
+            epoll_ctl(r.epfd, EPOLL_CTL_ADD, r.subs[j].fd, &ev);
+        }
+        pthread_create(&r.tid, NULL, receiver_thread, &r);
+    }
+
+    std::string rest;
+    int pub = open_ws(rest);
+    if(pub < 0)
+    {
+        printf("publisher failed to connect\n");
+        return 1;
+    }
+    /* 发布者收到的 ping 等数据不读，等订阅者都进入 epoll 后再开始 */
+    usleep(200000);
+
+    std::string payload(opt.size, 'x');
+    long long run_start = now_us();
+    for(int i = 0; i < opt.messages; ++i)
+    {
+        uint64_t seq = i;
+        uint64_t at = now_us();
+        sent_at[i] = at;
+        memcpy(&payload[0], &seq, 8);
+        memcpy(&payload[8], &at, 8);
+        if(!send_all(pub, client_frame(0x2, payload)))
+        {
+            printf("publisher closed after %d messages\n", i);
+            break;
+        }
+        if(opt.interval > 0)
+        {
+            usleep(opt.interval * 1000);
+        }
+    }
+
+    /* 等所有消息送达所有订阅者，最多再等 5 秒 */
+    long long expected = (long long)opt.clients * opt.messages;
+    long long deadline = now_us() + 5000000;
+    long long total_received = 0;
+    while (now_us() < deadline)
+    {
+        total_received = 0;
+        for(int i = 0; i < opt.messages; ++i)
+        {
+            total_received += delivered[i].load(std::memory_order_relaxed);
+        }
+        if(total_received >= expected)
+        {
+            break;
+        }
+        usleep(10000);
+    }
+    double run_seconds = (now_us() - run_start) / 1e6;
+    stopping.store(true);
+
+    receiver total;
+    total.received = 0;
+    total.errors = 0;
+    for(int i = 0; i < opt.threads; ++i)
+    {
+        pthread_join(receivers[i].tid, NULL);
+        total.received += receivers[i].received;
+        total.errors += receivers[i].errors;
+        total.latency.merge(receivers[i].latency);
+    }
+    hdr_histogram fanout;
+    int complete = 0;
+    for(int i = 0; i < opt.messages; ++i)
+    {
+        if(delivered[i].load() == opt.clients)
+        {
+            fanout.record(last_arrival[i].load() - sent_at[i]);
+            ++complete;
+        }
+    }
+
+    printf("%d subscribers connected in %.2fs, %d messages of %d bytes every %d ms\n",
+            opt.clients, connect_seconds, opt.messages, opt.size, opt.interval);
+    printf("deliveries     %lld of %lld, %.0f/s, %lld connection errors\n",
+            total_received, expected, total_received / run_seconds, total.errors);
+    printf("delivery (us)  p50 %llu  p90 %llu  p99 %llu  max %llu\n",
+            (unsigned long long)total.latency.percentile(50), (unsigned long long)total.latency.percentile(90),
+            (unsigned long long)total.latency.percentile(99), (unsigned long long)total.latency.max());
+    printf("fan-out (us)   p50 %llu  p90 %llu  p99 %llu  max %llu  (%d of %d messages reached everyone)\n",
+            (unsigned long long)fanout.percentile(50), (unsigned long long)fanout.percentile(90),
+            (unsigned long long)fanout.percentile(99), (unsigned long long)fanout.max(), complete, opt.messages);
+    return 0;
+}
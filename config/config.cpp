@@ -0,0 +1,504 @@
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <libgen.h>
+
+#include "config.h"
+#include "../log/log.h"
+#include "../http/http_conn.h"
+
+server_config::server_config()
+    : port(9006), doc_root("/home/qyg/code/Learn_TinyWebServer/root"),
+      listen_trigger(TRIGGER_ET), conn_trigger(TRIGGER_ET), timeslot(5), max_fd(65536),
+      max_events(10000), backlog(5), eager_write(true),
+      log_async(true), log_queue_size(8), log_buf_size(2000), log_split_lines(80000),
+      header_timeout(10000), body_timeout(30000), min_recv_rate(64), write_timeout(10000),
+      min_send_rate(1024), keepalive_timeout(15000), rate_grace(2000),
+      max_conn(10000), max_queued(10000), admission_low_water(90), admission_recheck(100),
+      retry_after(1),
+      per_ip_max_conn(64), per_ip_rate(200), per_ip_burst(400), per_ip_exempt_loopback(true),
+      threads(8), adaptive_threads(true), min_threads(2), max_threads(64),
+      queue_target_delay(5000), adapt_interval(100),
+      static_weight(4), db_weight(1), db_max_running(4), db_max_queued(1000),
+      db_host("localhost"), db_port(3306), db_user("qyg"), db_password(""), db_name("qygdb"),
+      sql_num(8),
+      coro_threads(2), coro_db_threads(0),
+      metrics_path("/metrics"), metrics_local_only(true),
+      http2(true), h2_max_streams(100),
+      ws_path("/ws"), ws_relay(false), ws_ping_interval(30000), ws_pong_timeout(10000),
+      ws_max_backlog(1048576), ws_max_message(65536),
+      proxy_routes(""), proxy_connect_timeout(1000), proxy_timeout(60000), proxy_keepalive(32),
+      proxy_idle_timeout(30000), proxy_fail_timeout(10000), proxy_health_interval(2000), proxy_health_path(""),
+      tls_port(0), tls_cert("cert.pem"), tls_key("key.pem"), tls_session_cache(20480),
+      tls_session_timeout(3600), tls_session_tickets(true), ktls(true)
+{
+#ifdef CORO_ENGINE
+    /* 协程引擎不处理 WebSocket 握手，默认不接受 */
+    ws_path.clear();
+#endif
+}
+
+std::vector<server_config::option> server_config::options() const
+{
+    server_config* c = const_cast<server_config*>(this);
+    option table[] = {
+        { "port",                   TYPE_INT,     &c->port,                   "监听端口" },
+        { "doc_root",               TYPE_STRING,  &c->doc_root,               "网站根目录" },
+        { "listen_trigger",         TYPE_TRIGGER, &c->listen_trigger,         "监听 socket 的触发模式，LT 或 ET" },
+        { "conn_trigger",           TYPE_TRIGGER, &c->conn_trigger,           "连接 socket 的触发模式，LT 或 ET" },
+        { "timeslot",               TYPE_INT,     &c->timeslot,               "无定时器时主循环醒来刷新日志的间隔（秒）" },
+        { "max_fd",                 TYPE_INT,     &c->max_fd,                 "大于等于该值的连接 fd 直接关闭" },
+        { "max_events",             TYPE_INT,     &c->max_events,             "一次 epoll_wait 最多取出的事件数" },
+        { "backlog",                TYPE_INT,     &c->backlog,                "listen() 的监听队列长度" },
+        { "eager_write",            TYPE_BOOL,    &c->eager_write,            "工作线程生成应答后立即发送" },
+        { "log_async",              TYPE_BOOL,    &c->log_async,              "异步写日志" },
+        { "log_queue_size",         TYPE_INT,     &c->log_queue_size,         "异步日志队列长度" },
+        { "log_buf_size",           TYPE_INT,     &c->log_buf_size,           "一行日志的最大长度" },
+        { "log_split_lines",        TYPE_INT,     &c->log_split_lines,        "单个日志文件的最大行数" },
+        { "header_timeout",         TYPE_INT,     &c->header_timeout,         "读取请求头的期限（毫秒）" },
+        { "body_timeout",           TYPE_INT,     &c->body_timeout,           "读取消息体的期限（毫秒）" },
+        { "min_recv_rate",          TYPE_INT,     &c->min_recv_rate,          "读请求的最低接收速率（字节/秒）" },
+        { "write_timeout",          TYPE_INT,     &c->write_timeout,          "发送响应的基础期限（毫秒）" },
+        { "min_send_rate",          TYPE_INT,     &c->min_send_rate,          "发送响应的最低发送速率（字节/秒）" },
+        { "keepalive_timeout",      TYPE_INT,     &c->keepalive_timeout,      "保活连接的空闲期限（毫秒）" },
+        { "rate_grace",             TYPE_INT,     &c->rate_grace,             "阶段开始后多久开始检查速率（毫秒）" },
+        { "max_conn",               TYPE_INT,     &c->max_conn,               "最大并发连接数，达到后暂停 accept" },
+        { "max_queued",             TYPE_INT,     &c->max_queued,             "线程池请求队列的最大长度，达到后暂停 accept" },
+        { "admission_low_water",    TYPE_INT,     &c->admission_low_water,    "负载降到上限的该百分比以下才恢复 accept" },
+        { "admission_recheck",      TYPE_INT,     &c->admission_recheck,      "暂停 accept 期间的检查间隔（毫秒）" },
+        { "retry_after",            TYPE_INT,     &c->retry_after,            "503/429 应答的 Retry-After（秒）" },
+        { "per_ip_max_conn",        TYPE_INT,     &c->per_ip_max_conn,        "每个客户端 IP 的最大连接数，0 表示不限制" },
+        { "per_ip_rate",            TYPE_INT,     &c->per_ip_rate,            "每个客户端 IP 每秒的请求数，0 表示不限制" },
+        { "per_ip_burst",           TYPE_INT,     &c->per_ip_burst,           "每个客户端 IP 允许的突发请求数" },
+        { "per_ip_exempt_loopback", TYPE_BOOL,    &c->per_ip_exempt_loopback, "本机回环地址不受单个 IP 的限制" },
+        { "threads",                TYPE_INT,     &c->threads,                "工作线程数，自适应调节时为初始线程数" },
+        { "adaptive_threads",       TYPE_BOOL,    &c->adaptive_threads,       "按排队延迟自动增减工作线程" },
+        { "min_threads",            TYPE_INT,     &c->min_threads,            "自适应调节的最少线程数" },
+        { "max_threads",            TYPE_INT,     &c->max_threads,            "自适应调节的最多线程数" },
+        { "queue_target_delay",     TYPE_INT,     &c->queue_target_delay,     "目标排队延迟（微秒）" },
+        { "adapt_interval",         TYPE_INT,     &c->adapt_interval,         "自适应调节的评估周期（毫秒）" },
+        { "static_weight",          TYPE_INT,     &c->static_weight,          "快速通道的调度权重" },
+        { "db_weight",              TYPE_INT,     &c->db_weight,              "数据库通道的调度权重" },
+        { "db_max_running",         TYPE_INT,     &c->db_max_running,         "同时处理数据库请求的最多线程数" },
+        { "db_max_queued",          TYPE_INT,     &c->db_max_queued,          "数据库通道的最大排队数，超出时应答 503" },
+        { "db_host",                TYPE_STRING,  &c->db_host,                "MySQL 地址" },
+        { "db_port",                TYPE_INT,     &c->db_port,                "MySQL 端口" },
+        { "db_user",                TYPE_STRING,  &c->db_user,                "MySQL 用户名" },
+        { "db_password",            TYPE_STRING,  &c->db_password,            "MySQL 密码" },
+        { "db_name",                TYPE_STRING,  &c->db_name,                "MySQL 数据库名" },
+        { "sql_num",                TYPE_INT,     &c->sql_num,                "数据库连接池的连接数" },
+        { "reactor_cpus",           TYPE_STRING,  &c->reactor_cpus,           "主循环绑定的 CPU，空为默认布局，none 为不绑定" },
+        { "worker_cpus",            TYPE_STRING,  &c->worker_cpus,            "工作线程绑定的 CPU" },
+        { "log_cpus",               TYPE_STRING,  &c->log_cpus,               "异步日志写线程绑定的 CPU" },
+        { "coro_threads",           TYPE_INT,     &c->coro_threads,           "协程引擎的调度线程数" },
+        { "coro_db_threads",        TYPE_INT,     &c->coro_db_threads,        "协程引擎的数据库线程数，0 表示与 sql_num 相同" },
+        { "metrics_path",           TYPE_STRING,  &c->metrics_path,           "运行时指标的路径，空表示不提供" },
+        { "metrics_local_only",     TYPE_BOOL,    &c->metrics_local_only,     "运行时指标只对本机回环地址开放" },
+        { "http2",                  TYPE_BOOL,    &c->http2,                  "接受 HTTP/2（先验知识、h2c 升级、TLS 上的 ALPN），协程引擎不支持" },
+        { "h2_max_streams",         TYPE_INT,     &c->h2_max_streams,         "每个 HTTP/2 连接最多同时打开的流数" },
+        { "ws_path",                TYPE_STRING,  &c->ws_path,                "接受 WebSocket 握手的路径，空表示不接受，协程引擎不支持" },
+        { "ws_relay",               TYPE_BOOL,    &c->ws_relay,               "WebSocket 客户端发来的消息广播给其他所有连接" },
+        { "ws_ping_interval",       TYPE_INT,     &c->ws_ping_interval,       "WebSocket 连接空闲多久发送 ping（毫秒）" },
+        { "ws_pong_timeout",        TYPE_INT,     &c->ws_pong_timeout,        "等待 pong 的期限（毫秒），超时关闭连接" },
+        { "ws_max_backlog",         TYPE_INT,     &c->ws_max_backlog,         "单个 WebSocket 连接发送积压的上限（字节），超过时作为慢速订阅者关闭" },
+        { "ws_max_message",         TYPE_INT,     &c->ws_max_message,         "WebSocket 客户端消息的上限（字节）" },
+        { "proxy_routes",           TYPE_STRING,  &c->proxy_routes,           "反向代理路由：/前缀=host:port 或 unix:/path，多个地址以逗号分隔、多条路由以分号分隔，协程引擎不支持" },
+        { "proxy_connect_timeout",  TYPE_INT,     &c->proxy_connect_timeout,  "连接上游的期限（毫秒），超时换一个连接重试" },
+        { "proxy_timeout",          TYPE_INT,     &c->proxy_timeout,          "转发期间两次收发进展之间的最长间隔（毫秒），超时应答 504" },
+        { "proxy_keepalive",        TYPE_INT,     &c->proxy_keepalive,        "每个上游服务器保留的空闲保活连接数" },
+        { "proxy_idle_timeout",     TYPE_INT,     &c->proxy_idle_timeout,     "空闲保活连接的保留期限（毫秒）" },
+        { "proxy_fail_timeout",     TYPE_INT,     &c->proxy_fail_timeout,     "转发失败后暂停选中该服务器的时间（毫秒）" },
+        { "proxy_health_interval",  TYPE_INT,     &c->proxy_health_interval,  "主动健康检查的间隔（毫秒），0 表示只做被动检查" },
+        { "proxy_health_path",      TYPE_STRING,  &c->proxy_health_path,      "主动健康检查请求的路径，空表示只检查能否建立连接" },
+        { "tls_port",               TYPE_INT,     &c->tls_port,               "HTTPS 监听端口，0 表示不启用（需以 make TLS=1 编译）" },
+        { "tls_cert",               TYPE_STRING,  &c->tls_cert,               "PEM 格式的证书链" },
+        { "tls_key",                TYPE_STRING,  &c->tls_key,                "PEM 格式的私钥" },
+        { "tls_session_cache",      TYPE_INT,     &c->tls_session_cache,      "服务端 TLS 会话缓存的容量，0 表示不缓存" },
+        { "tls_session_timeout",    TYPE_INT,     &c->tls_session_timeout,    "TLS 会话的有效期（秒）" },
+        { "tls_session_tickets",    TYPE_BOOL,    &c->tls_session_tickets,    "用会话票据恢复 TLS 会话" },
+        { "ktls",                   TYPE_BOOL,    &c->ktls,                   "握手完成后把 TLS 记录的加解密交给内核" },
+    };
+    return std::vector<option>(table, table + sizeof(table) / sizeof(table[0]));
+}
+
+bool server_config::set(const char* key, const char* value, const char* where)
+{
+    std::vector<option> opts = options();
+    for(size_t i = 0; i < opts.size(); ++i)
+    {
+        if(strcmp(opts[i].key, key) != 0)
+        {
+            continue;
+        }
+        switch (opts[i].type)
+        {
+        case TYPE_INT:
+        {
+            char* end;
+            errno = 0;
+            long v = strtol(value, &end, 10);
+            if(errno != 0 || end == value || *end != '\0' || v < 0 || v > 0x7fffffff)
+            {
+                printf("%s: %s expects a non-negative integer, got \"%s\"\n", where, key, value);
+                return false;
+            }
+            *(int*)opts[i].value = (int)v;
+            return true;
+        }
+        case TYPE_BOOL:
+        {
+            if(strcmp(value, "1") == 0 || strcasecmp(value, "true") == 0 ||
+                strcasecmp(value, "on") == 0 || strcasecmp(value, "yes") == 0)
+            {
+                *(bool*)opts[i].value = true;
+            }
+            else if(strcmp(value, "0") == 0 || strcasecmp(value, "false") == 0 ||
+                    strcasecmp(value, "off") == 0 || strcasecmp(value, "no") == 0)
+            {
+                *(bool*)opts[i].value = false;
+            }
+            else
+            {
+                printf("%s: %s expects 0/1, got \"%s\"\n", where, key, value);
+                return false;
+            }
+            return true;
+        }
+        case TYPE_STRING:
+        {
+            *(std::string*)opts[i].value = value;
+            return true;
+        }
+        case TYPE_TRIGGER:
+        {
+            if(strcasecmp(value, "ET") == 0)
+            {
+                *(trigger_mode*)opts[i].value = TRIGGER_ET;
+            }
+            else if(strcasecmp(value, "LT") == 0)
+            {
+                *(trigger_mode*)opts[i].value = TRIGGER_LT;
+            }
+            else
+            {
+                printf("%s: %s expects LT or ET, got \"%s\"\n", where, key, value);
+                return false;
+            }
+            return true;
+        }
+        }
+    }
+    printf("%s: unknown option \"%s\"\n", where, key);
+    return false;
+}
+
+/* 去掉首尾空白，原地修改 */
+static char* trim(char* s)
+{
+    while (*s == ' ' || *s == '\t')
+    {
+        ++s;
+    }
+    char* end = s + strlen(s);
+    while (end > s && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r' || end[-1] == '\n'))
+    {
+        --end;
+    }
+    *end = '\0';
+    return s;
+}
+
+bool server_config::load_file(const char* path)
+{
+    FILE* fp = fopen(path, "r");
+    if(!fp)
+    {
+        printf("%s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    char line[1024];
+    int lineno = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), fp))
+    {
+        ++lineno;
+        char* hash = strchr(line, '#');
+        if(hash)
+        {
+            *hash = '\0';
+        }
+        char* text = trim(line);
+        if(*text == '\0')
+        {
+            continue;
+        }
+
+        char where[300];
+        snprintf(where, sizeof(where), "%s:%d", path, lineno);
+        char* eq = strchr(text, '=');
+        if(!eq)
+        {
+            printf("%s: expected \"key = value\"\n", where);
+            ok = false;
+            break;
+        }
+        *eq = '\0';
+        char* value = trim(eq + 1);
+        /* 值两边的引号可以省略，空串写作 "" */
+        size_t len = strlen(value);
+        if(len >= 2 && value[0] == '"' && value[len - 1] == '"')
+        {
+            value[len - 1] = '\0';
+            ++value;
+        }
+        ok = set(trim(text), value, where);
+    }
+    fclose(fp);
+    return ok;
+}
+
+bool server_config::parse(int argc, char* argv[], bool* exit)
+{
+    *exit = false;
+
+    /* 配置文件先读入，命令行中其余选项不论位置都覆盖它 */
+    for(int i = 1; i < argc; ++i)
+    {
+        if(strcmp(argv[i], "-f") == 0)
+        {
+            if(i + 1 >= argc)
+            {
+                usage(argv[0]);
+                return false;
+            }
+            if(!load_file(argv[++i]))
+            {
+                return false;
+            }
+        }
+    }
+
+    bool dump = false;
+    bool port_seen = false;
+    for(int i = 1; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+        if(strcmp(arg, "-f") == 0)
+        {
+            ++i;
+        }
+        else if(strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0)
+        {
+            usage(argv[0]);
+            *exit = true;
+            return true;
+        }
+        else if(strcmp(arg, "-d") == 0)
+        {
+            dump = true;
+        }
+        else if(strcmp(arg, "-p") == 0)
+        {
+            if(i + 1 >= argc || !set("port", argv[++i], "-p"))
+            {
+                return false;
+            }
+        }
+        else if(strncmp(arg, "--", 2) == 0)
+        {
+            std::string key = arg + 2;
+            std::string value;
+            size_t eq = key.find('=');
+            if(eq != std::string::npos)
+            {
+                value = key.substr(eq + 1);
+                key.erase(eq);
+            }
+            else if(i + 1 < argc)
+            {
+                value = argv[++i];
+            }
+            else
+            {
+                printf("%s: missing value\n", arg);
+                return false;
+            }
+            if(!set(key.c_str(), value.c_str(), "command line"))
+            {
+                return false;
+            }
+        }
+        else if(arg[0] != '-' && !port_seen)
+        {
+            port_seen = true;
+            if(!set("port", arg, "command line"))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            usage(argv[0]);
+            return false;
+        }
+    }
+
+    if(!check())
+    {
+        return false;
+    }
+    if(dump)
+    {
+        print(stdout);
+        *exit = true;
+    }
+    return true;
+}
+
+/* 检查配置项之间的约束 */
+bool server_config::check() const
+{
+    if(port <= 0 || port > 65535)
+    {
+        printf("port must be in 1..65535\n");
+        return false;
+    }
+    /* 请求的文件路径为 doc_root 加 url，放在 FILENAME_LEN 字节的缓冲区中，至少留一半给 url */
+    if(doc_root.empty() || doc_root.size() >= http_conn::FILENAME_LEN / 2)
+    {
+        printf("doc_root must be 1..%d characters\n", http_conn::FILENAME_LEN / 2 - 1);
+        return false;
+    }
+    if(threads <= 0 || sql_num <= 0 || max_events <= 0 || max_fd <= 0 || timeslot <= 0 ||
+        log_buf_size <= 0 || log_split_lines <= 0 || coro_threads <= 0 || h2_max_streams <= 0)
+    {
+        printf("threads, sql_num, max_events, max_fd, timeslot, log_buf_size, log_split_lines, "
+               "coro_threads and h2_max_streams must be positive\n");
+        return false;
+    }
+    if(ws_ping_interval <= 0 || ws_pong_timeout <= 0 || ws_max_backlog <= 0 || ws_max_message <= 0)
+    {
+        printf("ws_ping_interval, ws_pong_timeout, ws_max_backlog and ws_max_message must be positive\n");
+        return false;
+    }
+    if(!ws_path.empty() && ws_path[0] != '/')
+    {
+        printf("ws_path must start with '/'\n");
+        return false;
+    }
+#ifdef CORO_ENGINE
+    if(!ws_path.empty())
+    {
+        printf("ws_path is not supported by the coroutine engine\n");
+        return false;
+    }
+#endif
+    if(proxy_connect_timeout <= 0 || proxy_timeout <= 0 || proxy_keepalive < 0 || proxy_idle_timeout <= 0 ||
+        proxy_fail_timeout < 0 || proxy_health_interval < 0)
+    {
+        printf("proxy_connect_timeout, proxy_timeout and proxy_idle_timeout must be positive, "
+               "proxy_keepalive, proxy_fail_timeout and proxy_health_interval must not be negative\n");
+        return false;
+    }
+    if(!proxy_health_path.empty() && proxy_health_path[0] != '/')
+    {
+        printf("proxy_health_path must start with '/'\n");
+        return false;
+    }
+#ifdef CORO_ENGINE
+    if(!proxy_routes.empty())
+    {
+        printf("proxy_routes is not supported by the coroutine engine\n");
+        return false;
+    }
+#endif
+    if(adaptive_threads && (min_threads <= 0 || min_threads > max_threads))
+    {
+        printf("adaptive threads need 0 < min_threads <= max_threads\n");
+        return false;
+    }
+    if(db_max_running > sql_num)
+    {
+        printf("db_max_running (%d) must not exceed sql_num (%d)\n", db_max_running, sql_num);
+        return false;
+    }
+    if(static_weight <= 0 || db_weight <= 0)
+    {
+        printf("lane weights must be positive\n");
+        return false;
+    }
+    if(tls_port > 0)
+    {
+#ifndef TLS_ENABLED
+        printf("tls_port needs a build with TLS support (make TLS=1)\n");
+        return false;
+#endif
+#ifdef CORO_ENGINE
+        printf("tls_port is not supported by the coroutine engine\n");
+        return false;
+#endif
+        if(tls_port > 65535 || tls_port == port)
+        {
+            printf("tls_port must be in 1..65535 and differ from port\n");
+            return false;
+        }
+    }
+    return true;
+}
+
+std::string server_config::format(const option& opt)
+{
+    char buf[32];
+    switch (opt.type)
+    {
+    case TYPE_INT:
+        snprintf(buf, sizeof(buf), "%d", *(int*)opt.value);
+        return buf;
+    case TYPE_BOOL:
+        return *(bool*)opt.value ? "1" : "0";
+    case TYPE_TRIGGER:
+        return *(trigger_mode*)opt.value == TRIGGER_ET ? "ET" : "LT";
+    case TYPE_STRING:
+    default:
+        return "\"" + *(std::string*)opt.value + "\"";
+    }
+}
+
+void server_config::print(FILE* fp) const
+{
+    std::vector<option> opts = options();
+    for(size_t i = 0; i < opts.size(); ++i)
+    {
+        fprintf(fp, "# %s\n%s = %s\n", opts[i].help, opts[i].key, format(opts[i]).c_str());
+    }
+}
+
+void server_config::log() const
+{
+    static const server_config defaults;
+    std::vector<option> opts = options();
+    std::vector<option> base = defaults.options();
+    for(size_t i = 0; i < opts.size(); ++i)
+    {
+        std::string value = format(opts[i]);
+        if(value != format(base[i]) && strcmp(opts[i].key, "db_password") != 0)
+        {
+            LOG_INFO("[config] %s = %s\n", opts[i].key, value.c_str());
+        }
+    }
+}
+
+void server_config::usage(const char* prog) const
+{
+    printf("usage: %s [port] [-p port] [-f config_file] [--key=value ...] [-d] [-h]\n"
+           "  -f reads \"key = value\" lines; command line options override the file\n"
+           "  -d prints the effective configuration in config file format and exits\n\n",
+           basename((char*)prog));
+    std::vector<option> opts = options();
+    for(size_t i = 0; i < opts.size(); ++i)
+    {
+        printf("  --%-24s %-10s %s\n", opts[i].key, format(opts[i]).c_str(), opts[i].help);
+    }
+}
@@ -0,0 +1,153 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "../http/transport.h"
+
+/* 服务器的运行时配置
+   原来编译期宏对应的选项保持原来的默认值；之后加入的连接上限、按 IP 限流、自适应线程数和 /metrics
+   等功能默认开启，可用对应的选项关闭，-d 可查看所有生效的值。
+   启动时先读 -f 指定的配置文件，再应用命令行选项，命令行覆盖配置文件。
+   配置文件每行一个 "键 = 值"，# 之后为注释；命令行用 --键=值 或 --键 值，键名与配置文件相同。
+   兼容原来的用法：第一个不以 - 开头的参数为端口。
+   -p 端口、-f 配置文件、-d 输出生效的配置（格式与配置文件相同）后退出、-h 列出所有配置项 */
+class server_config
+{
+public:
+    static server_config* get_instance()
+    {
+        static server_config instance;
+        return &instance;
+    }
+
+    /* 解析命令行（其中 -f 指定的配置文件先于其余选项读入），出错时打印原因并返回 false，
+        exit 返回是否应直接退出（-h、-d） */
+    bool parse(int argc, char* argv[], bool* exit);
+    /* 读入配置文件，出错时打印文件名、行号和原因并返回 false */
+    bool load_file(const char* path);
+    /* 设置一项配置，出错时打印原因（where 说明来源）并返回 false */
+    bool set(const char* key, const char* value, const char* where);
+
+    /* 以配置文件的格式输出所有配置项及其当前值 */
+    void print(FILE* fp) const;
+    /* 把与默认值不同的配置项写入日志 */
+    void log() const;
+
+public:
+    int port;
+    std::string doc_root;           /* 网站根目录 */
+
+    trigger_mode listen_trigger;    /* 监听 socket 的触发模式 */
+    trigger_mode conn_trigger;      /* 连接 socket 的触发模式 */
+    int timeslot;                   /* 无定时器时主循环醒来的间隔（秒） */
+    int max_fd;                     /* 大于等于它的连接 fd 直接关闭 */
+    int max_events;                 /* 一次 epoll_wait 最多取出的事件数 */
+    int backlog;                    /* listen() 的监听队列长度 */
+    bool eager_write;               /* 工作线程生成应答后立即发送，仅在 EAGAIN 时等待写事件 */
+
+    bool log_async;                 /* 异步写日志 */
+    int log_queue_size;             /* 异步日志队列长度 */
+    int log_buf_size;               /* 一行日志的最大长度 */
+    int log_split_lines;            /* 单个日志文件的最大行数 */
+
+    int header_timeout;             /* 读取请求头的期限（毫秒） */
+    int body_timeout;               /* 读取消息体的期限（毫秒） */
+    int min_recv_rate;              /* 读请求的最低接收速率（字节/秒） */
+    int write_timeout;              /* 发送响应的基础期限（毫秒） */
+    int min_send_rate;              /* 发送响应的最低发送速率（字节/秒） */
+    int keepalive_timeout;          /* 保活连接的空闲期限（毫秒） */
+    int rate_grace;                 /* 阶段开始后多久开始检查速率（毫秒） */
+
+    int max_conn;                   /* 最大并发连接数，达到后暂停 accept */
+    int max_queued;                 /* 线程池请求队列的最大长度，达到后暂停 accept */
+    int admission_low_water;        /* 负载降到上限的该百分比以下才恢复 accept */
+    int admission_recheck;          /* 暂停 accept 期间检查是否可以恢复的间隔（毫秒） */
+    int retry_after;                /* 503/429 应答建议客户端重试的间隔（秒） */
+
+    int per_ip_max_conn;            /* 每个客户端 IP 的最大连接数，0 表示不限制 */
+    int per_ip_rate;                /* 每个客户端 IP 每秒的请求数，0 表示不限制 */
+    int per_ip_burst;               /* 每个客户端 IP 允许的突发请求数 */
+    bool per_ip_exempt_loopback;    /* 本机回环地址不受单个 IP 的限制 */
+
+    int threads;                    /* 工作线程数，开启自适应调节时为初始线程数 */
+    bool adaptive_threads;          /* 按排队延迟自动增减工作线程 */
+    int min_threads;
+    int max_threads;
+    int queue_target_delay;         /* 目标排队延迟（微秒） */
+    int adapt_interval;             /* 自适应调节的评估周期（毫秒） */
+
+    int static_weight;              /* 快速通道的调度权重 */
+    int db_weight;                  /* 数据库通道的调度权重 */
+    int db_max_running;             /* 同时处理数据库请求的最多线程数 */
+    int db_max_queued;              /* 数据库通道的最大排队数 */
+
+    std::string db_host;
+    int db_port;
+    std::string db_user;
+    std::string db_password;
+    std::string db_name;
+    int sql_num;                    /* 数据库连接池的连接数 */
+
+    std::string reactor_cpus;       /* CPU 列表，如 "0-3,8"；空串为按 NUMA 拓扑的默认布局，"none" 为不绑定 */
+    std::string worker_cpus;
+    std::string log_cpus;
+
+    int coro_threads;               /* 协程引擎的调度线程数 */
+    int coro_db_threads;            /* 协程引擎执行数据库请求的线程数，0 表示与 sql_num 相同 */
+
+    std::string metrics_path;       /* 运行时指标的路径，空串表示不提供 */
+    bool metrics_local_only;        /* 运行时指标只对本机回环地址开放 */
+
+    bool http2;                     /* 接受 HTTP/2：先验知识、h2c 升级和 TLS 上的 ALPN 协商 */
+    int h2_max_streams;             /* 每个 HTTP/2 连接最多同时打开的流数 */
+
+    std::string ws_path;            /* 接受 WebSocket 握手的路径，空串表示不接受 */
+    bool ws_relay;                  /* 客户端发来的消息广播给其他所有 WebSocket 连接 */
+    int ws_ping_interval;           /* WebSocket 连接空闲多久发送 ping（毫秒） */
+    int ws_pong_timeout;            /* 等待 pong 的期限（毫秒） */
+    int ws_max_backlog;             /* 单个 WebSocket 连接发送积压的上限（字节），超过时关闭 */
+    int ws_max_message;             /* 客户端消息的上限（字节） */
+
+    std::string proxy_routes;       /* 反向代理路由，形如 /api/=127.0.0.1:8081,unix:/run/app.sock;/app/=...，空串表示不转发 */
+    int proxy_connect_timeout;      /* 连接上游的期限（毫秒），也用于主动健康检查 */
+    int proxy_timeout;              /* 转发期间两次收发进展之间的最长间隔（毫秒） */
+    int proxy_keepalive;            /* 每个上游服务器保留的空闲保活连接数 */
+    int proxy_idle_timeout;         /* 空闲保活连接的保留期限（毫秒） */
+    int proxy_fail_timeout;         /* 转发失败后暂停选中该服务器的时间（毫秒） */
+    int proxy_health_interval;      /* 主动健康检查的间隔（毫秒），0 表示只做被动检查 */
+    std::string proxy_health_path;  /* 主动健康检查请求的路径，空串表示只检查能否建立连接 */
+
+    int tls_port;                   /* HTTPS 监听端口，0 表示不启用，需以 make TLS=1 编译 */
+    std::string tls_cert;           /* PEM 格式的证书链 */
+    std::string tls_key;            /* PEM 格式的私钥 */
+    int tls_session_cache;          /* 服务端会话缓存的容量，0 表示不缓存 */
+    int tls_session_timeout;        /* 会话的有效期（秒） */
+    bool tls_session_tickets;       /* 用会话票据恢复会话 */
+    bool ktls;                      /* 握手完成后把记录层的加解密交给内核 TLS */
+
+private:
+    enum value_type { TYPE_INT, TYPE_BOOL, TYPE_STRING, TYPE_TRIGGER };
+
+    /* 一个配置项：键名、类型、对应的成员和说明 */
+    struct option
+    {
+        const char* key;
+        value_type type;
+        void* value;
+        const char* help;
+    };
+
+    server_config();
+    server_config(const server_config&);
+    server_config& operator=(const server_config&);
+
+    /* 所有配置项，value 指向本对象的成员 */
+    std::vector<option> options() const;
+    static std::string format(const option& opt);
+    bool check() const;
+    void usage(const char* prog) const;
+};
+
+#endif
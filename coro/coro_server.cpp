@@ -0,0 +1,345 @@
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "coro_server.h"
+#include "scheduler.h"
+#include "task.h"
+#include "../http/http_conn.h"
+#include "../http/transport.h"
+#include "../memory/slab.h"
+#include "../threadpool/threadpool.h"
+#include "../timer/coarse_clock.h"
+#include "../affinity/cpu_topology.h"
+#include "../stats/syscall_stats.h"
+#include "../stats/metrics.h"
+#include "../log/log.h"
+
+#define CORO_DB_QUEUE 10000     /* 数据库线程的最大排队数，超出时应答 503 */
+
+/* 协程模式的传输层：事件注册由当前线程的调度器负责，
+    recv/writev 遇到 EAGAIN 时清除调度器中的就绪状态，等待下一次边缘事件 */
+class coro_transport : public transport
+{
+public:
+    static coro_transport* get_instance()
+    {
+        static coro_transport instance;
+        return &instance;
+    }
+
+    void attach(int fd, void*)
+    {
+        coro_scheduler::current()->watch(fd);
+    }
+
+    void rearm(int, void*, int)
+    {
+    }
+
+    ssize_t recv(int fd, char* buf, size_t len)
+    {
+        COUNT_SYSCALL(RECV);
+        ssize_t n = ::recv(fd, buf, len, 0);
+        if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            coro_scheduler::current()->clear(fd, EPOLLIN);
+        }
+        return n;
+    }
+
+    ssize_t writev(int fd, const struct iovec* iov, int count)
+    {
+        COUNT_SYSCALL(WRITEV);
+        ssize_t n = ::writev(fd, iov, count);
+        if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            coro_scheduler::current()->clear(fd, EPOLLOUT);
+        }
+        return n;
+    }
+
+    void send_nowait(int fd, const char* buf, size_t len)
+    {
+        COUNT_SYSCALL(WRITEV);
+        ::send(fd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    }
+
+    void close(int fd)
+    {
+        coro_scheduler::current()->forget(fd);
+        ::close(fd);
+        COUNT_SYSCALL(CLOSE);
+    }
+
+private:
+    coro_transport() { }
+};
+
+/* 交给数据库线程的任务，threadpool 为它取好数据库连接后调用 process()，
+    处理完把连接协程交回原来的调度器 */
+struct db_job
+{
+    http_conn* conn;
+    MYSQL* mysql;
+    coro_scheduler* sched;
+    std::coroutine_handle<> handle;
+    bool ok;
+    bool ready;
+
+    void process()
+    {
+        conn->mysql = mysql;
+        ok = conn->process_inline(&ready);
+        sched->post(handle);
+    }
+};
+
+/* 把请求交给数据库线程并挂起，co_await 的结果为 false 表示队列已满 */
+struct db_awaiter
+{
+    threadpool<db_job>* pool;
+    db_job* job;
+    bool queued;
+
+    bool await_ready() { return false; }
+    bool await_suspend(std::coroutine_handle<> h)
+    {
+        /* 数据库线程要到本线程回到事件循环之后才能恢复协程，交出之后不再访问 job */
+        job->handle = h;
+        job->sched = coro_scheduler::current();
+        queued = pool->append(job);
+        return queued;
+    }
+    bool await_resume() { return queued; }
+};
+
+static threadpool<db_job>* db_pool = NULL;
+/* 大于等于它的连接 fd 直接关闭 */
+static int fd_limit = 65536;
+/* 每个调度线程的连接对象池，连接协程只在创建它的调度线程上运行 */
+static thread_local slab<http_conn>* t_conns = NULL;
+
+static const char busy_response[] = "HTTP/1.1 503 Service Unavailable\r\n"
+                                    "Content-Length:0\r\n"
+                                    "Connection:close\r\n\r\n";
+
+/* 一个连接的处理协程，直到连接关闭才结束 */
+static coro_task session(coro_scheduler* sched, int fd, sockaddr_in addr)
+{
+    coarse_clock* clock = coarse_clock::get_instance();
+    http_conn* conn = t_conns->alloc();
+    conn->set_transport(coro_transport::get_instance());
+    conn->init(fd, addr);
+
+    while (true)
+    {
+        /* 新连接和保活连接按各自阶段的期限等待请求数据 */
+        if(!co_await sched->readable(fd, conn->deadline()))
+        {
+            LOG_INFO("[coro] connection %d timed out\n", fd);
+            conn->timeout_response();
+            break;
+        }
+        if(!conn->read_once<TRIGGER_ET>())
+        {
+            break;
+        }
+        if(conn->too_slow(clock->now_ms()))
+        {
+            LOG_INFO("[coro] connection %d too slow\n", fd);
+            conn->timeout_response();
+            break;
+        }
+
+        bool ok;
+        bool ready = false;
+        if(conn->db_bound())
+        {
+            db_job job;
+            job.conn = conn;
+            job.mysql = NULL;
+            job.ok = false;
+            job.ready = false;
+            db_awaiter wait = {db_pool, &job, false};
+            if(!co_await wait)
+            {
+                coro_transport::get_instance()->send_nowait(fd, busy_response,
+                                                            sizeof(busy_response) - 1);
+                server_metrics::count_response(503);
+                break;
+            }
+            ok = job.ok;
+            ready = job.ready;
+        }
+        else
+        {
+            /* 不访问数据库的请求直接在调度线程上处理 */
+            ok = conn->process_inline(&ready);
+        }
+        if(!ok)
+        {
+            break;
+        }
+        if(!ready)
+        {
+            continue;
+        }
+
+        /* write() 在发送完且为保活连接时回到空闲阶段，非保活连接发送完返回 false */
+        bool keep = conn->write();
+        while (keep && conn->has_output())
+        {
+            if(!co_await sched->writable(fd, conn->deadline()) ||
+                conn->too_slow(clock->now_ms()))
+            {
+                keep = false;
+                break;
+            }
+            keep = conn->write();
+        }
+        if(!keep)
+        {
+            break;
+        }
+    }
+
+    conn->close_conn();
+    t_conns->free(conn);
+}
+
+/* 接受新连接，为每个连接启动一个处理协程 */
+static coro_task acceptor(coro_scheduler* sched, int listenfd)
+{
+    sched->watch(listenfd, true);
+    while (true)
+    {
+        co_await sched->readable(listenfd, 0);
+        while (true)
+        {
+            struct sockaddr_in addr;
+            socklen_t len = sizeof(addr);
+            int fd = accept4(listenfd, (struct sockaddr*)&addr, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            COUNT_SYSCALL(ACCEPT);
+            if(fd < 0)
+            {
+                /* 监听队列已空；fd 耗尽等错误也等下一个新连接再重试，不在这里空转 */
+                if(errno != EAGAIN && errno != EWOULDBLOCK)
+                {
+                    LOG_ERROR("[coro] accept failed, errno is %d\n", errno);
+                }
+                sched->clear(listenfd, EPOLLIN);
+                break;
+            }
+            if(fd >= fd_limit)
+            {
+                close(fd);
+                continue;
+            }
+            server_metrics::accepts.add();
+            /* 处理协程立即开始运行，第一次等待数据时回到这里 */
+            session(sched, fd, addr);
+        }
+    }
+}
+
+struct scheduler_arg
+{
+    coro_scheduler* sched;
+    int listenfd;
+    const cpu_set_t* cpus;
+};
+
+static void* scheduler_thread(void* p)
+{
+    scheduler_arg* arg = (scheduler_arg*)p;
+    if(arg->cpus)
+    {
+        cpu_topology::get_instance()->bind_self(*arg->cpus);
+    }
+    /* 事件循环退出后仍挂起的协程不再恢复，对象池随线程结束一起丢弃 */
+    slab<http_conn> conns(64);
+    t_conns = &conns;
+    acceptor(arg->sched, arg->listenfd);
+    arg->sched->run();
+    return NULL;
+}
+
+int coro_server::run(int listenfd, int threads, connection_pool* connPool, int db_threads,
+                        int max_fd, const cpu_set_t* cpus, const sigset_t& sigmask)
+{
+    fd_limit = max_fd;
+    fcntl(listenfd, F_SETFL, fcntl(listenfd, F_GETFL) | O_NONBLOCK);
+
+    try
+    {
+        db_pool = new threadpool<db_job>(connPool, db_threads, CORO_DB_QUEUE, cpus);
+    }
+    catch(...)
+    {
+        return 1;
+    }
+
+    std::vector<coro_scheduler*> scheds(threads);
+    std::vector<scheduler_arg> args(threads);
+    std::vector<pthread_t> tids(threads);
+    for(int i = 0; i < threads; ++i)
+    {
+        scheds[i] = new coro_scheduler();
+        args[i].sched = scheds[i];
+        args[i].listenfd = listenfd;
+        args[i].cpus = cpus;
+        if(pthread_create(&tids[i], NULL, scheduler_thread, &args[i]) != 0)
+        {
+            return 1;
+        }
+    }
+    LOG_INFO("[coro] %d scheduler threads, %d db threads\n", threads, db_threads);
+
+    /* 调用线程只处理信号，并每秒发布一次连接数 */
+    bool stop = false;
+    while (!stop)
+    {
+        struct timespec ts = {1, 0};
+        int sig = sigtimedwait(&sigmask, NULL, &ts);
+        server_metrics::active_conns.store(http_conn::m_user_count.load(std::memory_order_relaxed),
+                                            std::memory_order_relaxed);
+        switch (sig)
+        {
+        case SIGTERM:
+        {
+            stop = true;
+            break;
+        }
+        case SIGHUP:
+        {
+            LOG_INFO("[coro] %d connections\n", http_conn::m_user_count.load());
+            db_pool->log_stats();
+            Log::get_instance()->flush();
+#ifdef SYSCALL_STATS
+            syscall_stats::dump();
+#endif
+#ifdef LOCK_PROFILE
+            lock_profile::dump();
+#endif
+            break;
+        }
+        }
+    }
+
+    for(int i = 0; i < threads; ++i)
+    {
+        scheds[i]->stop();
+    }
+    for(int i = 0; i < threads; ++i)
+    {
+        pthread_join(tids[i], NULL);
+        delete scheds[i];
+    }
+    close(listenfd);
+    return 0;
+}
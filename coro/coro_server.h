@@ -0,0 +1,25 @@
+#ifndef CORO_SERVER_H
+#define CORO_SERVER_H
+
+#include <signal.h>
+#include <sched.h>
+#include "../CGImysql/sql_connection_pool.h"
+
+/* 基于协程的服务器（实验性，编译时 make CORO=1 开启）
+   每个调度线程运行一个 accept 协程，共同监听同一个 socket（EPOLLEXCLUSIVE，新连接只唤醒一个），
+   每个连接是一个协程：等待可读、读取、解析并生成应答、写出、等待下一个请求，
+   各阶段的期限与主循环模式相同，由 http_conn 计算。
+   不访问数据库的请求在调度线程上直接处理，没有线程切换；访问数据库的请求交给数据库线程执行，
+   连接协程挂起等待结果，调度线程继续处理其他连接，少量调度线程就能服务大量等待数据库的请求。
+   解析和应答沿用 http_conn，读取使用边缘触发的 read_once<TRIGGER_ET>，读到 EAGAIN 为止，与 conn_trigger 配置无关 */
+class coro_server
+{
+public:
+    /* 在 listenfd 上运行 threads 个调度线程和 db_threads 个数据库线程，大于等于 max_fd 的连接直接关闭，
+        cpus 不为 NULL 时所有线程绑定到这组 CPU。
+        调用线程处理 sigmask 中的信号：SIGTERM 退出，SIGHUP 输出统计；返回值作为进程退出码 */
+    static int run(int listenfd, int threads, connection_pool* connPool, int db_threads, int max_fd,
+                    const cpu_set_t* cpus, const sigset_t& sigmask);
+};
+
+#endif
@@ -0,0 +1,238 @@
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdexcept>
+#include <sys/eventfd.h>
+
+#include "scheduler.h"
+#include "../timer/coarse_clock.h"
+#include "../stats/syscall_stats.h"
+
+/* 一次 epoll_wait 最多取出的事件数 */
+#define CORO_MAX_EVENTS 256
+
+thread_local coro_scheduler* coro_scheduler::t_current = NULL;
+
+coro_scheduler::coro_scheduler() : m_epollfd(-1), m_wakefd(-1), m_stop(false), m_fds(1024),
+                                    m_post_lock("coro_post")
+{
+    m_epollfd = epoll_create1(EPOLL_CLOEXEC);
+    m_wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(m_epollfd < 0 || m_wakefd < 0)
+    {
+        throw std::exception();
+    }
+    epoll_event event;
+    event.data.fd = m_wakefd;
+    event.events = EPOLLIN | EPOLLET;
+    epoll_ctl(m_epollfd, EPOLL_CTL_ADD, m_wakefd, &event);
+}
+
+coro_scheduler::~coro_scheduler()
+{
+    close(m_wakefd);
+    close(m_epollfd);
+}
+
+coro_scheduler::fd_state& coro_scheduler::state(int fd)
+{
+    if(fd >= (int)m_fds.size())
+    {
+        m_fds.resize(fd + 1 > (int)m_fds.size() * 2 ? fd + 1 : m_fds.size() * 2);
+    }
+    return m_fds[fd];
+}
+
+bool coro_scheduler::watch(int fd, bool exclusive)
+{
+    fd_state& st = state(fd);
+    st.readable = false;
+    st.writable = false;
+    st.waiter = std::coroutine_handle<>();
+    st.deadline = 0;
+    st.timer_at = 0;
+
+    /* 注册时内核会检查一次当前状态，注册前已经到达的数据同样会报告 */
+    epoll_event event;
+    event.data.fd = fd;
+    event.events = exclusive ? (EPOLLIN | EPOLLET | EPOLLEXCLUSIVE) :
+                                (EPOLLIN | EPOLLOUT | EPOLLET | EPOLLRDHUP);
+    COUNT_SYSCALL(EPOLL_CTL);
+    return epoll_ctl(m_epollfd, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+void coro_scheduler::forget(int fd)
+{
+    fd_state& st = state(fd);
+    ++st.gen;
+    st.readable = false;
+    st.writable = false;
+    st.waiter = std::coroutine_handle<>();
+    st.deadline = 0;
+    st.timer_at = 0;
+}
+
+void coro_scheduler::clear(int fd, int ev)
+{
+    fd_state& st = state(fd);
+    if(ev & EPOLLIN)
+    {
+        st.readable = false;
+    }
+    if(ev & EPOLLOUT)
+    {
+        st.writable = false;
+    }
+}
+
+bool coro_scheduler::ready(int fd, int ev)
+{
+    fd_state& st = state(fd);
+    st.timed_out = false;
+    return ev == EPOLLIN ? st.readable : st.writable;
+}
+
+void coro_scheduler::suspend(int fd, int ev, long long deadline, std::coroutine_handle<> h)
+{
+    fd_state& st = state(fd);
+    st.want = ev;
+    st.waiter = h;
+    st.deadline = deadline;
+    st.timed_out = false;
+    /* 期限比时间堆中已有的条目晚时不加新条目，已有条目到期时再按新期限重新加入 */
+    if(deadline > 0 && (st.timer_at == 0 || deadline < st.timer_at))
+    {
+        st.timer_at = deadline;
+        timer_entry e = {deadline, fd, st.gen};
+        m_timers.push(e);
+    }
+}
+
+bool coro_scheduler::resume_result(int fd)
+{
+    return !state(fd).timed_out;
+}
+
+void coro_scheduler::wake(fd_state& st)
+{
+    /* 恢复的协程可能接受新连接使 m_fds 扩容，恢复之后不能再访问 st */
+    std::coroutine_handle<> h = st.waiter;
+    st.waiter = std::coroutine_handle<>();
+    h.resume();
+}
+
+int coro_scheduler::expire(long long now)
+{
+    while (!m_timers.empty())
+    {
+        timer_entry e = m_timers.top();
+        if(e.at > now)
+        {
+            long long wait = e.at - now;
+            return wait > 60000 ? 60000 : (int)wait;
+        }
+        m_timers.pop();
+
+        fd_state& st = m_fds[e.fd];
+        if(e.gen != st.gen || e.at != st.timer_at)
+        {
+            continue;
+        }
+        st.timer_at = 0;
+        if(!st.waiter || st.deadline == 0)
+        {
+            continue;
+        }
+        if(st.deadline <= now)
+        {
+            st.timed_out = true;
+            wake(st);
+        }
+        else
+        {
+            st.timer_at = st.deadline;
+            timer_entry next = {st.deadline, e.fd, st.gen};
+            m_timers.push(next);
+        }
+    }
+    return -1;
+}
+
+void coro_scheduler::post(std::coroutine_handle<> h)
+{
+    m_post_lock.lock();
+    bool was_empty = m_posted.empty();
+    m_posted.push_back(h);
+    m_post_lock.unlock();
+    /* 队列由空变为非空时才需要唤醒，之后的交回由同一次唤醒一并处理 */
+    if(was_empty)
+    {
+        uint64_t one = 1;
+        write(m_wakefd, &one, sizeof(one));
+    }
+}
+
+void coro_scheduler::stop()
+{
+    m_stop.store(true);
+    uint64_t one = 1;
+    write(m_wakefd, &one, sizeof(one));
+}
+
+void coro_scheduler::run()
+{
+    t_current = this;
+    epoll_event events[CORO_MAX_EVENTS];
+    std::vector<std::coroutine_handle<> > posted;
+    coarse_clock* clock = coarse_clock::get_instance();
+
+    while (!m_stop.load())
+    {
+        clock->try_update();
+        int timeout = expire(clock->now_ms());
+        int number = epoll_wait(m_epollfd, events, CORO_MAX_EVENTS, timeout);
+        COUNT_SYSCALL(EPOLL_WAIT);
+        if(number < 0 && errno != EINTR)
+        {
+            break;
+        }
+        clock->try_update();
+
+        for(int i = 0; i < number; ++i)
+        {
+            int fd = events[i].data.fd;
+            if(fd == m_wakefd)
+            {
+                /* 先读 eventfd 再取队列，取队列之后的交回会再次唤醒 */
+                uint64_t n;
+                read(m_wakefd, &n, sizeof(n));
+                m_post_lock.lock();
+                posted.swap(m_posted);
+                m_post_lock.unlock();
+                for(size_t j = 0; j < posted.size(); ++j)
+                {
+                    posted[j].resume();
+                }
+                posted.clear();
+                continue;
+            }
+
+            fd_state& st = state(fd);
+            int ev = events[i].events;
+            if(ev & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            {
+                st.readable = true;
+            }
+            if(ev & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+            {
+                st.writable = true;
+            }
+            if(st.waiter && ((st.want == EPOLLIN && st.readable) ||
+                                (st.want == EPOLLOUT && st.writable)))
+            {
+                wake(st);
+            }
+        }
+    }
+    t_current = NULL;
+}
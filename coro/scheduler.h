@@ -0,0 +1,101 @@
+#ifndef CORO_SCHEDULER_H
+#define CORO_SCHEDULER_H
+
+#include <coroutine>
+#include <vector>
+#include <queue>
+#include <atomic>
+#include <sys/epoll.h>
+#include "../lock/locker.h"
+
+/* 协程调度器
+   每个调度线程一个，拥有自己的 epoll 实例。fd 以边缘触发常驻注册读写事件，
+   调度器记录每个 fd 的就绪状态，协程通过 readable/writable 等待就绪，可以附带期限（单调时钟毫秒）。
+   传输层的 recv/writev 返回 EAGAIN 时调用 clear 清除就绪状态，之后的边缘事件会重新置位。
+   每个 fd 同一时刻只能有一个协程等待。其他线程通过 post 把协程交回本调度器恢复 */
+class coro_scheduler
+{
+public:
+    /* 等待 fd 就绪的 awaiter，co_await 的结果为 true 表示就绪，false 表示期限已到 */
+    struct io_awaiter
+    {
+        coro_scheduler* sched;
+        int fd;
+        int ev;
+        long long deadline;
+
+        bool await_ready() { return sched->ready(fd, ev); }
+        void await_suspend(std::coroutine_handle<> h) { sched->suspend(fd, ev, deadline, h); }
+        bool await_resume() { return sched->resume_result(fd); }
+    };
+
+public:
+    coro_scheduler();
+    ~coro_scheduler();
+
+    /* 当前线程的调度器，不在调度线程中时为 NULL */
+    static coro_scheduler* current() { return t_current; }
+
+    /* 在当前线程运行事件循环直到 stop() */
+    void run();
+    /* 请求事件循环退出，可由任意线程调用。仍在等待的协程不再恢复 */
+    void stop();
+    /* 在本调度器上恢复协程 h，可由任意线程调用 */
+    void post(std::coroutine_handle<> h);
+
+    /* fd 加入本调度器。exclusive 用于多个调度器共同监听的 socket，新连接只唤醒其中一个 */
+    bool watch(int fd, bool exclusive = false);
+    /* fd 关闭前调用，丢弃它的就绪状态和期限（close 会自动把它移出 epoll） */
+    void forget(int fd);
+    /* recv/writev 返回 EAGAIN 后清除就绪状态，ev 为 EPOLLIN 或 EPOLLOUT */
+    void clear(int fd, int ev);
+
+    /* 等待 fd 可读或可写，deadline 为 0 表示不限 */
+    io_awaiter readable(int fd, long long deadline) { io_awaiter a = {this, fd, EPOLLIN, deadline}; return a; }
+    io_awaiter writable(int fd, long long deadline) { io_awaiter a = {this, fd, EPOLLOUT, deadline}; return a; }
+
+private:
+    /* 一个 fd 的状态，按 fd 下标存放 */
+    struct fd_state
+    {
+        bool readable;
+        bool writable;
+        bool timed_out;
+        int want;                       /* 等待的事件 */
+        std::coroutine_handle<> waiter; /* 等待的协程 */
+        long long deadline;             /* 等待的期限 */
+        long long timer_at;             /* 时间堆中该 fd 有效条目的到期时间，0 表示没有 */
+        unsigned gen;                   /* fd 关闭一次加一，使时间堆中的旧条目失效 */
+    };
+
+    /* 时间堆条目。每个 fd 至多一个有效条目，期限推迟时不更新，到期后按当前期限重新加入 */
+    struct timer_entry
+    {
+        long long at;
+        int fd;
+        unsigned gen;
+        bool operator>(const timer_entry& other) const { return at > other.at; }
+    };
+
+    fd_state& state(int fd);
+    bool ready(int fd, int ev);
+    void suspend(int fd, int ev, long long deadline, std::coroutine_handle<> h);
+    bool resume_result(int fd);
+    /* 处理到期的条目，返回下一次 epoll_wait 的超时（毫秒） */
+    int expire(long long now);
+    /* 恢复等待 fd 的协程 */
+    void wake(fd_state& st);
+
+private:
+    static thread_local coro_scheduler* t_current;
+
+    int m_epollfd;
+    int m_wakefd;                   /* post 和 stop 写这个 eventfd 唤醒事件循环 */
+    std::atomic<bool> m_stop;
+    std::vector<fd_state> m_fds;
+    std::priority_queue<timer_entry, std::vector<timer_entry>, std::greater<timer_entry> > m_timers;
+    futex_mutex m_post_lock;        /* 保护 m_posted */
+    std::vector<std::coroutine_handle<> > m_posted;
+};
+
+#endif
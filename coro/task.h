@@ -0,0 +1,22 @@
+#ifndef CORO_TASK_H
+#define CORO_TASK_H
+
+#include <coroutine>
+#include <exception>
+
+/* 独立运行的协程任务
+   创建后立即开始执行，直到第一次挂起才返回调用者；运行结束时自动销毁协程帧。
+   调用者不持有句柄，也不等待结果，连接的处理协程和 accept 协程都是这种任务 */
+struct coro_task
+{
+    struct promise_type
+    {
+        coro_task get_return_object() { return coro_task(); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() { }
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+#endif
@@ -1,13 +1,15 @@
 #include "http_conn.h"
 #include "../log/log.h"
+#include "../timer/coarse_clock.h"
+#include "../memory/buffer_pool.h"
+#include "../stats/syscall_stats.h"
+#include "../stats/metrics.h"
+#include "../http2/h2_session.h"
+#include "../websocket/ws_hub.h"
+#include "../proxy/proxy_session.h"
+#include <arpa/inet.h>
 #include <fstream>
 
-// #define connfdLT /* 水平触发阻塞 */
-#define connfdET /* 边缘触发非阻塞*/
-
-// #define listenfdLT /* 水平触发阻塞 */
-#define listenfdET /* 边缘触发非阻塞*/
-
 /* 定义 http 响应的一些状态信息 */
 const char *ok_200_title = "OK";
 const char *error_400_title = "Bad Request";
@@ -18,14 +20,22 @@ const char *error_404_title = "Not Found";
 const char *error_404_form = "The requested file was not found on this server.\n";
 const char *error_500_title = "Internal Error";
 const char *error_500_form = "There was an unusual problem serving the request file.\n";
-
-/* 当浏览器出现连接重置时，可能是网站根目录出错或 http 响应格式出错
-   或者访问的文件中内容完全为空 */
-const char* doc_root = "/home/qyg/code/Learn_TinyWebServer/root";
+const char *error_502_title = "Bad Gateway";
+const char *error_502_form = "The upstream server is unavailable or returned an invalid response.\n";
+
+/* 请求读取超时时直接发送的预先生成的应答 */
+const char *error_408_response = "HTTP/1.1 408 Request Timeout\r\n"
+                                 "Content-Length:0\r\n"
+                                 "Connection:close\r\n\r\n";
+/* 转发时上游超时、还没有向客户端应答任何内容时直接发送 */
+const char *error_504_response = "HTTP/1.1 504 Gateway Timeout\r\n"
+                                 "Content-Length:0\r\n"
+                                 "Connection:close\r\n\r\n";
 
 /* 将表中的用户名和密码放入 map */
 map<string, string> users;
-locker m_lock;
+/* 保护 users：登录只读，注册时写 */
+rw_locker m_lock("users");
 
 void http_conn::initmysql_result(connection_pool *connPool)
 {
@@ -64,50 +74,153 @@ int setnonblocking(int fd)
     return old_option;
 }
 
-void addfd(int epollfd, int fd, bool one_shot)
+/* 将 fd 注册到 epoll，ptr 作为事件的 data.ptr 返回，用于直接找到对应的对象 */
+void addfd(int epollfd, int fd, void* ptr, bool one_shot, bool et)
 {
     epoll_event event;
-    event.data.fd = fd;
-#ifdef listenfdET
-    event.events = EPOLLIN | EPOLLET | EPOLLRDHUP;
-#endif
-
-#ifdef listenfdLT
-    event.events = EPOLLIN | EPOLLRDHUP;
-#endif
+    event.data.ptr = ptr;
+    event.events = et ? (EPOLLIN | EPOLLET | EPOLLRDHUP) : (EPOLLIN | EPOLLRDHUP);
 
     if (one_shot)
     {
         event.events |= EPOLLONESHOT;
     }
     epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
+    COUNT_SYSCALL(EPOLL_CTL);
     setnonblocking(fd);
 }
 
 void removefd(int epollfd, int fd)
 {
     epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, 0);
+    COUNT_SYSCALL(EPOLL_CTL);
     close(fd);
+    COUNT_SYSCALL(CLOSE);
 }
 
-void modfd(int epollfd, int fd, int ev)
+/* 水平触发模式下重新注册 EPOLLONESHOT 事件 */
+void modfd(int epollfd, int fd, void* ptr, int ev)
 {
     epoll_event event;
-    event.data.fd = fd;
-    event.events = ev | EPOLLET | EPOLLONESHOT | EPOLLRDHUP;
+    event.data.ptr = ptr;
+    event.events = ev | EPOLLONESHOT | EPOLLRDHUP;
     epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event);
+    COUNT_SYSCALL(EPOLL_CTL);
+}
+
+template <>
+void socket_transport<TRIGGER_ET>::attach(int fd, void* owner)
+{
+    /* 边缘触发模式下连接常驻注册读写事件，整个生命周期只有这一次 epoll_ctl，
+        同一时刻只由一个线程处理连接由 m_owned 保证，而不是靠 EPOLLONESHOT 逐次重新注册 */
+    epoll_event event;
+    event.data.ptr = owner;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLET | EPOLLRDHUP;
+    epoll_ctl(http_conn::m_epollfd, EPOLL_CTL_ADD, fd, &event);
+    COUNT_SYSCALL(EPOLL_CTL);
+    setnonblocking(fd);
+}
+
+template <>
+void socket_transport<TRIGGER_LT>::attach(int fd, void* owner)
+{
+    addfd(http_conn::m_epollfd, fd, owner, true, false);
+}
+
+template <>
+void socket_transport<TRIGGER_ET>::rearm(int, void*, int)
+{
+}
+
+template <>
+void socket_transport<TRIGGER_LT>::rearm(int fd, void* owner, int ev)
+{
+    modfd(http_conn::m_epollfd, fd, owner, ev);
+}
+
+template <trigger_mode M>
+ssize_t socket_transport<M>::recv(int fd, char* buf, size_t len)
+{
+    COUNT_SYSCALL(RECV);
+    return ::recv(fd, buf, len, 0);
+}
+
+template <trigger_mode M>
+ssize_t socket_transport<M>::writev(int fd, const struct iovec* iov, int count)
+{
+    COUNT_SYSCALL(WRITEV);
+    return ::writev(fd, iov, count);
+}
+
+template <trigger_mode M>
+void socket_transport<M>::send_nowait(int fd, const char* buf, size_t len)
+{
+    COUNT_SYSCALL(WRITEV);
+    ::send(fd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+template <>
+void socket_transport<TRIGGER_ET>::close(int fd)
+{
+    /* 连接 fd 没有被复制过，close 会自动将其从 epoll 中移除，省去一次 EPOLL_CTL_DEL */
+    ::close(fd);
+    COUNT_SYSCALL(CLOSE);
+}
+
+template <>
+void socket_transport<TRIGGER_LT>::close(int fd)
+{
+    removefd(http_conn::m_epollfd, fd);
 }
 
-int http_conn::m_user_count = 0;
+template class socket_transport<TRIGGER_LT>;
+template class socket_transport<TRIGGER_ET>;
+
+std::atomic<int> http_conn::m_user_count(0);
+transport* http_conn::m_default_transport = socket_transport<TRIGGER_ET>::get_instance();
+/* 当浏览器出现连接重置时，可能是网站根目录出错或 http 响应格式出错
+   或者访问的文件中内容完全为空 */
+const char* http_conn::m_doc_root = "/home/qyg/code/Learn_TinyWebServer/root";
 int http_conn::m_epollfd = -1;
+bool http_conn::m_eager_write = true;
+http_conn::timeouts http_conn::m_timeouts = {10000, 30000, 64, 10000, 1024, 15000, 2000};
+int http_conn::m_handoff_fd = -1;
+const char* http_conn::m_metrics_path = NULL;
+bool http_conn::m_http2 = false;
+const char* http_conn::m_ws_path = NULL;
+bool http_conn::m_metrics_local_only = true;
+futex_mutex http_conn::m_handoff_lock("handoff");
+std::vector<http_conn*> http_conn::m_handoff_queue;
+
+http_conn::~http_conn()
+{
+    delete m_h2;
+    delete m_ws;
+    delete m_proxy;
+    release_buffers();
+}
 
 void http_conn::close_conn(bool real_close)
 {
     if(real_close && (m_sockfd != -1))
     {
-        removefd(m_epollfd, m_sockfd);
+        m_transport->close(m_sockfd);
         m_sockfd = -1;
-        m_user_count--;
+        m_user_count.fetch_sub(1, std::memory_order_relaxed);
+        unmap();
+        release_buffers();
+        delete m_h2;
+        m_h2 = NULL;
+        /* 未完成的转发关闭上游连接 */
+        delete m_proxy;
+        m_proxy = NULL;
+        /* 先退订，之后不会再有广播放入收件箱 */
+        if(m_ws)
+        {
+            ws_hub::get_instance()->unsubscribe(m_ws);
+            delete m_ws;
+            m_ws = NULL;
+        }
     }
 }
 
@@ -119,10 +232,24 @@ void http_conn::init(int sockfd, const sockaddr_in& addr)
     /* 如下两行是为了避免 TIME_WAIT 状态，仅用于调试，实际使用时应该去掉 */
     // int reuse = 1;
     // setsockopt(m_sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
-    addfd(m_epollfd, sockfd, true);
-    m_user_count++;
+    m_transport->attach(sockfd, this);
+    m_user_count.fetch_add(1, std::memory_order_relaxed);
+    m_owned.store(0);
+    m_pending.store(0);
+    m_read_deferred = false;
+
+    /* 文件名缓冲区的最后一个字节始终为 \0，拼接路径时最多写到它之前 */
+    m_real_file[FILENAME_LEN - 1] = '\0';
+
+    m_user_data.address = addr;
+    m_user_data.sockfd = sockfd;
+    m_user_data.timer = &m_timer;
+    m_user_data.conn = this;
+    m_timer.user_data = &m_user_data;
 
     init();
+    /* 新连接必须在请求头期限内发来完整的请求头 */
+    set_phase(PHASE_HEADER);
 }
 
 /* 初始化新接受的连接 */
@@ -138,14 +265,208 @@ void http_conn::init()
     m_url = 0;
     m_version = 0;
     m_content_length = 0;
+    m_chunked = false;
+    m_headers_start = 0;
+    m_route = NULL;
     m_host = 0;
+    m_string = 0;
+    m_upgrade_h2c = false;
+    m_h2_settings = 0;
+    m_upgrade_ws = false;
+    m_ws_key = 0;
+    m_ws_version = 0;
     m_start_line = 0;
     m_checked_idx = 0;
     m_read_idx = 0;
     m_write_idx = 0;
-    memset(m_read_buf, '\0', READ_BUFFER_SIZE);
-    memset(m_write_buf, '\0', WRITE_BUFFER_SIZE);
-    memset(m_real_file, '\0', FILENAME_LEN);
+    bytes_to_send = 0;
+    bytes_have_send = 0;
+    m_request_begun = false;
+
+    set_phase(PHASE_IDLE);
+}
+
+bool http_conn::release()
+{
+    m_owned.store(0);
+    /* 释放之后再检查待处理事件：释放前到达的事件，发送者占有失败，只能由这里接手 */
+    return m_pending.load() != 0 && try_acquire();
+}
+
+void http_conn::rearm(int ev)
+{
+    m_transport->rearm(m_sockfd, this, ev);
+}
+
+void http_conn::handoff()
+{
+    m_handoff_lock.lock();
+    bool was_empty = m_handoff_queue.empty();
+    m_handoff_queue.push_back(this);
+    m_handoff_lock.unlock();
+
+    /* 队列原本非空时主线程已被唤醒过，不必重复写 eventfd */
+    if(was_empty)
+    {
+        uint64_t one = 1;
+        ::write(m_handoff_fd, &one, sizeof(one));
+        COUNT_SYSCALL(OTHER);
+    }
+}
+
+void http_conn::take_handoff(std::vector<http_conn*>& conns)
+{
+    m_handoff_lock.lock();
+    conns.swap(m_handoff_queue);
+    m_handoff_lock.unlock();
+}
+
+bool http_conn::has_output() const
+{
+    if(m_ws)
+    {
+        return m_ws->pending();
+    }
+    return m_phase == PHASE_WRITE && bytes_to_send > 0;
+}
+
+void http_conn::set_phase(CONN_PHASE phase)
+{
+    m_phase = phase;
+    m_phase_start = coarse_clock::get_instance()->now_ms();
+    m_rate_start = m_phase_start;
+    m_phase_bytes = 0;
+    m_phase_total = 0;
+}
+
+long long http_conn::deadline() const
+{
+    /* 空闲的 WebSocket 连接不按保活期限关闭，到期时发 ping */
+    if(m_ws && m_phase == PHASE_IDLE)
+    {
+        return m_ws->deadline();
+    }
+    switch (m_phase)
+    {
+    case PHASE_PROXY:
+        return m_proxy->deadline();
+    case PHASE_HEADER:
+        return m_phase_start + m_timeouts.header;
+    case PHASE_BODY:
+        return m_phase_start + m_timeouts.body;
+    case PHASE_WRITE:
+        /* 大响应按最低发送速率追加发送时间 */
+        return m_phase_start + m_timeouts.write +
+                (long long)m_phase_total * 1000 / m_timeouts.min_send_rate;
+    default:
+        return m_phase_start + m_timeouts.keepalive;
+    }
+}
+
+bool http_conn::too_slow(long long now) const
+{
+    /* 读阶段从第一个字节到达才开始计算速率，建立连接后迟迟不发送的客户端由阶段期限处理 */
+    long long elapsed = now - m_rate_start;
+    if(m_phase == PHASE_IDLE || m_phase == PHASE_PROXY || elapsed < m_timeouts.rate_grace ||
+        (m_phase != PHASE_WRITE && m_phase_bytes == 0))
+    {
+        return false;
+    }
+
+    long long bytes = m_phase_bytes;
+    int min_rate = m_timeouts.min_recv_rate;
+    if(m_phase == PHASE_WRITE)
+    {
+        bytes = bytes_have_send;
+        min_rate = m_timeouts.min_send_rate;
+    }
+    return bytes * 1000 < (long long)min_rate * elapsed;
+}
+
+void http_conn::timeout_response()
+{
+    /* HTTP/2 连接发送队列为空时以 GOAWAY 告知对方，否则帧已发出一部分，不能插入 */
+    if(m_h2)
+    {
+        if(m_h2->queued() == 0)
+        {
+            char frame[17];
+            m_transport->send_nowait(m_sockfd, frame, m_h2->goaway_frame(frame));
+        }
+        return;
+    }
+    /* WebSocket 连接发送队列为空时以关闭帧告知对方 */
+    if(m_ws)
+    {
+        if(m_ws->queued() == 0)
+        {
+            char frame[4];
+            m_transport->send_nowait(m_sockfd, frame, m_ws->close_frame(frame, ws_session::CLOSE_GOING_AWAY));
+        }
+        return;
+    }
+    /* 只有请求读取中途超时才应答 408，非阻塞发送，发不出去就直接关闭 */
+    if(m_phase == PHASE_HEADER || m_phase == PHASE_BODY)
+    {
+        m_transport->send_nowait(m_sockfd, error_408_response, strlen(error_408_response));
+        server_metrics::count_response(408);
+    }
+}
+
+/* 读缓冲区已满时换成大一级的缓冲区，并修正指向旧缓冲区的解析结果 */
+static void rebase(char*& p, const char* old_buf, int old_size, char* new_buf)
+{
+    if(p && p >= old_buf && p < old_buf + old_size)
+    {
+        p = new_buf + (p - old_buf);
+    }
+}
+
+bool http_conn::grow_read_buf()
+{
+    int size = m_read_size * 2;
+    if(size > buffer_pool::max_size())
+    {
+        return false;
+    }
+
+    char* buf = buffer_pool::get_instance()->acquire(size);
+    if(!buf)
+    {
+        return false;
+    }
+    memcpy(buf, m_read_buf, m_read_idx);
+
+    rebase(m_url, m_read_buf, m_read_size, buf);
+    rebase(m_version, m_read_buf, m_read_size, buf);
+    rebase(m_host, m_read_buf, m_read_size, buf);
+    rebase(m_string, m_read_buf, m_read_size, buf);
+    rebase(m_h2_settings, m_read_buf, m_read_size, buf);
+    rebase(m_ws_key, m_read_buf, m_read_size, buf);
+
+    buffer_pool::get_instance()->release(m_read_buf, m_read_size);
+    m_read_buf = buf;
+    m_read_size = size;
+    return true;
+}
+
+void http_conn::release_buffers()
+{
+    if(m_read_buf)
+    {
+        buffer_pool::get_instance()->release(m_read_buf, m_read_size);
+        m_read_buf = NULL;
+        m_read_size = 0;
+    }
+    if(m_write_buf)
+    {
+        buffer_pool::get_instance()->release(m_write_buf, WRITE_BUFFER_SIZE);
+        m_write_buf = NULL;
+    }
+    if(!m_body.empty())
+    {
+        std::string().swap(m_body);
+    }
 }
 
 /* 从状态机，用于分析出一行的内容 */
@@ -191,33 +512,88 @@ http_conn::LINE_STATUS http_conn::parse_line()
 }
 
 /* 循环读取客户数据，直到无数据可读或对方关闭连接 */
-/* 非阻塞ET工作模式下，需要一次性将数据读完 */
-bool http_conn::read_once()
+/* 数据真正到达时才借用读缓冲区；预留一个字节存放 \0，缓冲区满了就换更大的，请求头过大返回 false */
+bool http_conn::reserve_read()
 {
-    if(m_read_idx >= READ_BUFFER_SIZE)
+    if(!m_read_buf)
     {
-        return false;
+        m_read_buf = buffer_pool::get_instance()->acquire(READ_BUFFER_SIZE);
+        m_read_size = buffer_pool::class_size(buffer_pool::class_of(READ_BUFFER_SIZE));
+        /* 内存不足，按读取失败关闭连接 */
+        if(!m_read_buf)
+        {
+            return false;
+        }
     }
+    return m_read_idx < m_read_size - 1 || grow_read_buf();
+}
 
-    int bytes_read = 0;
-#ifdef connfdLT
-    bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, 
-                                READ_BUFFER_SIZE - m_read_idx, 0);
-    if(bytes_read <= 0)
+/* 读到 bytes_read 字节后更新读取状态 */
+void http_conn::add_read(int bytes_read)
+{
+    /* 保活连接上新请求的第一个字节到来，进入读请求头阶段 */
+    if(m_phase == PHASE_IDLE)
     {
-        return false;
+        set_phase(PHASE_HEADER);
+    }
+    if(m_phase_bytes == 0)
+    {
+        m_rate_start = coarse_clock::get_instance()->now_ms();
     }
-
     m_read_idx += bytes_read;
+    m_phase_bytes += bytes_read;
+    m_read_buf[m_read_idx] = '\0';
+}
 
+/* 水平触发模式下每次事件只读一次，没读完的数据会再次触发 */
+template <>
+bool http_conn::read_once<TRIGGER_LT>()
+{
+    if(!reserve_read())
+    {
+        /* HTTP/2 和 WebSocket 连接的帧可以分批处理，缓冲区满时先处理已读到的部分，剩下的数据仍会触发读事件；
+            转发的请求只需读完请求头，消息体留在 socket 中由转发过程读取 */
+        return (split_read() || !proxy_table::get_instance()->empty()) && m_read_idx > 0;
+    }
+    int bytes_read = m_transport->recv(m_sockfd, m_read_buf + m_read_idx,
+                                        m_read_size - m_read_idx - 1);
+    /* 传输层读到的数据可能只推进了自身的状态（如 TLS 握手），没有交出请求数据，等下一个读事件 */
+    if(bytes_read == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+        return true;
+    }
+    if(bytes_read <= 0)
+    {
+        return false;
+    }
+    add_read(bytes_read);
     return true;
-#endif
+}
 
-#ifdef connfdET
+/* 非阻塞ET工作模式下，需要一次性将数据读完 */
+template <>
+bool http_conn::read_once<TRIGGER_ET>()
+{
     while (true)
     {
-        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, 
-                                READ_BUFFER_SIZE - m_read_idx, 0);
+        if(!reserve_read())
+        {
+            /* HTTP/2 和 WebSocket 连接先处理已读到的帧，处理完后补发读事件 */
+            if(split_read() && m_read_idx > 0)
+            {
+                m_read_deferred = true;
+                break;
+            }
+            /* 转发的请求只需读完请求头，消息体留在 socket 中由转发过程读取；
+                请求头不完整或不转发时由 process 关闭连接 */
+            if(!proxy_table::get_instance()->empty() && m_read_idx > 0)
+            {
+                break;
+            }
+            return false;
+        }
+        int bytes_read = m_transport->recv(m_sockfd, m_read_buf + m_read_idx,
+                                            m_read_size - m_read_idx - 1);
         if(bytes_read == -1)
         {
             if(errno == EAGAIN || errno == EWOULDBLOCK)
@@ -230,11 +606,9 @@ bool http_conn::read_once()
         {
             return false;
         }
-
-        m_read_idx += bytes_read;
+        add_read(bytes_read);
     }
     return true;
-#endif
 }
 
 /* 解析 http 请求行，获得请求方法，目标url及http版本号 */
@@ -261,6 +635,27 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char* text)
         m_method = POST;
         cgi = 1;
     }
+    /* 其余方法只用于转发的请求，本地处理时由 do_request 拒绝 */
+    else if(strcasecmp(method, "HEAD") == 0)
+    {
+        m_method = HEAD;
+    }
+    else if(strcasecmp(method, "PUT") == 0)
+    {
+        m_method = PUT;
+    }
+    else if(strcasecmp(method, "DELETE") == 0)
+    {
+        m_method = DELETE;
+    }
+    else if(strcasecmp(method, "OPTIONS") == 0)
+    {
+        m_method = OPTIONS;
+    }
+    else if(strcasecmp(method, "PATCH") == 0)
+    {
+        m_method = PATCH;
+    }
     else
     {
         return BAD_REQUEST;
@@ -301,8 +696,11 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char* text)
     {
         return BAD_REQUEST;
     }
+    /* 匹配反向代理路由的请求原样转发，不改写 url */
+    m_route = proxy_table::get_instance()->match(m_url);
+    m_headers_start = m_checked_idx;
     /* 当 url 为 / 时，显示欢迎界面 */
-    if(strlen(m_url) == 1)
+    if(!m_route && strlen(m_url) == 1)
     {
         strcat(m_url, "judge.html"); /*  把 src 所指向的字符串追加到 dest 所指向的字符串的结尾 */
     }
@@ -319,11 +717,13 @@ http_conn::HTTP_CODE http_conn::parse_headers(char* text)
     /* 判断是否是空行 */
     if(text[0] == '\0')
     {
-        /* 判断是否是 POST 请求 */
-        if(m_content_length != 0)
+        /* 判断是否是 POST 请求。转发的请求不在这里等待消息体，由转发过程边读边发 */
+        if(m_content_length != 0 && !m_route)
         {
             /* POST 请求需要跳转到消息体处理状态 */
             m_check_state = CHECK_STATE_CONTENT;
+            set_phase(PHASE_BODY);
+            m_phase_bytes = m_read_idx - m_checked_idx;
             return NO_REQUEST;
         }
         return GET_REQUEST;
@@ -343,7 +743,15 @@ http_conn::HTTP_CODE http_conn::parse_headers(char* text)
     {
         text += 15;
         text += strspn(text, " \t");
-        m_content_length = atol(text);
+        /* 负数、溢出或不是数字的长度无法确定消息体的边界，不能继续解析或转发 */
+        char* end;
+        errno = 0;
+        long length = strtol(text, &end, 10);
+        if(!isdigit((unsigned char)*text) || end[strspn(end, " \t")] != '\0' || errno == ERANGE || length > INT_MAX)
+        {
+            return MALFORMED_REQUEST;
+        }
+        m_content_length = length;
     }
     /* 解析请求头部的 HOST 字段 */
     else if(strncasecmp(text, "HOST:", 5) == 0)
@@ -352,6 +760,36 @@ http_conn::HTTP_CODE http_conn::parse_headers(char* text)
         text += strspn(text, " \t");
         m_host = text;
     }
+    /* h2c 和 WebSocket 升级，Connection 头中的 Upgrade 和 HTTP2-Settings 选项不单独检查 */
+    else if(strncasecmp(text, "Upgrade:", 8) == 0)
+    {
+        text += 8;
+        text += strspn(text, " \t");
+        m_upgrade_h2c = strcasecmp(text, "h2c") == 0;
+        m_upgrade_ws = strcasecmp(text, "websocket") == 0;
+    }
+    else if(strncasecmp(text, "Sec-WebSocket-Key:", 18) == 0)
+    {
+        text += 18;
+        text += strspn(text, " \t");
+        m_ws_key = text;
+    }
+    else if(strncasecmp(text, "Sec-WebSocket-Version:", 22) == 0)
+    {
+        text += 22;
+        text += strspn(text, " \t");
+        m_ws_version = atoi(text);
+    }
+    else if(strncasecmp(text, "Transfer-Encoding:", 18) == 0)
+    {
+        m_chunked = true;
+    }
+    else if(strncasecmp(text, "HTTP2-Settings:", 15) == 0)
+    {
+        text += 15;
+        text += strspn(text, " \t");
+        m_h2_settings = text;
+    }
     else
     {
         // LOG_ERROR("[http_conn] oop! unkonw header: %s\n", text);
@@ -381,8 +819,9 @@ http_conn::HTTP_CODE http_conn::process_read()
     HTTP_CODE ret = NO_REQUEST;
     char* text = 0;
 
+    /* 消息体不按行解析：等待消息体时不能调用 parse_line()，否则 m_checked_idx 会越过已到达的部分消息体 */
     while ((m_check_state == CHECK_STATE_CONTENT && line_stats == LINE_OK) ||
-            ((line_stats = parse_line()) == LINE_OK))
+            (m_check_state != CHECK_STATE_CONTENT && (line_stats = parse_line()) == LINE_OK))
     {
         text = get_line();
         m_start_line = m_checked_idx;
@@ -404,9 +843,9 @@ http_conn::HTTP_CODE http_conn::process_read()
         {
             /* 解析请求头 */
             ret = parse_headers(text);
-            if(BAD_REQUEST == ret)
+            if(BAD_REQUEST == ret || MALFORMED_REQUEST == ret)
             {
-                return BAD_REQUEST;
+                return ret;
             }
             /* 完整解析 GET 请求后，跳转到报文响应函数 */
             else if(GET_REQUEST == ret)
@@ -438,35 +877,76 @@ http_conn::HTTP_CODE http_conn::process_read()
 
 http_conn::HTTP_CODE http_conn::do_request()
 {
-    strcpy(m_real_file, doc_root);
-    int len = strlen(doc_root);
+    /* WebSocket 握手请求不对应文件。只支持版本 13（RFC 6455），Sec-WebSocket-Key 为 16 字节的 base64 编码 */
+    if(m_upgrade_ws && m_ws_path && strcmp(m_url, m_ws_path) == 0)
+    {
+        if(m_method != GET || m_content_length != 0 || !m_ws_key || strlen(m_ws_key) != 24 || m_ws_version != 13)
+        {
+            return BAD_REQUEST;
+        }
+        return WEBSOCKET_REQUEST;
+    }
+    /* 不支持转发分块编码的请求消息体，消息体留在连接上无法跳过，应答 400 后关闭 */
+    if(m_route)
+    {
+        return m_chunked ? MALFORMED_REQUEST : PROXY_REQUEST;
+    }
+    if(m_method != GET && m_method != POST)
+    {
+        return BAD_REQUEST;
+    }
+    return route(m_method, m_url, m_string, mysql, m_address, m_real_file, &m_file_stat, &m_file_address, m_body);
+}
 
-    /* 找到 m_url 中 / 的位置 */
-    const char* p = strrchr(m_url, '/');
+http_conn::HTTP_CODE http_conn::route(METHOD method, char* url, char* body, MYSQL* mysql, const sockaddr_in& peer,
+                                        char* real_file, struct stat* file_stat, char** file_address,
+                                        std::string& body_out)
+{
+    /* 内部指标不对应磁盘文件，直接生成应答正文 */
+    if(m_metrics_path && method == GET && strcmp(url, m_metrics_path) == 0 &&
+        (!m_metrics_local_only || (ntohl(peer.sin_addr.s_addr) >> 24) == 127))
+    {
+        body_out.clear();
+        metrics::get_instance()->render(body_out);
+        return METRICS_REQUEST;
+    }
+
+    strcpy(real_file, m_doc_root);
+    int len = strlen(m_doc_root);
+
+    /* 找到 url 中 / 的位置 */
+    const char* p = strrchr(url, '/');
 
     /* 实现登录和注册校验 */
-    if(cgi == 1 && (*(p + 1) == '2' || *(p + 1) == '3'))
+    if(method == POST && (*(p + 1) == '2' || *(p + 1) == '3'))
     {
+        /* 消息体应为 user=...&password=...，格式不对或字段过长时不解析 */
+        const char* amp = body ? strchr(body, '&') : NULL;
+        if(!amp || amp - body < 5 || amp - body - 5 >= 100 || strlen(amp) < 10 || strlen(amp) - 10 >= 100)
+        {
+            return BAD_REQUEST;
+        }
+
         //根据标志判断是登录检测还是注册检测
-        char flag = m_url[1];
+        char flag = url[1];
 
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/");
-        strcat(m_url_real, m_url + 2);
-        strncpy(m_real_file + len, m_url_real, FILENAME_LEN - len - 1);
-        free(m_url_real);
+        char *url_real = (char *)malloc(sizeof(char) * 200);
+        strcpy(url_real, "/");
+        strcat(url_real, url + 2);
+        strncpy(real_file + len, url_real, FILENAME_LEN - len - 1);
+        free(url_real);
 
         //将用户名和密码提取出来
         //user=123&passwd=123
         char name[100], password[100];
         int i;
-        for (i = 5; m_string[i] != '&'; ++i)
-            name[i - 5] = m_string[i];
+        for (i = 5; body[i] != '&'; ++i)
+            name[i - 5] = body[i];
         name[i - 5] = '\0';
 
         int j = 0;
-        for (i = i + 10; m_string[i] != '\0'; ++i, ++j)
-            password[j] = m_string[i];
+        for (i = i + 10; body[i] != '\0'; ++i, ++j)
+            password[j] = body[i];
         password[j] = '\0';
 
         //同步线程登录校验
@@ -482,102 +962,112 @@ http_conn::HTTP_CODE http_conn::do_request()
             strcat(sql_insert, password);
             strcat(sql_insert, "')");
 
+            /* 重名检查和插入在同一次写锁内完成，两个同名注册不会都插入 */
+            m_lock.write_lock();
             if (users.find(name) == users.end())
             {
-                m_lock.lock();
                 int res = mysql_query(mysql, sql_insert);
                 users.insert(pair<string, string>(name, password));
-                m_lock.unlock();
+                m_lock.write_unlock();
 
                 if (!res)
-                    strcpy(m_url, "/log.html");
+                    strcpy(url, "/log.html");
                 else
-                    strcpy(m_url, "/registerError.html");
+                    strcpy(url, "/registerError.html");
             }
             else
-                strcpy(m_url, "/registerError.html");
+            {
+                m_lock.write_unlock();
+                strcpy(url, "/registerError.html");
+            }
         }
         //如果是登录，直接判断
         //若浏览器端输入的用户名和密码在表中可以查找到，返回1，否则返回0
         else if (*(p + 1) == '2')
         {
-            if (users.find(name) != users.end() && users[name] == password)
-                strcpy(m_url, "/welcome.html");
+            read_guard guard(m_lock);
+            map<string, string>::const_iterator it = users.find(name);
+            if (it != users.end() && it->second == password)
+                strcpy(url, "/welcome.html");
             else
-                strcpy(m_url, "/logError.html");
+                strcpy(url, "/logError.html");
         }
     }
 
     /* 如果请求资源为 /0，表示跳转注册界面 */
     if(*(p + 1) == '0')
     {
-        char* m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/register.html");
+        char* url_real = (char *)malloc(sizeof(char) * 200);
+        strcpy(url_real, "/register.html");
 
-        /* 将网站目录和 /register.html 进行拼接，更新到 m_real_file 中 */
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+        /* 将网站目录和 /register.html 进行拼接，更新到 real_file 中 */
+        strcpy(real_file + len, url_real);
 
-        free(m_url_real);
+        free(url_real);
     }
     /* /1，跳转登录界面 */
     else if(*(p + 1) == '1')
     {
-        char* m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/log.html");
+        char* url_real = (char *)malloc(sizeof(char) * 200);
+        strcpy(url_real, "/log.html");
 
-        /* 将网站目录和 /log.html 进行拼接，更新到 m_real_file 中 */
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+        /* 将网站目录和 /log.html 进行拼接，更新到 real_file 中 */
+        strcpy(real_file + len, url_real);
 
-        free(m_url_real);
+        free(url_real);
     }
     else if (*(p + 1) == '5')
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/picture.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+        char *url_real = (char *)malloc(sizeof(char) * 200);
+        strcpy(url_real, "/picture.html");
+        strcpy(real_file + len, url_real);
 
-        free(m_url_real);
+        free(url_real);
     }
     else if (*(p + 1) == '6')
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/video.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+        char *url_real = (char *)malloc(sizeof(char) * 200);
+        strcpy(url_real, "/video.html");
+        strcpy(real_file + len, url_real);
 
-        free(m_url_real);
+        free(url_real);
     }
     else if (*(p + 1) == '7')
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/fans.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+        char *url_real = (char *)malloc(sizeof(char) * 200);
+        strcpy(url_real, "/fans.html");
+        strcpy(real_file + len, url_real);
 
-        free(m_url_real);
+        free(url_real);
     }
     else
     {
-        strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
+        strncpy(real_file + len, url, FILENAME_LEN - len - 1);
     }
 
-    if(stat(m_real_file, &m_file_stat) < 0)
+    COUNT_SYSCALL(OTHER);
+    if(stat(real_file, file_stat) < 0)
     {
         return NO_RESOURCE;
     }
     /* 判断文件的权限，是否可读 */
-    if(!(m_file_stat.st_mode & S_IROTH))
+    if(!(file_stat->st_mode & S_IROTH))
     {
         return FORBIDDEN_REQUEST;
     }
     /* 判断文件类型 */
-    if(S_ISDIR(m_file_stat.st_mode))
+    if(S_ISDIR(file_stat->st_mode))
     {
         return BAD_REQUEST;
     }
 
     /* 以只读方式获取文件描述符，通过mmap 将该文件映射到内存中 */
-    int fd = open(m_real_file, O_RDONLY);
-    m_file_address = (char*)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    int fd = open(real_file, O_RDONLY);
+    *file_address = (char*)mmap(0, file_stat->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
     close(fd);
+    COUNT_SYSCALL(OTHER);
+    COUNT_SYSCALL(OTHER);
+    COUNT_SYSCALL(CLOSE);
 
     return FILE_REQUEST;
 }
@@ -587,55 +1077,45 @@ void http_conn::unmap()
     if(m_file_address)
     {
         munmap(m_file_address, m_file_stat.st_size);
+        COUNT_SYSCALL(OTHER);
         m_file_address = 0;
     }
 }
 
 bool http_conn::write()
 {
+    if(m_h2)
+    {
+        return write_h2();
+    }
+    if(m_ws)
+    {
+        return write_ws();
+    }
+
     int temp = 0;
-    int newadd = 0;
 
     /* 响应报文为空，一般不会发生这种情况 */
     if(bytes_to_send == 0)
     {
-        modfd(m_epollfd, m_sockfd, EPOLLIN);
+        release_buffers();
         init();
+        rearm(EPOLLIN);
         return true;
     }
 
     while (1)
     {
         /* 将响应报文的状态行、消息头、空行和响应正文发送给浏览器 */
-        temp = writev(m_sockfd, m_iv, m_iv_count);
+        temp = m_transport->writev(m_sockfd, m_iv, m_iv_count);
 
-        /* 正常发送，temp 为发送的字节数 */
-        if(temp > 0 )
-        {
-            bytes_have_send += temp;
-            /* 偏移文件 iovec 的指针 */
-            newadd = bytes_have_send - m_write_idx;
-        }
         if(temp <= -1)
         {
             /* 判断缓冲区是否填满 */
             if(errno == EAGAIN)
             {
-                /* 第一个 iovec 头部信息的数据已发送完，发送第二个 iovec 数据 */
-                if(bytes_have_send >= m_iv[0].iov_len)
-                {
-                    m_iv[0].iov_len = 0;
-                    m_iv[1].iov_base = m_file_address + newadd;
-                    m_iv[1].iov_len = bytes_to_send;
-                }
-                /* 继续发送第一个 iovec 头部信息的数据 */
-                else
-                {
-                    m_iv[0].iov_base = m_write_buf + bytes_to_send;
-                    m_iv[0].iov_len = m_iv[0].iov_len - bytes_have_send;
-                }
-                /* 重新注册写事件 */
-                modfd(m_epollfd, m_sockfd, EPOLLOUT);
+                /* 等待写事件，边缘触发模式下写事件常驻注册 */
+                rearm(EPOLLOUT);
                 return true;
             }
             
@@ -644,20 +1124,43 @@ bool http_conn::write()
         }
 
         /* 更新已发送字节数 */
+        bytes_have_send += temp;
         bytes_to_send -= temp;
+        server_metrics::bytes_sent.add(temp);
+
+        /* 第一个 iovec 头部信息的数据已发送完，偏移第二个 iovec 的正文指针 */
+        if(bytes_have_send >= m_write_idx)
+        {
+            m_iv[0].iov_len = 0;
+            m_iv[1].iov_base = (char*)m_content_address + (bytes_have_send - m_write_idx);
+            m_iv[1].iov_len = bytes_to_send;
+        }
+        /* 继续发送第一个 iovec 头部信息的数据 */
+        else
+        {
+            m_iv[0].iov_base = m_write_buf + bytes_have_send;
+            m_iv[0].iov_len = m_write_idx - bytes_have_send;
+        }
 
         /* 数据已全部发送完 */
         if(bytes_to_send <= 0)
         {
             unmap();
-
-            /* 在 epoll 树上重置 EPOLLONESHOT 事件 */
-            modfd(m_epollfd, m_sockfd, EPOLLIN);
+            /* 请求已应答完毕，读写缓冲区还给缓冲区池，空闲的保活连接不再占用缓冲区 */
+            release_buffers();
 
             /* 浏览器的请求为长连接 */
             if(m_linger)
             {
                 init();
+                /* 水平触发模式下在 epoll 树上重置 EPOLLONESHOT 事件 */
+                rearm(EPOLLIN);
+                /* 发送期间到达的新请求数据被延后，边缘触发不会再通知，补发一个读事件 */
+                if(m_read_deferred)
+                {
+                    m_read_deferred = false;
+                    post_event(EV_READ);
+                }
                 return true;
             }
             else
@@ -671,6 +1174,15 @@ bool http_conn::write()
 /* 往写缓冲区中写入待发送的数据 */
 bool http_conn::add_response(const char* format, ...)
 {
+    /* 生成应答时才借用写缓冲区 */
+    if(!m_write_buf)
+    {
+        m_write_buf = buffer_pool::get_instance()->acquire(WRITE_BUFFER_SIZE);
+        if(!m_write_buf)
+        {
+            return false;
+        }
+    }
     if(m_write_idx >= WRITE_BUFFER_SIZE)
     {
         return false;
@@ -698,6 +1210,7 @@ bool http_conn::add_response(const char* format, ...)
 /* 添加状态行 */
 bool http_conn::add_status_line(int status, const char* title)
 {
+    server_metrics::count_response(status);
     return add_response("%s %d %s\r\n", "HTTP/1.1", status, title);
 }
 
@@ -705,6 +1218,7 @@ bool http_conn::add_status_line(int status, const char* title)
 bool http_conn::add_headers(int content_length)
 {
     add_content_length(content_length);
+    add_date();
     add_linger();
     add_blank_line();
     return true;
@@ -716,6 +1230,14 @@ bool http_conn::add_content_length(int content_length)
     return add_response("Content-Length:%d\r\n", content_length);
 }
 
+/* 添加 Date，取自缓存时钟预先格式化好的值 */
+bool http_conn::add_date()
+{
+    char date[coarse_clock::HTTP_DATE_LEN];
+    coarse_clock::get_instance()->http_date(date);
+    return add_response("Date:%s\r\n", date);
+}
+
 /* 添加连接状态，通知浏览器端是保持连接还是关闭 */
 bool http_conn::add_linger()
 {
@@ -762,6 +1284,29 @@ bool http_conn::process_wirte(HTTP_CODE ret)
         }
         break;
     }
+    /* 消息体的边界无法确定，之后的数据不能再按请求解析，400 后关闭连接 */
+    case MALFORMED_REQUEST:
+    {
+        m_linger = false;
+        add_status_line(400, error_400_title);
+        add_headers(strlen(error_400_form));
+        if(!add_content(error_400_form))
+        {
+            return false;
+        }
+        break;
+    }
+    /* 转发失败，502 */
+    case BAD_GATEWAY:
+    {
+        add_status_line(502, error_502_title);
+        add_headers(strlen(error_502_form));
+        if(!add_content(error_502_form))
+        {
+            return false;
+        }
+        break;
+    }
     /* 资源没有访问权限，403 */    
     case FORBIDDEN_REQUEST:
     {
@@ -776,7 +1321,12 @@ bool http_conn::process_wirte(HTTP_CODE ret)
     /* 文件存在，200*/
     case FILE_REQUEST:
     {
-        add_status_line(200, ok_200_title);
+        /* 借不到写缓冲区时不能只发文件内容，放弃应答 */
+        if(!add_status_line(200, ok_200_title))
+        {
+            unmap();
+            return false;
+        }
         /* 如果请求的资源存在 */
         if(m_file_stat.st_size != 0)
         {
@@ -785,11 +1335,15 @@ bool http_conn::process_wirte(HTTP_CODE ret)
             m_iv[0].iov_base = m_write_buf;
             m_iv[0].iov_len = m_write_idx;
             /* 第二个 iovec 指针指向 mmap 返回的文件指针，长度指向文件大小 */
+            m_content_address = m_file_address;
             m_iv[1].iov_base = m_file_address;
             m_iv[1].iov_len = m_file_stat.st_size;
             m_iv_count = 2;
             /* 发送的全部数据为响应报文头部信息和文件大小 */
             bytes_to_send = m_write_idx + m_file_stat.st_size;
+            set_phase(PHASE_WRITE);
+            m_phase_total = bytes_to_send;
+            return true;
         }
         else
         {
@@ -803,6 +1357,23 @@ bool http_conn::process_wirte(HTTP_CODE ret)
         }
         break;
     }
+    /* 内部指标，200，正文在 m_body 中 */
+    case METRICS_REQUEST:
+    {
+        add_status_line(200, ok_200_title);
+        add_response("Content-Type:text/plain; version=0.0.4\r\n");
+        add_headers(m_body.size());
+        m_iv[0].iov_base = m_write_buf;
+        m_iv[0].iov_len = m_write_idx;
+        m_content_address = m_body.data();
+        m_iv[1].iov_base = (char*)m_body.data();
+        m_iv[1].iov_len = m_body.size();
+        m_iv_count = 2;
+        bytes_to_send = m_write_idx + m_body.size();
+        set_phase(PHASE_WRITE);
+        m_phase_total = bytes_to_send;
+        return true;
+    }
     default:
         return false;
     }
@@ -810,29 +1381,511 @@ bool http_conn::process_wirte(HTTP_CODE ret)
     /* 除 FILE_REQUEST 状态外，其余状态只申请一个 iovec，指向响应报文缓冲区 */
     m_iv[0].iov_base = m_write_buf;
     m_iv[0].iov_len = m_write_idx;
-    m_iv_count = 2;
+    m_iv_count = 1;
+    bytes_to_send = m_write_idx;
+    set_phase(PHASE_WRITE);
+    m_phase_total = bytes_to_send;
 
     return true;
 }
 
 void http_conn::process()
+{
+    int preface = m_h2 ? 1 : (m_ws ? -1 : match_preface());
+    HTTP_CODE read_ret = NO_REQUEST;
+    if(preface < 0 && !m_ws)
+    {
+        read_ret = process_read();
+    }
+
+    if(preface > 0)
+    {
+        process_h2();
+    }
+    else if(m_ws)
+    {
+        process_ws();
+    }
+    else if(NO_REQUEST == read_ret)
+    {
+        /* 读缓冲区已满仍不完整（请求头过大，或本地处理的消息体超出缓冲区），关闭连接 */
+        if(m_read_size >= buffer_pool::max_size() && m_read_idx >= m_read_size - 1)
+        {
+            post_event(EV_CLOSE);
+        }
+        /* 请求还不完整，等待新数据 */
+        else
+        {
+            rearm(EPOLLIN);
+        }
+    }
+    /* 转发到上游服务器，由主线程推进 */
+    else if(PROXY_REQUEST == read_ret)
+    {
+        start_proxy();
+    }
+    /* 切换到 WebSocket，101 应答和之后的帧都由 WebSocket 会话发送 */
+    else if(WEBSOCKET_REQUEST == read_ret)
+    {
+        upgrade_ws();
+        process_ws();
+    }
+    /* 升级到 HTTP/2，应答在 HTTP/2 连接上发送 */
+    else if(m_upgrade_h2c && m_h2_settings && upgrade_h2(read_ret))
+    {
+        process_h2();
+    }
+    /* 完成报文响应 */
+    else if(!process_wirte(read_ret))
+    {
+        /* 连接对象由主线程回收，交还给主线程关闭 */
+        post_event(EV_CLOSE);
+    }
+    /* 立即发送模式：socket 发送缓冲区几乎总是空的，工作线程直接 writev，
+        遇到 EAGAIN 则等待写事件，发送完毕则回到保活状态，省去一次 epoll 往返 */
+    else if(m_eager_write)
+    {
+        COUNT_SYSCALL(REQUESTS);
+        if(!write())
+        {
+            post_event(EV_CLOSE);
+        }
+    }
+    /* 由主线程发送 */
+    else
+    {
+        COUNT_SYSCALL(REQUESTS);
+        post_event(EV_WRITE);
+    }
+
+    /* 处理期间到达的事件以及需要主线程完成的操作，都交还给主线程，
+        释放之后不能再访问连接对象 */
+    if(release())
+    {
+        handoff();
+    }
+}
+
+bool http_conn::process_inline(bool* ready)
 {
     HTTP_CODE read_ret = process_read();
+    *ready = read_ret != NO_REQUEST;
+    if(!*ready)
+    {
+        return true;
+    }
+    if(!process_wirte(read_ret))
+    {
+        return false;
+    }
+    COUNT_SYSCALL(REQUESTS);
+    return true;
+}
 
-    if(NO_REQUEST == read_ret)
+int http_conn::preface_state() const
+{
+    /* 连接前言只会出现在连接上的第一个请求之前 */
+    if(!m_http2 || m_check_state != CHECK_STATE_REQUESTLINE || m_checked_idx != 0 || m_read_idx == 0)
     {
-        /* 注册并监听 读事件 */
-        modfd(m_epollfd, m_sockfd, EPOLLIN);
-        return;
+        return -1;
     }
+    int len = m_read_idx < h2_session::PREFACE_LEN ? m_read_idx : h2_session::PREFACE_LEN;
+    if(memcmp(m_read_buf, h2_session::PREFACE, len) != 0)
+    {
+        return -1;
+    }
+    return len < h2_session::PREFACE_LEN ? 0 : 1;
+}
 
-    /* 完成报文响应 */
-    bool write_ret = process_wirte(read_ret);
-    if(!write_ret)
+int http_conn::match_preface()
+{
+    int state = preface_state();
+    if(state <= 0)
+    {
+        return state;
+    }
+    m_h2 = new h2_session(m_address);
+    m_h2->start();
+    server_metrics::h2_sessions.add();
+    return 1;
+}
+
+bool http_conn::upgrade_h2(HTTP_CODE ret)
+{
+    /* 消息体已被 HTTP/1.1 解析占用，这类少见的请求以及格式有误的请求按 HTTP/1.1 应答 */
+    if(!m_http2 || m_content_length != 0 || ret == MALFORMED_REQUEST)
+    {
+        return false;
+    }
+    m_h2 = new h2_session(m_address);
+    off_t file_size = ret == FILE_REQUEST ? m_file_stat.st_size : 0;
+    if(!m_h2->upgrade(m_h2_settings, ret, m_file_address, file_size, m_body))
+    {
+        delete m_h2;
+        m_h2 = NULL;
+        return false;
+    }
+    /* 映射的文件已转交给流 1 */
+    m_file_address = NULL;
+    server_metrics::h2_sessions.add();
+    server_metrics::h2_streams.add();
+    COUNT_SYSCALL(REQUESTS);
+
+    /* 升级请求之后已读到的数据（通常是连接前言）留给 HTTP/2 处理 */
+    m_read_idx -= m_checked_idx;
+    memmove(m_read_buf, m_read_buf + m_checked_idx, m_read_idx);
+    m_checked_idx = 0;
+    return true;
+}
+
+void http_conn::process_h2()
+{
+    /* 出错时 GOAWAY 已排入发送队列，之后的数据被忽略，GOAWAY 发出后 finished 为 true */
+    m_h2->on_data(m_read_buf, m_read_idx, mysql);
+    /* 数据已全部交给会话，读缓冲区还给缓冲区池 */
+    m_read_idx = 0;
+    m_checked_idx = 0;
+    release_buffers();
+    m_request_begun = false;
+    if(m_phase == PHASE_HEADER && !m_h2->partial())
+    {
+        set_phase(PHASE_IDLE);
+    }
+    if(m_read_deferred)
+    {
+        m_read_deferred = false;
+        post_event(EV_READ);
+    }
+
+    if(m_eager_write)
+    {
+        if(!write_h2())
+        {
+            post_event(EV_CLOSE);
+        }
+    }
+    else if(schedule_h2())
+    {
+        post_event(EV_WRITE);
+    }
+    else if(m_h2->finished())
+    {
+        post_event(EV_CLOSE);
+    }
+    else
+    {
+        rearm(EPOLLIN);
+    }
+}
+
+bool http_conn::schedule_h2()
+{
+    m_h2->fill();
+    bytes_to_send = m_h2->queued();
+    if(bytes_to_send > 0)
+    {
+        /* 发送阶段的期限按阶段内要发送的总字节数计算，发送期间排入的新数据也计入 */
+        if(m_phase != PHASE_WRITE)
+        {
+            set_phase(PHASE_WRITE);
+            bytes_have_send = 0;
+        }
+        m_phase_total = bytes_have_send + bytes_to_send;
+        return true;
+    }
+    if(m_phase == PHASE_WRITE)
+    {
+        set_phase(m_h2->partial() ? PHASE_HEADER : PHASE_IDLE);
+    }
+    return false;
+}
+
+bool http_conn::write_h2()
+{
+    struct iovec iov[64];
+    while (schedule_h2())
+    {
+        int count = m_h2->gather(iov, sizeof(iov) / sizeof(iov[0]));
+        int temp = m_transport->writev(m_sockfd, iov, count);
+        if(temp < 0)
+        {
+            if(errno == EAGAIN)
+            {
+                /* 发送期间仍要读取对方的帧 */
+                rearm(EPOLLIN | EPOLLOUT);
+                return true;
+            }
+            return false;
+        }
+        m_h2->consume(temp);
+        bytes_have_send += temp;
+        server_metrics::bytes_sent.add(temp);
+    }
+    if(m_h2->finished())
     {
-        close_conn();
+        return false;
+    }
+    rearm(EPOLLIN);
+    return true;
+}
+
+void http_conn::upgrade_ws()
+{
+    m_ws = new ws_session(this);
+    m_ws->start(m_ws_key);
+    ws_hub::get_instance()->subscribe(m_ws);
+    server_metrics::ws_sessions.add();
+    COUNT_SYSCALL(REQUESTS);
+
+    /* 握手请求之后已读到的数据（客户端不等 101 就发出的帧）留给 WebSocket 处理 */
+    m_read_idx -= m_checked_idx;
+    memmove(m_read_buf, m_read_buf + m_checked_idx, m_read_idx);
+    m_checked_idx = 0;
+}
+
+void http_conn::process_ws()
+{
+    /* 出错或收到关闭帧时关闭帧已排入发送队列，之后的数据被忽略，关闭帧发出后 finished 为 true */
+    if(m_read_idx > 0)
+    {
+        m_ws->on_data(m_read_buf, m_read_idx);
+    }
+    m_read_idx = 0;
+    m_checked_idx = 0;
+    release_buffers();
+    m_request_begun = false;
+    if(m_phase == PHASE_HEADER && !m_ws->partial())
+    {
+        set_phase(PHASE_IDLE);
+    }
+    if(m_read_deferred)
+    {
+        m_read_deferred = false;
+        post_event(EV_READ);
+    }
+
+    if(m_eager_write)
+    {
+        if(!write_ws())
+        {
+            post_event(EV_CLOSE);
+        }
+    }
+    else if(schedule_ws())
+    {
+        post_event(EV_WRITE);
+    }
+    else if(m_ws->finished())
+    {
+        post_event(EV_CLOSE);
+    }
+    else
+    {
+        rearm(EPOLLIN);
+    }
+}
+
+bool http_conn::schedule_ws()
+{
+    /* 积压超限的慢速订阅者不再发送，由调用者根据 finished 关闭 */
+    if(!m_ws->drain())
+    {
+        bytes_to_send = 0;
+        return false;
+    }
+    bytes_to_send = m_ws->queued();
+    if(bytes_to_send > 0)
+    {
+        if(m_phase != PHASE_WRITE)
+        {
+            set_phase(PHASE_WRITE);
+            bytes_have_send = 0;
+        }
+        m_phase_total = bytes_have_send + bytes_to_send;
+        return true;
+    }
+    if(m_phase == PHASE_WRITE)
+    {
+        set_phase(m_ws->partial() ? PHASE_HEADER : PHASE_IDLE);
+    }
+    return false;
+}
+
+bool http_conn::write_ws()
+{
+    struct iovec iov[64];
+    while (schedule_ws())
+    {
+        int count = m_ws->gather(iov, sizeof(iov) / sizeof(iov[0]));
+        int temp = m_transport->writev(m_sockfd, iov, count);
+        if(temp < 0)
+        {
+            if(errno == EAGAIN)
+            {
+                /* 发送期间仍要读取对方的帧 */
+                rearm(EPOLLIN | EPOLLOUT);
+                return true;
+            }
+            return false;
+        }
+        m_ws->consume(temp);
+        bytes_have_send += temp;
+        server_metrics::bytes_sent.add(temp);
+    }
+    if(m_ws->finished())
+    {
+        return false;
+    }
+    rearm(EPOLLIN);
+    return true;
+}
+
+bool http_conn::ws_keepalive(long long now)
+{
+    return m_ws && m_phase == PHASE_IDLE && m_ws->ping(now);
+}
+
+void http_conn::flush_broadcast()
+{
+    /* 广播方占有连接时取出的事件中，除了它自己记录的写事件，还可能有其他线程记录后占有失败的事件，
+        只有写事件时在本线程写出，否则连同写事件一起交还给主线程 */
+    int ev = take_events();
+    if(m_eager_write && ev == EV_WRITE)
+    {
+        if(!write_ws())
+        {
+            post_event(EV_CLOSE);
+        }
+    }
+    else
+    {
+        post_event(ev);
+    }
+    if(release())
+    {
+        handoff();
+    }
+}
+
+void http_conn::start_proxy()
+{
+    static const char* method_names[] = {"GET", "POST", "HEAD", "PUT", "DELETE", "TRACE", "OPTIONS", "CONNECT", "PATCH"};
+
+    m_proxy = new proxy_session(m_sockfd, m_transport, this);
+    std::string& req = m_proxy->request();
+    req.reserve(m_checked_idx - m_headers_start + 256);
+    req.append(method_names[m_method]).append(" ").append(m_url).append(" HTTP/1.1\r\n");
+
+    /* 请求头各行的 \r\n 已被 parse_line 改为 \0\0。逐跳头部不转发，客户端地址追加到 X-Forwarded-For */
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &m_address.sin_addr, ip, sizeof(ip));
+    bool forwarded = false;
+    const char* end = m_read_buf + m_checked_idx;
+    for(const char* line = m_read_buf + m_headers_start; line < end && line[0] != '\0'; line += strlen(line) + 2)
+    {
+        if(strncasecmp(line, "Connection:", 11) == 0 || strncasecmp(line, "Keep-Alive:", 11) == 0 ||
+            strncasecmp(line, "Proxy-Connection:", 17) == 0 || strncasecmp(line, "TE:", 3) == 0 ||
+            strncasecmp(line, "Trailer:", 8) == 0 || strncasecmp(line, "Upgrade:", 8) == 0 ||
+            strncasecmp(line, "HTTP2-Settings:", 15) == 0)
+        {
+            continue;
+        }
+        req.append(line);
+        if(strncasecmp(line, "X-Forwarded-For:", 16) == 0)
+        {
+            req.append(", ").append(ip);
+            forwarded = true;
+        }
+        req.append("\r\n");
+    }
+    if(!forwarded)
+    {
+        req.append("X-Forwarded-For: ").append(ip).append("\r\n");
+    }
+    req.append("\r\n");
+
+    /* 已读到的消息体随请求头一起发出，其余的由转发过程从 socket 中读取；之后的数据（流水线请求）被丢弃 */
+    int body = m_read_idx - m_checked_idx;
+    if(body > m_content_length)
+    {
+        body = m_content_length;
+    }
+    req.append(m_read_buf + m_checked_idx, body);
+
+    bool idempotent = m_method != POST && m_method != PATCH;
+    m_proxy->begin(m_route, m_method == HEAD, idempotent, m_linger, m_content_length - body);
+    release_buffers();
+    set_phase(PHASE_PROXY);
+    server_metrics::proxy_requests.add();
+    /* 上游连接只由主线程取用和推进 */
+    post_event(EV_UPSTREAM);
+}
+
+bool http_conn::proxy_io(int ev)
+{
+    /* 转发期间到达的新请求数据等转发结束再读 */
+    if(ev & EV_READ)
+    {
+        m_read_deferred = true;
     }
 
-    /* 注册并监听 写事件 */
-    modfd(m_epollfd, m_sockfd, EPOLLOUT);
-}
\ No newline at end of file
+    long long now = coarse_clock::get_instance()->now_ms();
+    if((ev & EV_TIMEOUT) && m_proxy->deadline() <= now && !m_proxy->expire(now))
+    {
+        LOG_INFO("[proxy] request on connection %d timed out\n", m_sockfd);
+        server_metrics::proxy_failures.add();
+        if(!m_proxy->responded())
+        {
+            m_transport->send_nowait(m_sockfd, error_504_response, strlen(error_504_response));
+            server_metrics::count_response(504);
+        }
+        return false;
+    }
+
+    int events = 0;
+    switch (m_proxy->pump(&events))
+    {
+    case proxy_session::PROXY_AGAIN:
+    {
+        rearm(events);
+        return true;
+    }
+    case proxy_session::PROXY_DONE:
+    {
+        COUNT_SYSCALL(REQUESTS);
+        bool keep = m_linger && m_proxy->keepalive();
+        delete m_proxy;
+        m_proxy = NULL;
+        if(!keep)
+        {
+            return false;
+        }
+        init();
+        rearm(EPOLLIN);
+        if(m_read_deferred)
+        {
+            m_read_deferred = false;
+            post_event(EV_READ);
+        }
+        return true;
+    }
+    case proxy_session::PROXY_FAILED:
+    {
+        /* 消息体还留在 socket 中时无法继续解析下一个请求 */
+        if(m_proxy->body_left() > 0)
+        {
+            m_linger = false;
+        }
+        delete m_proxy;
+        m_proxy = NULL;
+        COUNT_SYSCALL(REQUESTS);
+        if(!process_wirte(BAD_GATEWAY))
+        {
+            return false;
+        }
+        return write();
+    }
+    default:
+        return false;
+    }
+}
@@ -11,22 +11,38 @@
 
 #include <sys/stat.h>
 #include <string.h>
+#include <strings.h>
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <ctype.h>
+#include <limits.h>
 #include <sys/mman.h>
 #include <stdarg.h>
 #include <map>
+#include <string>
+#include <vector>
+#include <atomic>
 #include <sys/uio.h>
 
 #include "../CGImysql/sql_connection_pool.h"
+#include "../timer/min_heap.h"
+#include "transport.h"
+
+class h2_session;
+class ws_session;
+class proxy_session;
+struct proxy_route;
 
 class http_conn
 {
+    /* 微基准测试（bench/microbench.cpp）直接驱动请求解析 */
+    friend class http_conn_bench;
+
 public:
     /* 文件名的最大长度 */
     static const int FILENAME_LEN = 200;
-    /* 读缓冲区的大小 */
+    /* 读缓冲区的初始大小 */
     static const int READ_BUFFER_SIZE = 2048;
     /* 写缓冲区的大小 */
     static const int WRITE_BUFFER_SIZE = 1024;
@@ -60,7 +76,31 @@ public:
         FORBIDDEN_REQUEST,  /* 请求资源禁止访问，没有读取权限  */
         FILE_REQUEST,       /* 请求资源可以正常访问 */
         INTERNAL_ERROR, /* 服务器内部错误，该结果在主状态机逻辑switch的default下，一般不会触发 */
-        CLOSED_CONNECTION
+        CLOSED_CONNECTION,
+        METRICS_REQUEST,    /* 请求内部指标，应答正文已生成在 m_body 中 */
+        WEBSOCKET_REQUEST,  /* WebSocket 握手请求，由 process 切换协议 */
+        PROXY_REQUEST,      /* 匹配反向代理路由的请求，由 process 开始转发 */
+        BAD_GATEWAY,        /* 上游服务器都不可用或转发失败，502 */
+        MALFORMED_REQUEST   /* 无法确定消息体的边界（Content-Length 有误，或转发的请求使用分块编码），400 后关闭连接 */
+    };
+    /* 连接所处的阶段，每个阶段有各自的超时期限 */
+    enum CONN_PHASE
+    {
+        PHASE_IDLE = 0, /* 保活连接空闲，等待下一个请求 */
+        PHASE_HEADER,   /* 读取请求行和请求头 */
+        PHASE_BODY,     /* 读取消息体 */
+        PHASE_WRITE,    /* 发送响应 */
+        PHASE_PROXY     /* 转发到上游服务器，期限由转发过程给出 */
+    };
+    /* 连接事件。连接同一时刻只由一个线程占有，
+        被占有期间到达的事件累积在 m_pending 中，由占有者在释放前处理 */
+    enum CONN_EVENT
+    {
+        EV_READ = 1,    /* socket 可读 */
+        EV_WRITE = 2,   /* socket 可写，或应答已生成、等待主线程发送 */
+        EV_CLOSE = 4,   /* 需要关闭连接 */
+        EV_TIMEOUT = 8, /* 定时器到期 */
+        EV_UPSTREAM = 16    /* 转发中的上游连接有事件，或转发已准备好、等待主线程开始 */
     };
     /* 行的读取状态 */
     enum LINE_STATUS
@@ -70,9 +110,23 @@ public:
         LINE_OPEN       /* 读取的行不完整 */
     };
 
+    /* 各阶段超时配置，时间单位为毫秒，速率单位为字节/秒 */
+    struct timeouts
+    {
+        int header;         /* 从第一个字节到读完请求头的期限 */
+        int body;           /* 读完消息体的期限 */
+        int min_recv_rate;  /* 读请求时的最低接收速率 */
+        int write;          /* 发送响应的基础期限，另按最低发送速率为响应大小追加时间 */
+        int min_send_rate;  /* 发送响应时的最低发送速率 */
+        int keepalive;      /* 保活连接的空闲期限 */
+        int rate_grace;     /* 阶段开始后多久才开始检查速率 */
+    };
+
 public:
-    http_conn(){ }
-    ~http_conn(){ }
+    http_conn() : mysql(NULL), m_sockfd(-1), m_read_buf(NULL), m_read_size(0),
+                    m_write_buf(NULL), m_file_address(NULL), m_content_address(NULL), m_owned(0), m_pending(0),
+                    m_transport(m_default_transport), m_h2(NULL), m_ws(NULL), m_proxy(NULL) { }
+    ~http_conn();
 
 public:
     /* 初始化新接受的连接 */
@@ -81,16 +135,101 @@ public:
     void close_conn(bool real_close = true);
     /* 处理客户请求 */
     void process();
-    /* 非阻塞读操作 */
+    /* 不经过主循环和线程池的处理流程（协程引擎使用）：解析已读到的数据，请求完整时生成应答，
+        不注册事件、不交还连接。ready 返回请求是否完整，返回 false 表示应关闭连接 */
+    bool process_inline(bool* ready);
+    /* 非阻塞读操作，按连接的触发模式特化 */
+    template <trigger_mode M>
     bool read_once();
     /* 非阻塞写操作 */
     bool write();
 
-    void initmysql_result(connection_pool *connPool);
+    static void initmysql_result(connection_pool *connPool);
+
+    /* 当前阶段的超时期限，单调时钟毫秒 */
+    long long deadline() const;
+    /* 当前阶段的收发速率是否低于下限 */
+    bool too_slow(long long now) const;
+    /* 超时关闭前的应答：请求读取中途超时则尽力发送 408 */
+    void timeout_response();
+
+    /* 更换传输层，必须在 init(sockfd, addr) 之前调用 */
+    void set_transport(transport* t) { m_transport = t; }
+    transport* get_transport() const { return m_transport; }
+
+    /* 尝试占有连接，成功后才能读写连接状态 */
+    bool try_acquire()
+    {
+        int expected = 0;
+        return m_owned.compare_exchange_strong(expected, 1);
+    }
+    /* 记录一个待处理事件 */
+    void post_event(int ev) { m_pending.fetch_or(ev); }
+    /* 取出所有待处理事件 */
+    int take_events() { return m_pending.exchange(0); }
+    /* 释放占有权。若期间又有事件到达并重新占有成功则返回 true，调用者需要继续处理 */
+    bool release();
+    /* 是否有尚未发送完的应答，WebSocket 连接还包括其他线程广播到收件箱的消息 */
+    bool has_output() const;
+    /* 是否已切换到 HTTP/2 或 WebSocket。这两种连接按帧收发，发送期间仍要读取对方的帧（如 WINDOW_UPDATE、pong），
+        读事件不延后，也不能插入 HTTP/1.1 应答 */
+    bool framed() const { return m_h2 != NULL || m_ws != NULL; }
+    /* 是否正在把请求转发到上游服务器 */
+    bool proxying() const { return m_phase == PHASE_PROXY; }
+    /* 转发期间客户 socket 和上游 socket 上的事件，只由主线程调用，返回 false 表示应关闭连接 */
+    bool proxy_io(int ev);
+    /* WebSocket 连接空闲到期时排入 ping，返回 false 表示不是 WebSocket 连接或 pong 已超时，应关闭 */
+    bool ws_keepalive(long long now);
+    /* ws_hub 广播后已占有连接：立即发送模式下直接写出，否则交还给主线程写出。之后不能再访问连接对象 */
+    void flush_broadcast();
+    /* 应答发送完之前到达的新请求数据，等应答发送完再读 */
+    void defer_read() { m_read_deferred = true; }
+    /* 读到了新请求的数据，每个请求只返回一次 true，用于按请求计数 */
+    bool begin_request()
+    {
+        if(m_request_begun || m_read_idx == 0)
+        {
+            return false;
+        }
+        m_request_begun = true;
+        return true;
+    }
+
+    /* 请求是否要访问数据库：POST 请求（cgi == 1）是登录和注册校验。
+        主线程交给线程池之前根据已读到的请求行判断，不足以判断时按静态请求处理，
+        之后读到更多数据会再次判断，请求行完整之前不会用到数据库 */
+    bool db_bound() const
+    {
+        return m_read_idx >= 4 && strncasecmp(m_read_buf, "POST", 4) == 0;
+    }
+
+    /* 取出工作线程交还给主线程的连接，这些连接已由交还者代为占有 */
+    static void take_handoff(std::vector<http_conn*>& conns);
+
+    /* 按请求方法、url 和消息体找到应答内容，HTTP/1.1 和 HTTP/2 共用。
+        登录和注册会把 url 改写为结果页面，url 所在的缓冲区要能容纳这些页面的路径；
+        real_file 为 FILENAME_LEN 字节、最后一个字节为 \0 的缓冲区；
+        文件请求的结果在 file_stat 和 file_address 中，内部指标的正文生成在 body_out 中 */
+    static HTTP_CODE route(METHOD method, char* url, char* body, MYSQL* mysql, const sockaddr_in& peer,
+                            char* real_file, struct stat* file_stat, char** file_address, std::string& body_out);
 
 private:
     /* 初始化连接 */
     void init();
+    /* 切换连接阶段，重新开始计时 */
+    void set_phase(CONN_PHASE phase);
+    /* 水平触发模式下重新注册 EPOLLONESHOT 事件，边缘触发模式下连接常驻注册，无需操作 */
+    void rearm(int ev);
+    /* 工作线程处理完后仍有待处理事件，把连接交还给主线程 */
+    void handoff();
+    /* 读缓冲区已满时换成更大的缓冲区，已无更大级别时返回 false */
+    bool grow_read_buf();
+    /* 确保读缓冲区还有空间，请求头过大时返回 false */
+    bool reserve_read();
+    /* 读到新数据后更新读取位置、阶段和速率计时 */
+    void add_read(int bytes_read);
+    /* 请求应答完毕后把读写缓冲区还给缓冲区池 */
+    void release_buffers();
     /* 解析 HTTP 请求 */
     HTTP_CODE process_read();
     /* 填充 HTTP 应答 */
@@ -111,25 +250,77 @@ private:
     bool add_status_line(int status, const char* title);
     bool add_headers(int content_length);
     bool add_content_length(int content_length);
+    bool add_date();
     bool add_linger();
     bool add_blank_line();
 
+    /* 读缓冲区开头是否为 HTTP/2 的连接前言：是返回 1，前言还不完整返回 0，否则返回 -1 */
+    int preface_state() const;
+    /* 同 preface_state，是连接前言时创建会话 */
+    int match_preface();
+    /* 缓冲区满时能否先处理已读到的部分：按帧处理的连接，以及连接前言之后紧跟大量数据的连接（会话到 process 中才创建） */
+    bool split_read() const { return framed() || preface_state() > 0; }
+    /* 请求带 Upgrade: h2c 时切换到 HTTP/2，请求本身作为流 1 应答。请求带消息体时不升级 */
+    bool upgrade_h2(HTTP_CODE ret);
+    /* HTTP/2 连接上读到数据后的处理，对应 HTTP/1.1 的 process_read 和 process_wirte */
+    void process_h2();
+    /* 把 HTTP/2 会话待发送的数据排入发送队列，更新发送阶段，返回是否有数据要发送 */
+    bool schedule_h2();
+    /* HTTP/2 连接的写操作，返回 false 表示应关闭连接 */
+    bool write_h2();
+
+    /* 切换到 WebSocket：排入 101 应答并订阅广播 */
+    void upgrade_ws();
+    /* WebSocket 连接上读到数据后的处理 */
+    void process_ws();
+    /* 取出广播的消息排入发送队列，更新发送阶段，返回是否有数据要发送 */
+    bool schedule_ws();
+    /* WebSocket 连接的写操作，返回 false 表示应关闭连接 */
+    bool write_ws();
+
+    /* 改写请求头，连同已读到的消息体交给转发过程，之后由主线程推进 */
+    void start_proxy();
+
 public:
     /* 所有 socket 上的事件都被注册到同一个 epoll 内核事件表中，
         所以将 epoll 文件描述符设置为静态的 */
     static int m_epollfd;
     /* 统计用户数量 */
-    static int m_user_count;
+    static std::atomic<int> m_user_count;
+    /* 各阶段超时配置 */
+    static timeouts m_timeouts;
+    /* 是否由工作线程在生成应答后立即发送 */
+    static bool m_eager_write;
+    /* 工作线程交还连接时用于唤醒主循环的 eventfd */
+    static int m_handoff_fd;
+    /* 输出内部指标的路径，NULL 表示不提供 */
+    static const char* m_metrics_path;
+    /* 内部指标是否只对本机回环地址的客户端开放 */
+    static bool m_metrics_local_only;
+    /* 网站根目录 */
+    static const char* m_doc_root;
+    /* 新连接对象使用的传输层，按连接的触发模式选择 socket_transport 的特化 */
+    static transport* m_default_transport;
+    /* 是否接受 HTTP/2（先验知识、h2c 升级，TLS 连接上经 ALPN 协商） */
+    static bool m_http2;
+    /* 接受 WebSocket 握手的路径，NULL 表示不接受 */
+    static const char* m_ws_path;
     MYSQL* mysql;
 
+    /* 连接资源和定时器内嵌在连接对象中，随连接对象一起从对象池分配和回收 */
+    clinet_data m_user_data;
+    heap_timer m_timer;
+
 private:
     /* 该 HTTP 连接的 socket */
     int m_sockfd;
     /* 该 HTTP 连接对方的 socket 地址*/
     sockaddr_in m_address;
 
-    /* 读缓冲区 */
-    char m_read_buf[READ_BUFFER_SIZE];
+    /* 读缓冲区，有数据到达时才从缓冲区池借用 */
+    char* m_read_buf;
+    /* 读缓冲区的大小 */
+    int m_read_size;
     /* 标识读缓冲中已经读入到客户数据的最后一个字节的下一个位置 */
     int m_read_idx;
     /* 当前正在分析的字符在读缓冲区中的位置 */
@@ -137,8 +328,8 @@ private:
     /* 当前正在解析的行的起始位置 */
     int m_start_line;
 
-    /* 写缓冲区*/
-    char m_write_buf[WRITE_BUFFER_SIZE];
+    /* 写缓冲区，生成应答时才从缓冲区池借用 */
+    char* m_write_buf;
     /* 写缓冲区中待发送的字节数 */
     int m_write_idx;
 
@@ -156,13 +347,30 @@ private:
     char* m_version;
     /* 主机名 */
     char* m_host;
+    /* 请求是否带 Upgrade: h2c，以及 HTTP2-Settings 的值 */
+    bool m_upgrade_h2c;
+    char* m_h2_settings;
+    /* 请求是否带 Upgrade: websocket，以及 Sec-WebSocket-Key 和 Sec-WebSocket-Version 的值 */
+    bool m_upgrade_ws;
+    char* m_ws_key;
+    int m_ws_version;
     /* HTTP 请求消息体的长度 */
     int m_content_length;
+    /* 请求是否带 Transfer-Encoding（转发时不支持分块编码的请求） */
+    bool m_chunked;
+    /* 请求头在读缓冲区中的起始位置，转发时据此复制请求头 */
+    int m_headers_start;
+    /* 匹配的反向代理路由，NULL 表示本地处理 */
+    const proxy_route* m_route;
     /* HTTP 请求是否要求保持连接 */
     bool m_linger;
 
     /* 客户请求的目标文件被 mmap 到内存中的起始位置 */
     char* m_file_address;
+    /* 动态生成的应答正文（内部指标） */
+    std::string m_body;
+    /* 应答正文的起始位置，指向 m_file_address 或 m_body */
+    const char* m_content_address;
     /* 目标文件的状态。通过它可以判断文件是否存在、是否为目录、是否可读，
         并获取文件大小等信息 */
     struct stat m_file_stat;
@@ -176,6 +384,40 @@ private:
     char* m_string;
     int bytes_to_send;
     int bytes_have_send;
+
+    /* 连接当前所处的阶段及其开始时间 */
+    CONN_PHASE m_phase;
+    long long m_phase_start;
+    /* 速率统计的起点：读阶段为收到第一个字节的时间，发送阶段为阶段开始时间 */
+    long long m_rate_start;
+    /* 当前阶段已接收的字节数，用于计算接收速率 */
+    int m_phase_bytes;
+    /* 发送阶段需要发送的总字节数 */
+    int m_phase_total;
+
+    /* 占有标志，0 表示空闲，1 表示正由主线程或某个工作线程处理 */
+    std::atomic<int> m_owned;
+    /* 被占有期间到达的事件 */
+    std::atomic<int> m_pending;
+    /* 是否有延后处理的读事件 */
+    bool m_read_deferred;
+    /* 当前请求是否已经计数 */
+    bool m_request_begun;
+    /* 传输层，默认为 socket */
+    transport* m_transport;
+    /* 切换到 HTTP/2 后的会话，HTTP/1.1 连接为 NULL */
+    h2_session* m_h2;
+    /* 切换到 WebSocket 后的会话 */
+    ws_session* m_ws;
+    /* 正在进行的转发，转发结束后删除 */
+    proxy_session* m_proxy;
+
+    /* 交还给主线程的连接队列 */
+    static futex_mutex m_handoff_lock;
+    static std::vector<http_conn*> m_handoff_queue;
 };
 
+template <> bool http_conn::read_once<TRIGGER_LT>();
+template <> bool http_conn::read_once<TRIGGER_ET>();
+
 #endif
\ No newline at end of file
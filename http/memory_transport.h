@@ -0,0 +1,135 @@
+#ifndef MEMORY_TRANSPORT_H
+#define MEMORY_TRANSPORT_H
+
+#include <errno.h>
+#include <string.h>
+#include <string>
+#include "transport.h"
+
+/* 内存传输层
+   输入是预先写入的字节流，每次 recv 最多交出 max_read 字节，读完后返回 EAGAIN（或在 finish() 后返回 0）；
+   应答追加到 output() 中，每次 writev 最多接受 max_write 字节，用完写额度后返回 EAGAIN。
+   不涉及任何系统调用，单线程使用 */
+class memory_transport : public transport
+{
+public:
+    memory_transport()
+        : m_in_pos(0), m_eof(false), m_max_read(0), m_max_write(0), m_write_budget(-1),
+          m_closed(false)
+    {
+    }
+
+    /* 追加一段“到达”的数据 */
+    void feed(const char* data, size_t len)
+    {
+        m_input.append(data, len);
+    }
+    /* 对方关闭写端，输入读完后 recv 返回 0 */
+    void finish() { m_eof = true; }
+
+    /* 每次 recv/writev 的最大字节数，0 表示不限制 */
+    void set_max_read(size_t n) { m_max_read = n; }
+    void set_max_write(size_t n) { m_max_write = n; }
+    /* 剩余可写入的字节数，用完后 writev 返回 EAGAIN，-1 表示不限制 */
+    void set_write_budget(long n) { m_write_budget = n; }
+
+    std::string& output() { return m_output; }
+    bool closed() const { return m_closed; }
+    /* 清空所有状态，供下一个连接复用 */
+    void reset()
+    {
+        m_input.clear();
+        m_output.clear();
+        m_in_pos = 0;
+        m_eof = false;
+        m_closed = false;
+    }
+
+    void attach(int, void*) { m_closed = false; }
+    void rearm(int, void*, int) { }
+
+    ssize_t recv(int, char* buf, size_t len)
+    {
+        size_t avail = m_input.size() - m_in_pos;
+        if(avail == 0)
+        {
+            if(m_eof)
+            {
+                return 0;
+            }
+            errno = EAGAIN;
+            return -1;
+        }
+        if(len > avail)
+        {
+            len = avail;
+        }
+        if(m_max_read && len > m_max_read)
+        {
+            len = m_max_read;
+        }
+        memcpy(buf, m_input.data() + m_in_pos, len);
+        m_in_pos += len;
+        /* 已读完的输入丢弃，避免长时间运行时输入无限增长 */
+        if(m_in_pos == m_input.size())
+        {
+            m_input.clear();
+            m_in_pos = 0;
+        }
+        return len;
+    }
+
+    ssize_t writev(int, const struct iovec* iov, int count)
+    {
+        size_t limit = (size_t)-1;
+        if(m_max_write)
+        {
+            limit = m_max_write;
+        }
+        if(m_write_budget >= 0 && (size_t)m_write_budget < limit)
+        {
+            limit = m_write_budget;
+        }
+        if(limit == 0)
+        {
+            errno = EAGAIN;
+            return -1;
+        }
+
+        size_t written = 0;
+        for(int i = 0; i < count && written < limit; ++i)
+        {
+            size_t n = iov[i].iov_len;
+            if(n > limit - written)
+            {
+                n = limit - written;
+            }
+            m_output.append((const char*)iov[i].iov_base, n);
+            written += n;
+        }
+        if(m_write_budget >= 0)
+        {
+            m_write_budget -= written;
+        }
+        return written;
+    }
+
+    void send_nowait(int, const char* buf, size_t len)
+    {
+        m_output.append(buf, len);
+    }
+
+    void close(int) { m_closed = true; }
+
+private:
+    std::string m_input;
+    size_t m_in_pos;
+    bool m_eof;
+    size_t m_max_read;
+    size_t m_max_write;
+    long m_write_budget;
+    std::string m_output;
+    bool m_closed;
+};
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/* 连接的传输层
+   http_conn 的收发、事件注册和关闭都经过传输层，默认的 socket_transport 直接操作 socket 和 epoll；
+   内存传输层（memory_transport.h）让请求处理流程脱离 socket 运行，用于测量和重放 */
+class transport
+{
+public:
+    virtual ~transport() { }
+
+    /* 新连接加入事件循环 */
+    virtual void attach(int fd, void* owner) = 0;
+    /* 水平触发模式下重新注册 EPOLLONESHOT 事件 */
+    virtual void rearm(int fd, void* owner, int ev) = 0;
+    /* 语义与 recv/writev 相同：出错返回 -1 并设置 errno，对方关闭时 recv 返回 0 */
+    virtual ssize_t recv(int fd, char* buf, size_t len) = 0;
+    virtual ssize_t writev(int fd, const struct iovec* iov, int count) = 0;
+    /* 非阻塞地尽力发送，不关心结果 */
+    virtual void send_nowait(int fd, const char* buf, size_t len) = 0;
+    /* 关闭连接并移出事件循环 */
+    virtual void close(int fd) = 0;
+    /* 数据是否原样经过 socket，可以用 splice 直接在 socket 和管道之间搬运（反向代理转发正文） */
+    virtual bool spliceable() const { return false; }
+};
+
+/* 事件触发模式：水平触发时连接以 EPOLLONESHOT 注册，每次处理完重新注册，一次事件只 recv 一次；
+    边缘触发时连接常驻注册读写事件，每次读到 EAGAIN 为止。
+    启动时按配置选定一种，与模式有关的代码都是模板特化，运行时不再判断模式 */
+enum trigger_mode { TRIGGER_LT, TRIGGER_ET };
+
+/* 基于 socket 和 epoll 的传输层，实现在 http_conn.cpp 中，与连接的 LT/ET 模式放在一起 */
+template <trigger_mode M>
+class socket_transport : public transport
+{
+public:
+    static socket_transport* get_instance()
+    {
+        static socket_transport instance;
+        return &instance;
+    }
+
+    void attach(int fd, void* owner);
+    void rearm(int fd, void* owner, int ev);
+    ssize_t recv(int fd, char* buf, size_t len);
+    ssize_t writev(int fd, const struct iovec* iov, int count);
+    void send_nowait(int fd, const char* buf, size_t len);
+    void close(int fd);
+    bool spliceable() const { return true; }
+
+private:
+    socket_transport() { }
+};
+
+template <> void socket_transport<TRIGGER_LT>::attach(int fd, void* owner);
+template <> void socket_transport<TRIGGER_ET>::attach(int fd, void* owner);
+template <> void socket_transport<TRIGGER_LT>::rearm(int fd, void* owner, int ev);
+template <> void socket_transport<TRIGGER_ET>::rearm(int fd, void* owner, int ev);
+template <> void socket_transport<TRIGGER_LT>::close(int fd);
+template <> void socket_transport<TRIGGER_ET>::close(int fd);
+extern template class socket_transport<TRIGGER_LT>;
+extern template class socket_transport<TRIGGER_ET>;
+
+#endif
@@ -0,0 +1,1276 @@
+#include <string.h>
+#include <sys/mman.h>
+
+#include "h2_session.h"
+#include "../timer/coarse_clock.h"
+#include "../stats/syscall_stats.h"
+#include "../stats/metrics.h"
+#include "../proxy/upstream.h"
+
+/* 错误页面的正文与 HTTP/1.1 相同，定义在 http_conn.cpp 中 */
+extern const char* error_403_form;
+extern const char* error_404_form;
+extern const char* error_500_form;
+extern const char* error_502_form;
+
+const char h2_session::PREFACE[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+uint32_t h2_session::m_max_streams = 100;
+
+/* 依赖链的最大遍历深度，防止对方构造出过深的依赖树 */
+static const int MAX_DEPTH = 64;
+/* 默认权重 */
+static const int DEFAULT_WEIGHT = 16;
+
+static uint32_t read_u32(const uint8_t* p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void write_u32(char* p, uint32_t v)
+{
+    p[0] = (char)(v >> 24);
+    p[1] = (char)(v >> 16);
+    p[2] = (char)(v >> 8);
+    p[3] = (char)v;
+}
+
+/* 从 priority 请求头（RFC 9218 的结构化字段，如 "u=1, i"）中取出 urgency，没有时返回 def */
+static int parse_urgency(const char* value, size_t len, int def)
+{
+    for(size_t i = 0; i + 2 < len; ++i)
+    {
+        bool start = i == 0 || value[i - 1] == ',' || value[i - 1] == ' ';
+        bool end = i + 3 == len || value[i + 3] == ',' || value[i + 3] == ' ' || value[i + 3] == ';';
+        if(start && end && value[i] == 'u' && value[i + 1] == '=' && value[i + 2] >= '0' && value[i + 2] <= '7')
+        {
+            return value[i + 2] - '0';
+        }
+    }
+    return def;
+}
+
+/* base64url 解码（h2c 升级的 HTTP2-Settings），允许省略结尾的 = */
+static bool base64url_decode(const char* in, std::string& out)
+{
+    unsigned int acc = 0;
+    int bits = 0;
+    for(; *in && *in != '='; ++in)
+    {
+        int v;
+        char c = *in;
+        if(c >= 'A' && c <= 'Z')
+            v = c - 'A';
+        else if(c >= 'a' && c <= 'z')
+            v = c - 'a' + 26;
+        else if(c >= '0' && c <= '9')
+            v = c - '0' + 52;
+        else if(c == '-')
+            v = 62;
+        else if(c == '_')
+            v = 63;
+        else
+            return false;
+        acc = (acc << 6) | v;
+        bits += 6;
+        if(bits >= 8)
+        {
+            bits -= 8;
+            out.push_back((char)(acc >> bits));
+        }
+    }
+    return true;
+}
+
+h2_session::stream::stream(uint32_t sid, long long window)
+    : id(sid), end_remote(false), responded(false), closed(false), send_window(window),
+      recv_window(DEFAULT_WINDOW), urgency(DEFAULT_URGENCY), vtime(0), content_length(-1),
+      file_address(NULL), file_size(0), content(NULL), content_len(0), sent(0), pending(0)
+{
+}
+
+h2_session::stream::~stream()
+{
+    if(file_address && file_size > 0)
+    {
+        munmap(file_address, file_size);
+        COUNT_SYSCALL(OTHER);
+    }
+}
+
+h2_session::h2_session(const sockaddr_in& peer)
+    : m_peer(peer), m_preface_done(false), m_settings_received(false), m_last_stream(0),
+      m_header_stream(0), m_header_flags(0), m_header_self_dep(false),
+      m_peer_initial_window(DEFAULT_WINDOW), m_send_window(DEFAULT_WINDOW), m_recv_window(DEFAULT_WINDOW),
+      m_front_off(0), m_queued(0), m_raw_queued(0), m_vclock(0), m_failed(false), m_peer_goaway(false),
+      m_mysql(NULL)
+{
+}
+
+h2_session::~h2_session()
+{
+    for(std::map<uint32_t, stream*>::iterator it = m_streams.begin(); it != m_streams.end(); ++it)
+    {
+        it->second->closed = true;
+        if(it->second->pending == 0)
+        {
+            delete it->second;
+        }
+    }
+    /* 已关闭但仍被发送队列引用的流，由引用它的最后一段负责释放 */
+    for(std::deque<chunk>::iterator it = m_chunks.begin(); it != m_chunks.end(); ++it)
+    {
+        if(it->owner && --it->owner->pending == 0)
+        {
+            delete it->owner;
+        }
+    }
+}
+
+void h2_session::start()
+{
+    send_settings();
+}
+
+bool h2_session::upgrade(const char* settings, http_conn::HTTP_CODE ret, char* file_address,
+                            off_t file_size, std::string& body)
+{
+    std::string payload;
+    if(!base64url_decode(settings, payload) || payload.size() % 6 != 0 ||
+        apply_settings((const uint8_t*)payload.data(), payload.size()) != NO_ERROR)
+    {
+        return false;
+    }
+
+    static const char switching[] = "HTTP/1.1 101 Switching Protocols\r\n"
+                                    "Connection: Upgrade\r\n"
+                                    "Upgrade: h2c\r\n\r\n";
+    append_raw(switching, sizeof(switching) - 1);
+    send_settings();
+
+    /* 升级请求本身是流 1，请求已完整，只等应答 */
+    m_last_stream = 1;
+    stream* s = open_stream(1);
+    s->end_remote = true;
+    if(ret == http_conn::FILE_REQUEST && file_size > 0)
+    {
+        s->file_address = file_address;
+        s->file_size = file_size;
+    }
+    s->generated.swap(body);
+    respond(s, ret);
+    return true;
+}
+
+int h2_session::goaway_frame(char* frame) const
+{
+    frame[0] = 0;
+    frame[1] = 0;
+    frame[2] = 8;
+    frame[3] = FRAME_GOAWAY;
+    frame[4] = 0;
+    write_u32(frame + 5, 0);
+    write_u32(frame + 9, m_last_stream);
+    write_u32(frame + 13, NO_ERROR);
+    return 17;
+}
+
+bool h2_session::on_data(const char* data, size_t len, MYSQL* mysql)
+{
+    if(m_failed)
+    {
+        return false;
+    }
+    m_mysql = mysql;
+
+    /* 没有遗留的不完整帧时直接在调用者的缓冲区上解析 */
+    const uint8_t* p = (const uint8_t*)data;
+    size_t n = len;
+    if(!m_in.empty())
+    {
+        m_in.append(data, len);
+        p = (const uint8_t*)m_in.data();
+        n = m_in.size();
+    }
+
+    size_t used = 0;
+    bool ok = true;
+    if(!m_preface_done)
+    {
+        size_t cmp = n < (size_t)PREFACE_LEN ? n : PREFACE_LEN;
+        if(memcmp(p, PREFACE, cmp) != 0)
+        {
+            ok = fail(PROTOCOL_ERROR);
+        }
+        else if(cmp == (size_t)PREFACE_LEN)
+        {
+            m_preface_done = true;
+            used = PREFACE_LEN;
+        }
+    }
+
+    while (ok && m_preface_done && n - used >= 9)
+    {
+        const uint8_t* h = p + used;
+        uint32_t flen = ((uint32_t)h[0] << 16) | ((uint32_t)h[1] << 8) | h[2];
+        if(flen > FRAME_SIZE)
+        {
+            ok = fail(FRAME_SIZE_ERROR);
+            break;
+        }
+        if(n - used < 9 + flen)
+        {
+            break;
+        }
+        ok = process_frame(h[3], h[4], read_u32(h + 5) & 0x7fffffff, h + 9, flen);
+        used += 9 + flen;
+        if(ok && m_raw_queued > MAX_RAW_QUEUE)
+        {
+            ok = fail(ENHANCE_YOUR_CALM);
+        }
+    }
+
+    if(!ok)
+    {
+        m_in.clear();
+    }
+    else if(m_in.empty())
+    {
+        m_in.assign((const char*)p + used, n - used);
+    }
+    else
+    {
+        m_in.erase(0, used);
+    }
+    m_mysql = NULL;
+    return ok;
+}
+
+bool h2_session::process_frame(uint8_t type, uint8_t flags, uint32_t id, const uint8_t* p, uint32_t len)
+{
+    /* 客户端的连接前言之后第一个帧必须是 SETTINGS */
+    if(!m_settings_received && (type != FRAME_SETTINGS || (flags & FLAG_ACK)))
+    {
+        return fail(PROTOCOL_ERROR);
+    }
+    /* 头部块必须连续：HEADERS 之后只能是同一个流的 CONTINUATION */
+    if(m_header_stream && (type != FRAME_CONTINUATION || id != m_header_stream))
+    {
+        return fail(PROTOCOL_ERROR);
+    }
+
+    switch (type)
+    {
+    case FRAME_DATA:
+        return on_data_frame(flags, id, p, len);
+    case FRAME_HEADERS:
+        return on_headers(flags, id, p, len);
+    case FRAME_PRIORITY:
+        return on_priority(id, p, len);
+    case FRAME_RST_STREAM:
+        return on_rst_stream(id, len);
+    case FRAME_SETTINGS:
+        return on_settings(flags, id, p, len);
+    case FRAME_PUSH_PROMISE:
+        /* 客户端不能推送 */
+        return fail(PROTOCOL_ERROR);
+    case FRAME_PING:
+        return on_ping(flags, id, p, len);
+    case FRAME_GOAWAY:
+        return on_goaway(id, len);
+    case FRAME_WINDOW_UPDATE:
+        return on_window_update(id, p, len);
+    case FRAME_CONTINUATION:
+        return on_continuation(flags, id, p, len);
+    case FRAME_PRIORITY_UPDATE:
+        return on_priority_update(id, p, len);
+    default:
+        /* 未知类型的帧忽略 */
+        return true;
+    }
+}
+
+bool h2_session::on_data_frame(uint8_t flags, uint32_t id, const uint8_t* p, uint32_t len)
+{
+    if(id == 0 || id > m_last_stream)
+    {
+        return fail(PROTOCOL_ERROR);
+    }
+    /* 整个帧（含填充）都计入流量控制 */
+    if(len > m_recv_window)
+    {
+        return fail(FLOW_CONTROL_ERROR);
+    }
+    /* 消息体收下就交给请求处理，不会积压。窗口用掉一半时一次补满，不为每个 DATA 帧发送 WINDOW_UPDATE */
+    m_recv_window -= len;
+    if(m_recv_window <= DEFAULT_WINDOW / 2)
+    {
+        send_window_update(0, DEFAULT_WINDOW - m_recv_window);
+        m_recv_window = DEFAULT_WINDOW;
+    }
+
+    const uint8_t* data = p;
+    uint32_t size = len;
+    if(flags & FLAG_PADDED)
+    {
+        if(len < 1 || p[0] >= len)
+        {
+            return fail(PROTOCOL_ERROR);
+        }
+        data = p + 1;
+        size = len - 1 - p[0];
+    }
+
+    stream* s = find(id);
+    /* 已关闭的流（可能是本端刚重置的）上仍在途中的数据直接丢弃 */
+    if(!s)
+    {
+        return true;
+    }
+    if(s->end_remote)
+    {
+        reset(s, id, STREAM_CLOSED);
+        return true;
+    }
+    if(len > s->recv_window)
+    {
+        reset(s, id, FLOW_CONTROL_ERROR);
+        return true;
+    }
+    s->recv_window -= len;
+    if(s->body.size() + size > MAX_BODY)
+    {
+        reset(s, id, ENHANCE_YOUR_CALM);
+        return true;
+    }
+    s->body.append((const char*)data, size);
+
+    if(flags & FLAG_END_STREAM)
+    {
+        s->end_remote = true;
+        if(s->content_length >= 0 && (size_t)s->content_length != s->body.size())
+        {
+            reset(s, id, PROTOCOL_ERROR);
+            return true;
+        }
+        handle(s, m_mysql);
+    }
+    else if(s->recv_window <= DEFAULT_WINDOW / 2)
+    {
+        send_window_update(id, DEFAULT_WINDOW - s->recv_window);
+        s->recv_window = DEFAULT_WINDOW;
+    }
+    return true;
+}
+
+bool h2_session::on_headers(uint8_t flags, uint32_t id, const uint8_t* p, uint32_t len)
+{
+    /* 客户端发起的流 ID 必须是奇数 */
+    if(id == 0 || (id & 1) == 0)
+    {
+        return fail(PROTOCOL_ERROR);
+    }
+
+    uint32_t pos = 0;
+    uint32_t pad = 0;
+    if(flags & FLAG_PADDED)
+    {
+        if(len < 1)
+        {
+            return fail(FRAME_SIZE_ERROR);
+        }
+        pad = p[0];
+        pos = 1;
+    }
+    m_header_self_dep = false;
+    if(flags & FLAG_PRIORITY)
+    {
+        if(len < pos + 5)
+        {
+            return fail(FRAME_SIZE_ERROR);
+        }
+        uint32_t dep = read_u32(p + pos);
+        int weight = p[pos + 4] + 1;
+        pos += 5;
+        bool exclusive = (dep & 0x80000000) != 0;
+        dep &= 0x7fffffff;
+        if(dep == id)
+        {
+            m_header_self_dep = true;
+        }
+        /* 已关闭的流不再参与调度 */
+        else if(id > m_last_stream || find(id))
+        {
+            set_priority(id, dep, weight, exclusive);
+        }
+    }
+    if(pad > len - pos)
+    {
+        return fail(PROTOCOL_ERROR);
+    }
+
+    m_header_block.assign((const char*)p + pos, len - pos - pad);
+    if(flags & FLAG_END_HEADERS)
+    {
+        return on_header_block(id, (flags & FLAG_END_STREAM) != 0);
+    }
+    m_header_stream = id;
+    m_header_flags = flags;
+    return true;
+}
+
+bool h2_session::on_continuation(uint8_t flags, uint32_t id, const uint8_t* p, uint32_t len)
+{
+    if(m_header_stream == 0)
+    {
+        return fail(PROTOCOL_ERROR);
+    }
+    /* 限制头部块的总长度，避免无穷的 CONTINUATION 耗尽内存 */
+    if(m_header_block.size() + len > MAX_HEADER_BLOCK)
+    {
+        return fail(ENHANCE_YOUR_CALM);
+    }
+    m_header_block.append((const char*)p, len);
+    if(flags & FLAG_END_HEADERS)
+    {
+        m_header_stream = 0;
+        return on_header_block(id, (m_header_flags & FLAG_END_STREAM) != 0);
+    }
+    return true;
+}
+
+bool h2_session::on_header_block(uint32_t id, bool end_stream)
+{
+    /* 无论流是否还需要，头部块都要解码，否则动态表与对方不同步 */
+    std::vector<hpack_header> headers;
+    if(!m_decoder.decode((const uint8_t*)m_header_block.data(), m_header_block.size(), headers))
+    {
+        return fail(COMPRESSION_ERROR);
+    }
+    m_header_block.clear();
+    bool self_dep = m_header_self_dep;
+    m_header_self_dep = false;
+
+    stream* s = find(id);
+    if(!s)
+    {
+        if(id <= m_last_stream)
+        {
+            return true;
+        }
+        m_last_stream = id;
+        if(m_streams.size() >= m_max_streams)
+        {
+            m_prio.erase(id);
+            reset(NULL, id, REFUSED_STREAM);
+            return true;
+        }
+        s = open_stream(id);
+        if(self_dep || !take_headers(s, headers))
+        {
+            reset(s, id, PROTOCOL_ERROR);
+            return true;
+        }
+    }
+    /* 已打开的流上的第二个头部块是 trailer，必须结束请求，内容忽略 */
+    else if(s->end_remote)
+    {
+        reset(s, id, STREAM_CLOSED);
+        return true;
+    }
+    else if(!end_stream || self_dep)
+    {
+        reset(s, id, PROTOCOL_ERROR);
+        return true;
+    }
+
+    if(end_stream)
+    {
+        s->end_remote = true;
+        if(s->content_length >= 0 && (size_t)s->content_length != s->body.size())
+        {
+            reset(s, id, PROTOCOL_ERROR);
+            return true;
+        }
+        handle(s, m_mysql);
+    }
+    return true;
+}
+
+bool h2_session::take_headers(stream* s, const std::vector<hpack_header>& headers)
+{
+    bool regular = false;
+    for(size_t i = 0; i < headers.size(); ++i)
+    {
+        const std::string& name = headers[i].name;
+        const std::string& value = headers[i].value;
+        if(name.empty())
+        {
+            return false;
+        }
+        /* 伪头部只能出现在普通头部之前，每种最多一个 */
+        if(name[0] == ':')
+        {
+            if(regular)
+            {
+                return false;
+            }
+            if(name == ":method" && s->method.empty())
+            {
+                s->method = value;
+            }
+            else if(name == ":path" && s->path.empty())
+            {
+                s->path = value;
+            }
+            else if(name != ":scheme" && name != ":authority")
+            {
+                return false;
+            }
+            continue;
+        }
+
+        regular = true;
+        for(size_t j = 0; j < name.size(); ++j)
+        {
+            if(name[j] >= 'A' && name[j] <= 'Z')
+            {
+                return false;
+            }
+        }
+        /* HTTP/2 中没有逐跳的连接头部 */
+        if(name == "connection" || name == "keep-alive" || name == "proxy-connection" ||
+            name == "transfer-encoding" || name == "upgrade" || (name == "te" && value != "trailers"))
+        {
+            return false;
+        }
+        if(name == "content-length")
+        {
+            char* end;
+            s->content_length = strtoll(value.c_str(), &end, 10);
+            if(value.empty() || *end != '\0' || s->content_length < 0)
+            {
+                return false;
+            }
+        }
+        else if(name == "priority")
+        {
+            s->urgency = parse_urgency(value.data(), value.size(), DEFAULT_URGENCY);
+        }
+    }
+    return !s->method.empty() && !s->path.empty();
+}
+
+void h2_session::handle(stream* s, MYSQL* mysql)
+{
+    http_conn::HTTP_CODE ret = http_conn::BAD_REQUEST;
+    http_conn::METHOD method = http_conn::GET;
+    bool supported = true;
+    if(s->method == "GET")
+    {
+        method = http_conn::GET;
+    }
+    else if(s->method == "POST")
+    {
+        method = http_conn::POST;
+    }
+    else
+    {
+        supported = false;
+    }
+
+    /* url 与 HTTP/1.1 的请求行相同处理：必须以 / 开头，/ 显示欢迎界面。
+        路由可能把 url 改写为登录和注册的结果页面，所以放在足够大的缓冲区中 */
+    char url[http_conn::FILENAME_LEN];
+    /* 反向代理只支持 HTTP/1.1 连接，HTTP/2 上的代理路由不落到文档目录，直接应答 502 */
+    if(supported && proxy_table::get_instance()->match(s->path.c_str()))
+    {
+        ret = http_conn::BAD_GATEWAY;
+    }
+    else if(supported && !s->path.empty() && s->path[0] == '/' && s->path.size() < sizeof(url))
+    {
+        strcpy(url, s->path == "/" ? "/judge.html" : s->path.c_str());
+        char real_file[http_conn::FILENAME_LEN];
+        real_file[http_conn::FILENAME_LEN - 1] = '\0';
+        struct stat file_stat;
+        char* body = const_cast<char*>(s->body.c_str());
+
+        /* 登录和注册要访问数据库。HTTP/2 连接上的请求都在快速通道中处理，需要时才从连接池取连接 */
+        if(method == http_conn::POST && !mysql)
+        {
+            connectionRAII mysqlcon(&mysql, connection_pool::GetInstance());
+            ret = http_conn::route(method, url, body, mysql, m_peer, real_file, &file_stat,
+                                    &s->file_address, s->generated);
+        }
+        else
+        {
+            ret = http_conn::route(method, url, body, mysql, m_peer, real_file, &file_stat,
+                                    &s->file_address, s->generated);
+        }
+        if(ret == http_conn::FILE_REQUEST)
+        {
+            s->file_size = file_stat.st_size;
+        }
+    }
+    COUNT_SYSCALL(REQUESTS);
+    server_metrics::h2_streams.add();
+    respond(s, ret);
+}
+
+void h2_session::respond(stream* s, http_conn::HTTP_CODE ret)
+{
+    int status = 200;
+    const char* content = NULL;
+    size_t len = 0;
+    switch (ret)
+    {
+    case http_conn::FILE_REQUEST:
+    {
+        /* 空文件的 mmap 会失败，与 HTTP/1.1 一样返回空白页面 */
+        if(s->file_size == 0)
+        {
+            s->file_address = NULL;
+            content = "<html><body></body></html>";
+            len = strlen(content);
+        }
+        else
+        {
+            content = s->file_address;
+            len = s->file_size;
+        }
+        break;
+    }
+    case http_conn::METRICS_REQUEST:
+    {
+        content = s->generated.data();
+        len = s->generated.size();
+        break;
+    }
+    case http_conn::FORBIDDEN_REQUEST:
+    {
+        status = 403;
+        content = error_403_form;
+        len = strlen(content);
+        break;
+    }
+    /* 与 HTTP/1.1 相同，语法错误也应答 404 */
+    case http_conn::BAD_REQUEST:
+    case http_conn::NO_RESOURCE:
+    {
+        status = 404;
+        content = error_404_form;
+        len = strlen(content);
+        break;
+    }
+    case http_conn::BAD_GATEWAY:
+    {
+        status = 502;
+        content = error_502_form;
+        len = strlen(content);
+        break;
+    }
+    default:
+    {
+        status = 500;
+        content = error_500_form;
+        len = strlen(content);
+        break;
+    }
+    }
+
+    char status_str[8];
+    char length_str[24];
+    char date[coarse_clock::HTTP_DATE_LEN];
+    snprintf(status_str, sizeof(status_str), "%d", status);
+    snprintf(length_str, sizeof(length_str), "%zu", len);
+    coarse_clock::get_instance()->http_date(date);
+
+    std::string block;
+    m_encoder.encode(block, ":status", status_str);
+    if(ret == http_conn::METRICS_REQUEST)
+    {
+        m_encoder.encode(block, "content-type", "text/plain; version=0.0.4", true);
+    }
+    m_encoder.encode(block, "content-length", length_str);
+    /* date 在一秒内不变，插入动态表后同一秒内的应答只需一个字节 */
+    m_encoder.encode(block, "date", date, true);
+    append_frame(FRAME_HEADERS, FLAG_END_HEADERS | (len == 0 ? FLAG_END_STREAM : 0), s->id,
+                    block.data(), block.size());
+    server_metrics::count_response(status);
+
+    s->responded = true;
+    s->content = content;
+    s->content_len = len;
+    /* 新加入调度的流从当前虚拟时间开始排队 */
+    s->vtime = m_vclock;
+    if(len == 0)
+    {
+        close_stream(s);
+    }
+}
+
+bool h2_session::on_priority(uint32_t id, const uint8_t* p, uint32_t len)
+{
+    if(id == 0)
+    {
+        return fail(PROTOCOL_ERROR);
+    }
+    if(len != 5)
+    {
+        reset(find(id), id, FRAME_SIZE_ERROR);
+        return true;
+    }
+    uint32_t dep = read_u32(p);
+    bool exclusive = (dep & 0x80000000) != 0;
+    dep &= 0x7fffffff;
+    if(dep == id)
+    {
+        reset(find(id), id, PROTOCOL_ERROR);
+        return true;
+    }
+    /* 尚未打开的流也可以设置优先级（如作为其他流的分组节点），已关闭的流忽略 */
+    if(id > m_last_stream || find(id))
+    {
+        set_priority(id, dep, p[4] + 1, exclusive);
+    }
+    return true;
+}
+
+bool h2_session::on_rst_stream(uint32_t id, uint32_t len)
+{
+    if(id == 0 || id > m_last_stream)
+    {
+        return fail(PROTOCOL_ERROR);
+    }
+    if(len != 4)
+    {
+        return fail(FRAME_SIZE_ERROR);
+    }
+    stream* s = find(id);
+    if(s)
+    {
+        close_stream(s);
+    }
+    return true;
+}
+
+bool h2_session::on_settings(uint8_t flags, uint32_t id, const uint8_t* p, uint32_t len)
+{
+    if(id != 0)
+    {
+        return fail(PROTOCOL_ERROR);
+    }
+    if(flags & FLAG_ACK)
+    {
+        return len == 0 || fail(FRAME_SIZE_ERROR);
+    }
+    if(len % 6 != 0)
+    {
+        return fail(FRAME_SIZE_ERROR);
+    }
+    ERROR_CODE code = apply_settings(p, len);
+    if(code != NO_ERROR)
+    {
+        return fail(code);
+    }
+    m_settings_received = true;
+    append_frame(FRAME_SETTINGS, FLAG_ACK, 0, NULL, 0);
+    return true;
+}
+
+h2_session::ERROR_CODE h2_session::apply_settings(const uint8_t* p, uint32_t len)
+{
+    for(uint32_t i = 0; i + 6 <= len; i += 6)
+    {
+        int key = (p[i] << 8) | p[i + 1];
+        uint32_t value = read_u32(p + i + 2);
+        switch (key)
+        {
+        case SETTINGS_HEADER_TABLE_SIZE:
+            m_encoder.set_max_size(value);
+            break;
+        case SETTINGS_ENABLE_PUSH:
+            if(value > 1)
+            {
+                return PROTOCOL_ERROR;
+            }
+            break;
+        case SETTINGS_INITIAL_WINDOW_SIZE:
+        {
+            if(value > MAX_WINDOW)
+            {
+                return FLOW_CONTROL_ERROR;
+            }
+            /* 初始窗口的变化作用于所有已打开的流 */
+            long long delta = (long long)value - m_peer_initial_window;
+            for(std::map<uint32_t, stream*>::iterator it = m_streams.begin(); it != m_streams.end(); ++it)
+            {
+                it->second->send_window += delta;
+                if(it->second->send_window > MAX_WINDOW)
+                {
+                    return FLOW_CONTROL_ERROR;
+                }
+            }
+            m_peer_initial_window = value;
+            break;
+        }
+        case SETTINGS_MAX_FRAME_SIZE:
+            /* 本端发送的帧不超过默认的 16384，只检查取值范围 */
+            if(value < 16384 || value > 16777215)
+            {
+                return PROTOCOL_ERROR;
+            }
+            break;
+        default:
+            /* SETTINGS_MAX_CONCURRENT_STREAMS 只限制本端发起的流（推送），本端不推送；其余忽略 */
+            break;
+        }
+    }
+    return NO_ERROR;
+}
+
+bool h2_session::on_ping(uint8_t flags, uint32_t id, const uint8_t* p, uint32_t len)
+{
+    if(id != 0)
+    {
+        return fail(PROTOCOL_ERROR);
+    }
+    if(len != 8)
+    {
+        return fail(FRAME_SIZE_ERROR);
+    }
+    if(!(flags & FLAG_ACK))
+    {
+        append_frame(FRAME_PING, FLAG_ACK, 0, p, 8);
+    }
+    return true;
+}
+
+bool h2_session::on_goaway(uint32_t id, uint32_t len)
+{
+    if(id != 0)
+    {
+        return fail(PROTOCOL_ERROR);
+    }
+    if(len < 8)
+    {
+        return fail(FRAME_SIZE_ERROR);
+    }
+    /* 对方不再发起新的流，已有的流应答完后关闭连接 */
+    m_peer_goaway = true;
+    return true;
+}
+
+bool h2_session::on_window_update(uint32_t id, const uint8_t* p, uint32_t len)
+{
+    if(len != 4)
+    {
+        return fail(FRAME_SIZE_ERROR);
+    }
+    uint32_t increment = read_u32(p) & 0x7fffffff;
+    if(id == 0)
+    {
+        if(increment == 0)
+        {
+            return fail(PROTOCOL_ERROR);
+        }
+        m_send_window += increment;
+        return m_send_window <= MAX_WINDOW || fail(FLOW_CONTROL_ERROR);
+    }
+
+    if(id > m_last_stream)
+    {
+        return fail(PROTOCOL_ERROR);
+    }
+    stream* s = find(id);
+    if(!s)
+    {
+        return true;
+    }
+    if(increment == 0)
+    {
+        reset(s, id, PROTOCOL_ERROR);
+        return true;
+    }
+    s->send_window += increment;
+    if(s->send_window > MAX_WINDOW)
+    {
+        reset(s, id, FLOW_CONTROL_ERROR);
+    }
+    return true;
+}
+
+bool h2_session::on_priority_update(uint32_t id, const uint8_t* p, uint32_t len)
+{
+    if(id != 0)
+    {
+        return fail(PROTOCOL_ERROR);
+    }
+    if(len < 4)
+    {
+        return fail(FRAME_SIZE_ERROR);
+    }
+    uint32_t target = read_u32(p) & 0x7fffffff;
+    if(target == 0)
+    {
+        return fail(PROTOCOL_ERROR);
+    }
+    /* 只调整已打开的流，尚未打开的流按它自己的请求头 */
+    stream* s = find(target);
+    if(s)
+    {
+        s->urgency = parse_urgency((const char*)p + 4, len - 4, DEFAULT_URGENCY);
+    }
+    return true;
+}
+
+h2_session::stream* h2_session::find(uint32_t id) const
+{
+    std::map<uint32_t, stream*>::const_iterator it = m_streams.find(id);
+    return it == m_streams.end() ? NULL : it->second;
+}
+
+h2_session::stream* h2_session::open_stream(uint32_t id)
+{
+    stream* s = new stream(id, m_peer_initial_window);
+    m_streams[id] = s;
+    if(m_prio.find(id) == m_prio.end())
+    {
+        prio_node node = { 0, DEFAULT_WEIGHT };
+        m_prio[id] = node;
+    }
+    return s;
+}
+
+void h2_session::close_stream(stream* s)
+{
+    m_streams.erase(s->id);
+
+    /* 子节点改为依赖本流的父节点 */
+    std::map<uint32_t, prio_node>::iterator self = m_prio.find(s->id);
+    if(self != m_prio.end())
+    {
+        uint32_t parent = self->second.parent;
+        for(std::map<uint32_t, prio_node>::iterator it = m_prio.begin(); it != m_prio.end(); ++it)
+        {
+            if(it->second.parent == s->id)
+            {
+                it->second.parent = parent;
+            }
+        }
+        m_prio.erase(self);
+    }
+
+    s->closed = true;
+    if(s->pending == 0)
+    {
+        delete s;
+    }
+}
+
+void h2_session::reset(stream* s, uint32_t id, ERROR_CODE code)
+{
+    char payload[4];
+    write_u32(payload, code);
+    append_frame(FRAME_RST_STREAM, 0, id, payload, sizeof(payload));
+    if(s)
+    {
+        close_stream(s);
+    }
+}
+
+bool h2_session::fail(ERROR_CODE code)
+{
+    char payload[8];
+    write_u32(payload, m_last_stream);
+    write_u32(payload + 4, code);
+    append_frame(FRAME_GOAWAY, 0, 0, payload, sizeof(payload));
+    m_failed = true;
+    return false;
+}
+
+bool h2_session::is_descendant(uint32_t node, uint32_t id) const
+{
+    for(int depth = 0; node != 0 && depth < MAX_DEPTH; ++depth)
+    {
+        if(node == id)
+        {
+            return true;
+        }
+        std::map<uint32_t, prio_node>::const_iterator it = m_prio.find(node);
+        if(it == m_prio.end())
+        {
+            return false;
+        }
+        node = it->second.parent;
+    }
+    return false;
+}
+
+void h2_session::set_priority(uint32_t id, uint32_t depend, int weight, bool exclusive)
+{
+    /* 尚未打开的流的节点数有上限，超出后忽略这类 PRIORITY 帧 */
+    if(m_prio.find(id) == m_prio.end() && m_prio.size() >= 2 * m_max_streams + 16)
+    {
+        return;
+    }
+    /* 依赖于不在树中的流时使用默认优先级 */
+    if(depend != 0 && m_prio.find(depend) == m_prio.end())
+    {
+        depend = 0;
+        weight = DEFAULT_WEIGHT;
+        exclusive = false;
+    }
+
+    if(m_prio.find(id) == m_prio.end())
+    {
+        prio_node node = { 0, DEFAULT_WEIGHT };
+        m_prio[id] = node;
+    }
+    prio_node& node = m_prio[id];
+    /* 依赖于自己的后代时，先把该后代移到本流原来的位置，避免成环 */
+    if(depend != 0 && is_descendant(depend, id))
+    {
+        m_prio[depend].parent = node.parent;
+    }
+    /* 独占依赖：被依赖流原有的子节点都改为依赖本流 */
+    if(exclusive)
+    {
+        for(std::map<uint32_t, prio_node>::iterator it = m_prio.begin(); it != m_prio.end(); ++it)
+        {
+            if(it->second.parent == depend && it->first != id)
+            {
+                it->second.parent = id;
+            }
+        }
+    }
+    node.parent = depend;
+    node.weight = weight;
+}
+
+bool h2_session::blocked_by_ancestor(const stream* s) const
+{
+    std::map<uint32_t, prio_node>::const_iterator it = m_prio.find(s->id);
+    for(int depth = 0; it != m_prio.end() && it->second.parent != 0 && depth < MAX_DEPTH; ++depth)
+    {
+        const stream* parent = find(it->second.parent);
+        if(parent && parent->urgency <= s->urgency && sendable(parent))
+        {
+            return true;
+        }
+        it = m_prio.find(it->second.parent);
+    }
+    return false;
+}
+
+h2_session::stream* h2_session::pick() const
+{
+    stream* best = NULL;
+    for(std::map<uint32_t, stream*>::const_iterator it = m_streams.begin(); it != m_streams.end(); ++it)
+    {
+        stream* s = it->second;
+        if(!sendable(s) || blocked_by_ancestor(s))
+        {
+            continue;
+        }
+        /* 先比 urgency，再比虚拟完成时间，相同时先打开的流优先 */
+        if(!best || s->urgency < best->urgency ||
+            (s->urgency == best->urgency && s->vtime < best->vtime))
+        {
+            best = s;
+        }
+    }
+    return best;
+}
+
+void h2_session::fill()
+{
+    /* h2c 升级后流 1 的正文等收到对方的连接前言再发，对方在此之前只准备好了接收 101 之后的少量数据 */
+    if(m_queued >= FILL_LOW || !m_settings_received)
+    {
+        return;
+    }
+    while (m_queued < FILL_LIMIT && m_send_window > 0)
+    {
+        stream* s = pick();
+        if(!s)
+        {
+            break;
+        }
+        if(s->vtime > m_vclock)
+        {
+            m_vclock = s->vtime;
+        }
+
+        size_t n = s->content_len - s->sent;
+        if(n > FRAME_SIZE)
+        {
+            n = FRAME_SIZE;
+        }
+        if((long long)n > m_send_window)
+        {
+            n = m_send_window;
+        }
+        if((long long)n > s->send_window)
+        {
+            n = s->send_window;
+        }
+        bool last = s->sent + n == s->content_len;
+
+        /* 帧头在 m_out 中，载荷直接引用正文 */
+        append_frame(FRAME_DATA, last ? FLAG_END_STREAM : 0, s->id, NULL, n);
+        append_content(s, s->content + s->sent, n);
+        s->sent += n;
+        s->send_window -= n;
+        m_send_window -= n;
+
+        /* 权重越大，发送同样多的字节虚拟时间增加得越少 */
+        std::map<uint32_t, prio_node>::const_iterator node = m_prio.find(s->id);
+        int weight = node == m_prio.end() ? DEFAULT_WEIGHT : node->second.weight;
+        s->vtime += (unsigned long long)n * 256 / weight;
+
+        if(last)
+        {
+            close_stream(s);
+        }
+    }
+}
+
+void h2_session::append_frame(uint8_t type, uint8_t flags, uint32_t id, const void* payload, size_t len)
+{
+    char header[9];
+    header[0] = (char)(len >> 16);
+    header[1] = (char)(len >> 8);
+    header[2] = (char)len;
+    header[3] = (char)type;
+    header[4] = (char)flags;
+    write_u32(header + 5, id);
+    append_raw(header, sizeof(header));
+    if(payload)
+    {
+        append_raw((const char*)payload, len);
+    }
+}
+
+void h2_session::append_raw(const char* data, size_t len)
+{
+    if(len == 0)
+    {
+        return;
+    }
+    /* 与前一段 m_out 中的数据相邻时合并 */
+    if(!m_chunks.empty() && !m_chunks.back().ptr && m_chunks.back().off + m_chunks.back().len == m_out.size())
+    {
+        m_chunks.back().len += len;
+    }
+    else
+    {
+        chunk c = { m_out.size(), NULL, len, NULL };
+        m_chunks.push_back(c);
+    }
+    m_out.append(data, len);
+    m_queued += len;
+    m_raw_queued += len;
+}
+
+void h2_session::append_content(stream* s, const char* data, size_t len)
+{
+    if(len == 0)
+    {
+        return;
+    }
+    chunk c = { 0, data, len, s };
+    m_chunks.push_back(c);
+    ++s->pending;
+    m_queued += len;
+}
+
+void h2_session::send_settings()
+{
+    char payload[6];
+    payload[0] = 0;
+    payload[1] = SETTINGS_MAX_CONCURRENT_STREAMS;
+    write_u32(payload + 2, m_max_streams);
+    append_frame(FRAME_SETTINGS, 0, 0, payload, sizeof(payload));
+}
+
+void h2_session::send_window_update(uint32_t id, uint32_t increment)
+{
+    char payload[4];
+    write_u32(payload, increment);
+    append_frame(FRAME_WINDOW_UPDATE, 0, id, payload, sizeof(payload));
+}
+
+int h2_session::gather(struct iovec* iov, int max) const
+{
+    int count = 0;
+    size_t off = m_front_off;
+    for(std::deque<chunk>::const_iterator it = m_chunks.begin(); it != m_chunks.end() && count < max; ++it)
+    {
+        const char* base = it->ptr ? it->ptr : m_out.data() + it->off;
+        iov[count].iov_base = (void*)(base + off);
+        iov[count].iov_len = it->len - off;
+        ++count;
+        off = 0;
+    }
+    return count;
+}
+
+void h2_session::consume(size_t n)
+{
+    m_queued -= n;
+    while (n > 0 && !m_chunks.empty())
+    {
+        chunk& c = m_chunks.front();
+        size_t left = c.len - m_front_off;
+        if(n < left)
+        {
+            m_front_off += n;
+            if(!c.ptr)
+            {
+                m_raw_queued -= n;
+            }
+            break;
+        }
+        if(!c.ptr)
+        {
+            m_raw_queued -= left;
+        }
+        n -= left;
+        m_front_off = 0;
+        if(c.owner && --c.owner->pending == 0 && c.owner->closed)
+        {
+            delete c.owner;
+        }
+        m_chunks.pop_front();
+    }
+
+    if(m_chunks.empty())
+    {
+        m_out.clear();
+        return;
+    }
+    /* 长时间的传输中队列一直不空，m_out 前部已发送的部分达到一定大小后移除 */
+    if(m_out.size() > 65536)
+    {
+        size_t base = m_out.size();
+        for(std::deque<chunk>::iterator it = m_chunks.begin(); it != m_chunks.end(); ++it)
+        {
+            if(!it->ptr)
+            {
+                base = it->off;
+                break;
+            }
+        }
+        if(base > m_out.size() / 2)
+        {
+            m_out.erase(0, base);
+            for(std::deque<chunk>::iterator it = m_chunks.begin(); it != m_chunks.end(); ++it)
+            {
+                if(!it->ptr)
+                {
+                    it->off -= base;
+                }
+            }
+        }
+    }
+}
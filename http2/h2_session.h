@@ -0,0 +1,282 @@
+#ifndef H2_SESSION_H
+#define H2_SESSION_H
+
+#include <stdint.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <deque>
+#include <map>
+#include <string>
+
+#include "hpack.h"
+#include "../http/http_conn.h"
+
+/* HTTP/2 连接（RFC 9113）
+   连接以三种方式进入 HTTP/2：明文连接上直接发送连接前言（先验知识）、HTTP/1.1 请求带 Upgrade: h2c 升级，
+   以及 TLS 握手时经 ALPN 协商为 h2（之后同样以连接前言开始）。http_conn 识别出来后创建本对象，
+   之后该连接上读到的数据都交给 on_data 按帧处理，应答帧由 fill 排入发送队列，http_conn 用 gather/consume 写出。
+   每个请求占一个流，请求完整后在当前工作线程中经 http_conn::route 找到应答内容，与 HTTP/1.1 走同一套路由、
+   同样把文件 mmap 后直接从映射的页面发送；DATA 帧的载荷直接指向 mmap 的页面，不复制。
+   发送受连接和流两级流量控制窗口限制，窗口用完的流等待对方的 WINDOW_UPDATE。
+   多个流都有数据可发时按优先级调度：先按请求头 priority 的 urgency（RFC 9218）分级，
+   同级内按 RFC 7540 的依赖树，父流还有数据可发时子流等待，兄弟流之间按权重加权公平排队。
+   对象只由占有连接的线程访问，不需要加锁 */
+class h2_session
+{
+public:
+    /* 单个 DATA 帧的最大载荷，等于协议默认的 SETTINGS_MAX_FRAME_SIZE，与 TLS 记录的大小一致 */
+    static const uint32_t FRAME_SIZE = 16384;
+    /* 每个连接最多同时打开的流数，在 SETTINGS_MAX_CONCURRENT_STREAMS 中通告 */
+    static uint32_t m_max_streams;
+
+    /* 连接前言 */
+    static const char PREFACE[];
+    static const int PREFACE_LEN = 24;
+
+public:
+    explicit h2_session(const sockaddr_in& peer);
+    ~h2_session();
+
+    /* 先验知识和 ALPN：连接以客户端的连接前言开始，先排入服务端的连接前言（SETTINGS 帧） */
+    void start();
+    /* h2c 升级：先发送 101 应答，升级请求本身作为流 1，其结果 ret 和 route 给出的应答内容转交给本对象。
+        settings 为请求头 HTTP2-Settings 的值（base64url 编码的 SETTINGS 载荷），格式错误返回 false */
+    bool upgrade(const char* settings, http_conn::HTTP_CODE ret, char* file_address, off_t file_size,
+                    std::string& body);
+
+    /* 处理收到的数据，不完整的帧留到下次。mysql 为当前线程持有的数据库连接，可为 NULL，需要时再从连接池取。
+        出现连接错误时已排入 GOAWAY，返回 false，之后的数据都被忽略 */
+    bool on_data(const char* data, size_t len, MYSQL* mysql);
+    /* 按优先级和流量控制窗口把应答的 DATA 帧排入发送队列 */
+    void fill();
+    /* 把发送队列开头最多 max 段填入 iov，返回段数 */
+    int gather(struct iovec* iov, int max) const;
+    /* 已写出 n 字节 */
+    void consume(size_t n);
+
+    /* 发送队列中的字节数 */
+    size_t queued() const { return m_queued; }
+    /* 是否有未收完的帧 */
+    bool partial() const { return !m_in.empty(); }
+    /* 连接可以关闭：GOAWAY 已发出，或对方发来 GOAWAY 后所有流都已结束，且发送队列已空 */
+    bool finished() const
+    {
+        return m_queued == 0 && (m_failed || (m_peer_goaway && m_streams.empty()));
+    }
+    /* 生成一个 GOAWAY(NO_ERROR) 帧，超时关闭前尽力发送，frame 至少 17 字节，返回帧长度 */
+    int goaway_frame(char* frame) const;
+
+private:
+    /* 帧类型 */
+    enum FRAME_TYPE
+    {
+        FRAME_DATA = 0,
+        FRAME_HEADERS,
+        FRAME_PRIORITY,
+        FRAME_RST_STREAM,
+        FRAME_SETTINGS,
+        FRAME_PUSH_PROMISE,
+        FRAME_PING,
+        FRAME_GOAWAY,
+        FRAME_WINDOW_UPDATE,
+        FRAME_CONTINUATION,
+        FRAME_PRIORITY_UPDATE = 0x10    /* RFC 9218 */
+    };
+    /* 帧标志 */
+    enum FRAME_FLAG
+    {
+        FLAG_END_STREAM = 0x1,
+        FLAG_ACK = 0x1,
+        FLAG_END_HEADERS = 0x4,
+        FLAG_PADDED = 0x8,
+        FLAG_PRIORITY = 0x20
+    };
+    /* 错误码 */
+    enum ERROR_CODE
+    {
+        NO_ERROR = 0,
+        PROTOCOL_ERROR,
+        INTERNAL_ERROR,
+        FLOW_CONTROL_ERROR,
+        SETTINGS_TIMEOUT,
+        STREAM_CLOSED,
+        FRAME_SIZE_ERROR,
+        REFUSED_STREAM,
+        CANCEL,
+        COMPRESSION_ERROR,
+        CONNECT_ERROR,
+        ENHANCE_YOUR_CALM
+    };
+    /* 对方的 SETTINGS 参数 */
+    enum SETTING
+    {
+        SETTINGS_HEADER_TABLE_SIZE = 1,
+        SETTINGS_ENABLE_PUSH,
+        SETTINGS_MAX_CONCURRENT_STREAMS,
+        SETTINGS_INITIAL_WINDOW_SIZE,
+        SETTINGS_MAX_FRAME_SIZE,
+        SETTINGS_MAX_HEADER_LIST_SIZE
+    };
+
+    /* 窗口的上限 2^31 - 1 */
+    static const long long MAX_WINDOW = 0x7fffffff;
+    /* 协议默认的初始窗口 */
+    static const long long DEFAULT_WINDOW = 65535;
+    /* 请求消息体的上限，登录和注册的表单远小于它 */
+    static const size_t MAX_BODY = 65536;
+    /* 一个头部块（HEADERS 加 CONTINUATION）的上限 */
+    static const size_t MAX_HEADER_BLOCK = 65536;
+    /* 发送队列低于该值时才继续排入 DATA 帧，排入后不超过 FILL_LIMIT */
+    static const size_t FILL_LOW = 32768;
+    static const size_t FILL_LIMIT = 262144;
+    /* 发送队列中本端生成的帧（控制帧、应答头和 DATA 帧头）的上限。对方只发 PING、SETTINGS、
+        会被重置的流等却不读应答时，这部分会无限增长，超过后以 ENHANCE_YOUR_CALM 关闭连接 */
+    static const size_t MAX_RAW_QUEUE = 262144;
+    /* RFC 9218 的默认 urgency */
+    static const int DEFAULT_URGENCY = 3;
+
+    /* 一个流 */
+    struct stream
+    {
+        uint32_t id;
+        bool end_remote;        /* 请求已收完 */
+        bool responded;         /* 应答头已排入发送队列 */
+        bool closed;            /* 已从流表中移除，等待引用它的 DATA 段发送完再释放 */
+        long long send_window;
+        long long recv_window;
+        int urgency;
+        unsigned long long vtime;   /* 加权公平排队的虚拟完成时间 */
+
+        /* 请求 */
+        std::string method;
+        std::string path;
+        std::string body;
+        long long content_length;   /* 请求头中的 content-length，-1 表示没有 */
+
+        /* 应答正文：mmap 的文件、生成的正文或静态的错误页面 */
+        char* file_address;
+        size_t file_size;
+        std::string generated;
+        const char* content;
+        size_t content_len;
+        size_t sent;
+        /* 发送队列中引用本流正文的段数 */
+        int pending;
+
+        stream(uint32_t sid, long long window);
+        ~stream();
+    };
+
+    /* 依赖树的节点，打开的流以及 PRIORITY 帧提到的尚未打开的流都有节点 */
+    struct prio_node
+    {
+        uint32_t parent;
+        int weight;     /* 1..256 */
+    };
+
+    /* 发送队列中的一段：ptr 为 NULL 时是 m_out 中从 off 开始的字节，否则直接指向 owner 的正文 */
+    struct chunk
+    {
+        size_t off;
+        const char* ptr;
+        size_t len;
+        stream* owner;
+    };
+
+    bool process_frame(uint8_t type, uint8_t flags, uint32_t id, const uint8_t* p, uint32_t len);
+    bool on_data_frame(uint8_t flags, uint32_t id, const uint8_t* p, uint32_t len);
+    bool on_headers(uint8_t flags, uint32_t id, const uint8_t* p, uint32_t len);
+    bool on_continuation(uint8_t flags, uint32_t id, const uint8_t* p, uint32_t len);
+    bool on_header_block(uint32_t id, bool end_stream);
+    bool on_priority(uint32_t id, const uint8_t* p, uint32_t len);
+    bool on_rst_stream(uint32_t id, uint32_t len);
+    bool on_settings(uint8_t flags, uint32_t id, const uint8_t* p, uint32_t len);
+    bool on_ping(uint8_t flags, uint32_t id, const uint8_t* p, uint32_t len);
+    bool on_goaway(uint32_t id, uint32_t len);
+    bool on_window_update(uint32_t id, const uint8_t* p, uint32_t len);
+    bool on_priority_update(uint32_t id, const uint8_t* p, uint32_t len);
+    /* 应用一组 SETTINGS 参数，出错时返回错误码 */
+    ERROR_CODE apply_settings(const uint8_t* p, uint32_t len);
+
+    /* 请求头解码后检查并记入流，格式错误返回 false */
+    bool take_headers(stream* s, const std::vector<hpack_header>& headers);
+    /* 请求已完整：路由并排入应答头 */
+    void handle(stream* s, MYSQL* mysql);
+    /* 按路由结果准备应答正文并排入应答头 */
+    void respond(stream* s, http_conn::HTTP_CODE ret);
+
+    stream* find(uint32_t id) const;
+    stream* open_stream(uint32_t id);
+    /* 流已结束：移出流表和依赖树，没有待发送的段时立即释放 */
+    void close_stream(stream* s);
+    /* 以错误码重置流 */
+    void reset(stream* s, uint32_t id, ERROR_CODE code);
+    /* 连接错误：排入 GOAWAY，之后不再处理任何帧 */
+    bool fail(ERROR_CODE code);
+
+    /* 调整依赖树，depend 为被依赖的流 */
+    void set_priority(uint32_t id, uint32_t depend, int weight, bool exclusive);
+    /* 选出下一个发送 DATA 帧的流 */
+    stream* pick() const;
+    /* 流的祖先中是否有同级或更紧急、可以发送的流 */
+    bool blocked_by_ancestor(const stream* s) const;
+    /* node 是否为 id 的后代 */
+    bool is_descendant(uint32_t node, uint32_t id) const;
+    bool sendable(const stream* s) const
+    {
+        return s->responded && s->sent < s->content_len && s->send_window > 0;
+    }
+
+    void append_frame(uint8_t type, uint8_t flags, uint32_t id, const void* payload, size_t len);
+    void append_raw(const char* data, size_t len);
+    void append_content(stream* s, const char* data, size_t len);
+    void send_settings();
+    void send_window_update(uint32_t id, uint32_t increment);
+
+private:
+    sockaddr_in m_peer;
+    hpack_decoder m_decoder;
+    hpack_encoder m_encoder;
+
+    /* 跨越多次读取的不完整帧 */
+    std::string m_in;
+    /* 是否已收到连接前言和对方的第一个 SETTINGS */
+    bool m_preface_done;
+    bool m_settings_received;
+
+    std::map<uint32_t, stream*> m_streams;
+    std::map<uint32_t, prio_node> m_prio;
+    /* 对方打开过的最大流 ID */
+    uint32_t m_last_stream;
+
+    /* 正在接收的头部块（HEADERS 之后等待 CONTINUATION）：流 ID（0 表示没有）、标志和内容，
+        以及 HEADERS 中的优先级是否依赖于流自身（解码完头部块后重置该流） */
+    uint32_t m_header_stream;
+    uint8_t m_header_flags;
+    std::string m_header_block;
+    bool m_header_self_dep;
+
+    /* 对方的设置 */
+    long long m_peer_initial_window;
+    /* 连接级窗口 */
+    long long m_send_window;
+    long long m_recv_window;
+
+    /* 发送队列 */
+    std::string m_out;
+    std::deque<chunk> m_chunks;
+    size_t m_front_off;
+    size_t m_queued;
+    /* 发送队列中位于 m_out 的字节数 */
+    size_t m_raw_queued;
+    /* 加权公平排队的当前虚拟时间 */
+    unsigned long long m_vclock;
+
+    bool m_failed;
+    bool m_peer_goaway;
+
+    /* 当前 on_data 调用中的数据库连接 */
+    MYSQL* m_mysql;
+};
+
+#endif
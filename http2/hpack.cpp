@@ -0,0 +1,539 @@
+#include <string.h>
+
+#include "hpack.h"
+
+/* 静态表（RFC 7541 附录 A），下标 0 不使用 */
+static const struct { const char* name; const char* value; } static_table[] = {
+    { "", "" },
+    { ":authority", "" },
+    { ":method", "GET" },
+    { ":method", "POST" },
+    { ":path", "/" },
+    { ":path", "/index.html" },
+    { ":scheme", "http" },
+    { ":scheme", "https" },
+    { ":status", "200" },
+    { ":status", "204" },
+    { ":status", "206" },
+    { ":status", "304" },
+    { ":status", "400" },
+    { ":status", "404" },
+    { ":status", "500" },
+    { "accept-charset", "" },
+    { "accept-encoding", "gzip, deflate" },
+    { "accept-language", "" },
+    { "accept-ranges", "" },
+    { "accept", "" },
+    { "access-control-allow-origin", "" },
+    { "age", "" },
+    { "allow", "" },
+    { "authorization", "" },
+    { "cache-control", "" },
+    { "content-disposition", "" },
+    { "content-encoding", "" },
+    { "content-language", "" },
+    { "content-length", "" },
+    { "content-location", "" },
+    { "content-range", "" },
+    { "content-type", "" },
+    { "cookie", "" },
+    { "date", "" },
+    { "etag", "" },
+    { "expect", "" },
+    { "expires", "" },
+    { "from", "" },
+    { "host", "" },
+    { "if-match", "" },
+    { "if-modified-since", "" },
+    { "if-none-match", "" },
+    { "if-range", "" },
+    { "if-unmodified-since", "" },
+    { "last-modified", "" },
+    { "link", "" },
+    { "location", "" },
+    { "max-forwards", "" },
+    { "proxy-authenticate", "" },
+    { "proxy-authorization", "" },
+    { "range", "" },
+    { "referer", "" },
+    { "refresh", "" },
+    { "retry-after", "" },
+    { "server", "" },
+    { "set-cookie", "" },
+    { "strict-transport-security", "" },
+    { "transfer-encoding", "" },
+    { "user-agent", "" },
+    { "vary", "" },
+    { "via", "" },
+    { "www-authenticate", "" },
+};
+static const uint32_t STATIC_COUNT = sizeof(static_table) / sizeof(static_table[0]) - 1;
+
+/* Huffman 编码表（RFC 7541 附录 B）：每个符号的码字（右对齐）和位数，第 256 个为 EOS */
+static const struct { uint32_t code; uint8_t bits; } huffman_codes[257] = {
+    { 0x1ff8, 13 }, { 0x7fffd8, 23 }, { 0xfffffe2, 28 }, { 0xfffffe3, 28 },
+    { 0xfffffe4, 28 }, { 0xfffffe5, 28 }, { 0xfffffe6, 28 }, { 0xfffffe7, 28 },
+    { 0xfffffe8, 28 }, { 0xffffea, 24 }, { 0x3ffffffc, 30 }, { 0xfffffe9, 28 },
+    { 0xfffffea, 28 }, { 0x3ffffffd, 30 }, { 0xfffffeb, 28 }, { 0xfffffec, 28 },
+    { 0xfffffed, 28 }, { 0xfffffee, 28 }, { 0xfffffef, 28 }, { 0xffffff0, 28 },
+    { 0xffffff1, 28 }, { 0xffffff2, 28 }, { 0x3ffffffe, 30 }, { 0xffffff3, 28 },
+    { 0xffffff4, 28 }, { 0xffffff5, 28 }, { 0xffffff6, 28 }, { 0xffffff7, 28 },
+    { 0xffffff8, 28 }, { 0xffffff9, 28 }, { 0xffffffa, 28 }, { 0xffffffb, 28 },
+    { 0x14, 6 }, { 0x3f8, 10 }, { 0x3f9, 10 }, { 0xffa, 12 },
+    { 0x1ff9, 13 }, { 0x15, 6 }, { 0xf8, 8 }, { 0x7fa, 11 },
+    { 0x3fa, 10 }, { 0x3fb, 10 }, { 0xf9, 8 }, { 0x7fb, 11 },
+    { 0xfa, 8 }, { 0x16, 6 }, { 0x17, 6 }, { 0x18, 6 },
+    { 0x0, 5 }, { 0x1, 5 }, { 0x2, 5 }, { 0x19, 6 },
+    { 0x1a, 6 }, { 0x1b, 6 }, { 0x1c, 6 }, { 0x1d, 6 },
+    { 0x1e, 6 }, { 0x1f, 6 }, { 0x5c, 7 }, { 0xfb, 8 },
+    { 0x7ffc, 15 }, { 0x20, 6 }, { 0xffb, 12 }, { 0x3fc, 10 },
+    { 0x1ffa, 13 }, { 0x21, 6 }, { 0x5d, 7 }, { 0x5e, 7 },
+    { 0x5f, 7 }, { 0x60, 7 }, { 0x61, 7 }, { 0x62, 7 },
+    { 0x63, 7 }, { 0x64, 7 }, { 0x65, 7 }, { 0x66, 7 },
+    { 0x67, 7 }, { 0x68, 7 }, { 0x69, 7 }, { 0x6a, 7 },
+    { 0x6b, 7 }, { 0x6c, 7 }, { 0x6d, 7 }, { 0x6e, 7 },
+    { 0x6f, 7 }, { 0x70, 7 }, { 0x71, 7 }, { 0x72, 7 },
+    { 0xfc, 8 }, { 0x73, 7 }, { 0xfd, 8 }, { 0x1ffb, 13 },
+    { 0x7fff0, 19 }, { 0x1ffc, 13 }, { 0x3ffc, 14 }, { 0x22, 6 },
+    { 0x7ffd, 15 }, { 0x3, 5 }, { 0x23, 6 }, { 0x4, 5 },
+    { 0x24, 6 }, { 0x5, 5 }, { 0x25, 6 }, { 0x26, 6 },
+    { 0x27, 6 }, { 0x6, 5 }, { 0x74, 7 }, { 0x75, 7 },
+    { 0x28, 6 }, { 0x29, 6 }, { 0x2a, 6 }, { 0x7, 5 },
+    { 0x2b, 6 }, { 0x76, 7 }, { 0x2c, 6 }, { 0x8, 5 },
+    { 0x9, 5 }, { 0x2d, 6 }, { 0x77, 7 }, { 0x78, 7 },
+    { 0x79, 7 }, { 0x7a, 7 }, { 0x7b, 7 }, { 0x7ffe, 15 },
+    { 0x7fc, 11 }, { 0x3ffd, 14 }, { 0x1ffd, 13 }, { 0xffffffc, 28 },
+    { 0xfffe6, 20 }, { 0x3fffd2, 22 }, { 0xfffe7, 20 }, { 0xfffe8, 20 },
+    { 0x3fffd3, 22 }, { 0x3fffd4, 22 }, { 0x3fffd5, 22 }, { 0x7fffd9, 23 },
+    { 0x3fffd6, 22 }, { 0x7fffda, 23 }, { 0x7fffdb, 23 }, { 0x7fffdc, 23 },
+    { 0x7fffdd, 23 }, { 0x7fffde, 23 }, { 0xffffeb, 24 }, { 0x7fffdf, 23 },
+    { 0xffffec, 24 }, { 0xffffed, 24 }, { 0x3fffd7, 22 }, { 0x7fffe0, 23 },
+    { 0xffffee, 24 }, { 0x7fffe1, 23 }, { 0x7fffe2, 23 }, { 0x7fffe3, 23 },
+    { 0x7fffe4, 23 }, { 0x1fffdc, 21 }, { 0x3fffd8, 22 }, { 0x7fffe5, 23 },
+    { 0x3fffd9, 22 }, { 0x7fffe6, 23 }, { 0x7fffe7, 23 }, { 0xffffef, 24 },
+    { 0x3fffda, 22 }, { 0x1fffdd, 21 }, { 0xfffe9, 20 }, { 0x3fffdb, 22 },
+    { 0x3fffdc, 22 }, { 0x7fffe8, 23 }, { 0x7fffe9, 23 }, { 0x1fffde, 21 },
+    { 0x7fffea, 23 }, { 0x3fffdd, 22 }, { 0x3fffde, 22 }, { 0xfffff0, 24 },
+    { 0x1fffdf, 21 }, { 0x3fffdf, 22 }, { 0x7fffeb, 23 }, { 0x7fffec, 23 },
+    { 0x1fffe0, 21 }, { 0x1fffe1, 21 }, { 0x3fffe0, 22 }, { 0x1fffe2, 21 },
+    { 0x7fffed, 23 }, { 0x3fffe1, 22 }, { 0x7fffee, 23 }, { 0x7fffef, 23 },
+    { 0xfffea, 20 }, { 0x3fffe2, 22 }, { 0x3fffe3, 22 }, { 0x3fffe4, 22 },
+    { 0x7ffff0, 23 }, { 0x3fffe5, 22 }, { 0x3fffe6, 22 }, { 0x7ffff1, 23 },
+    { 0x3ffffe0, 26 }, { 0x3ffffe1, 26 }, { 0xfffeb, 20 }, { 0x7fff1, 19 },
+    { 0x3fffe7, 22 }, { 0x7ffff2, 23 }, { 0x3fffe8, 22 }, { 0x1ffffec, 25 },
+    { 0x3ffffe2, 26 }, { 0x3ffffe3, 26 }, { 0x3ffffe4, 26 }, { 0x7ffffde, 27 },
+    { 0x7ffffdf, 27 }, { 0x3ffffe5, 26 }, { 0xfffff1, 24 }, { 0x1ffffed, 25 },
+    { 0x7fff2, 19 }, { 0x1fffe3, 21 }, { 0x3ffffe6, 26 }, { 0x7ffffe0, 27 },
+    { 0x7ffffe1, 27 }, { 0x3ffffe7, 26 }, { 0x7ffffe2, 27 }, { 0xfffff2, 24 },
+    { 0x1fffe4, 21 }, { 0x1fffe5, 21 }, { 0x3ffffe8, 26 }, { 0x3ffffe9, 26 },
+    { 0xffffffd, 28 }, { 0x7ffffe3, 27 }, { 0x7ffffe4, 27 }, { 0x7ffffe5, 27 },
+    { 0xfffec, 20 }, { 0xfffff3, 24 }, { 0xfffed, 20 }, { 0x1fffe6, 21 },
+    { 0x3fffe9, 22 }, { 0x1fffe7, 21 }, { 0x1fffe8, 21 }, { 0x7ffff3, 23 },
+    { 0x3fffea, 22 }, { 0x3fffeb, 22 }, { 0x1ffffee, 25 }, { 0x1ffffef, 25 },
+    { 0xfffff4, 24 }, { 0xfffff5, 24 }, { 0x3ffffea, 26 }, { 0x7ffff4, 23 },
+    { 0x3ffffeb, 26 }, { 0x7ffffe6, 27 }, { 0x3ffffec, 26 }, { 0x3ffffed, 26 },
+    { 0x7ffffe7, 27 }, { 0x7ffffe8, 27 }, { 0x7ffffe9, 27 }, { 0x7ffffea, 27 },
+    { 0x7ffffeb, 27 }, { 0xffffffe, 28 }, { 0x7ffffec, 27 }, { 0x7ffffed, 27 },
+    { 0x7ffffee, 27 }, { 0x7ffffef, 27 }, { 0x7fffff0, 27 }, { 0x3ffffee, 26 },
+    { 0x3fffffff, 30 },
+};
+
+/* 由编码表建成的解码树，逐位查找。节点 0 为根，child 为 0 表示不存在（根不会是子节点），
+   叶子的 symbol 为符号值 */
+class huffman_tree
+{
+public:
+    static const huffman_tree& get()
+    {
+        static huffman_tree tree;
+        return tree;
+    }
+
+    struct node
+    {
+        int child[2];
+        int symbol;     /* 非叶子为 -1 */
+    };
+
+    std::vector<node> nodes;
+
+private:
+    huffman_tree()
+    {
+        node root = { { 0, 0 }, -1 };
+        nodes.push_back(root);
+        for(int sym = 0; sym < 257; ++sym)
+        {
+            int cur = 0;
+            for(int bit = huffman_codes[sym].bits - 1; bit >= 0; --bit)
+            {
+                int b = (huffman_codes[sym].code >> bit) & 1;
+                if(nodes[cur].child[b] == 0)
+                {
+                    node n = { { 0, 0 }, -1 };
+                    nodes.push_back(n);
+                    nodes[cur].child[b] = (int)nodes.size() - 1;
+                }
+                cur = nodes[cur].child[b];
+            }
+            nodes[cur].symbol = sym;
+        }
+    }
+};
+
+void hpack_table::set_max_size(size_t max_size)
+{
+    m_max_size = max_size;
+    evict(0);
+}
+
+void hpack_table::evict(size_t needed)
+{
+    while (!m_entries.empty() && m_size + needed > m_max_size)
+    {
+        const hpack_header& h = m_entries.back();
+        m_size -= h.name.size() + h.value.size() + ENTRY_OVERHEAD;
+        m_entries.pop_back();
+    }
+}
+
+void hpack_table::add(const std::string& name, const std::string& value)
+{
+    size_t size = name.size() + value.size() + ENTRY_OVERHEAD;
+    /* 比整张表还大的条目使表变空，本身也不插入 */
+    evict(size);
+    if(size > m_max_size)
+    {
+        return;
+    }
+    hpack_header h;
+    h.name = name;
+    h.value = value;
+    m_entries.push_front(h);
+    m_size += size;
+}
+
+void hpack::encode_int(std::string& out, uint32_t value, int prefix_bits, uint8_t flags)
+{
+    uint32_t max_prefix = (1u << prefix_bits) - 1;
+    if(value < max_prefix)
+    {
+        out.push_back((char)(flags | value));
+        return;
+    }
+    out.push_back((char)(flags | max_prefix));
+    value -= max_prefix;
+    while (value >= 128)
+    {
+        out.push_back((char)((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.push_back((char)value);
+}
+
+void hpack::encode_string(std::string& out, const char* s, size_t len, bool huffman)
+{
+    size_t bits = 0;
+    if(huffman)
+    {
+        for(size_t i = 0; i < len; ++i)
+        {
+            bits += huffman_codes[(uint8_t)s[i]].bits;
+        }
+    }
+    size_t encoded = (bits + 7) / 8;
+    if(!huffman || encoded >= len)
+    {
+        encode_int(out, (uint32_t)len, 7, 0);
+        out.append(s, len);
+        return;
+    }
+
+    encode_int(out, (uint32_t)encoded, 7, 0x80);
+    /* 码字最长 30 位，累加器中最多留 7 位，64 位足够 */
+    uint64_t acc = 0;
+    int acc_bits = 0;
+    for(size_t i = 0; i < len; ++i)
+    {
+        acc = (acc << huffman_codes[(uint8_t)s[i]].bits) | huffman_codes[(uint8_t)s[i]].code;
+        acc_bits += huffman_codes[(uint8_t)s[i]].bits;
+        while (acc_bits >= 8)
+        {
+            acc_bits -= 8;
+            out.push_back((char)(acc >> acc_bits));
+        }
+    }
+    /* 最后不足一个字节的部分用 EOS 的高位（全 1）填充 */
+    if(acc_bits > 0)
+    {
+        out.push_back((char)((acc << (8 - acc_bits)) | (0xff >> acc_bits)));
+    }
+}
+
+bool hpack::huffman_decode(const uint8_t* data, size_t len, std::string& out)
+{
+    const std::vector<huffman_tree::node>& nodes = huffman_tree::get().nodes;
+    int cur = 0;
+    /* 当前未完成的码字的位数和这些位是否全为 1，用于检查结尾的填充 */
+    int depth = 0;
+    bool all_ones = true;
+    for(size_t i = 0; i < len; ++i)
+    {
+        for(int bit = 7; bit >= 0; --bit)
+        {
+            int b = (data[i] >> bit) & 1;
+            cur = nodes[cur].child[b];
+            if(cur == 0)
+            {
+                return false;
+            }
+            ++depth;
+            all_ones = all_ones && b == 1;
+            if(nodes[cur].symbol >= 0)
+            {
+                /* 解码出 EOS 是错误 */
+                if(nodes[cur].symbol == 256)
+                {
+                    return false;
+                }
+                out.push_back((char)nodes[cur].symbol);
+                cur = 0;
+                depth = 0;
+                all_ones = true;
+            }
+        }
+    }
+    /* 填充不超过 7 位且必须是 EOS 码字的前缀 */
+    return depth <= 7 && all_ones;
+}
+
+uint32_t hpack::static_find(const char* name, const char* value, bool* exact)
+{
+    uint32_t found = 0;
+    *exact = false;
+    for(uint32_t i = 1; i <= STATIC_COUNT; ++i)
+    {
+        if(strcmp(static_table[i].name, name) != 0)
+        {
+            continue;
+        }
+        if(strcmp(static_table[i].value, value) == 0)
+        {
+            *exact = true;
+            return i;
+        }
+        if(!found)
+        {
+            found = i;
+        }
+    }
+    return found;
+}
+
+/* 解码整数，p 前进到整数之后，数据不足或超出 2^28 返回 false */
+static bool decode_int(const uint8_t*& p, const uint8_t* end, int prefix_bits, uint32_t* value)
+{
+    if(p >= end)
+    {
+        return false;
+    }
+    uint32_t max_prefix = (1u << prefix_bits) - 1;
+    uint32_t v = *p++ & max_prefix;
+    if(v < max_prefix)
+    {
+        *value = v;
+        return true;
+    }
+    for(int shift = 0; shift <= 21; shift += 7)
+    {
+        if(p >= end)
+        {
+            return false;
+        }
+        uint8_t b = *p++;
+        v += (uint32_t)(b & 0x7f) << shift;
+        if(!(b & 0x80))
+        {
+            *value = v;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* 解码字符串字面值 */
+static bool decode_string(const uint8_t*& p, const uint8_t* end, std::string& out)
+{
+    if(p >= end)
+    {
+        return false;
+    }
+    bool huffman = (*p & 0x80) != 0;
+    uint32_t len;
+    if(!decode_int(p, end, 7, &len) || len > (size_t)(end - p))
+    {
+        return false;
+    }
+    out.clear();
+    if(huffman)
+    {
+        if(!hpack::huffman_decode(p, len, out))
+        {
+            return false;
+        }
+    }
+    else
+    {
+        out.assign((const char*)p, len);
+    }
+    p += len;
+    return true;
+}
+
+bool hpack_decoder::lookup(uint32_t index, const hpack_header** field) const
+{
+    static thread_local hpack_header static_field;
+    if(index == 0)
+    {
+        return false;
+    }
+    if(index <= STATIC_COUNT)
+    {
+        static_field.name = static_table[index].name;
+        static_field.value = static_table[index].value;
+        *field = &static_field;
+        return true;
+    }
+    index -= STATIC_COUNT + 1;
+    if(index >= m_table.count())
+    {
+        return false;
+    }
+    *field = &m_table.at(index);
+    return true;
+}
+
+bool hpack_decoder::decode(const uint8_t* data, size_t len, std::vector<hpack_header>& headers)
+{
+    const uint8_t* p = data;
+    const uint8_t* end = data + len;
+    /* 表大小更新只能出现在头部块的开头 */
+    bool leading = true;
+    while (p < end)
+    {
+        uint8_t b = *p;
+        uint32_t index;
+        const hpack_header* field;
+
+        /* 索引字段 */
+        if(b & 0x80)
+        {
+            if(!decode_int(p, end, 7, &index) || !lookup(index, &field))
+            {
+                return false;
+            }
+            headers.push_back(*field);
+            leading = false;
+            continue;
+        }
+        /* 表大小更新 */
+        if((b & 0xe0) == 0x20)
+        {
+            if(!leading || !decode_int(p, end, 5, &index) || index > m_limit)
+            {
+                return false;
+            }
+            m_table.set_max_size(index);
+            continue;
+        }
+
+        /* 字面值字段：01 为插入动态表，0000 为不插入，0001 为永不索引 */
+        bool incremental = (b & 0xc0) == 0x40;
+        if(!decode_int(p, end, incremental ? 6 : 4, &index))
+        {
+            return false;
+        }
+        hpack_header h;
+        if(index != 0)
+        {
+            if(!lookup(index, &field))
+            {
+                return false;
+            }
+            h.name = field->name;
+        }
+        else if(!decode_string(p, end, h.name))
+        {
+            return false;
+        }
+        if(!decode_string(p, end, h.value))
+        {
+            return false;
+        }
+        if(incremental)
+        {
+            m_table.add(h.name, h.value);
+        }
+        headers.push_back(h);
+        leading = false;
+    }
+    return true;
+}
+
+void hpack_encoder::set_max_size(size_t max_size)
+{
+    /* 编码器的表不超过默认的 4096 字节，对方通告更大的值时不扩大 */
+    if(max_size > 4096)
+    {
+        max_size = 4096;
+    }
+    if(max_size != m_table.max_size())
+    {
+        m_table.set_max_size(max_size);
+        m_pending_update = true;
+    }
+}
+
+void hpack_encoder::encode(std::string& out, const char* name, const char* value, bool index)
+{
+    if(m_pending_update)
+    {
+        hpack::encode_int(out, (uint32_t)m_table.max_size(), 5, 0x20);
+        m_pending_update = false;
+    }
+
+    bool exact;
+    uint32_t name_index = hpack::static_find(name, value, &exact);
+    if(exact)
+    {
+        hpack::encode_int(out, name_index, 7, 0x80);
+        return;
+    }
+    for(size_t i = 0; i < m_table.count(); ++i)
+    {
+        const hpack_header& h = m_table.at(i);
+        if(h.name == name)
+        {
+            if(h.value == value)
+            {
+                hpack::encode_int(out, (uint32_t)(STATIC_COUNT + 1 + i), 7, 0x80);
+                return;
+            }
+            if(!name_index)
+            {
+                name_index = (uint32_t)(STATIC_COUNT + 1 + i);
+            }
+        }
+    }
+
+    hpack::encode_int(out, name_index, index ? 6 : 4, index ? 0x40 : 0x00);
+    if(!name_index)
+    {
+        hpack::encode_string(out, name, strlen(name), true);
+    }
+    hpack::encode_string(out, value, strlen(value), true);
+    if(index)
+    {
+        m_table.add(name, value);
+    }
+}
@@ -0,0 +1,97 @@
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+/* HPACK 头部压缩（RFC 7541）
+   解码器和编码器各有一张动态表，分别与对方的编码器和解码器同步：解码器的表由对方的编码决定，
+   容量上限为本端在 SETTINGS_HEADER_TABLE_SIZE 中通告的值；编码器的表容量不超过对方通告的值。
+   整个连接共用一对编解码器，头部块必须按收发顺序处理，所以只在占有连接的线程中调用，不需要加锁 */
+
+/* 一个头部字段 */
+struct hpack_header
+{
+    std::string name;
+    std::string value;
+};
+
+/* 动态表：新条目插在最前面，超出容量时从最旧的一端淘汰。
+   每个条目的大小为名字和值的长度加 32 字节 */
+class hpack_table
+{
+public:
+    static const size_t ENTRY_OVERHEAD = 32;
+
+    hpack_table() : m_size(0), m_max_size(4096) { }
+
+    size_t size() const { return m_size; }
+    size_t max_size() const { return m_max_size; }
+    size_t count() const { return m_entries.size(); }
+    /* 第 i 个条目，0 为最新插入的 */
+    const hpack_header& at(size_t i) const { return m_entries[i]; }
+
+    void set_max_size(size_t max_size);
+    void add(const std::string& name, const std::string& value);
+
+private:
+    void evict(size_t needed);
+
+    std::deque<hpack_header> m_entries;
+    size_t m_size;
+    size_t m_max_size;
+};
+
+class hpack_decoder
+{
+public:
+    /* max_size 为本端通告的动态表容量 */
+    explicit hpack_decoder(size_t max_size = 4096) : m_limit(max_size) { m_table.set_max_size(max_size); }
+
+    /* 解码一个完整的头部块，追加到 headers。
+        格式错误、索引越界、Huffman 编码有误或超出表容量的大小更新都返回 false（COMPRESSION_ERROR），
+        此后整个连接的动态表已不可信，调用者必须关闭连接 */
+    bool decode(const uint8_t* data, size_t len, std::vector<hpack_header>& headers);
+
+private:
+    bool lookup(uint32_t index, const hpack_header** field) const;
+
+    hpack_table m_table;
+    size_t m_limit;
+};
+
+class hpack_encoder
+{
+public:
+    hpack_encoder() : m_pending_update(false) { }
+
+    /* 对方通告了新的动态表容量，下一个头部块开头会带上表大小更新 */
+    void set_max_size(size_t max_size);
+
+    /* 编码一个头部字段追加到 out，name 必须为小写。
+        静态表或动态表中有完全相同的字段时只输出索引；否则输出字面值，
+        index 为 true 时同时插入动态表（值在连接上会重复出现的字段，如 date），字符串较短时用 Huffman 编码 */
+    void encode(std::string& out, const char* name, const char* value, bool index = false);
+
+private:
+    hpack_table m_table;
+    bool m_pending_update;
+};
+
+/* 整数和字符串的基本编码，bench 下的工具也用它们构造请求 */
+namespace hpack
+{
+    /* 整数编码：prefix_bits 为首字节中用于整数的位数，flags 为首字节的其余高位 */
+    void encode_int(std::string& out, uint32_t value, int prefix_bits, uint8_t flags);
+    /* 字符串编码，huffman 为 true 且编码后更短时用 Huffman 编码 */
+    void encode_string(std::string& out, const char* s, size_t len, bool huffman);
+    /* Huffman 解码，出错（含非法填充和 EOS）返回 false */
+    bool huffman_decode(const uint8_t* data, size_t len, std::string& out);
+    /* 静态表中名字为 name 的第一个条目的索引，value 也相同时 exact 为 true，没有则返回 0 */
+    uint32_t static_find(const char* name, const char* value, bool* exact);
+}
+
+#endif
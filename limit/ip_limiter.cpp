@@ -0,0 +1,248 @@
+#include <stdlib.h>
+
+#include "ip_limiter.h"
+#include "../timer/coarse_clock.h"
+
+ip_limiter::ip_limiter()
+    : m_max_conns(0), m_rate(0), m_bucket(0), m_exempt_loopback(false),
+      m_rejected_conns(0), m_rejected_requests(0)
+{
+    for(int i = 0; i < SHARD_COUNT; ++i)
+    {
+        m_shards[i].table = NULL;
+        m_shards[i].size = 0;
+    }
+}
+
+ip_limiter::~ip_limiter()
+{
+    for(int i = 0; i < SHARD_COUNT; ++i)
+    {
+        free(m_shards[i].table);
+    }
+}
+
+void ip_limiter::init(int max_conns, int rate, int burst, bool exempt_loopback)
+{
+    m_exempt_loopback = exempt_loopback;
+    m_max_conns = max_conns;
+    m_rate = rate;
+    m_bucket = (long long)(burst > 0 ? burst : 1) * 1000;
+
+    if(m_max_conns <= 0 && m_rate <= 0)
+    {
+        return;
+    }
+    for(int i = 0; i < SHARD_COUNT; ++i)
+    {
+        if(!m_shards[i].table)
+        {
+            m_shards[i].table = (entry*)calloc(SHARD_CAPACITY, sizeof(entry));
+        }
+    }
+}
+
+void ip_limiter::refill(entry* e, long long now)
+{
+    /* 速率单位为请求/秒，令牌单位为千分之一请求，每毫秒正好补充 m_rate 个 */
+    e->tokens += (now - e->last_ms) * m_rate;
+    if(e->tokens > m_bucket)
+    {
+        e->tokens = m_bucket;
+    }
+    e->last_ms = now;
+}
+
+bool ip_limiter::stale(entry* e, long long now)
+{
+    if(e->conns > 0)
+    {
+        return false;
+    }
+    if(m_rate <= 0)
+    {
+        return true;
+    }
+    refill(e, now);
+    return e->tokens >= m_bucket;
+}
+
+ip_limiter::entry* ip_limiter::find_or_insert(shard& s, uint32_t ip, long long now)
+{
+    if(!s.table)
+    {
+        return NULL;
+    }
+
+    /* 表快满时先老化，保持探测链较短 */
+    if(s.size >= SHARD_CAPACITY * 3 / 4)
+    {
+        age(s, now);
+    }
+
+    int mask = SHARD_CAPACITY - 1;
+    for(int i = hash(ip) & mask, n = 0; n < SHARD_CAPACITY; i = (i + 1) & mask, ++n)
+    {
+        entry* e = &s.table[i];
+        if(!e->used)
+        {
+            e->used = true;
+            e->ip = ip;
+            e->conns = 0;
+            e->tokens = m_bucket;
+            e->last_ms = now;
+            ++s.size;
+            return e;
+        }
+        if(e->ip == ip)
+        {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+void ip_limiter::erase(shard& s, int i)
+{
+    int mask = SHARD_CAPACITY - 1;
+    int hole = i;
+    for(int j = (i + 1) & mask; s.table[j].used; j = (j + 1) & mask)
+    {
+        /* j 处记录的理想位置不在 (hole, j] 之间时，可以前移到空穴，否则查找时会越过空穴找不到它 */
+        int home = hash(s.table[j].ip) & mask;
+        bool between = hole <= j ? (hole < home && home <= j) : (hole < home || home <= j);
+        if(!between)
+        {
+            s.table[hole] = s.table[j];
+            hole = j;
+        }
+    }
+    s.table[hole].used = false;
+    --s.size;
+}
+
+void ip_limiter::age(shard& s, long long now)
+{
+    for(int i = 0; i < SHARD_CAPACITY; )
+    {
+        /* 删除后当前位置可能被后面的记录填补，需要重新检查 */
+        if(s.table[i].used && stale(&s.table[i], now))
+        {
+            erase(s, i);
+        }
+        else
+        {
+            ++i;
+        }
+    }
+}
+
+void ip_limiter::age()
+{
+    long long now = coarse_clock::get_instance()->now_ms();
+    for(int i = 0; i < SHARD_COUNT; ++i)
+    {
+        shard& s = m_shards[i];
+        if(!s.table)
+        {
+            continue;
+        }
+        s.lock.lock();
+        age(s, now);
+        s.lock.unlock();
+    }
+}
+
+bool ip_limiter::on_accept(uint32_t ip)
+{
+    if(m_max_conns <= 0 || exempt(ip))
+    {
+        return true;
+    }
+
+    shard& s = shard_of(ip);
+    bool ok = true;
+    s.lock.lock();
+    entry* e = find_or_insert(s, ip, coarse_clock::get_instance()->now_ms());
+    /* 表满时放行，不因记录不下而拒绝正常客户端 */
+    if(e)
+    {
+        if(e->conns >= m_max_conns)
+        {
+            ok = false;
+        }
+        else
+        {
+            ++e->conns;
+        }
+    }
+    s.lock.unlock();
+
+    if(!ok)
+    {
+        m_rejected_conns.fetch_add(1, std::memory_order_relaxed);
+    }
+    return ok;
+}
+
+void ip_limiter::on_close(uint32_t ip)
+{
+    if(m_max_conns <= 0 || exempt(ip))
+    {
+        return;
+    }
+
+    shard& s = shard_of(ip);
+    if(!s.table)
+    {
+        return;
+    }
+    s.lock.lock();
+    int mask = SHARD_CAPACITY - 1;
+    for(int i = hash(ip) & mask, n = 0; s.table[i].used && n < SHARD_CAPACITY;
+        i = (i + 1) & mask, ++n)
+    {
+        if(s.table[i].ip == ip)
+        {
+            if(s.table[i].conns > 0)
+            {
+                --s.table[i].conns;
+            }
+            break;
+        }
+    }
+    s.lock.unlock();
+}
+
+bool ip_limiter::on_request(uint32_t ip)
+{
+    if(m_rate <= 0 || exempt(ip))
+    {
+        return true;
+    }
+
+    shard& s = shard_of(ip);
+    bool ok = true;
+    long long now = coarse_clock::get_instance()->now_ms();
+    s.lock.lock();
+    entry* e = find_or_insert(s, ip, now);
+    if(e)
+    {
+        refill(e, now);
+        if(e->tokens < 1000)
+        {
+            ok = false;
+        }
+        else
+        {
+            e->tokens -= 1000;
+        }
+    }
+    s.lock.unlock();
+
+    if(!ok)
+    {
+        m_rejected_requests.fetch_add(1, std::memory_order_relaxed);
+    }
+    return ok;
+}
@@ -0,0 +1,108 @@
+#ifndef IP_LIMITER_H
+#define IP_LIMITER_H
+
+#include <stdint.h>
+#include <atomic>
+#include "../lock/locker.h"
+
+/* 按客户端 IP 限流
+   每个 IP 限制同时打开的连接数，并用令牌桶限制请求速率，单个客户端的异常行为不会拖累其他客户端。
+   IP 记录放在开放寻址（线性探测）的哈希表中，按 IP 哈希分片，每片一把锁。
+   连接数为 0 且令牌桶已满的记录与新建无异，定期老化回收，表满时也会先老化再插入 */
+class ip_limiter
+{
+public:
+    /* 分片数 */
+    static const int SHARD_COUNT = 16;
+    /* 每个分片的容量，必须是 2 的幂 */
+    static const int SHARD_CAPACITY = 1024;
+
+public:
+    static ip_limiter* get_instance()
+    {
+        static ip_limiter instance;
+        return &instance;
+    }
+
+    /* 每个 IP 的最大连接数、每秒请求数和令牌桶容量（允许的突发请求数），为 0 表示不限制。
+        exempt_loopback 为 true 时不限制本机回环地址，便于本机压测和运维检查 */
+    void init(int max_conns, int rate, int burst, bool exempt_loopback);
+
+    /* 新连接建立时调用，超出该 IP 的连接数限制时返回 false，不计入连接数 */
+    bool on_accept(uint32_t ip);
+    /* 已计入的连接关闭时调用 */
+    void on_close(uint32_t ip);
+    /* 连接上开始一个新请求时调用，该 IP 的令牌用完时返回 false */
+    bool on_request(uint32_t ip);
+
+    /* 回收所有分片中的过期记录，由主循环定期调用 */
+    void age();
+
+    /* 被拒绝的连接数和请求数 */
+    long rejected_conns() const { return m_rejected_conns.load(std::memory_order_relaxed); }
+    long rejected_requests() const { return m_rejected_requests.load(std::memory_order_relaxed); }
+
+private:
+    ip_limiter();
+    ~ip_limiter();
+
+    /* 一个 IP 的记录。令牌以千分之一个请求为单位，便于按毫秒补充 */
+    struct entry
+    {
+        uint32_t ip;
+        int conns;              /* 当前连接数 */
+        long long tokens;       /* 剩余令牌 */
+        long long last_ms;      /* 上次补充令牌的时刻 */
+        bool used;
+    };
+
+    struct shard
+    {
+        locker lock;
+        entry* table;
+        int size;
+    };
+
+    /* 是否不受限制的地址，ip 为网络字节序 */
+    bool exempt(uint32_t ip) const
+    {
+        return m_exempt_loopback && ((const unsigned char*)&ip)[0] == 127;
+    }
+
+    /* murmur3 的混合函数，IP 的每一位都会影响分片和槽位 */
+    static uint32_t hash(uint32_t ip)
+    {
+        ip ^= ip >> 16;
+        ip *= 0x85ebca6b;
+        ip ^= ip >> 13;
+        ip *= 0xc2b2ae35;
+        ip ^= ip >> 16;
+        return ip;
+    }
+
+    /* 分片用哈希值的高位，槽位用低位，两者互不相关 */
+    shard& shard_of(uint32_t ip) { return m_shards[(hash(ip) >> 24) % SHARD_COUNT]; }
+
+    /* 以下函数都需要持有分片的锁 */
+    /* 查找 IP 的记录，不存在时插入新记录，表满时返回 NULL */
+    entry* find_or_insert(shard& s, uint32_t ip, long long now);
+    /* 按流逝的时间补充令牌 */
+    void refill(entry* e, long long now);
+    /* 记录是否已无需保留 */
+    bool stale(entry* e, long long now);
+    /* 删除下标 i 的记录，把后面探测链上的记录前移填补，不留墓碑 */
+    void erase(shard& s, int i);
+    /* 回收一个分片中的过期记录 */
+    void age(shard& s, long long now);
+
+private:
+    int m_max_conns;
+    int m_rate;
+    long long m_bucket;         /* 令牌桶容量 */
+    bool m_exempt_loopback;
+    shard m_shards[SHARD_COUNT];
+    std::atomic<long> m_rejected_conns;
+    std::atomic<long> m_rejected_requests;
+};
+
+#endif
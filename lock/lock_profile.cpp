@@ -0,0 +1,74 @@
+#include "locker.h"
+
+#ifdef LOCK_PROFILE
+
+#include <string.h>
+#include <algorithm>
+#include "../log/log.h"
+
+/* 不同名字的锁最多这么多个，超出的归入最后一个 */
+#define MAX_LOCK_NAMES 64
+
+static lock_stats g_stats[MAX_LOCK_NAMES];
+static int g_count = 0;
+/* 只在构造锁时查找名字，用 pthread 静态初始化的互斥锁，不依赖构造顺序 */
+static pthread_mutex_t g_registry_lock = PTHREAD_MUTEX_INITIALIZER;
+
+lock_stats* lock_profile::get(const char* name)
+{
+    if(!name)
+    {
+        name = "unnamed";
+    }
+    pthread_mutex_lock(&g_registry_lock);
+    int i = 0;
+    while (i < g_count && strcmp(g_stats[i].name, name) != 0)
+    {
+        ++i;
+    }
+    if(i == g_count)
+    {
+        if(g_count < MAX_LOCK_NAMES)
+        {
+            g_stats[g_count++].name = name;
+        }
+        else
+        {
+            i = MAX_LOCK_NAMES - 1;
+            g_stats[i].name = "other";
+        }
+    }
+    pthread_mutex_unlock(&g_registry_lock);
+    return &g_stats[i];
+}
+
+static bool more_wait(const lock_stats* a, const lock_stats* b)
+{
+    return a->wait_ns.load() > b->wait_ns.load();
+}
+
+void lock_profile::dump()
+{
+    pthread_mutex_lock(&g_registry_lock);
+    int count = g_count;
+    pthread_mutex_unlock(&g_registry_lock);
+
+    lock_stats* sorted[MAX_LOCK_NAMES];
+    for(int i = 0; i < count; ++i)
+    {
+        sorted[i] = &g_stats[i];
+    }
+    std::sort(sorted, sorted + count, more_wait);
+
+    LOG_INFO("[lock] %-16s %12s %10s %12s %10s %12s\n", "name", "acquires", "contended",
+                "wait_ms", "max_wait_us", "hold_ms");
+    for(int i = 0; i < count; ++i)
+    {
+        lock_stats* s = sorted[i];
+        LOG_INFO("[lock] %-16s %12ld %10ld %12.3f %10lld %12.3f\n", s->name, s->acquires.load(),
+                    s->contended.load(), s->wait_ns.load() / 1e6, s->max_wait_ns.load() / 1000,
+                    s->hold_ns.load() / 1e6);
+    }
+}
+
+#endif
@@ -2,8 +2,105 @@
 #define LOCKER_H
 
 #include <exception>
+#include <atomic>
+#include <climits>
 #include <pthread.h>
 #include <semaphore.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+/* 锁竞争统计（编译时定义 LOCK_PROFILE 开启）
+   每个锁构造时可以指定名字，同名的锁共用一组统计：获取次数、需要等待的次数、
+   等待时间和持有时间。lock_profile::dump() 按总等待时间从大到小写入日志。
+   未开启时名字被忽略，锁中不保存任何统计状态 */
+#ifdef LOCK_PROFILE
+struct lock_stats
+{
+    const char* name;
+    std::atomic<long> acquires;         /* 获取次数 */
+    std::atomic<long> contended;        /* 获取时需要等待的次数 */
+    std::atomic<long long> wait_ns;     /* 等待时间之和 */
+    std::atomic<long long> max_wait_ns; /* 最长的一次等待 */
+    std::atomic<long long> hold_ns;     /* 持有时间之和（读锁不统计） */
+};
+
+class lock_profile
+{
+public:
+    /* 名字对应的统计，名字为 NULL 时归入 "unnamed" */
+    static lock_stats* get(const char* name);
+    /* 把所有锁的统计写入日志 */
+    static void dump();
+
+    static long long now_ns()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+
+    /* 一次获取完成，start 为开始获取的时刻，返回获取完成的时刻 */
+    static long long acquired(lock_stats* stats, long long start, bool contended)
+    {
+        long long now = now_ns();
+        stats->acquires.fetch_add(1, std::memory_order_relaxed);
+        if(contended)
+        {
+            long long wait = now - start;
+            stats->contended.fetch_add(1, std::memory_order_relaxed);
+            stats->wait_ns.fetch_add(wait, std::memory_order_relaxed);
+            long long max = stats->max_wait_ns.load(std::memory_order_relaxed);
+            while (wait > max && !stats->max_wait_ns.compare_exchange_weak(max, wait))
+            {
+            }
+        }
+        return now;
+    }
+
+    static void released(lock_stats* stats, long long acquired_at)
+    {
+        stats->hold_ns.fetch_add(now_ns() - acquired_at, std::memory_order_relaxed);
+    }
+};
+
+#define LOCK_PROFILE_MEMBERS lock_stats* m_stats; long long m_acquired_at;
+#define LOCK_PROFILE_INIT(name) m_stats = lock_profile::get(name); m_acquired_at = 0;
+#define LOCK_PROFILE_START long long profile_start = lock_profile::now_ns();
+#define LOCK_PROFILE_ACQUIRED(contended) \
+    m_acquired_at = lock_profile::acquired(m_stats, profile_start, contended);
+#define LOCK_PROFILE_RELEASED lock_profile::released(m_stats, m_acquired_at);
+#else
+#define LOCK_PROFILE_MEMBERS
+#define LOCK_PROFILE_INIT(name) (void)name;
+#define LOCK_PROFILE_START
+#define LOCK_PROFILE_ACQUIRED(contended)
+#define LOCK_PROFILE_RELEASED
+#endif
+
+/* futex 系统调用，只在同一进程的线程之间使用 */
+inline void futex_wait(std::atomic<int>* addr, int expected)
+{
+    syscall(SYS_futex, (int*)addr, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+inline void futex_wake(std::atomic<int>* addr, int count)
+{
+    syscall(SYS_futex, (int*)addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+/* 自旋等待时提示 CPU 降低功耗、让出流水线给同核的超线程 */
+inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#else
+    asm volatile("" ::: "memory");
+#endif
+}
 
 /* 封装信号量的类 */
 class sem
@@ -15,7 +112,7 @@ public:
         if(sem_init(&m_sem, 0, 0) != 0)
         {
             throw std::exception();
-        }   
+        }
     }
 
     sem(int num)
@@ -23,7 +120,7 @@ public:
         if(sem_init(&m_sem, 0, num) != 0)
         {
             throw std::exception();
-        }   
+        }
     }
 
     /* 销毁信号量 */
@@ -48,17 +145,18 @@ private:
     sem_t m_sem;
 };
 
-/* 封装互斥锁的类 */
+/* 封装互斥锁的类，需要配合 cond 使用时用它，否则优先使用 futex_mutex */
 class locker
 {
 public:
     /* 创建并初始化互斥锁 */
-    locker()
+    explicit locker(const char* name = NULL)
     {
         if(pthread_mutex_init(&m_mutex, NULL) != 0)
         {
             throw std::exception();
         }
+        LOCK_PROFILE_INIT(name)
     }
 
     /* 销毁互斥锁 */
@@ -70,12 +168,26 @@ public:
     /* 获取互斥锁 */
     bool lock()
     {
+#ifdef LOCK_PROFILE
+        if(pthread_mutex_trylock(&m_mutex) == 0)
+        {
+            LOCK_PROFILE_START
+            LOCK_PROFILE_ACQUIRED(false)
+            return true;
+        }
+        LOCK_PROFILE_START
+        bool ok = pthread_mutex_lock(&m_mutex) == 0;
+        LOCK_PROFILE_ACQUIRED(true)
+        return ok;
+#else
         return pthread_mutex_lock(&m_mutex) == 0;
+#endif
     }
 
     /* 释放互斥锁 */
     bool unlock()
     {
+        LOCK_PROFILE_RELEASED
         return pthread_mutex_unlock(&m_mutex) == 0;
     }
 
@@ -85,23 +197,21 @@ public:
     }
 
 private:
+    friend class cond;
+
     pthread_mutex_t m_mutex;
+    LOCK_PROFILE_MEMBERS
 };
 
-/* 封装条件变量的类 */
+/* 封装条件变量的类，等待时使用调用者的互斥锁 */
 class cond
 {
 public:
     /* 创建并初始化条件变量 */
     cond()
     {
-        if(pthread_mutex_init(&m_mutex, NULL) != 0)
-        {
-            throw std::exception();
-        }
         if(pthread_cond_init(&m_cond, NULL) != 0)
         {
-            pthread_mutex_destroy(&m_mutex);
             throw std::exception();
         }
     }
@@ -109,18 +219,26 @@ public:
     /* 销毁条件变量 */
     ~cond()
     {
-        pthread_mutex_destroy(&m_mutex);
         pthread_cond_destroy(&m_cond);
     }
 
-    /* 等待条件变量 */
+    /* 等待条件变量，调用前必须持有 m_mutex */
     bool wait(pthread_mutex_t* m_mutex)
     {
-        int ret = 0;
-        //pthread_mutex_lock(&m_mutex);
-        ret = pthread_cond_wait(&m_cond, m_mutex);
-        //pthread_mutex_unlock(&m_mutex);
-        return ret == 0;
+        return pthread_cond_wait(&m_cond, m_mutex) == 0;
+    }
+
+    /* 同上，等待期间不计入锁的持有时间 */
+    bool wait(locker& m)
+    {
+#ifdef LOCK_PROFILE
+        lock_profile::released(m.m_stats, m.m_acquired_at);
+        bool ok = pthread_cond_wait(&m_cond, &m.m_mutex) == 0;
+        m.m_acquired_at = lock_profile::now_ns();
+        return ok;
+#else
+        return pthread_cond_wait(&m_cond, &m.m_mutex) == 0;
+#endif
     }
 
     /* 唤醒等待条件变量的线程 */
@@ -135,8 +253,299 @@ public:
     }
 
 private:
-    pthread_mutex_t m_mutex;
     pthread_cond_t  m_cond;
 };
 
-#endif
\ No newline at end of file
+/* 先自旋再睡眠的互斥锁
+   状态为 0（未加锁）、1（已加锁，无人等待）、2（已加锁，可能有人在 futex 上等待），
+   无竞争时加锁和解锁各只有一次原子操作，不进入内核。
+   竞争时先自旋一段时间，持有者通常很快释放；自旋次数按最近几次实际需要的次数自适应调整
+   （与 glibc 的 PTHREAD_MUTEX_ADAPTIVE_NP 相同），单核机器上不自旋 */
+class futex_mutex
+{
+public:
+    explicit futex_mutex(const char* name = NULL) : m_state(0), m_spins(0)
+    {
+        LOCK_PROFILE_INIT(name)
+    }
+
+    void lock()
+    {
+        LOCK_PROFILE_START
+        int expected = 0;
+        if(m_state.compare_exchange_strong(expected, 1, std::memory_order_acquire))
+        {
+            LOCK_PROFILE_ACQUIRED(false)
+            return;
+        }
+        lock_slow();
+        LOCK_PROFILE_ACQUIRED(true)
+    }
+
+    bool try_lock()
+    {
+        LOCK_PROFILE_START
+        int expected = 0;
+        if(m_state.compare_exchange_strong(expected, 1, std::memory_order_acquire))
+        {
+            LOCK_PROFILE_ACQUIRED(false)
+            return true;
+        }
+        return false;
+    }
+
+    void unlock()
+    {
+        LOCK_PROFILE_RELEASED
+        if(m_state.exchange(0, std::memory_order_release) == 2)
+        {
+            futex_wake(&m_state, 1);
+        }
+    }
+
+    /* 自旋的最多次数 */
+    static const int MAX_SPINS = 100;
+
+private:
+    static bool multi_cpu()
+    {
+        static const bool multi = sysconf(_SC_NPROCESSORS_ONLN) > 1;
+        return multi;
+    }
+
+    void lock_slow()
+    {
+        if(multi_cpu())
+        {
+            int spins = m_spins.load(std::memory_order_relaxed);
+            int limit = spins * 2 + 10;
+            if(limit > MAX_SPINS)
+            {
+                limit = MAX_SPINS;
+            }
+            for(int i = 0; i < limit; ++i)
+            {
+                int expected = 0;
+                if(m_state.load(std::memory_order_relaxed) == 0 &&
+                    m_state.compare_exchange_weak(expected, 1, std::memory_order_acquire))
+                {
+                    /* 自旋次数向本次实际需要的次数靠拢 */
+                    m_spins.store(spins + (i - spins) / 8, std::memory_order_relaxed);
+                    return;
+                }
+                cpu_relax();
+            }
+            m_spins.store(spins + (limit - spins) / 8, std::memory_order_relaxed);
+        }
+
+        /* 标记有人等待后睡眠，醒来后仍以 2 的状态抢锁，保证解锁者会唤醒其余等待者 */
+        int state = m_state.exchange(2, std::memory_order_acquire);
+        while (state != 0)
+        {
+            futex_wait(&m_state, 2);
+            state = m_state.exchange(2, std::memory_order_acquire);
+        }
+    }
+
+private:
+    std::atomic<int> m_state;
+    std::atomic<int> m_spins;   /* 自旋次数的估计，并发更新时互相覆盖，不要求精确 */
+    LOCK_PROFILE_MEMBERS
+};
+
+/* 基于 futex 的信号量，计数大于 0 时 wait 和 post 都不进入内核 */
+class futex_sem
+{
+public:
+    explicit futex_sem(int count = 0) : m_count(count), m_waiters(0) { }
+
+    void wait()
+    {
+        while (true)
+        {
+            int count = m_count.load(std::memory_order_relaxed);
+            while (count > 0)
+            {
+                if(m_count.compare_exchange_weak(count, count - 1, std::memory_order_acquire))
+                {
+                    return;
+                }
+            }
+            /* 先登记等待再睡眠；post 先增加计数再检查等待者，两者至少有一方看到对方 */
+            m_waiters.fetch_add(1);
+            futex_wait(&m_count, 0);
+            m_waiters.fetch_sub(1);
+        }
+    }
+
+    void post(int n = 1)
+    {
+        m_count.fetch_add(n);
+        if(m_waiters.load() > 0)
+        {
+            futex_wake(&m_count, n);
+        }
+    }
+
+private:
+    std::atomic<int> m_count;
+    std::atomic<int> m_waiters;
+};
+
+/* 基于 futex 的读写锁，写者优先：有写者等待时新的读者也等待，写者不会饿死。
+   读者和写者在同一个序号上睡眠，释放时序号加一并唤醒所有睡眠者，由它们重新竞争 */
+class rw_locker
+{
+public:
+    explicit rw_locker(const char* name = NULL) : m_state(0), m_write_waiters(0), m_seq(0),
+                                                    m_sleepers(0)
+    {
+        LOCK_PROFILE_INIT(name)
+    }
+
+    void read_lock()
+    {
+        LOCK_PROFILE_START
+        bool contended = false;
+        while (true)
+        {
+            int state = m_state.load(std::memory_order_relaxed);
+            if(!(state & WRITER) && m_write_waiters.load(std::memory_order_relaxed) == 0)
+            {
+                if(m_state.compare_exchange_weak(state, state + 1, std::memory_order_acquire))
+                {
+                    break;
+                }
+                continue;
+            }
+            contended = true;
+            sleep_while([this]() {
+                return (m_state.load() & WRITER) || m_write_waiters.load() > 0;
+            });
+        }
+#ifdef LOCK_PROFILE
+        lock_profile::acquired(m_stats, profile_start, contended);
+#else
+        (void)contended;
+#endif
+    }
+
+    void read_unlock()
+    {
+        if(m_state.fetch_sub(1, std::memory_order_release) == 1)
+        {
+            wake_all();
+        }
+    }
+
+    void write_lock()
+    {
+        LOCK_PROFILE_START
+        int expected = 0;
+        if(m_state.compare_exchange_strong(expected, WRITER, std::memory_order_acquire))
+        {
+            LOCK_PROFILE_ACQUIRED(false)
+            return;
+        }
+        m_write_waiters.fetch_add(1);
+        while (true)
+        {
+            expected = 0;
+            if(m_state.compare_exchange_strong(expected, WRITER, std::memory_order_acquire))
+            {
+                break;
+            }
+            sleep_while([this]() { return m_state.load() != 0; });
+        }
+        m_write_waiters.fetch_sub(1);
+        LOCK_PROFILE_ACQUIRED(true)
+    }
+
+    void write_unlock()
+    {
+        LOCK_PROFILE_RELEASED
+        m_state.store(0, std::memory_order_release);
+        wake_all();
+    }
+
+private:
+    static const int WRITER = 1 << 30;
+
+    /* 登记为睡眠者后再读序号并复查条件，释放者先改状态再检查睡眠者。
+        释放一侧的“写状态、读睡眠者”之间要有 wake_all 中的栅栏，否则读可能先于写完成，
+        两边都看到对方的旧值：睡眠者仍看到锁被占用，释放者看到没有睡眠者，唤醒就丢了 */
+    template<typename F>
+    void sleep_while(F blocked)
+    {
+        m_sleepers.fetch_add(1);
+        int seq = m_seq.load();
+        if(blocked())
+        {
+            futex_wait(&m_seq, seq);
+        }
+        m_sleepers.fetch_sub(1);
+    }
+
+    void wake_all()
+    {
+        /* 与 sleep_while 中的登记配对：要么这里看到睡眠者，要么睡眠者复查时看到新状态 */
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(m_sleepers.load() > 0)
+        {
+            m_seq.fetch_add(1);
+            futex_wake(&m_seq, INT_MAX);
+        }
+    }
+
+private:
+    std::atomic<int> m_state;           /* 读者数，写者持有时为 WRITER */
+    std::atomic<int> m_write_waiters;   /* 等待的写者数 */
+    std::atomic<int> m_seq;             /* 释放序号，睡眠者在它上面等待 */
+    std::atomic<int> m_sleepers;        /* 睡眠或准备睡眠的线程数 */
+    LOCK_PROFILE_MEMBERS
+};
+
+/* 作用域内持有互斥锁，用于 locker 和 futex_mutex */
+template<typename L>
+class locker_guard
+{
+public:
+    explicit locker_guard(L& l) : m_lock(l) { m_lock.lock(); }
+    ~locker_guard() { m_lock.unlock(); }
+
+private:
+    locker_guard(const locker_guard&);
+    locker_guard& operator=(const locker_guard&);
+
+    L& m_lock;
+};
+
+/* 作用域内持有读锁 */
+class read_guard
+{
+public:
+    explicit read_guard(rw_locker& l) : m_lock(l) { m_lock.read_lock(); }
+    ~read_guard() { m_lock.read_unlock(); }
+
+private:
+    read_guard(const read_guard&);
+    read_guard& operator=(const read_guard&);
+
+    rw_locker& m_lock;
+};
+
+/* 作用域内持有写锁 */
+class write_guard
+{
+public:
+    explicit write_guard(rw_locker& l) : m_lock(l) { m_lock.write_lock(); }
+    ~write_guard() { m_lock.write_unlock(); }
+
+private:
+    write_guard(const write_guard&);
+    write_guard& operator=(const write_guard&);
+
+    rw_locker& m_lock;
+};
+
+#endif
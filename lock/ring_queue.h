@@ -0,0 +1,348 @@
+#ifndef RING_QUEUE_H
+#define RING_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <utility>
+#include "locker.h"
+
+/* 无锁有界环形队列
+   spsc_ring 用于单生产者单消费者，mpsc_ring 用于多生产者单消费者。容量向上取整为 2 的幂，
+   生产者和消费者各自修改的下标放在不同的缓存行，避免互相使对方的缓存行失效。
+   try_push/try_pop 从不阻塞，队列满或空时返回 false；pop_batch 一次取出多个元素，
+   只更新一次消费者下标。需要阻塞等待时用下面的 ring_queue 包装 */
+
+#define RING_CACHE_LINE 64
+
+static inline size_t ring_capacity(size_t n)
+{
+    size_t cap = 2;
+    while (cap < n)
+    {
+        cap <<= 1;
+    }
+    return cap;
+}
+
+template <class T>
+class spsc_ring
+{
+public:
+    explicit spsc_ring(size_t size) : m_cap(ring_capacity(size)), m_mask(m_cap - 1),
+                                        m_head(0), m_tail_cache(0), m_tail(0), m_head_cache(0)
+    {
+        m_array = new T[m_cap];
+    }
+
+    ~spsc_ring()
+    {
+        delete [] m_array;
+    }
+
+    /* 只能由生产者线程调用 */
+    template <class U>
+    bool try_push(U&& item)
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        /* 先看缓存的消费者下标，确实显示已满时才去读对方的缓存行 */
+        if(tail - m_head_cache == m_cap)
+        {
+            m_head_cache = m_head.load(std::memory_order_acquire);
+            if(tail - m_head_cache == m_cap)
+            {
+                return false;
+            }
+        }
+        m_array[tail & m_mask] = std::forward<U>(item);
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /* 只能由消费者线程调用 */
+    bool try_pop(T& item)
+    {
+        return pop_batch(&item, 1) == 1;
+    }
+
+    /* 最多取出 max 个元素，返回取出的个数 */
+    int pop_batch(T* items, int max)
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if(head == m_tail_cache)
+        {
+            m_tail_cache = m_tail.load(std::memory_order_acquire);
+            if(head == m_tail_cache)
+            {
+                return 0;
+            }
+        }
+        size_t n = m_tail_cache - head;
+        if(n > (size_t)max)
+        {
+            n = max;
+        }
+        for(size_t i = 0; i < n; ++i)
+        {
+            items[i] = std::move(m_array[(head + i) & m_mask]);
+        }
+        m_head.store(head + n, std::memory_order_release);
+        return (int)n;
+    }
+
+    /* 任意线程可调用，并发修改时只是近似值 */
+    size_t size() const
+    {
+        size_t head = m_head.load(std::memory_order_acquire);
+        size_t tail = m_tail.load(std::memory_order_acquire);
+        return tail > head ? tail - head : 0;
+    }
+
+    size_t capacity() const { return m_cap; }
+
+private:
+    spsc_ring(const spsc_ring&);
+    spsc_ring& operator=(const spsc_ring&);
+
+    const size_t m_cap;
+    const size_t m_mask;
+    T* m_array;
+
+    /* 消费者的缓存行：消费者下标和它看到的生产者下标 */
+    alignas(RING_CACHE_LINE) std::atomic<size_t> m_head;
+    size_t m_tail_cache;
+    /* 生产者的缓存行 */
+    alignas(RING_CACHE_LINE) std::atomic<size_t> m_tail;
+    size_t m_head_cache;
+};
+
+/* 每个槽位带一个序号（Vyukov 有界队列）：序号等于下标时槽位空闲，生产者用比较交换占下标后写入，
+   写完把序号置为下标 + 1 发布给消费者；消费者取走后置为下标 + 容量，留给下一圈的生产者 */
+template <class T>
+class mpsc_ring
+{
+public:
+    explicit mpsc_ring(size_t size) : m_cap(ring_capacity(size)), m_mask(m_cap - 1),
+                                        m_head(0), m_tail(0)
+    {
+        m_slots = new slot[m_cap];
+        for(size_t i = 0; i < m_cap; ++i)
+        {
+            m_slots[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    ~mpsc_ring()
+    {
+        delete [] m_slots;
+    }
+
+    /* 任意线程可调用 */
+    template <class U>
+    bool try_push(U&& item)
+    {
+        size_t pos = m_tail.load(std::memory_order_relaxed);
+        slot* s;
+        while (true)
+        {
+            s = &m_slots[pos & m_mask];
+            size_t seq = s->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if(diff == 0)
+            {
+                if(m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if(diff < 0)
+            {
+                /* 上一圈的元素还没被取走，队列已满 */
+                return false;
+            }
+            else
+            {
+                pos = m_tail.load(std::memory_order_relaxed);
+            }
+        }
+        s->value = std::forward<U>(item);
+        s->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /* 只能由消费者线程调用 */
+    bool try_pop(T& item)
+    {
+        return pop_batch(&item, 1) == 1;
+    }
+
+    /* 最多取出 max 个元素，返回取出的个数。遇到已占下标但还没写完的槽位就停下 */
+    int pop_batch(T* items, int max)
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        int n = 0;
+        while (n < max)
+        {
+            slot* s = &m_slots[(head + n) & m_mask];
+            if(s->seq.load(std::memory_order_acquire) != head + n + 1)
+            {
+                break;
+            }
+            items[n] = std::move(s->value);
+            s->seq.store(head + n + m_cap, std::memory_order_release);
+            ++n;
+        }
+        if(n > 0)
+        {
+            m_head.store(head + n, std::memory_order_relaxed);
+        }
+        return n;
+    }
+
+    /* 任意线程可调用，并发修改时只是近似值 */
+    size_t size() const
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        return tail > head ? tail - head : 0;
+    }
+
+    size_t capacity() const { return m_cap; }
+
+private:
+    mpsc_ring(const mpsc_ring&);
+    mpsc_ring& operator=(const mpsc_ring&);
+
+    struct slot
+    {
+        std::atomic<size_t> seq;
+        T value;
+    };
+
+    const size_t m_cap;
+    const size_t m_mask;
+    slot* m_slots;
+
+    alignas(RING_CACHE_LINE) std::atomic<size_t> m_head;    /* 只有消费者修改 */
+    alignas(RING_CACHE_LINE) std::atomic<size_t> m_tail;    /* 生产者竞争的下标 */
+};
+
+/* 在环形队列上加阻塞等待，接口与 block_queue 相同，可以直接替换。只允许一个消费者。
+   队列为空时消费者先自旋一会儿，再把 m_sleeping 置 1 后复查队列，确实为空才在 futex 上睡眠；
+   生产者放入元素后只读一次 m_sleeping，消费者醒着时 push 不进入内核 */
+template <class T, class Ring = mpsc_ring<T> >
+class ring_queue
+{
+public:
+    explicit ring_queue(int max_size = 1000) : m_ring(max_size > 0 ? max_size : 1),
+                                                m_sleeping(0), m_closed(false)
+    {
+    }
+
+    bool full() { return m_ring.size() >= m_ring.capacity(); }
+    bool empty() { return m_ring.size() == 0; }
+    int size() { return (int)m_ring.size(); }
+    int max_size() { return (int)m_ring.capacity(); }
+
+    /* 队列满时返回 false，不阻塞，右值版本此时也不移走 item */
+    bool push(const T& item)
+    {
+        if(!m_ring.try_push(item))
+        {
+            return false;
+        }
+        notify();
+        return true;
+    }
+
+    bool push(T&& item)
+    {
+        if(!m_ring.try_push(std::move(item)))
+        {
+            return false;
+        }
+        notify();
+        return true;
+    }
+
+    /* 取出一个元素，队列为空时阻塞。队列关闭且已取空时返回 false */
+    bool pop(T& item)
+    {
+        return pop(&item, 1) == 1;
+    }
+
+    /* 取出至少一个、最多 max 个元素，返回个数。队列关闭且已取空时返回 0 */
+    int pop(T* items, int max)
+    {
+        while (true)
+        {
+            int n = m_ring.pop_batch(items, max);
+            if(n > 0)
+            {
+                return n;
+            }
+            if(multi_cpu())
+            {
+                for(int i = 0; i < SPINS && m_ring.size() == 0; ++i)
+                {
+                    cpu_relax();
+                }
+                n = m_ring.pop_batch(items, max);
+                if(n > 0)
+                {
+                    return n;
+                }
+            }
+
+            /* 与 notify 中的栅栏配对：要么生产者看到 m_sleeping 为 1，要么这里看到新元素 */
+            m_sleeping.store(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            n = m_ring.pop_batch(items, max);
+            if(n > 0)
+            {
+                m_sleeping.store(0, std::memory_order_relaxed);
+                return n;
+            }
+            if(m_closed.load())
+            {
+                m_sleeping.store(0, std::memory_order_relaxed);
+                return 0;
+            }
+            futex_wait(&m_sleeping, 1);
+        }
+    }
+
+    /* 唤醒消费者，之后 pop 取空队列后返回 */
+    void close()
+    {
+        m_closed.store(true);
+        notify();
+    }
+
+    /* 自旋检查的次数 */
+    static const int SPINS = 200;
+
+private:
+    static bool multi_cpu()
+    {
+        static const bool multi = sysconf(_SC_NPROCESSORS_ONLN) > 1;
+        return multi;
+    }
+
+    void notify()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(m_sleeping.load(std::memory_order_relaxed) &&
+            m_sleeping.exchange(0, std::memory_order_relaxed))
+        {
+            futex_wake(&m_sleeping, 1);
+        }
+    }
+
+private:
+    Ring m_ring;
+    alignas(RING_CACHE_LINE) std::atomic<int> m_sleeping;  /* 消费者已经或即将在 futex 上睡眠 */
+    std::atomic<bool> m_closed;
+};
+
+#endif
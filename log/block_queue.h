@@ -8,7 +8,7 @@ template <class T>
 class block_queue
 {
 public:
-    block_queue(int max_size = 1000)
+    block_queue(int max_size = 1000) : m_mutex("log_queue")
     {
         if(max_size <= 0)
         {
@@ -157,7 +157,7 @@ public:
 
         while(m_size <= 0)
         {
-            if(!m_cond.wait(m_mutex.get()))
+            if(!m_cond.wait(m_mutex))
             {
                 m_mutex.unlock();
                 return false;
@@ -173,6 +173,32 @@ public:
         return true;
     }
 
+    /* 一次取出至少一个、最多 max 个元素，返回个数，与 ring_queue 的接口相同 */
+    int pop(T* items, int max)
+    {
+        m_mutex.lock();
+
+        while(m_size <= 0)
+        {
+            if(!m_cond.wait(m_mutex))
+            {
+                m_mutex.unlock();
+                return 0;
+            }
+        }
+
+        int n = m_size < max ? m_size : max;
+        for(int i = 0; i < n; ++i)
+        {
+            m_front = (m_front + 1) % m_max_size;
+            items[i] = m_array[m_front];
+        }
+        m_size -= n;
+
+        m_mutex.unlock();
+        return n;
+    }
+
 private:
     locker m_mutex;
     cond m_cond;
@@ -1,15 +1,17 @@
 #include <pthread.h>
 #include <string.h>
 #include <time.h>
-#include <sys/time.h>
 #include <stdarg.h>
 
 #include "log.h"
+#include "../timer/coarse_clock.h"
+#include "../stats/metrics.h"
 
-Log::Log()
+Log::Log() : m_mutex("log")
 {
     m_count = 0;
     m_is_async = false;
+    m_flusher_pinned = false;
 }
 
 Log::~Log()
@@ -27,7 +29,7 @@ bool Log::init(const char* file_name, int log_buf_size,
     if(max_queue_size >= 1)
     {
         m_is_async = true;
-        m_log_queue = new block_queue<string>(max_queue_size);
+        m_log_queue = new log_queue(max_queue_size);
         pthread_t tid;
         /* 创建线程异步写日志 */
         pthread_create(&tid, NULL, flush_log_thread, NULL);
@@ -74,11 +76,11 @@ bool Log::init(const char* file_name, int log_buf_size,
 
 void Log::write_log(int level, const char* format, ...)
 {
-    struct timeval now = {0, 0};
-    gettimeofday(&now, NULL);
-    time_t t = now.tv_sec;
-    struct tm *sys_tm = localtime(&t);
-    struct tm my_tm = *sys_tm;
+    /* 时间取自主循环刷新的缓存时钟，避免每行日志都调用 gettimeofday 和 localtime */
+    char timestamp[coarse_clock::TIMESTAMP_LEN];
+    struct tm my_tm;
+    long usec = 0;
+    coarse_clock::get_instance()->timestamp(timestamp, &my_tm, &usec);
     char s[16] = {0};
 
     /* 日志分级 */
@@ -143,9 +145,7 @@ void Log::write_log(int level, const char* format, ...)
 
     /* 写入内容格式：时间+内容 */
     /* 时间格式化 */
-    int n = snprintf(m_buf, 48, "%d-%02d-%02d %02d:%02d:%02d.%06ld %s ",
-                    my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday,
-                    my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec, now.tv_usec, s);
+    int n = snprintf(m_buf, 48, "%s.%06ld %s ", timestamp, usec, s);
     /* 内容格式化 */
     int m = vsnprintf(m_buf + n, m_log_buf_size - 1, format, valst);
     m_buf[n + m] = '\n';
@@ -155,12 +155,15 @@ void Log::write_log(int level, const char* format, ...)
 
     m_mutex.unlock();
 
-    if(m_is_async && !m_log_queue->full())
-    {
-        m_log_queue->push(log_str);
-    }
-    else
+    /* 队列满时 push 返回 false 且不会移走 log_str，不必先调用 full() 多取一次锁 */
+    bool queued = m_is_async && m_log_queue->push(std::move(log_str));
+    if(!queued)
     {
+        /* 异步队列已满，改为同步写入 */
+        if(m_is_async)
+        {
+            server_metrics::log_overflows.add();
+        }
         m_mutex.lock();
         fputs(log_str.c_str(), m_fp);
         m_mutex.unlock();
@@ -6,9 +6,18 @@
 #include <string>
 
 #include "block_queue.h"
+#include "../lock/ring_queue.h"
+#include "../affinity/cpu_topology.h"
 
 using namespace std;
 
+/* 异步日志队列：默认用无锁的多生产者环形队列，编译时定义 LOG_BLOCK_QUEUE 改回互斥锁的 block_queue */
+#ifdef LOG_BLOCK_QUEUE
+typedef block_queue<string> log_queue;
+#else
+typedef ring_queue<string, mpsc_ring<string> > log_queue;
+#endif
+
 class Log
 {
 public:
@@ -24,7 +33,19 @@ public:
     /* 异步写日志公有方法 */
     static void* flush_log_thread(void *args)
     {
-        Log::get_instance()->async_write_log();
+        Log* log = Log::get_instance();
+        if(log->m_flusher_pinned)
+        {
+            cpu_topology::get_instance()->bind_self(log->m_flusher_cpus);
+        }
+        log->async_write_log();
+    }
+
+    /* 异步模式下写日志的线程绑定的 CPU，必须在 init() 之前调用 */
+    void set_flusher_cpus(const cpu_set_t& cpus)
+    {
+        m_flusher_pinned = true;
+        m_flusher_cpus = cpus;
     }
 
     /* 将输出内容按照标准格式整理 */
@@ -33,6 +54,9 @@ public:
     /* 强制刷新缓冲区 */
     void flush(void);
 
+    /* 异步日志队列中等待写入的日志条数，同步模式下为 0 */
+    int queue_size() { return m_is_async ? m_log_queue->size() : 0; }
+
 private:
     Log();
     virtual ~Log();
@@ -40,15 +64,22 @@ private:
     /* 异步写日志方法 */
     void* async_write_log()
     {
-        string single_log;
-        /* 从阻塞队列中取出一个日志 string，写入文件 */
-        while(m_log_queue->pop(single_log))
+        string logs[LOG_BATCH];
+        /* 从阻塞队列中一次取出若干条日志，加一次锁写入文件 */
+        int n;
+        while((n = m_log_queue->pop(logs, LOG_BATCH)) > 0)
         {
             m_mutex.lock();
-            fputs(single_log.c_str(), m_fp);
+            for(int i = 0; i < n; ++i)
+            {
+                fputs(logs[i].c_str(), m_fp);
+            }
             m_mutex.unlock();
         }
     }
+
+    /* 写日志线程一次最多取出的条数 */
+    static const int LOG_BATCH = 64;
 private:
     char dir_name[128];     /* 路径名 */
     char log_name[128];     /* log 文件名 */
@@ -58,8 +89,10 @@ private:
     int m_today;            /* 记录当前时间是哪一天 */
     FILE* m_fp;             /* 打开 log 的文件指针 */
     char* m_buf;
-    block_queue<string> *m_log_queue;   /* 阻塞队列 */
+    log_queue *m_log_queue; /* 阻塞队列 */
     bool m_is_async;        /* 同步标志位 */
+    bool m_flusher_pinned;  /* 写日志的线程是否绑定 CPU */
+    cpu_set_t m_flusher_cpus;
     locker m_mutex;
 };
 
@@ -4,45 +4,78 @@
 #include <errno.h>
 
 #include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
+#include <stdint.h>
 #include <cassert>
 
 #include "./lock/locker.h"
 #include "./threadpool/threadpool.h"
 #include "./timer/min_heap.h"
+#include "./timer/coarse_clock.h"
+#include "./memory/slab.h"
+#include "./limit/ip_limiter.h"
 #include "./http/http_conn.h"
+#include "./http2/h2_session.h"
+#include "./websocket/ws_hub.h"
+#include "./proxy/upstream.h"
 #include "./CGImysql/sql_connection_pool.h"
 #include "./log/log.h"
+#include "./stats/syscall_stats.h"
+#include "./stats/metrics.h"
+#include "./affinity/cpu_topology.h"
+#include "./config/config.h"
+#ifdef CORO_ENGINE
+#include "./coro/coro_server.h"
+#endif
+#ifdef TLS_ENABLED
+#include "./tls/tls_transport.h"
+#endif
 
-#define MAX_FD 65536            /* 最大文件描述符 */
-#define MAX_EVENT_NUMBER 10000  /* 最大事件数 */
-#define TIMESLOT 5              /* 最小超时单位 */
-
-//#define SYNLOG      /* 同步写日志 */
-#define ASYNLOG   /* 异步写日志 */
+/* 可调参数都在 config/config.h 中，启动时由配置文件和命令行给出，这里只保留代码中的常量 */
 
-// #define listenfdLT /* 水平触发阻塞 */
-#define listenfdET /* 边缘触发非阻塞*/
+/* 线程池的调度通道：静态文件等不访问数据库的请求走快速通道，登录和注册等 CGI 请求走数据库通道，
+    数据库通道限制同时占用的线程数（db_max_running），注册请求堆积时静态请求仍有线程可用 */
+#define LANE_STATIC 0
+#define LANE_DB 1
 
-extern int addfd(int epollfd, int fd, bool one_shot);
-extern int removefd(int epollfd, int fd);
+extern void addfd(int epollfd, int fd, void* ptr, bool one_shot, bool et);
+extern void removefd(int epollfd, int fd);
 extern int setnonblocking(int fd);
 
-static int pipefd[2];
+static server_config* conf = server_config::get_instance();
 static int epollfd = 0;
 static time_heap timer_lst(5);
-
-/* 信号处理函数 */
-void sig_handler(int sig)
-{
-    /* 为保证函数的可重入性，保留原来的 errno */
-    /* 可重入性表示中断后再次进入该函数，环境变量与之前相同，不会丢失数据 */
-    int save_errno = errno;
-    int msg = sig;
-
-    /* 将信号值从管道写端写入，传输字符类型，而非整形 */
-    send(pipefd[1], (char *)&msg, 1, 0);
-    errno = save_errno;
-}
+/* 连接对象池，连接建立时分配，关闭时回收 */
+static slab<http_conn> conn_slab(64);
+
+/* 定时器 fd，始终武装到堆顶定时器的到期时间 */
+static int timerfd = -1;
+/* 当前 timerfd 武装的到期时间（单调时钟毫秒），0 表示未武装或已触发 */
+static long long timer_armed = 0;
+/* 信号 fd，SIGTERM 和 SIGHUP 通过它以普通可读事件的形式进入主循环 */
+static int signalfd_ = -1;
+/* 工作线程交还连接时写这个 eventfd 唤醒主循环 */
+static int handoff_fd = -1;
+static threadpool<http_conn>* pool = NULL;
+
+/* 监听 socket */
+static int listenfd = -1;
+/* HTTPS 监听 socket，未启用时为 -1 */
+static int tls_listenfd = -1;
+/* 是否因过载暂停了 accept（监听 socket 已从 epoll 中移除） */
+static bool accept_paused = false;
+/* 暂停 accept 后最早可以恢复的时刻（单调时钟毫秒） */
+static long long accept_resume_at = 0;
+/* 过载时拒绝的连接和请求数 */
+static long shed_count = 0;
+/* 预先生成的过载应答 */
+static char busy_response[128];
+static int busy_response_len = 0;
+/* 预先生成的超出单个 IP 限制时的应答 */
+static char limited_response[128];
+static int limited_response_len = 0;
 
 /* 设置信号函数 */
 void addsig(int sig, void(handler)(int), bool restart = true)
@@ -50,7 +83,6 @@ void addsig(int sig, void(handler)(int), bool restart = true)
     struct sigaction sa;
     memset(&sa, '\0', sizeof(sa));
 
-    /* 信号处理函数中仅发送信号，不做对应的逻辑处理 */
     sa.sa_handler = handler;
     if(restart)
     {
@@ -63,23 +95,70 @@ void addsig(int sig, void(handler)(int), bool restart = true)
     assert(sigaction(sig, &sa, NULL) != -1);
 }
 
+/* 将 timerfd 武装到下一个定时器的到期时间，毫秒精度 */
+void arm_timer()
+{
+    long long deadline;
+    if( ! timer_lst.empty() )
+    {
+        deadline = timer_lst.top()->expire;
+    }
+    else
+    {
+        /* 没有定时器时也每隔 timeslot 秒醒来一次，用于刷新日志 */
+        deadline = coarse_clock::get_instance()->now_ms() + conf->timeslot * 1000;
+    }
+
+    /* 暂停 accept 期间需要定期醒来检查负载是否已经回落 */
+    if(accept_paused)
+    {
+        long long recheck = coarse_clock::get_instance()->now_ms() + conf->admission_recheck;
+        if(recheck < deadline)
+        {
+            deadline = recheck;
+        }
+    }
+
+    /* 到期时间只会因新定时器而提前，推迟的情况等已武装的时刻到来后再重新武装，
+        这样保活连接上频繁的定时器调整不会每次都产生 timerfd_settime 调用 */
+    if(timer_armed != 0 && timer_armed <= deadline)
+    {
+        return;
+    }
+    if(deadline <= 0)
+    {
+        deadline = 1;
+    }
+
+    struct itimerspec its;
+    memset(&its, '\0', sizeof(its));
+    its.it_value.tv_sec = deadline / 1000;
+    its.it_value.tv_nsec = (deadline % 1000) * 1000000;
+    timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+    COUNT_SYSCALL(OTHER);
+    timer_armed = deadline;
+}
+
 /* 定时处理任务 */
 void timer_handler()
 {
     LOG_DEBUG("[main] call timer_handler()\n");
     Log::get_instance()->flush();
 
-    timer_lst.tick();
-
-    if( ! timer_lst.empty() )
+    /* 读走到期次数，否则 timerfd 一直可读 */
+    uint64_t expirations;
+    while (read(timerfd, &expirations, sizeof(expirations)) > 0)
     {
-        time_t cur = time(NULL);
-        alarm(timer_lst.top()->expire - cur);
-    }
-    else
-    {
-        alarm(TIMESLOT);
+        COUNT_SYSCALL(OTHER);
     }
+    COUNT_SYSCALL(OTHER);
+    timer_armed = 0;
+
+    timer_lst.tick();
+    /* 回收不再需要的客户端 IP 记录 */
+    ip_limiter::get_instance()->age();
+    /* 上游的空闲连接与客户连接在同一个 epoll 上，只在主线程中关闭 */
+    proxy_table::get_instance()->prune(coarse_clock::get_instance()->now_ms());
 }
 /* 定时器回调函数，删除非活动连接在 socket 上的注册事件，并关闭 */
 void cb_func(clinet_data* user_data)
@@ -88,125 +167,401 @@ void cb_func(clinet_data* user_data)
     Log::get_instance()->flush();
 
     assert(user_data);
-    epoll_ctl(epollfd, EPOLL_CTL_DEL, user_data->sockfd, 0);
-    close(user_data->sockfd);
-    http_conn::m_user_count--;
+    http_conn* conn = (http_conn*)user_data->conn;
+    timer_lst.del_timer(user_data->timer);
+    ip_limiter::get_instance()->on_close(user_data->address.sin_addr.s_addr);
+    conn->close_conn();
+    conn_slab.free(conn);
 }
 
-void show_error(int connfd, const char* info)
+/* 连接在当前阶段超时或速率过低，读请求中途的先尽力应答 408，然后关闭 */
+void timeout_close(clinet_data* user_data)
 {
-    printf("%s", info);
-    send(connfd, info, strlen(info), 0);
-    close(connfd);
+    assert(user_data);
+    LOG_INFO("[main] connection %d timed out\n", user_data->sockfd);
+    ((http_conn*)user_data->conn)->timeout_response();
+    cb_func(user_data);
 }
 
-int main(int argc, char* argv[])
+/* 负载是否已达上限：并发连接数或线程池请求队列长度 */
+bool overloaded()
+{
+    return http_conn::m_user_count >= conf->max_conn || pool->queue_size() >= conf->max_queued;
+}
+
+/* 负载是否已回落到低水位以下，与 overloaded() 之间留有余量，避免 accept 频繁开关 */
+bool underloaded()
 {
-    if(argc <= 1)
+    return http_conn::m_user_count < conf->max_conn * conf->admission_low_water / 100 &&
+            pool->queue_size() < conf->max_queued * conf->admission_low_water / 100;
+}
+
+/* 暂停或恢复 accept。暂停时把监听 socket 从 epoll 中移除，新连接留在内核的监听队列中；
+    恢复时重新加入，内核会立即报告监听队列中已有的连接 */
+void set_accepting(bool on)
+{
+    if(on == !accept_paused)
     {
-        printf("usage: %s port_number\n", basename(argv[0]));
-        return 1;
+        return;
+    }
+    int* listeners[] = { &listenfd, &tls_listenfd };
+    if(on)
+    {
+        for(int i = 0; i < 2; ++i)
+        {
+            if(*listeners[i] < 0)
+            {
+                continue;
+            }
+            epoll_event event;
+            event.data.ptr = listeners[i];
+            event.events = EPOLLIN | EPOLLRDHUP;
+            if(conf->listen_trigger == TRIGGER_ET)
+            {
+                event.events |= EPOLLET;
+            }
+            epoll_ctl(epollfd, EPOLL_CTL_ADD, *listeners[i], &event);
+            COUNT_SYSCALL(EPOLL_CTL);
+        }
+        LOG_INFO("[main] accept resumed, %d connections, %ld shed\n",
+                    http_conn::m_user_count.load(), shed_count);
     }
+    else
+    {
+        for(int i = 0; i < 2; ++i)
+        {
+            if(*listeners[i] >= 0)
+            {
+                epoll_ctl(epollfd, EPOLL_CTL_DEL, *listeners[i], 0);
+                COUNT_SYSCALL(EPOLL_CTL);
+            }
+        }
+        /* 至少暂停一个检查间隔，fd 耗尽等负载计数反映不出的情况也不会反复开关 */
+        accept_resume_at = coarse_clock::get_instance()->now_ms() + conf->admission_recheck;
+        LOG_WARN("[main] overloaded, accept paused, %d connections, %d queued\n",
+                    http_conn::m_user_count.load(), pool->queue_size());
+    }
+    accept_paused = !on;
+}
 
-#ifdef ASYNLOG
-    Log::get_instance()->init("ServerLog", 2000, 80000, 8);
-#endif
+/* 非阻塞地尽力经传输层 t 发送预先生成的 503 应答，发不出去就算了，不会阻塞主线程。
+    t 为 NULL 表示无法应答（还没有握手的 TLS 连接、HTTP/2 和 WebSocket 连接），只计数 */
+void send_busy(int fd, transport* t)
+{
+    if(t)
+    {
+        t->send_nowait(fd, busy_response, busy_response_len);
+        server_metrics::count_response(503);
+    }
+    ++shed_count;
+}
 
-#ifdef SYNLOG
-    Log::get_instance()->init("ServerLog", 2000, 80000, 0);
-#endif
+/* 非阻塞地尽力发送预先生成的 429 应答 */
+void send_limited(int fd, transport* t)
+{
+    if(t)
+    {
+        t->send_nowait(fd, limited_response, limited_response_len);
+        server_metrics::count_response(429);
+    }
+}
 
-    int port = atoi(argv[1]);
+/* 输出运行时指标时采样的数值，由工作线程调用，只能读取自带锁的状态 */
+long sample_queue_depth()
+{
+    return pool ? pool->queue_size() : 0;
+}
 
-    /* 忽略 SIGPIPE 信号 */
-    addsig(SIGPIPE, SIG_IGN);
+long sample_static_queue()
+{
+    return pool ? pool->queue_size(LANE_STATIC) : 0;
+}
 
-    /* 创建数据库连接池 */
-    connection_pool* connPool = connection_pool::GetInstance();
-    connPool->init("localhost", "qyg", "", "qygdb", 3306, 8);
+long sample_db_queue()
+{
+    return pool ? pool->queue_size(LANE_DB) : 0;
+}
 
-    /* 创建线程池 */
-    threadpool<http_conn>* pool = NULL;
-    try
+long sample_free_db_conns()
+{
+    return connection_pool::GetInstance()->GetFreeConn();
+}
+
+long sample_log_queue()
+{
+    return Log::get_instance()->queue_size();
+}
+
+long sample_ws_subscribers()
+{
+    return ws_hub::get_instance()->size();
+}
+
+long sample_healthy_upstreams()
+{
+    return proxy_table::get_instance()->healthy_count();
+}
+
+long sample_idle_upstream_conns()
+{
+    return proxy_table::get_instance()->idle_count();
+}
+
+/* 注册运行时指标，必须在创建线程池之前完成 */
+void init_metrics()
+{
+    server_metrics::init();
+    metrics* reg = metrics::get_instance();
+    reg->add_sampled_gauge("tws_threadpool_queue_depth", "Requests waiting in the threadpool queue.",
+                            sample_queue_depth);
+    reg->add_sampled_gauge("tws_threadpool_lane_queue_depth", "Requests waiting in each scheduling lane.",
+                            sample_static_queue, "lane=\"static\"");
+    reg->add_sampled_gauge("tws_threadpool_lane_queue_depth", "Requests waiting in each scheduling lane.",
+                            sample_db_queue, "lane=\"db\"");
+    reg->add_sampled_gauge("tws_db_pool_free_connections", "Idle connections in the MySQL pool.",
+                            sample_free_db_conns);
+    reg->add_sampled_gauge("tws_log_queue_depth", "Log lines waiting for the async writer.",
+                            sample_log_queue);
+    reg->add_sampled_gauge("tws_websocket_subscribers", "Open WebSocket connections subscribed to broadcasts.",
+                            sample_ws_subscribers);
+    reg->add_sampled_gauge("tws_proxy_upstreams_healthy", "Upstream servers currently eligible for forwarding.",
+                            sample_healthy_upstreams);
+    reg->add_sampled_gauge("tws_proxy_idle_connections", "Idle keep-alive connections to upstream servers.",
+                            sample_idle_upstream_conns);
+
+    if(!conf->metrics_path.empty())
     {
-        pool = new threadpool<http_conn>(connPool);
+        http_conn::m_metrics_path = conf->metrics_path.c_str();
+        http_conn::m_metrics_local_only = conf->metrics_local_only;
     }
-    catch(...)
+}
+
+/* 按连接当前阶段的期限设置定时器，不在时间堆中的重新挂回 */
+void update_timer(http_conn* conn)
+{
+    heap_timer* timer = &conn->m_timer;
+    timer->expire = conn->deadline();
+    if(timer->index < 0)
     {
-        return 1;
+        timer_lst.add_timer(timer);
     }
+    else
+    {
+        timer_lst.adjust(timer);
+    }
+}
 
-    /* 预先为每个可能的客户连接分配一个 http_conn 对象 */
-    http_conn* users = new http_conn[MAX_FD];
-    assert(users);
+/* 处理主线程已占有的连接上累积的事件。
+    读到数据后连接连同占有权一起交给工作线程；处理完所有事件后释放，释放时又有新事件则继续处理。
+    C 为连接的触发模式 */
+template <trigger_mode C>
+void dispatch(http_conn* conn)
+{
+    do
+    {
+        int ev = conn->take_events();
 
-    /* 初始化数据库读取表 */
-    users->initmysql_result(connPool);
+        /* 异常事件或工作线程要求关闭，直接关闭客户连接 */
+        if(ev & http_conn::EV_CLOSE)
+        {
+            cb_func(&conn->m_user_data);
+            return;
+        }
 
-    /* 创建监听socket文件描述符 */
-    int listenfd = socket(PF_INET, SOCK_STREAM, 0);
-    assert(listenfd >= 0);
+        /* 转发期间两个 socket 上的事件和转发的超时都交给转发过程，不经过线程池 */
+        if(conn->proxying())
+        {
+            if(!conn->proxy_io(ev))
+            {
+                cb_func(&conn->m_user_data);
+                return;
+            }
+            update_timer(conn);
+            continue;
+        }
 
-    int flag = 1;
-    /*
-    * SOL_SOCKET: 在套接字级别上设置选项
-    * SO_REUSEADDR: 允许端口被重复使用
-    * flag = 1 表示打开
-    */
-    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+        /* 工作线程立即发送时会自行切换阶段而不经过主线程，
+            定时器到期时按连接当前阶段的期限重新判断，未到期就重新挂回时间堆 */
+        if(ev & http_conn::EV_TIMEOUT)
+        {
+            long long now = coarse_clock::get_instance()->now_ms();
+            if(conn->deadline() <= now)
+            {
+                /* 空闲的 WebSocket 连接先发 ping，等待 pong 超时才关闭 */
+                if(!conn->ws_keepalive(now))
+                {
+                    timeout_close(&conn->m_user_data);
+                    return;
+                }
+                ev |= http_conn::EV_WRITE;
+            }
+            update_timer(conn);
+        }
 
-    int ret = 0;
-    /* 创建监听socket的TCP/IP的IPv4 socket地址 */
-    struct sockaddr_in address;
-    bzero(&address, sizeof(address));
-    address.sin_family = AF_INET;
-    /* INADDR_ANY：将套接字绑定到所有可用的接口 */
-    address.sin_addr.s_addr = htonl(INADDR_ANY);
-    address.sin_port = htons(port);
+        /* 边缘触发模式下写事件常驻注册，只有应答未发完时才需要处理 */
+        if((ev & http_conn::EV_WRITE) && conn->has_output())
+        {
+            /* 根据写的结果，决定是否关闭连接 */
+            if(!conn->write())
+            {
+                cb_func(&conn->m_user_data);
+                return;
+            }
+            /* 发送速率低于下限的客户端直接关闭 */
+            if(conn->too_slow(coarse_clock::get_instance()->now_ms()))
+            {
+                timeout_close(&conn->m_user_data);
+                return;
+            }
+            /* 按当前阶段（继续发送或保活空闲）的期限调整定时器 */
+            update_timer(conn);
+        }
 
-    /* 绑定socket和它的地址 */
-    ret = bind(listenfd, (struct sockaddr *)&address, sizeof(address));
-    assert(ret >= 0);
+        if(ev & http_conn::EV_READ)
+        {
+            /* 上一个应答还没发完，新请求的数据等发完再读。
+                HTTP/2 和 WebSocket 连接上的帧互相独立，且发送要靠对方的 WINDOW_UPDATE 推进，照常读取 */
+            if(conn->has_output() && !conn->framed())
+            {
+                conn->defer_read();
+                continue;
+            }
 
-    /* 创建监听队列以存放待处理的客户连接，在这些客户连接被accept()之前 */
-    ret = listen(listenfd, 5);
-    assert(ret >= 0);
+            /* 根据读的结果，决定是将任务添加到线程池，还是关闭连接 */
+            if(!conn->read_once<C>())
+            {
+                cb_func(&conn->m_user_data);
+                return;
+            }
+            /* 接收速率低于下限的慢速客户端，应答 408 后关闭 */
+            if(conn->too_slow(coarse_clock::get_instance()->now_ms()))
+            {
+                timeout_close(&conn->m_user_data);
+                return;
+            }
 
-    /* 创建内核事件表 */
-    epoll_event events[MAX_EVENT_NUMBER];
-    epollfd = epoll_create(5);
-    assert(epollfd != -1);
+            /* 该客户端 IP 的请求速率超出限制，应答 429 后关闭 */
+            if(conn->begin_request() &&
+                !ip_limiter::get_instance()->on_request(conn->m_user_data.address.sin_addr.s_addr))
+            {
+                /* HTTP/2 和 WebSocket 连接上无法插入 HTTP/1.1 应答，直接关闭 */
+                send_limited(conn->m_user_data.sockfd, conn->framed() ? NULL : conn->get_transport());
+                cb_func(&conn->m_user_data);
+                return;
+            }
 
-    /* 将 listenfd 放到epoll树上 */
-    addfd(epollfd, listenfd, false);
-    http_conn::m_epollfd = epollfd;
+            /* 按当前阶段的期限调整定时器，必须在交给工作线程之前完成 */
+            update_timer(conn);
 
-    /* 创建管道套接字 */
-    ret = socketpair(PF_UNIX, SOCK_STREAM, 0, pipefd);
-    assert(ret != -1);
-    
-    /* 设置管道写端为非阻塞 */
-    setnonblocking(pipefd[1]);
-    /* 设置管道读端为 ET 非阻塞 */
-    addfd(epollfd, pipefd[0], false);
+            /* 占有权随任务转给工作线程，此后不能再访问连接对象。
+                请求队列已满则应答 503 后关闭 */
+            if(!pool->append(conn, conn->db_bound() ? LANE_DB : LANE_STATIC))
+            {
+                send_busy(conn->m_user_data.sockfd, conn->framed() ? NULL : conn->get_transport());
+                cb_func(&conn->m_user_data);
+            }
+            return;
+        }
+    } while (conn->release());
+}
 
-    /* 传递给主循环的信号值，这里只关注 SIGALRM 和 SIGTERM */
-    addsig(SIGALRM, sig_handler, false);
-    addsig(SIGTERM, sig_handler, false);
+/* 定时器到期回调，连接正被工作线程处理时由其处理完后交还主线程再判断 */
+template <trigger_mode C>
+void timeout_cb(clinet_data* user_data)
+{
+    assert(user_data);
+    http_conn* conn = (http_conn*)user_data->conn;
+    conn->post_event(http_conn::EV_TIMEOUT);
+    if(conn->try_acquire())
+    {
+        dispatch<C>(conn);
+    }
+}
 
-    bool stop_server = false;
+/* 从监听 socket lfd 接受新连接，负载达到上限时拒绝该连接并暂停 accept */
+template <trigger_mode C>
+bool accept_conn(int lfd)
+{
+    /* HTTPS 连接在握手之前无法应答，拒绝时直接关闭 */
+    bool tls = lfd == tls_listenfd;
+    transport* reject = tls ? NULL : http_conn::m_default_transport;
+
+    struct sockaddr_in client_address;
+    socklen_t client_addrlength = sizeof(client_address);
+    int connfd = accept(lfd, (struct sockaddr*)&client_address, 
+                                    &client_addrlength);
+    COUNT_SYSCALL(ACCEPT);
+    if(connfd < 0)
+    {
+        /* fd 耗尽时监听队列非空却无法 accept，边缘触发不会再通知，暂停后定期重试 */
+        if(errno == EMFILE || errno == ENFILE)
+        {
+            LOG_ERROR("[main] accept failed: %s\n", strerror(errno));
+            set_accepting(false);
+        }
+        return false;
+    }
+    if(connfd >= conf->max_fd)
+    {
+        close(connfd);
+        COUNT_SYSCALL(CLOSE);
+        return true;
+    }
+    /* 负载已达上限，拒绝这个连接并暂停 accept，其余连接留在监听队列中等待负载回落 */
+    if(overloaded())
+    {
+        send_busy(connfd, reject);
+        close(connfd);
+        COUNT_SYSCALL(CLOSE);
+        set_accepting(false);
+        return false;
+    }
+    /* 该客户端 IP 的连接数已达上限，只拒绝这个连接，继续 accept 其他连接 */
+    if(!ip_limiter::get_instance()->on_accept(client_address.sin_addr.s_addr))
+    {
+        send_limited(connfd, reject);
+        close(connfd);
+        COUNT_SYSCALL(CLOSE);
+        return true;
+    }
 
-    clinet_data* users_timer = new clinet_data[MAX_FD];
+    server_metrics::accepts.add();
+
+    /* 从对象池分配并初始化客户连接，定时器内嵌在连接对象中 */
+    http_conn* conn = conn_slab.alloc();
+#ifdef TLS_ENABLED
+    conn->set_transport(tls ? tls_transport<C>::get_instance() : http_conn::m_default_transport);
+#endif
+    conn->init(connfd, client_address);
+    conn->m_timer.cb_func = timeout_cb<C>;
+    conn->m_timer.expire = conn->deadline();
+    timer_lst.add_timer(&conn->m_timer);
+    return true;
+}
+
+/* 主循环，L 和 C 分别为监听 socket 和连接的触发模式，启动时按配置选定一种实例，
+    循环中不再判断触发模式 */
+template <trigger_mode L, trigger_mode C>
+void event_loop()
+{
+    std::vector<epoll_event> events(conf->max_events);
+    std::vector<http_conn*> handoffs;
+
+    bool stop_server = false;
 
     /* 超时标志 */
     bool timeout = false;
-    /* 每隔 TIMESLOT 时间触发 SIGALRM 信号 */
-    alarm(TIMESLOT);
+    /* 有工作线程交还的连接 */
+    bool handoff = false;
+    arm_timer();
 
     while (!stop_server)
     {
         /* 等待所监控文件描述符上有事件发生 */
-        int number = epoll_wait(epollfd, events, MAX_EVENT_NUMBER, -1);
+        int number = epoll_wait(epollfd, &events[0], (int)events.size(), -1);
+        COUNT_SYSCALL(EPOLL_WAIT);
+        /* 每轮循环只刷新一次缓存时钟，本轮所有事件共用该时间 */
+        coarse_clock::get_instance()->update();
         if((number < 0) && (errno != EINTR))
         {
             printf("epoll failure\n");
@@ -216,192 +571,423 @@ int main(int argc, char* argv[])
         /* 处理所有就绪事件 */
         for (int i = 0; i < number; i++)
         {
-            int sockfd = events[i].data.fd;
+            /* 监听 socket、timerfd、signalfd 和 eventfd 以各自 fd 变量的地址注册，
+                上游连接以最低位置 1 的对象地址注册，其余 data.ptr 都直接指向连接对象 */
+            void* ptr = events[i].data.ptr;
 
             /* 处理新到的客户连接 */
-            if( sockfd == listenfd)
+            if(ptr == &listenfd || ptr == &tls_listenfd)
             {
-                struct sockaddr_in client_address;
-                socklen_t client_addrlength = sizeof(client_address);
-/* LT 水平触发 */
-#ifdef listenfdLT
-                int connfd = accept(listenfd, (struct sockaddr*)&client_address, 
-                                                &client_addrlength);
-                if(connfd < 0)
+                int lfd = *(int*)ptr;
+                /* LT 水平触发，每次事件接受一个连接，其余的会再次触发 */
+                if(L == TRIGGER_LT)
                 {
-                    printf("errno is: %d\n", errno);
-                    continue;
+                    accept_conn<C>(lfd);
                 }
-                if(http_conn::m_user_count >= MAX_FD)
-                {
-                    show_error(connfd, "Internal server busy");
-                    continue;
-                }
-
-                /* 初始化客户连接 */
-                users[connfd].init(connfd, client_address);
-
-                users_timer[connfd].address = client_address;
-                users_timer[connfd].sockfd = connfd;
-                heap_timer* timer = new heap_timer(0);
-                timer->user_data = &users_timer[connfd];
-                timer->cb_func = cb_func;
-                time_t cur = time(NULL);
-                timer->expire = cur + 3 * TIMESLOT;
-                users_timer[connfd].timer = timer;
-                timer_lst.add_timer(timer);
-#endif
-
-/* ET 非阻塞边缘触发 */
-#ifdef listenfdET
-                while (1)
+                /* ET 非阻塞边缘触发，需要一直 accept 到监听队列为空或暂停 accept */
+                else
                 {
-                    int connfd = accept(listenfd, (struct sockaddr*)&client_address, 
-                                                    &client_addrlength);
-                    if(connfd < 0)
+                    while (accept_conn<C>(lfd))
                     {
-                        break;
-                    }
-                    if(http_conn::m_user_count >= MAX_FD)
-                    {
-                        show_error(connfd, "Internal server busy");
-                        break;
                     }
-                    
-                    /* 初始化客户连接 */
-                    users[connfd].init(connfd, client_address);
-
-                    users_timer[connfd].address = client_address;
-                    users_timer[connfd].sockfd = connfd;
-                    heap_timer* timer = new heap_timer(60);
-                    timer->user_data = &users_timer[connfd];
-                    timer->cb_func = cb_func;
-                    time_t cur = time(NULL);
-                    timer->expire = cur + 3 * TIMESLOT;
-                    users_timer[connfd].timer = timer;
-                    timer_lst.add_timer(timer);
                 }
                 continue;
-#endif
             }
-            /* 处理异常事件 */
-            else if(events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            /* 处理定时器到期 */
+            else if(ptr == &timerfd)
             {
-                /* 如果有异常，直接关闭客户连接 */
-                // users[sockfd].close_conn();
-
-                cb_func(&users_timer[sockfd]);
-
-                heap_timer* timer = users_timer[sockfd].timer;
-                if(timer)
-                {
-                    timer_lst.del_timer(timer);
-                }
+                timeout = true;
+                continue;
+            }
+            /* 处理工作线程交还的连接，放到本轮事件之后统一处理 */
+            else if(ptr == &handoff_fd)
+            {
+                handoff = true;
+                continue;
             }
             /* 处理信号 */
-            else if((sockfd == pipefd[0]) && (events[i].events & EPOLLIN))
+            else if(ptr == &signalfd_)
             {
-                int sig;
-                char signals[1024];
+                struct signalfd_siginfo si;
 
-                /* 从管道读端读出信号值，成功返回字节数，失败返回 -1*/
-                ret = recv(pipefd[0], signals, sizeof(signals), 0);
-                if(-1 == ret)
-                {
-                    continue;
-                }
-                else if(0 == ret)
-                {
-                    continue;
-                }
-                else
+                /* ET 模式下需要一次读完所有待处理的信号 */
+                while (read(signalfd_, &si, sizeof(si)) == sizeof(si))
                 {
-                    /* 处理信号值对应的逻辑 */
-                    for(int i = 0; i < ret; ++i)
+                    COUNT_SYSCALL(OTHER);
+                    switch (si.ssi_signo)
                     {
-                        switch (signals[i])
-                        {
-                        case SIGALRM:
-                        {
-                            timeout = true;
-                            break;
-                        }
-                        case SIGTERM:
-                        {
-                            stop_server = true;
-                            break;
-                        }
-                        }
-                    }
-                }
-            }
-            /* 处理客户端连接上接收到的数据 */
-            else if(events[i].events & EPOLLIN)
-            {
-                /* 取出该连接对应的定时器 */
-                heap_timer* timer = users_timer[sockfd].timer;
-                
-                /* 根据读的结果，决定是将任务添加到线程池，还是关闭连接 */
-                if(users[sockfd].read_once())
-                {
-                    pool->append(users + sockfd);
-
-                    /* 若有数据传输，则将定时器往后延迟3个单位 */
-                    if(timer)
+                    case SIGTERM:
                     {
-                        time_t cur = time(NULL);
-                        timer->expire = cur + 3 * TIMESLOT;
-                        timer_lst.adjust(timer);
+                        stop_server = true;
+                        break;
                     }
-                }
-                else
-                {
-                    // users[sockfd].close_conn();
-                    cb_func(&users_timer[sockfd]);
-                    if(timer)
+                    case SIGHUP:
                     {
-                        timer_lst.del_timer(timer);
+                        LOG_INFO("[main] %ld shed, %ld connections and %ld requests rate limited\n",
+                                    shed_count, ip_limiter::get_instance()->rejected_conns(),
+                                    ip_limiter::get_instance()->rejected_requests());
+                        pool->log_stats();
+                        Log::get_instance()->flush();
+#ifdef SYSCALL_STATS
+                        syscall_stats::dump();
+#endif
+#ifdef LOCK_PROFILE
+                        lock_profile::dump();
+#endif
+                        break;
+                    }
                     }
                 }
+                continue;
             }
-            else if(events[i].events & EPOLLOUT)
-            {
-                /* 取出该连接对应的定时器 */
-                heap_timer* timer = users_timer[sockfd].timer;
 
-                /* 根据写的结果，决定是否关闭连接 */
-                if(users[sockfd].write())
-                {
-                    /* 若有数据传输，则将定时器往后延迟3个单位 */
-                    if(timer)
-                    {
-                        time_t cur = time(NULL);
-                        timer->expire = cur + 3 * TIMESLOT;
-                        timer_lst.adjust(timer);
-                    }
-                }
-                else
+            /* 上游连接的事件记到正在使用它的客户连接上 */
+            if(upstream_conn* uc = upstream_conn::from_epoll(ptr))
+            {
+                http_conn* owner = uc->on_event(events[i].events);
+                if(owner)
                 {
-                    // users[sockfd].close_conn();
-                    cb_func(&users_timer[sockfd]);
-                    if(timer)
+                    owner->post_event(http_conn::EV_UPSTREAM);
+                    if(owner->try_acquire())
                     {
-                        timer_lst.del_timer(timer);
+                        dispatch<C>(owner);
                     }
                 }
+                continue;
+            }
+
+            /* 连接事件先记下，再尝试占有连接；连接正被工作线程处理时，
+                由工作线程处理完后交还主线程 */
+            http_conn* conn = (http_conn*)ptr;
+            int ev = 0;
+            if(events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            {
+                ev |= http_conn::EV_CLOSE;
+            }
+            if(events[i].events & EPOLLIN)
+            {
+                ev |= http_conn::EV_READ;
+            }
+            if(events[i].events & EPOLLOUT)
+            {
+                ev |= http_conn::EV_WRITE;
+            }
+            conn->post_event(ev);
+            if(conn->try_acquire())
+            {
+                dispatch<C>(conn);
             }
         }
+        /* 交还的连接已由工作线程代为占有，本轮事件处理完之后再处理，
+            避免关闭回收后本轮后续事件还指向它 */
+        if(handoff)
+        {
+            uint64_t n;
+            /* 先读 eventfd 再取队列，取队列之后交还的连接会再次唤醒主循环 */
+            read(handoff_fd, &n, sizeof(n));
+            COUNT_SYSCALL(OTHER);
+            http_conn::take_handoff(handoffs);
+            for(size_t j = 0; j < handoffs.size(); ++j)
+            {
+                dispatch<C>(handoffs[j]);
+            }
+            handoffs.clear();
+            handoff = false;
+        }
         if(timeout)
         {
             timer_handler();
             timeout = false;
         }
-        
+        /* 负载回落到低水位以下后恢复 accept */
+        if(accept_paused && coarse_clock::get_instance()->now_ms() >= accept_resume_at &&
+            underloaded())
+        {
+            set_accepting(true);
+        }
+        /* 只有主线程访问的状态，每轮循环发布一次供指标输出读取 */
+        server_metrics::active_conns.store(http_conn::m_user_count, std::memory_order_relaxed);
+        server_metrics::timer_count.store(timer_lst.size(), std::memory_order_relaxed);
+        /* 按上一个周期的排队延迟和忙碌程度增减工作线程 */
+        pool->adjust(coarse_clock::get_instance()->now_ms());
+        server_metrics::worker_threads.store(pool->thread_number(), std::memory_order_relaxed);
+        arm_timer();
+
+    }
+}
+
+/* 创建监听 port 的 socket */
+int open_listener(int port)
+{
+    /* 创建监听socket文件描述符 */
+    int fd = socket(PF_INET, SOCK_STREAM, 0);
+    assert(fd >= 0);
+
+    int flag = 1;
+    /*
+    * SOL_SOCKET: 在套接字级别上设置选项
+    * SO_REUSEADDR: 允许端口被重复使用
+    * flag = 1 表示打开
+    */
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+
+    /* 创建监听socket的TCP/IP的IPv4 socket地址 */
+    struct sockaddr_in address;
+    bzero(&address, sizeof(address));
+    address.sin_family = AF_INET;
+    /* INADDR_ANY：将套接字绑定到所有可用的接口 */
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+
+    /* 绑定socket和它的地址 */
+    int ret = bind(fd, (struct sockaddr *)&address, sizeof(address));
+    assert(ret >= 0);
+
+    /* 创建监听队列以存放待处理的客户连接，在这些客户连接被accept()之前 */
+    ret = listen(fd, conf->backlog);
+    assert(ret >= 0);
+    return fd;
+}
+
+int main(int argc, char* argv[])
+{
+    /* 先读配置文件，再应用命令行选项 */
+    bool exit_now = false;
+    if(!conf->parse(argc, argv, &exit_now))
+    {
+        return 1;
+    }
+    if(exit_now)
+    {
+        return 0;
+    }
+
+    /* 屏蔽 SIGTERM 和 SIGHUP，之后创建的日志线程和工作线程都继承该屏蔽字，
+        这两个信号只会通过 signalfd 交给主循环处理，不会中断任何线程的系统调用 */
+    sigset_t sigmask;
+    sigemptyset(&sigmask);
+    sigaddset(&sigmask, SIGTERM);
+    sigaddset(&sigmask, SIGHUP);
+    int ret = pthread_sigmask(SIG_BLOCK, &sigmask, NULL);
+    assert(ret == 0);
+
+    /* 主循环在分配任何连接对象和缓冲区之前绑定 CPU，这些内存首次访问时就落在它所在的节点上 */
+    cpu_layout layout;
+    if(!cpu_topology::get_instance()->plan(conf->reactor_cpus.c_str(), conf->worker_cpus.c_str(),
+                                            conf->log_cpus.c_str(), &layout))
+    {
+        printf("invalid cpu list: reactor \"%s\", workers \"%s\", log \"%s\"\n",
+                conf->reactor_cpus.c_str(), conf->worker_cpus.c_str(), conf->log_cpus.c_str());
+        return 1;
+    }
+    if(layout.pin_reactor)
+    {
+        cpu_topology::get_instance()->bind_self(layout.reactor);
+    }
+    if(layout.pin_log)
+    {
+        Log::get_instance()->set_flusher_cpus(layout.log);
+    }
+
+    /* 指标注册表在创建任何线程之前建好，之后只读 */
+    init_metrics();
+
+    /* 队列长度为 0 时同步写日志 */
+    Log::get_instance()->init("ServerLog", conf->log_buf_size, conf->log_split_lines,
+                                conf->log_async ? conf->log_queue_size : 0);
+    conf->log();
+
+    char reactor_cpus[64], worker_cpus[64], log_cpus[64];
+    cpu_topology::format_cpu_list(layout.reactor, reactor_cpus, sizeof(reactor_cpus));
+    cpu_topology::format_cpu_list(layout.workers, worker_cpus, sizeof(worker_cpus));
+    cpu_topology::format_cpu_list(layout.log, log_cpus, sizeof(log_cpus));
+    LOG_INFO("[main] %d NUMA nodes, cpus: reactor %s, workers %s, log %s\n",
+                cpu_topology::get_instance()->node_count(),
+                layout.pin_reactor ? reactor_cpus : "any", layout.pin_workers ? worker_cpus : "any",
+                layout.pin_log ? log_cpus : "any");
+
+
+    /* 忽略 SIGPIPE 信号 */
+    addsig(SIGPIPE, SIG_IGN);
+
+    /* 创建数据库连接池 */
+    connection_pool* connPool = connection_pool::GetInstance();
+    connPool->init(conf->db_host, conf->db_user, conf->db_password, conf->db_name, conf->db_port,
+                    conf->sql_num);
+
+#ifndef CORO_ENGINE
+    /* 创建线程池 */
+    try
+    {
+        pool = new threadpool<http_conn>(connPool, conf->threads, conf->max_queued,
+                                            layout.pin_workers ? &layout.workers : NULL);
+        pool->set_lane(LANE_STATIC, "static", conf->static_weight, 0, 0, false);
+        pool->set_lane(LANE_DB, "db", conf->db_weight, conf->db_max_running, conf->db_max_queued, true);
+        if(conf->adaptive_threads)
+        {
+            pool->set_adaptive(conf->min_threads, conf->max_threads, conf->queue_target_delay,
+                                conf->adapt_interval);
+        }
+    }
+    catch(...)
+    {
+        return 1;
     }
+#endif
 
+    /* 各阶段超时配置 */
+    http_conn::m_timeouts.header = conf->header_timeout;
+    http_conn::m_timeouts.body = conf->body_timeout;
+    http_conn::m_timeouts.min_recv_rate = conf->min_recv_rate;
+    http_conn::m_timeouts.write = conf->write_timeout;
+    http_conn::m_timeouts.min_send_rate = conf->min_send_rate;
+    http_conn::m_timeouts.keepalive = conf->keepalive_timeout;
+    http_conn::m_timeouts.rate_grace = conf->rate_grace;
+    http_conn::m_eager_write = conf->eager_write;
+    http_conn::m_doc_root = conf->doc_root.c_str();
+    http_conn::m_http2 = conf->http2;
+    h2_session::m_max_streams = conf->h2_max_streams;
+    if(!conf->ws_path.empty())
+    {
+        http_conn::m_ws_path = conf->ws_path.c_str();
+    }
+    ws_hub::m_relay = conf->ws_relay;
+    ws_session::m_ping_interval = conf->ws_ping_interval;
+    ws_session::m_pong_timeout = conf->ws_pong_timeout;
+    ws_session::m_max_backlog = conf->ws_max_backlog;
+    ws_session::m_max_message = conf->ws_max_message;
+    proxy_table::m_connect_timeout = conf->proxy_connect_timeout;
+    proxy_table::m_timeout = conf->proxy_timeout;
+    proxy_table::m_max_idle = conf->proxy_keepalive;
+    proxy_table::m_idle_timeout = conf->proxy_idle_timeout;
+    proxy_table::m_fail_timeout = conf->proxy_fail_timeout;
+    proxy_table::m_health_interval = conf->proxy_health_interval;
+    proxy_table::m_health_path = conf->proxy_health_path;
+    if(!proxy_table::get_instance()->init(conf->proxy_routes.c_str()))
+    {
+        return 1;
+    }
+    if(conf->conn_trigger == TRIGGER_LT)
+    {
+        http_conn::m_default_transport = socket_transport<TRIGGER_LT>::get_instance();
+    }
+
+    /* 过载应答只生成一次，拒绝时直接发送 */
+    busy_response_len = snprintf(busy_response, sizeof(busy_response),
+                                    "HTTP/1.1 503 Service Unavailable\r\n"
+                                    "Retry-After:%d\r\n"
+                                    "Content-Length:0\r\n"
+                                    "Connection:close\r\n\r\n", conf->retry_after);
+    limited_response_len = snprintf(limited_response, sizeof(limited_response),
+                                    "HTTP/1.1 429 Too Many Requests\r\n"
+                                    "Retry-After:%d\r\n"
+                                    "Content-Length:0\r\n"
+                                    "Connection:close\r\n\r\n", conf->retry_after);
+
+    /* 按客户端 IP 限流 */
+    ip_limiter::get_instance()->init(conf->per_ip_max_conn, conf->per_ip_rate, conf->per_ip_burst,
+                                        conf->per_ip_exempt_loopback);
+
+    /* 初始化数据库读取表 */
+    http_conn::initmysql_result(connPool);
+
+    listenfd = open_listener(conf->port);
+
+#ifdef TLS_ENABLED
+    /* HTTPS 监听 socket，连接使用与连接触发模式对应的 TLS 传输层 */
+    if(conf->tls_port > 0)
+    {
+        if(!tls_context::get_instance()->init(conf->tls_cert.c_str(), conf->tls_key.c_str(),
+                                                conf->tls_session_cache, conf->tls_session_timeout,
+                                                conf->tls_session_tickets, conf->ktls, conf->http2))
+        {
+            return 1;
+        }
+        if(conf->conn_trigger == TRIGGER_LT)
+        {
+            tls_transport<TRIGGER_LT>::get_instance()->init(conf->max_fd);
+        }
+        else
+        {
+            tls_transport<TRIGGER_ET>::get_instance()->init(conf->max_fd);
+        }
+        tls_listenfd = open_listener(conf->tls_port);
+    }
+#endif
+
+#ifdef CORO_ENGINE
+    /* 连接由协程引擎的调度线程处理，本线程只处理信号 */
+    return coro_server::run(listenfd, conf->coro_threads, connPool,
+                            conf->coro_db_threads > 0 ? conf->coro_db_threads : conf->sql_num,
+                            conf->max_fd, layout.pin_workers ? &layout.workers : NULL, sigmask);
+#endif
+
+    /* 创建内核事件表 */
+    epollfd = epoll_create(5);
+    assert(epollfd != -1);
+
+    /* 将 listenfd 放到epoll树上 */
+    addfd(epollfd, listenfd, &listenfd, false, conf->listen_trigger == TRIGGER_ET);
+    if(tls_listenfd >= 0)
+    {
+        addfd(epollfd, tls_listenfd, &tls_listenfd, false, conf->listen_trigger == TRIGGER_ET);
+    }
+    http_conn::m_epollfd = epollfd;
+
+    /* 创建 signalfd，接收被屏蔽的 SIGTERM 和 SIGHUP */
+    signalfd_ = signalfd(-1, &sigmask, SFD_NONBLOCK | SFD_CLOEXEC);
+    assert(signalfd_ != -1);
+    addfd(epollfd, signalfd_, &signalfd_, false, true);
+
+    /* 创建基于单调时钟的 timerfd，代替 alarm() 驱动定时器 */
+    timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    assert(timerfd != -1);
+    addfd(epollfd, timerfd, &timerfd, false, true);
+
+    /* 创建工作线程交还连接用的 eventfd */
+    handoff_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    assert(handoff_fd != -1);
+    addfd(epollfd, handoff_fd, &handoff_fd, false, true);
+    http_conn::m_handoff_fd = handoff_fd;
+
+    /* 上游连接注册到同一个 epoll，健康检查线程在 epoll 建好之后启动 */
+    proxy_table::get_instance()->start();
+
+    LOG_INFO("[main] listen %s, connections %s\n",
+                conf->listen_trigger == TRIGGER_ET ? "ET" : "LT",
+                conf->conn_trigger == TRIGGER_ET ? "ET" : "LT");
+    if(conf->listen_trigger == TRIGGER_ET)
+    {
+        if(conf->conn_trigger == TRIGGER_ET)
+        {
+            event_loop<TRIGGER_ET, TRIGGER_ET>();
+        }
+        else
+        {
+            event_loop<TRIGGER_ET, TRIGGER_LT>();
+        }
+    }
+    else
+    {
+        if(conf->conn_trigger == TRIGGER_ET)
+        {
+            event_loop<TRIGGER_LT, TRIGGER_ET>();
+        }
+        else
+        {
+            event_loop<TRIGGER_LT, TRIGGER_LT>();
+        }
+    }
+
+    close(handoff_fd);
+    close(timerfd);
+    close(signalfd_);
     close(epollfd);
     close(listenfd);
-    delete [] users;
+    if(tls_listenfd >= 0)
+    {
+        close(tls_listenfd);
+    }
     delete pool;
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,122 @@
+#include <stdlib.h>
+
+#include "buffer_pool.h"
+#include "../stats/metrics.h"
+
+/* 每个线程的缓冲区缓存，线程退出时释放 */
+struct buffer_cache
+{
+    std::vector<char*> lists[buffer_pool::CLASS_COUNT];
+
+    ~buffer_cache()
+    {
+        for(int cls = 0; cls < buffer_pool::CLASS_COUNT; ++cls)
+        {
+            for(size_t i = 0; i < lists[cls].size(); ++i)
+            {
+                free(lists[cls][i]);
+            }
+        }
+    }
+};
+
+static thread_local buffer_cache t_cache;
+
+buffer_pool::~buffer_pool()
+{
+    for(int cls = 0; cls < CLASS_COUNT; ++cls)
+    {
+        for(size_t i = 0; i < m_depot[cls].size(); ++i)
+        {
+            free(m_depot[cls][i]);
+        }
+    }
+}
+
+int buffer_pool::class_of(int size)
+{
+    for(int cls = 0; cls < CLASS_COUNT; ++cls)
+    {
+        if(size <= class_size(cls))
+        {
+            return cls;
+        }
+    }
+    return -1;
+}
+
+char* buffer_pool::acquire(int size)
+{
+    int cls = class_of(size);
+    if(cls < 0)
+    {
+        return NULL;
+    }
+
+    std::vector<char*>& cache = t_cache.lists[cls];
+    if(!cache.empty())
+    {
+        server_metrics::buffer_hits.add();
+    }
+    else
+    {
+        refill(cls, cache);
+        if(cache.empty())
+        {
+            server_metrics::buffer_mallocs.add();
+            return (char*)malloc(class_size(cls));
+        }
+        server_metrics::buffer_refills.add();
+    }
+
+    char* buf = cache.back();
+    cache.pop_back();
+    return buf;
+}
+
+void buffer_pool::release(char* buf, int size)
+{
+    if(!buf)
+    {
+        return;
+    }
+    int cls = class_of(size);
+
+    std::vector<char*>& cache = t_cache.lists[cls];
+    if((int)cache.size() >= THREAD_CACHE)
+    {
+        drain(cls, cache);
+    }
+    cache.push_back(buf);
+}
+
+void buffer_pool::refill(int cls, std::vector<char*>& cache)
+{
+    m_mutex.lock();
+    std::vector<char*>& depot = m_depot[cls];
+    while (!depot.empty() && (int)cache.size() < THREAD_CACHE / 2)
+    {
+        cache.push_back(depot.back());
+        depot.pop_back();
+    }
+    m_mutex.unlock();
+}
+
+void buffer_pool::drain(int cls, std::vector<char*>& cache)
+{
+    m_mutex.lock();
+    std::vector<char*>& depot = m_depot[cls];
+    while ((int)cache.size() > THREAD_CACHE / 2)
+    {
+        if((int)depot.size() < DEPOT_LIMIT)
+        {
+            depot.push_back(cache.back());
+        }
+        else
+        {
+            free(cache.back());
+        }
+        cache.pop_back();
+    }
+    m_mutex.unlock();
+}
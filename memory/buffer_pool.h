@@ -0,0 +1,57 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <vector>
+#include "../lock/locker.h"
+
+/* 共享 I/O 缓冲区池
+   连接只在真正有数据收发时借用读写缓冲区，请求应答完毕后归还，空闲的保活连接不占用缓冲区。
+   缓冲区按 1K/2K/4K/8K/16K 分为若干大小级别，读缓冲区遇到较大的请求头时可以换成更大的级别。
+   每个线程有自己的缓存，借还都不加锁；线程缓存过多或不足时与全局仓库批量交换 */
+class buffer_pool
+{
+public:
+    /* 最小级别的大小 */
+    static const int MIN_SIZE = 1024;
+    /* 级别个数，最大级别为 MIN_SIZE << (CLASS_COUNT - 1) */
+    static const int CLASS_COUNT = 5;
+    /* 每个线程每个级别最多缓存的缓冲区数 */
+    static const int THREAD_CACHE = 64;
+    /* 全局仓库每个级别最多保留的缓冲区数，超出的直接释放 */
+    static const int DEPOT_LIMIT = 4096;
+
+public:
+    static buffer_pool* get_instance()
+    {
+        static buffer_pool instance;
+        return &instance;
+    }
+
+    /* 能容纳 size 字节的最小级别，超出最大级别时返回 -1 */
+    static int class_of(int size);
+    /* 级别对应的缓冲区大小 */
+    static int class_size(int cls) { return MIN_SIZE << cls; }
+    /* 最大级别的缓冲区大小 */
+    static int max_size() { return class_size(CLASS_COUNT - 1); }
+
+    /* 借用一个至少 size 字节的缓冲区，实际大小为 class_size(class_of(size))。
+        size 超出最大级别或内存不足时返回 NULL，调用者需要检查 */
+    char* acquire(int size);
+    /* 归还缓冲区，size 为借用时的实际大小 */
+    void release(char* buf, int size);
+
+private:
+    buffer_pool() { }
+    ~buffer_pool();
+
+    /* 线程缓存为空时，从仓库取一批 */
+    void refill(int cls, std::vector<char*>& cache);
+    /* 线程缓存已满时，还一批给仓库 */
+    void drain(int cls, std::vector<char*>& cache);
+
+private:
+    locker m_mutex;                             /* 保护全局仓库 */
+    std::vector<char*> m_depot[CLASS_COUNT];    /* 全局仓库 */
+};
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <new>
+#include <vector>
+#include <exception>
+
+/* 对象池（slab）类
+   按块向系统申请内存，每块容纳 chunk_objects 个对象，按需增长。
+   释放的对象挂在空闲链表上，下次分配时优先复用（后进先出，复用的对象更可能还在缓存中）。
+   新块中的对象按顺序切分，未分配过的对象所在页不会被访问，常驻内存随活跃对象数增长。
+   非线程安全，只应由一个线程（主循环）分配和回收 */
+template<typename T>
+class slab
+{
+public:
+    slab(int chunk_objects = 64)
+        : m_free(NULL), m_next(NULL), m_end(NULL),
+          m_chunk_objects(chunk_objects), m_live(0)
+    {
+        if(chunk_objects <= 0)
+        {
+            throw std::exception();
+        }
+    }
+
+    /* 销毁对象池，此时所有对象都应已回收 */
+    ~slab()
+    {
+        for(size_t i = 0; i < m_chunks.size(); ++i)
+        {
+            ::operator delete(m_chunks[i]);
+        }
+    }
+
+    /* 分配并默认构造一个对象 */
+    T* alloc()
+    {
+        node* n = m_free;
+        if(n)
+        {
+            m_free = n->next;
+        }
+        else
+        {
+            if(m_next == m_end)
+            {
+                grow();
+            }
+            n = m_next++;
+        }
+        ++m_live;
+        return new (n->storage) T();
+    }
+
+    /* 析构对象并放回空闲链表 */
+    void free(T* obj)
+    {
+        if(!obj)
+        {
+            return;
+        }
+        obj->~T();
+        node* n = reinterpret_cast<node*>(obj);
+        n->next = m_free;
+        m_free = n;
+        --m_live;
+    }
+
+    /* 当前存活的对象数 */
+    int live() const { return m_live; }
+
+    /* 已向系统申请的对象容量 */
+    int capacity() const { return (int)m_chunks.size() * m_chunk_objects; }
+
+private:
+    /* 对象槽，空闲时复用其内存作为链表指针 */
+    union node
+    {
+        node* next;
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+    /* 申请一个新块 */
+    void grow()
+    {
+        node* chunk = static_cast<node*>(::operator new(sizeof(node) * m_chunk_objects));
+        m_chunks.push_back(chunk);
+        m_next = chunk;
+        m_end = chunk + m_chunk_objects;
+    }
+
+private:
+    std::vector<node*> m_chunks;    /* 所有已申请的块 */
+    node* m_free;                   /* 空闲链表 */
+    node* m_next;                   /* 当前块中下一个未切分的对象 */
+    node* m_end;                    /* 当前块的末尾 */
+    int m_chunk_objects;            /* 每块容纳的对象数 */
+    int m_live;                     /* 存活对象数 */
+};
+
+#endif
@@ -0,0 +1,838 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "proxy_session.h"
+#include "../log/log.h"
+#include "../timer/coarse_clock.h"
+#include "../memory/buffer_pool.h"
+#include "../stats/syscall_stats.h"
+#include "../stats/metrics.h"
+
+proxy_session::proxy_session(int fd, transport* t, http_conn* owner)
+    : m_fd(fd), m_transport(t), m_owner(owner), m_route(NULL), m_head(false), m_idempotent(false),
+        m_linger(false), m_keepalive(false), m_upstream(NULL), m_fresh(false), m_opened_at(0), m_attempts(0),
+        m_last_progress(0), m_req_off(0), m_body_left(0), m_body_read(false), m_body_abandoned(false),
+        m_req_pipe(0), m_xfer_off(0), m_write_failed(false), m_in(NULL), m_in_len(0), m_head_done(false),
+        m_received(false), m_mode(BODY_NONE), m_resp_left(0), m_resp_done(false), m_upstream_close(false),
+        m_resp_pipe(0), m_chunk_state(CHUNK_SIZE), m_chunk_left(0), m_out_off(0), m_responded(false),
+        m_upstream_failed(false), m_client_failed(false), m_want_read(false), m_want_write(false)
+{
+}
+
+proxy_session::~proxy_session()
+{
+    finish();
+}
+
+void proxy_session::begin(const proxy_route* route, bool head, bool idempotent, bool keepalive, long long body_left)
+{
+    m_route = route;
+    m_head = head;
+    m_idempotent = idempotent;
+    m_linger = keepalive;
+    m_body_left = body_left;
+    progress();
+}
+
+void proxy_session::progress()
+{
+    m_last_progress = coarse_clock::get_instance()->now_ms();
+}
+
+void proxy_session::finish()
+{
+    if(m_upstream)
+    {
+        /* 只有应答完整读完、请求完整发出、管道已清空的连接才能交给下一个请求 */
+        drop_upstream(m_head_done && m_resp_done && !m_upstream_close && !m_body_abandoned &&
+                        !m_write_failed && request_done() && m_resp_pipe == 0);
+    }
+    if(m_in)
+    {
+        buffer_pool::get_instance()->release(m_in, buffer_pool::max_size());
+        m_in = NULL;
+    }
+}
+
+void proxy_session::drop_upstream(bool reusable)
+{
+    upstream_server* server = m_upstream->m_server;
+    server->m_active.fetch_sub(1, std::memory_order_relaxed);
+    server->checkin(m_upstream, reusable, coarse_clock::get_instance()->now_ms());
+    m_upstream = NULL;
+}
+
+bool proxy_session::open()
+{
+    long long now = coarse_clock::get_instance()->now_ms();
+    proxy_table* table = proxy_table::get_instance();
+    /* 新建连接立即失败的服务器被暂停选中，最多把路由中的每台服务器都试一遍 */
+    for(size_t i = 0; i < m_route->servers.size(); ++i)
+    {
+        upstream_server* server = table->pick(m_route, now);
+        if(!server)
+        {
+            return false;
+        }
+        /* 重试时不再用空闲连接，上一个连接失败很可能是因为它已被上游关闭 */
+        upstream_conn* c = m_attempts == 0 ? server->checkout(now) : NULL;
+        m_fresh = c == NULL;
+        if(m_fresh)
+        {
+            c = server->connect();
+            if(!c)
+            {
+                server->fail(now);
+                continue;
+            }
+            server_metrics::proxy_connects_new.add();
+        }
+        else
+        {
+            server_metrics::proxy_connects_pooled.add();
+        }
+        c->m_owner.store(m_owner);
+        server->m_active.fetch_add(1, std::memory_order_relaxed);
+        m_upstream = c;
+        m_opened_at = now;
+        m_last_progress = now;
+        ++m_attempts;
+        return true;
+    }
+    return false;
+}
+
+bool proxy_session::retry()
+{
+    long long now = coarse_clock::get_instance()->now_ms();
+    /* 新建的连接没有收到任何应答就失败，说明服务器有问题；空闲连接失败多半只是被上游关闭了 */
+    if(m_fresh && !m_received)
+    {
+        m_upstream->m_server->fail(now);
+    }
+    drop_upstream(false);
+
+    /* 已向客户端应答、已收到应答、已从客户 socket 读走消息体时无法重新发送；
+        非幂等的请求只有在一个字节都没发出时才重试 */
+    if(m_responded || m_received || m_body_read || m_attempts >= MAX_ATTEMPTS ||
+        (!m_idempotent && m_req_off > 0))
+    {
+        return false;
+    }
+    m_req_off = 0;
+    m_write_failed = false;
+    return true;
+}
+
+bool proxy_session::expire(long long now)
+{
+    if(!m_upstream)
+    {
+        return false;
+    }
+    /* 连接超时：换一个连接重试 */
+    if(m_fresh && m_req_off == 0 && !m_received)
+    {
+        LOG_WARN("[proxy] connect to %s timed out\n", m_upstream->m_server->name());
+        if(retry())
+        {
+            server_metrics::proxy_retries.add();
+            return true;
+        }
+        return false;
+    }
+    /* 请求已发完、等待应答头时超时，按被动检查的失败处理；等待客户端读取时超时与上游无关 */
+    if(!m_head_done && request_done())
+    {
+        LOG_WARN("[proxy] upstream %s did not respond in time\n", m_upstream->m_server->name());
+        m_upstream->m_server->fail(now);
+    }
+    return false;
+}
+
+long long proxy_session::deadline() const
+{
+    if(m_upstream && m_fresh && m_req_off == 0 && !m_received)
+    {
+        return m_opened_at + proxy_table::m_connect_timeout;
+    }
+    return m_last_progress + proxy_table::m_timeout;
+}
+
+proxy_session::RESULT proxy_session::pump(int* client_events)
+{
+    while (true)
+    {
+        if(!m_upstream && !open())
+        {
+            LOG_WARN("[proxy] no upstream available for %s\n", m_route->prefix.c_str());
+            server_metrics::proxy_failures.add();
+            return m_responded ? PROXY_CLOSED : PROXY_FAILED;
+        }
+
+        m_upstream_failed = false;
+        m_client_failed = false;
+        m_want_read = false;
+        m_want_write = false;
+        /* 每次推进都把所有方向试一遍，直到都没有进展：
+            上游 socket 边缘触发常驻注册，只要某一步因 EAGAIN 停下，对应的事件到达时会再次推进 */
+        bool moved = true;
+        while (moved && !m_upstream_failed && !m_client_failed)
+        {
+            moved = false;
+            if(send_request())
+            {
+                moved = true;
+            }
+            if(send_body())
+            {
+                moved = true;
+            }
+            if(read_head())
+            {
+                moved = true;
+            }
+            if(relay_body())
+            {
+                moved = true;
+            }
+            if(write_out())
+            {
+                moved = true;
+            }
+            if(splice_out())
+            {
+                moved = true;
+            }
+        }
+
+        if(m_client_failed)
+        {
+            return PROXY_CLOSED;
+        }
+        if(!m_upstream_failed)
+        {
+            break;
+        }
+        if(retry())
+        {
+            server_metrics::proxy_retries.add();
+            continue;
+        }
+        server_metrics::proxy_failures.add();
+        return m_responded ? PROXY_CLOSED : PROXY_FAILED;
+    }
+
+    if(m_head_done && m_resp_done && out_pending() == 0 && m_resp_pipe == 0)
+    {
+        return PROXY_DONE;
+    }
+    *client_events = (m_want_read ? (int)EPOLLIN : 0) | (m_want_write ? (int)EPOLLOUT : 0);
+    return PROXY_AGAIN;
+}
+
+bool proxy_session::send_request()
+{
+    if(m_write_failed || m_body_abandoned || m_req_off == m_request.size())
+    {
+        return false;
+    }
+    COUNT_SYSCALL(WRITEV);
+    ssize_t n = ::send(m_upstream->m_fd, m_request.data() + m_req_off, m_request.size() - m_req_off,
+                        MSG_NOSIGNAL | MSG_DONTWAIT);
+    if(n < 0)
+    {
+        if(errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            return false;
+        }
+        /* 上游可能已给出应答后关闭（如拒绝过大的消息体），由读一侧判断是应答还是失败 */
+        m_write_failed = true;
+        return true;
+    }
+    m_req_off += n;
+    progress();
+    return true;
+}
+
+bool proxy_session::send_body()
+{
+    if(m_write_failed || m_body_abandoned || m_req_off < m_request.size())
+    {
+        return false;
+    }
+    bool moved = false;
+    if(m_transport->spliceable() && m_upstream->pipe_ready())
+    {
+        /* 客户 socket -> 管道 -> 上游 socket，管道清空后才从客户 socket 读下一段 */
+        if(m_req_pipe > 0)
+        {
+            COUNT_SYSCALL(WRITEV);
+            ssize_t n = splice(m_upstream->m_pipe[0], NULL, m_upstream->m_fd, NULL, m_req_pipe,
+                                SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if(n < 0)
+            {
+                if(errno != EAGAIN)
+                {
+                    m_write_failed = true;
+                    return true;
+                }
+            }
+            else
+            {
+                m_req_pipe -= n;
+                moved = true;
+            }
+        }
+        if(m_req_pipe == 0 && m_body_left > 0)
+        {
+            size_t len = m_body_left < (long long)CHUNK ? m_body_left : CHUNK;
+            COUNT_SYSCALL(RECV);
+            ssize_t n = splice(m_fd, NULL, m_upstream->m_pipe[1], NULL, len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if(n < 0)
+            {
+                if(errno == EAGAIN)
+                {
+                    m_want_read = true;
+                }
+                else
+                {
+                    m_client_failed = true;
+                }
+            }
+            else if(n == 0)
+            {
+                m_client_failed = true;
+            }
+            else
+            {
+                m_body_left -= n;
+                m_req_pipe += n;
+                m_body_read = true;
+                moved = true;
+            }
+        }
+    }
+    else
+    {
+        /* TLS 连接的数据要经传输层解密，只能读到缓冲区再发出 */
+        if(m_xfer_off < m_xfer.size())
+        {
+            COUNT_SYSCALL(WRITEV);
+            ssize_t n = ::send(m_upstream->m_fd, m_xfer.data() + m_xfer_off, m_xfer.size() - m_xfer_off,
+                                MSG_NOSIGNAL | MSG_DONTWAIT);
+            if(n < 0)
+            {
+                if(errno != EAGAIN && errno != EWOULDBLOCK)
+                {
+                    m_write_failed = true;
+                    return true;
+                }
+            }
+            else
+            {
+                m_xfer_off += n;
+                moved = true;
+            }
+        }
+        if(m_xfer_off == m_xfer.size() && m_body_left > 0)
+        {
+            size_t len = m_body_left < (long long)CHUNK ? m_body_left : CHUNK;
+            m_xfer.resize(len);
+            ssize_t n = m_transport->recv(m_fd, &m_xfer[0], len);
+            if(n < 0)
+            {
+                m_xfer.clear();
+                if(errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    m_want_read = true;
+                }
+                else
+                {
+                    m_client_failed = true;
+                }
+            }
+            else if(n == 0)
+            {
+                m_xfer.clear();
+                m_client_failed = true;
+            }
+            else
+            {
+                m_xfer.resize(n);
+                m_body_left -= n;
+                m_body_read = true;
+                moved = true;
+            }
+            m_xfer_off = 0;
+        }
+    }
+    if(moved)
+    {
+        progress();
+    }
+    return moved;
+}
+
+bool proxy_session::read_head()
+{
+    if(m_head_done)
+    {
+        return false;
+    }
+    int cap = buffer_pool::max_size();
+    if(!m_in)
+    {
+        m_in = buffer_pool::get_instance()->acquire(cap);
+        /* 内存不足不是上游的问题，不重试也不计入上游的失败，直接关闭客户连接 */
+        if(!m_in)
+        {
+            LOG_WARN("[proxy] out of memory for the response header\n");
+            m_client_failed = true;
+            return false;
+        }
+    }
+    if((int)m_in_len >= cap)
+    {
+        LOG_WARN("[proxy] response header from %s too large\n", m_upstream->m_server->name());
+        m_upstream_failed = true;
+        return false;
+    }
+    COUNT_SYSCALL(RECV);
+    ssize_t n = ::recv(m_upstream->m_fd, m_in + m_in_len, cap - m_in_len, MSG_DONTWAIT);
+    if(n < 0)
+    {
+        if(errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            m_upstream_failed = true;
+        }
+        return false;
+    }
+    if(n == 0)
+    {
+        m_upstream_failed = true;
+        return false;
+    }
+    m_received = true;
+    m_in_len += n;
+    progress();
+
+    /* 可能连续收到若干个 1xx 中间应答和最终应答头 */
+    while (!m_head_done)
+    {
+        char* end = (char*)memmem(m_in, m_in_len, "\r\n\r\n", 4);
+        if(!end)
+        {
+            break;
+        }
+        if(!parse_head(end + 4 - m_in))
+        {
+            LOG_WARN("[proxy] malformed response header from %s\n", m_upstream->m_server->name());
+            m_upstream_failed = true;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool proxy_session::parse_head(size_t head_len)
+{
+    const char* line_end = (const char*)memmem(m_in, head_len, "\r\n", 2);
+    if(line_end - m_in < 12 || strncmp(m_in, "HTTP/1.", 7) != 0 || m_in[8] != ' ')
+    {
+        return false;
+    }
+    bool http10 = m_in[7] == '0';
+    int status = atoi(m_in + 9);
+    if(status < 100 || status > 999)
+    {
+        return false;
+    }
+
+    /* 状态行统一为 HTTP/1.1，逐跳头部换成本连接自己的 Connection */
+    std::string head;
+    head.reserve(head_len + 32);
+    head.append("HTTP/1.1");
+    head.append(m_in + 8, line_end + 2 - (m_in + 8));
+
+    bool chunked = false;
+    bool has_length = false;
+    long long length = 0;
+    bool upstream_keepalive = false;
+    bool upstream_close = false;
+    const char* p = line_end + 2;
+    const char* end = m_in + head_len - 2;
+    while (p < end)
+    {
+        const char* eol = (const char*)memmem(p, end + 2 - p, "\r\n", 2);
+        size_t len = eol - p;
+        if(len >= 11 && strncasecmp(p, "Connection:", 11) == 0)
+        {
+            std::string value(p + 11, len - 11);
+            upstream_close = strcasestr(value.c_str(), "close") != NULL;
+            upstream_keepalive = strcasestr(value.c_str(), "keep-alive") != NULL;
+        }
+        else if((len >= 11 && strncasecmp(p, "Keep-Alive:", 11) == 0) ||
+                (len >= 17 && strncasecmp(p, "Proxy-Connection:", 17) == 0))
+        {
+        }
+        else
+        {
+            if(len >= 15 && strncasecmp(p, "Content-Length:", 15) == 0)
+            {
+                has_length = true;
+                length = strtoll(p + 15, NULL, 10);
+                if(length < 0)
+                {
+                    return false;
+                }
+            }
+            else if(len >= 18 && strncasecmp(p, "Transfer-Encoding:", 18) == 0)
+            {
+                std::string value(p + 18, len - 18);
+                chunked = strcasestr(value.c_str(), "chunked") != NULL;
+            }
+            head.append(p, len + 2);
+        }
+        p = eol + 2;
+    }
+
+    /* 1xx 中间应答（如 100 Continue）原样转发，继续等待最终应答 */
+    if(status < 200)
+    {
+        if(status == 101)
+        {
+            return false;
+        }
+        head.append("\r\n");
+        m_out.append(head);
+        m_responded = true;
+        m_in_len -= head_len;
+        memmove(m_in, m_in + head_len, m_in_len);
+        return true;
+    }
+
+    m_upstream_close = upstream_close || (http10 && !upstream_keepalive);
+    if(m_head || status == 204 || status == 304)
+    {
+        m_mode = BODY_NONE;
+    }
+    else if(chunked)
+    {
+        m_mode = BODY_CHUNKED;
+    }
+    else if(has_length)
+    {
+        m_mode = BODY_LENGTH;
+        m_resp_left = length;
+    }
+    else
+    {
+        m_mode = BODY_EOF;
+        m_upstream_close = true;
+    }
+    m_resp_done = m_mode == BODY_NONE || (m_mode == BODY_LENGTH && m_resp_left == 0);
+
+    /* 上游在消息体发完之前就给出了最终应答，剩余的消息体不再转发，管道中残留的部分随管道丢弃 */
+    if(!request_done())
+    {
+        m_body_abandoned = true;
+        if(m_req_pipe > 0)
+        {
+            ::close(m_upstream->m_pipe[0]);
+            ::close(m_upstream->m_pipe[1]);
+            m_upstream->m_pipe[0] = m_upstream->m_pipe[1] = -1;
+            m_req_pipe = 0;
+        }
+        m_xfer.clear();
+        m_xfer_off = 0;
+    }
+
+    /* 读到关闭为止的正文之后客户端无法区分结束，留在客户 socket 中的消息体也无法再跳过 */
+    m_keepalive = m_linger && m_mode != BODY_EOF && !m_body_abandoned;
+    head.append(m_keepalive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n");
+    m_out.append(head);
+    m_responded = true;
+    m_head_done = true;
+    server_metrics::count_response(status);
+
+    size_t rest = m_in_len - head_len;
+    m_in_len = 0;
+    take_body(m_in + head_len, rest);
+    return true;
+}
+
+void proxy_session::take_body(const char* data, size_t len)
+{
+    if(len == 0)
+    {
+        return;
+    }
+    switch (m_mode)
+    {
+    case BODY_LENGTH:
+    {
+        size_t n = (long long)len < m_resp_left ? len : m_resp_left;
+        m_out.append(data, n);
+        m_resp_left -= n;
+        m_resp_done = m_resp_left == 0;
+        /* 正文之后多出的数据说明上游的应答有误，连接不再复用 */
+        if(n < len)
+        {
+            m_upstream_close = true;
+        }
+        break;
+    }
+    case BODY_CHUNKED:
+    {
+        size_t n = scan_chunked(data, len);
+        m_out.append(data, n);
+        if(n < len)
+        {
+            m_upstream_close = true;
+        }
+        break;
+    }
+    case BODY_EOF:
+        m_out.append(data, len);
+        break;
+    default:
+        m_upstream_close = true;
+        break;
+    }
+}
+
+size_t proxy_session::scan_chunked(const char* data, size_t len)
+{
+    size_t i = 0;
+    while (i < len && m_chunk_state != CHUNK_DONE)
+    {
+        char c = data[i];
+        switch (m_chunk_state)
+        {
+        case CHUNK_SIZE:
+        {
+            if(isxdigit((unsigned char)c))
+            {
+                int digit = c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10;
+                m_chunk_left = m_chunk_left * 16 + digit;
+            }
+            else
+            {
+                m_chunk_state = CHUNK_EXT;
+                continue;
+            }
+            ++i;
+            break;
+        }
+        case CHUNK_EXT:
+        {
+            ++i;
+            if(c == '\n')
+            {
+                m_chunk_state = m_chunk_left > 0 ? CHUNK_DATA : CHUNK_TRAILER;
+            }
+            break;
+        }
+        case CHUNK_DATA:
+        {
+            size_t n = (long long)(len - i) < m_chunk_left ? len - i : m_chunk_left;
+            i += n;
+            m_chunk_left -= n;
+            if(m_chunk_left == 0)
+            {
+                m_chunk_state = CHUNK_DATA_END;
+            }
+            break;
+        }
+        case CHUNK_DATA_END:
+        {
+            ++i;
+            if(c == '\n')
+            {
+                m_chunk_state = CHUNK_SIZE;
+            }
+            break;
+        }
+        case CHUNK_TRAILER:
+        {
+            /* 空行结束整个正文，否则是一个尾部字段 */
+            ++i;
+            if(c == '\n')
+            {
+                m_chunk_state = CHUNK_DONE;
+            }
+            else if(c != '\r')
+            {
+                m_chunk_state = CHUNK_TRAILER_LINE;
+            }
+            break;
+        }
+        case CHUNK_TRAILER_LINE:
+        {
+            ++i;
+            if(c == '\n')
+            {
+                m_chunk_state = CHUNK_TRAILER;
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+    if(m_chunk_state == CHUNK_DONE)
+    {
+        m_resp_done = true;
+    }
+    return i;
+}
+
+bool proxy_session::relay_body()
+{
+    if(!m_head_done || m_resp_done)
+    {
+        return false;
+    }
+    /* 长度确定或读到关闭为止的正文经管道 splice。管道与请求的消息体共用，上面已保证请求已发完或已放弃 */
+    if((m_mode == BODY_LENGTH || m_mode == BODY_EOF) && m_transport->spliceable() && m_upstream->pipe_ready())
+    {
+        if(m_resp_pipe >= CHUNK)
+        {
+            return false;
+        }
+        size_t len = CHUNK - m_resp_pipe;
+        if(m_mode == BODY_LENGTH && m_resp_left < (long long)len)
+        {
+            len = m_resp_left;
+        }
+        COUNT_SYSCALL(RECV);
+        ssize_t n = splice(m_upstream->m_fd, NULL, m_upstream->m_pipe[1], NULL, len,
+                            SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if(n < 0)
+        {
+            if(errno != EAGAIN)
+            {
+                m_upstream_failed = true;
+            }
+            return false;
+        }
+        if(n == 0)
+        {
+            if(m_mode == BODY_EOF)
+            {
+                m_resp_done = true;
+                return true;
+            }
+            LOG_WARN("[proxy] upstream %s closed before the response was complete\n", m_upstream->m_server->name());
+            m_upstream_failed = true;
+            return false;
+        }
+        m_resp_pipe += n;
+        if(m_mode == BODY_LENGTH)
+        {
+            m_resp_left -= n;
+            m_resp_done = m_resp_left == 0;
+        }
+        progress();
+        return true;
+    }
+
+    /* 分块编码和 TLS 客户连接经缓冲区转发，发送缓冲区积压时先不读 */
+    if(out_pending() >= CHUNK)
+    {
+        return false;
+    }
+    COUNT_SYSCALL(RECV);
+    ssize_t n = ::recv(m_upstream->m_fd, m_in, buffer_pool::max_size(), MSG_DONTWAIT);
+    if(n < 0)
+    {
+        if(errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            m_upstream_failed = true;
+        }
+        return false;
+    }
+    if(n == 0)
+    {
+        if(m_mode == BODY_EOF)
+        {
+            m_resp_done = true;
+            return true;
+        }
+        LOG_WARN("[proxy] upstream %s closed before the response was complete\n", m_upstream->m_server->name());
+        m_upstream_failed = true;
+        return false;
+    }
+    take_body(m_in, n);
+    progress();
+    return true;
+}
+
+bool proxy_session::write_out()
+{
+    if(out_pending() == 0)
+    {
+        return false;
+    }
+    struct iovec iov;
+    iov.iov_base = (char*)m_out.data() + m_out_off;
+    iov.iov_len = out_pending();
+    ssize_t n = m_transport->writev(m_fd, &iov, 1);
+    if(n < 0)
+    {
+        if(errno == EAGAIN)
+        {
+            m_want_write = true;
+        }
+        else
+        {
+            m_client_failed = true;
+        }
+        return false;
+    }
+    m_out_off += n;
+    server_metrics::bytes_sent.add(n);
+    if(m_out_off == m_out.size())
+    {
+        m_out.clear();
+        m_out_off = 0;
+    }
+    progress();
+    return true;
+}
+
+bool proxy_session::splice_out()
+{
+    /* 管道中的正文排在发送缓冲区之后 */
+    if(m_resp_pipe == 0 || out_pending() > 0)
+    {
+        return false;
+    }
+    COUNT_SYSCALL(WRITEV);
+    ssize_t n = splice(m_upstream->m_pipe[0], NULL, m_fd, NULL, m_resp_pipe, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if(n < 0)
+    {
+        if(errno == EAGAIN)
+        {
+            m_want_write = true;
+        }
+        else
+        {
+            m_client_failed = true;
+        }
+        return false;
+    }
+    m_resp_pipe -= n;
+    server_metrics::bytes_sent.add(n);
+    progress();
+    return true;
+}
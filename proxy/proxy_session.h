@@ -0,0 +1,174 @@
+#ifndef PROXY_SESSION_H
+#define PROXY_SESSION_H
+
+#include <sys/types.h>
+#include <string>
+
+#include "upstream.h"
+#include "../http/transport.h"
+
+class http_conn;
+
+/* 一个请求的转发过程
+   工作线程解析完请求头后由 http_conn 创建，改写好的请求头（连同已读到的消息体）放在 request() 中，
+   之后客户 socket 和上游 socket 上的事件都在主线程中交给 pump 推进：
+   连接或取用上游连接、发送请求头、转发剩余的消息体、读取并改写应答头、转发应答正文。
+   客户连接是普通 socket 时消息体和长度确定的应答正文经管道 splice，不经过用户态；
+   TLS 连接和分块编码的应答经缓冲区转发，分块编码原样转发，只扫描出结束位置。
+   上游连接失败且还没有向客户端应答时，按重试条件换一个连接（可能是另一台服务器）重新发送 */
+class proxy_session
+{
+public:
+    enum RESULT
+    {
+        PROXY_AGAIN = 0,    /* 等待 socket 事件 */
+        PROXY_DONE,         /* 应答已完整转发 */
+        PROXY_FAILED,       /* 上游失败，还没有向客户端应答任何内容，可以应答 502 */
+        PROXY_CLOSED        /* 客户端关闭或转发中途失败，只能关闭客户连接 */
+    };
+
+    /* 同一个请求最多尝试的上游连接数 */
+    static const int MAX_ATTEMPTS = 3;
+
+public:
+    proxy_session(int fd, transport* t, http_conn* owner);
+    ~proxy_session();
+
+    /* 发给上游的请求头和已读到的消息体，由 http_conn 在 begin 之前填好 */
+    std::string& request() { return m_request; }
+    /* 开始转发：head 为 HEAD 请求（应答没有正文），idempotent 的请求在已发出后失败也可以重试，
+        keepalive 为客户端是否要求保持连接，body_left 为还留在客户 socket 中的消息体字节数 */
+    void begin(const proxy_route* route, bool head, bool idempotent, bool keepalive, long long body_left);
+    /* 尽力推进转发，返回 PROXY_AGAIN 时 client_events 为需要等待的客户 socket 事件 */
+    RESULT pump(int* client_events);
+    /* 转发期限已到：正在连接的上游按失败处理并换一个连接重试，返回 true；否则返回 false，由调用者按超时关闭 */
+    bool expire(long long now);
+    /* 结束转发，归还或关闭上游连接，转发完整时连接放回连接池 */
+    void finish();
+
+    /* 没有进展时的期限：正在建立新连接时为连接期限，否则为上次收发进展之后的转发期限 */
+    long long deadline() const;
+    /* 是否已开始向客户端发送应答 */
+    bool responded() const { return m_responded; }
+    /* 应答完成后客户连接能否保持 */
+    bool keepalive() const { return m_keepalive; }
+    long long body_left() const { return m_body_left; }
+
+private:
+    /* 应答正文的定界方式 */
+    enum BODY_MODE
+    {
+        BODY_NONE = 0,  /* 没有正文：HEAD 请求、1xx、204、304 */
+        BODY_LENGTH,    /* Content-Length */
+        BODY_CHUNKED,   /* Transfer-Encoding: chunked */
+        BODY_EOF        /* 读到上游关闭为止 */
+    };
+    /* 分块编码的扫描状态 */
+    enum CHUNK_STATE
+    {
+        CHUNK_SIZE = 0, /* 块大小的十六进制数字 */
+        CHUNK_EXT,      /* 块扩展，直到行尾 */
+        CHUNK_DATA,     /* 块数据 */
+        CHUNK_DATA_END, /* 块数据之后的 \r\n */
+        CHUNK_TRAILER,  /* 最后一块之后，尾部字段行的开头 */
+        CHUNK_TRAILER_LINE, /* 尾部字段行的其余部分 */
+        CHUNK_DONE
+    };
+    /* 每次 splice 或经缓冲区转发的最大字节数 */
+    static const size_t CHUNK = 65536;
+
+    /* 选出服务器，取用空闲连接或新建连接，返回 false 表示没有可用的服务器 */
+    bool open();
+    /* 当前上游连接失败，能重试时换一个连接并返回 true */
+    bool retry();
+    /* 放弃当前上游连接 */
+    void drop_upstream(bool reusable);
+
+    /* 下面这组函数各推进一步，返回是否有进展；出错时设置 m_upstream_failed 或 m_client_failed */
+    bool send_request();
+    bool send_body();
+    bool read_head();
+    bool relay_body();
+    bool write_out();
+    bool splice_out();
+
+    /* 解析完整的应答头，生成发给客户端的应答头，返回 false 表示应答头有误 */
+    bool parse_head(size_t head_len);
+    /* 收到一段应答正文：放入发送缓冲区并按定界方式判断是否结束 */
+    void take_body(const char* data, size_t len);
+    /* 扫描分块编码，返回结束位置之后的偏移，未结束时返回 len */
+    size_t scan_chunked(const char* data, size_t len);
+    /* 发送缓冲区中待发送的字节数 */
+    size_t out_pending() const { return m_out.size() - m_out_off; }
+    /* 请求的消息体是否已全部发出或已放弃 */
+    bool request_done() const
+    {
+        return m_body_abandoned || (m_req_off == m_request.size() && m_body_left == 0 &&
+                                    m_req_pipe == 0 && m_xfer_off == m_xfer.size());
+    }
+    void progress();
+
+private:
+    int m_fd;
+    transport* m_transport;
+    http_conn* m_owner;
+    const proxy_route* m_route;
+    bool m_head;
+    bool m_idempotent;
+    /* 客户端要求保持连接，以及应答后实际能否保持 */
+    bool m_linger;
+    bool m_keepalive;
+
+    /* 当前上游连接，是否为本次新建，打开的时间和已尝试的连接数 */
+    upstream_conn* m_upstream;
+    bool m_fresh;
+    long long m_opened_at;
+    int m_attempts;
+    /* 上次收发进展的时间 */
+    long long m_last_progress;
+
+    /* 请求头（和已读到的消息体）及已发出的字节数 */
+    std::string m_request;
+    size_t m_req_off;
+    /* 还留在客户 socket 中的消息体字节数，已从客户 socket 读出过消息体之后不能再重试 */
+    long long m_body_left;
+    bool m_body_read;
+    /* 上游在消息体发完之前就给出了应答，剩余的消息体不再转发 */
+    bool m_body_abandoned;
+    /* 管道中等待发给上游的消息体字节数 */
+    size_t m_req_pipe;
+    /* 不能 splice 时经缓冲区转发的消息体 */
+    std::string m_xfer;
+    size_t m_xfer_off;
+    /* 向上游写失败，不再写，交给读一侧判断结果 */
+    bool m_write_failed;
+
+    /* 应答头的接收缓冲区，从缓冲区池借用，也用于读取需要经缓冲区转发的正文 */
+    char* m_in;
+    size_t m_in_len;
+    bool m_head_done;
+    /* 从上游收到过应答的字节 */
+    bool m_received;
+    BODY_MODE m_mode;
+    long long m_resp_left;
+    bool m_resp_done;
+    bool m_upstream_close;
+    /* 管道中等待发给客户端的正文字节数 */
+    size_t m_resp_pipe;
+    CHUNK_STATE m_chunk_state;
+    long long m_chunk_left;
+
+    /* 等待发给客户端的数据：应答头和经缓冲区转发的正文 */
+    std::string m_out;
+    size_t m_out_off;
+    bool m_responded;
+
+    /* 本轮推进中发生的错误 */
+    bool m_upstream_failed;
+    bool m_client_failed;
+    /* 客户 socket 上需要等待的事件 */
+    bool m_want_read;
+    bool m_want_write;
+};
+
+#endif
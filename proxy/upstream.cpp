@@ -0,0 +1,503 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/un.h>
+
+#include "upstream.h"
+#include "../http/http_conn.h"
+#include "../log/log.h"
+#include "../timer/coarse_clock.h"
+#include "../stats/syscall_stats.h"
+
+int proxy_table::m_connect_timeout = 1000;
+int proxy_table::m_timeout = 60000;
+int proxy_table::m_max_idle = 32;
+int proxy_table::m_idle_timeout = 30000;
+int proxy_table::m_fail_timeout = 10000;
+int proxy_table::m_health_interval = 2000;
+std::string proxy_table::m_health_path;
+
+futex_mutex upstream_conn::m_free_lock("upstream_free");
+std::vector<upstream_conn*> upstream_conn::m_free;
+
+upstream_conn* upstream_conn::create(upstream_server* server, int fd)
+{
+    upstream_conn* c = NULL;
+    m_free_lock.lock();
+    if(!m_free.empty())
+    {
+        c = m_free.back();
+        m_free.pop_back();
+    }
+    m_free_lock.unlock();
+    if(!c)
+    {
+        c = new upstream_conn();
+    }
+    c->m_fd = fd;
+    c->m_server = server;
+    c->m_owner.store(NULL);
+    c->m_broken.store(false);
+    c->m_idle_since = 0;
+    return c;
+}
+
+void upstream_conn::destroy(upstream_conn* c)
+{
+    /* fd 没有被复制过，close 会自动将其从 epoll 中移除 */
+    ::close(c->m_fd);
+    COUNT_SYSCALL(CLOSE);
+    c->m_fd = -1;
+    if(c->m_pipe[0] >= 0)
+    {
+        ::close(c->m_pipe[0]);
+        ::close(c->m_pipe[1]);
+        c->m_pipe[0] = c->m_pipe[1] = -1;
+    }
+    c->m_owner.store(NULL);
+    m_free_lock.lock();
+    m_free.push_back(c);
+    m_free_lock.unlock();
+}
+
+http_conn* upstream_conn::on_event(uint32_t events)
+{
+    http_conn* owner = m_owner.load();
+    if(owner || m_fd < 0)
+    {
+        return owner;
+    }
+    if(events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+    {
+        m_broken.store(true);
+    }
+    /* 同一轮 epoll_wait 中排在客户连接后面的可读事件可能已过期（应答已在归还前读完），
+        窥探一下是否真有数据或已关闭 */
+    else if(events & EPOLLIN)
+    {
+        char c;
+        COUNT_SYSCALL(RECV);
+        ssize_t n = ::recv(m_fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+        if(n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+        {
+            m_broken.store(true);
+        }
+    }
+    return NULL;
+}
+
+bool upstream_conn::pipe_ready()
+{
+    if(m_pipe[0] >= 0)
+    {
+        return true;
+    }
+    COUNT_SYSCALL(OTHER);
+    return pipe2(m_pipe, O_NONBLOCK | O_CLOEXEC) == 0;
+}
+
+bool upstream_server::resolve()
+{
+    memset(&m_addr, '\0', sizeof(m_addr));
+    if(m_name.compare(0, 5, "unix:") == 0)
+    {
+        struct sockaddr_un* un = (struct sockaddr_un*)&m_addr;
+        std::string path = m_name.substr(5);
+        if(path.empty() || path.size() >= sizeof(un->sun_path))
+        {
+            printf("proxy_routes: bad unix socket path \"%s\"\n", path.c_str());
+            return false;
+        }
+        un->sun_family = AF_UNIX;
+        memcpy(un->sun_path, path.c_str(), path.size() + 1);
+        m_addr_len = sizeof(struct sockaddr_un);
+        return true;
+    }
+
+    size_t colon = m_name.rfind(':');
+    if(colon == std::string::npos || colon == 0 || colon + 1 == m_name.size())
+    {
+        printf("proxy_routes: expected host:port or unix:/path, got \"%s\"\n", m_name.c_str());
+        return false;
+    }
+    std::string host = m_name.substr(0, colon);
+    std::string port = m_name.substr(colon + 1);
+
+    struct addrinfo hints;
+    memset(&hints, '\0', sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* res = NULL;
+    int ret = getaddrinfo(host.c_str(), port.c_str(), &hints, &res);
+    if(ret != 0 || !res)
+    {
+        printf("proxy_routes: cannot resolve \"%s\": %s\n", m_name.c_str(), gai_strerror(ret));
+        return false;
+    }
+    memcpy(&m_addr, res->ai_addr, res->ai_addrlen);
+    m_addr_len = res->ai_addrlen;
+    freeaddrinfo(res);
+    return true;
+}
+
+upstream_conn* upstream_server::connect()
+{
+    int fd = socket(m_addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    COUNT_SYSCALL(OTHER);
+    if(fd < 0)
+    {
+        return NULL;
+    }
+    if(m_addr.ss_family != AF_UNIX)
+    {
+        int flag = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    }
+    /* TCP 连接建立之前 send 返回 EAGAIN，建立后产生可写事件；
+        Unix socket 要么立即连上，要么监听队列已满返回 EAGAIN，按失败处理 */
+    COUNT_SYSCALL(OTHER);
+    if(::connect(fd, (struct sockaddr*)&m_addr, m_addr_len) < 0 && errno != EINPROGRESS)
+    {
+        LOG_WARN("[proxy] connect to %s failed: %s\n", m_name.c_str(), strerror(errno));
+        ::close(fd);
+        return NULL;
+    }
+
+    upstream_conn* c = upstream_conn::create(this, fd);
+    epoll_event event;
+    event.data.ptr = upstream_conn::epoll_tag(c);
+    event.events = EPOLLIN | EPOLLOUT | EPOLLET | EPOLLRDHUP;
+    epoll_ctl(http_conn::m_epollfd, EPOLL_CTL_ADD, fd, &event);
+    COUNT_SYSCALL(EPOLL_CTL);
+    return c;
+}
+
+upstream_conn* upstream_server::checkout(long long now)
+{
+    upstream_conn* c = NULL;
+    m_idle_lock.lock();
+    while (!m_idle.empty())
+    {
+        c = m_idle.back();
+        m_idle.pop_back();
+        if(!c->m_broken.load() && now - c->m_idle_since < proxy_table::m_idle_timeout)
+        {
+            break;
+        }
+        upstream_conn::destroy(c);
+        c = NULL;
+    }
+    m_idle_lock.unlock();
+    return c;
+}
+
+void upstream_server::checkin(upstream_conn* c, bool reusable, long long now)
+{
+    c->m_owner.store(NULL);
+    if(reusable && !c->m_broken.load())
+    {
+        m_idle_lock.lock();
+        if((int)m_idle.size() < proxy_table::m_max_idle)
+        {
+            c->m_idle_since = now;
+            m_idle.push_back(c);
+            m_idle_lock.unlock();
+            return;
+        }
+        m_idle_lock.unlock();
+    }
+    upstream_conn::destroy(c);
+}
+
+void upstream_server::prune(long long now)
+{
+    m_idle_lock.lock();
+    /* 空闲表按放入时间排列，最早放入的在前面 */
+    size_t expired = 0;
+    while (expired < m_idle.size() &&
+            (m_idle[expired]->m_broken.load() || now - m_idle[expired]->m_idle_since >= proxy_table::m_idle_timeout))
+    {
+        upstream_conn::destroy(m_idle[expired]);
+        ++expired;
+    }
+    m_idle.erase(m_idle.begin(), m_idle.begin() + expired);
+    m_idle_lock.unlock();
+}
+
+size_t upstream_server::idle_size()
+{
+    m_idle_lock.lock();
+    size_t n = m_idle.size();
+    m_idle_lock.unlock();
+    return n;
+}
+
+void upstream_server::fail(long long now)
+{
+    m_down_until.store(now + proxy_table::m_fail_timeout);
+    LOG_WARN("[proxy] upstream %s failed, not used for %d ms\n", m_name.c_str(), proxy_table::m_fail_timeout);
+}
+
+void upstream_server::set_health(bool ok)
+{
+    bool was = m_healthy.exchange(ok);
+    if(ok)
+    {
+        m_down_until.store(0);
+    }
+    if(was != ok)
+    {
+        if(ok)
+        {
+            LOG_INFO("[proxy] upstream %s passed health check\n", m_name.c_str());
+        }
+        else
+        {
+            LOG_WARN("[proxy] upstream %s failed health check\n", m_name.c_str());
+        }
+    }
+}
+
+bool upstream_server::probe() const
+{
+    int fd = socket(m_addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0)
+    {
+        return false;
+    }
+    bool ok = false;
+    if(::connect(fd, (struct sockaddr*)&m_addr, m_addr_len) == 0 || errno == EINPROGRESS)
+    {
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLOUT;
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if(poll(&pfd, 1, proxy_table::m_connect_timeout) == 1 &&
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err == 0)
+        {
+            ok = proxy_table::m_health_path.empty() || check_http(fd);
+        }
+    }
+    ::close(fd);
+    return ok;
+}
+
+bool upstream_server::check_http(int fd) const
+{
+    char buf[512];
+    int len = snprintf(buf, sizeof(buf), "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n",
+                        proxy_table::m_health_path.c_str(), m_name.c_str());
+    if(len >= (int)sizeof(buf) || send(fd, buf, len, MSG_NOSIGNAL) != len)
+    {
+        return false;
+    }
+
+    /* 只需要状态行开头的 "HTTP/1.x NNN" */
+    int got = 0;
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    while (got < 12)
+    {
+        if(poll(&pfd, 1, proxy_table::m_connect_timeout) != 1)
+        {
+            return false;
+        }
+        ssize_t n = recv(fd, buf + got, sizeof(buf) - 1 - got, 0);
+        if(n <= 0)
+        {
+            return false;
+        }
+        got += n;
+    }
+    buf[got] = '\0';
+    if(strncmp(buf, "HTTP/1.", 7) != 0 || buf[8] != ' ')
+    {
+        return false;
+    }
+    int status = atoi(buf + 9);
+    return status >= 200 && status < 400;
+}
+
+upstream_server* proxy_table::find_server(const std::string& name)
+{
+    for(size_t i = 0; i < m_servers.size(); ++i)
+    {
+        if(m_servers[i]->name() == name)
+        {
+            return m_servers[i];
+        }
+    }
+    upstream_server* s = new upstream_server(name);
+    if(!s->resolve())
+    {
+        delete s;
+        return NULL;
+    }
+    m_servers.push_back(s);
+    return s;
+}
+
+bool proxy_table::init(const char* spec)
+{
+    /* 路由之间以 ; 分隔，每条为 前缀=地址[,地址...] */
+    std::string text(spec);
+    size_t pos = 0;
+    while (pos <= text.size())
+    {
+        size_t end = text.find(';', pos);
+        if(end == std::string::npos)
+        {
+            end = text.size();
+        }
+        std::string item = text.substr(pos, end - pos);
+        pos = end + 1;
+        if(item.empty())
+        {
+            continue;
+        }
+
+        size_t eq = item.find('=');
+        if(eq == std::string::npos || eq == 0 || item[0] != '/' || eq + 1 == item.size())
+        {
+            printf("proxy_routes: expected /prefix=address[,address...], got \"%s\"\n", item.c_str());
+            return false;
+        }
+        proxy_route* route = new proxy_route();
+        route->prefix = item.substr(0, eq);
+        size_t p = eq + 1;
+        while (p <= item.size())
+        {
+            size_t comma = item.find(',', p);
+            if(comma == std::string::npos)
+            {
+                comma = item.size();
+            }
+            std::string name = item.substr(p, comma - p);
+            p = comma + 1;
+            if(name.empty())
+            {
+                continue;
+            }
+            upstream_server* s = find_server(name);
+            if(!s)
+            {
+                delete route;
+                return false;
+            }
+            route->servers.push_back(s);
+        }
+        if(route->servers.empty())
+        {
+            printf("proxy_routes: route %s has no upstream\n", route->prefix.c_str());
+            delete route;
+            return false;
+        }
+        m_routes.push_back(route);
+    }
+    return true;
+}
+
+void proxy_table::start()
+{
+    if(m_routes.empty() || m_health_interval <= 0)
+    {
+        return;
+    }
+    pthread_t tid;
+    if(pthread_create(&tid, NULL, health_thread, this) == 0)
+    {
+        pthread_detach(tid);
+    }
+}
+
+void* proxy_table::health_thread(void* arg)
+{
+    proxy_table* table = (proxy_table*)arg;
+    while (true)
+    {
+        usleep(m_health_interval * 1000);
+        for(size_t i = 0; i < table->m_servers.size(); ++i)
+        {
+            upstream_server* s = table->m_servers[i];
+            s->set_health(s->probe());
+        }
+    }
+    return NULL;
+}
+
+void proxy_table::prune(long long now)
+{
+    for(size_t i = 0; i < m_servers.size(); ++i)
+    {
+        m_servers[i]->prune(now);
+    }
+}
+
+const proxy_route* proxy_table::match(const char* url) const
+{
+    const proxy_route* best = NULL;
+    for(size_t i = 0; i < m_routes.size(); ++i)
+    {
+        const std::string& prefix = m_routes[i]->prefix;
+        if(strncmp(url, prefix.c_str(), prefix.size()) == 0 && (!best || prefix.size() > best->prefix.size()))
+        {
+            best = m_routes[i];
+        }
+    }
+    return best;
+}
+
+upstream_server* proxy_table::pick(const proxy_route* route, long long now) const
+{
+    size_t n = route->servers.size();
+    size_t start = route->next.fetch_add(1, std::memory_order_relaxed) % n;
+    upstream_server* best = NULL;
+    int best_active = 0;
+    for(size_t i = 0; i < n; ++i)
+    {
+        upstream_server* s = route->servers[(start + i) % n];
+        if(!s->usable(now))
+        {
+            continue;
+        }
+        int active = s->m_active.load(std::memory_order_relaxed);
+        if(!best || active < best_active)
+        {
+            best = s;
+            best_active = active;
+        }
+    }
+    return best;
+}
+
+long proxy_table::healthy_count() const
+{
+    long now = coarse_clock::get_instance()->now_ms();
+    long n = 0;
+    for(size_t i = 0; i < m_servers.size(); ++i)
+    {
+        n += m_servers[i]->usable(now) ? 1 : 0;
+    }
+    return n;
+}
+
+long proxy_table::idle_count() const
+{
+    long n = 0;
+    for(size_t i = 0; i < m_servers.size(); ++i)
+    {
+        n += m_servers[i]->idle_size();
+    }
+    return n;
+}
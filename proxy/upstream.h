@@ -0,0 +1,183 @@
+#ifndef UPSTREAM_H
+#define UPSTREAM_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "../lock/locker.h"
+
+class http_conn;
+class upstream_server;
+
+/* 到上游服务器的一个连接
+   连接建立时以边缘触发常驻注册到主循环的 epoll，data.ptr 为最低位置 1 的对象地址（epoll_tag），
+   与直接指向 http_conn 的连接事件区分。正在转发请求时 m_owner 指向客户连接，上游 socket 的事件作为 EV_UPSTREAM
+   记到客户连接上，与客户 socket 的事件一样经占有和分派处理；空闲时 m_owner 为 NULL，
+   这时的可读或挂断事件说明上游已关闭了保活连接，只做标记，取用时丢弃。
+   取用、归还、转发和关闭空闲超时的连接都在主线程中进行，m_fd 只由主线程读写。
+   关闭的对象不还给系统而是留在空闲链表中复用，本轮 epoll_wait 已取出的过期事件仍指向有效的对象 */
+class upstream_conn
+{
+public:
+    /* 为已连接（或正在连接）的 fd 分配对象 */
+    static upstream_conn* create(upstream_server* server, int fd);
+    /* 关闭 socket 和管道，对象放回空闲链表 */
+    static void destroy(upstream_conn* c);
+
+    static void* epoll_tag(upstream_conn* c) { return (void*)((uintptr_t)c | 1); }
+    /* 不是上游连接的事件返回 NULL */
+    static upstream_conn* from_epoll(void* ptr)
+    {
+        uintptr_t p = (uintptr_t)ptr;
+        return (p & 1) ? (upstream_conn*)(p & ~(uintptr_t)1) : NULL;
+    }
+
+    /* 主循环收到上游 socket 的事件：返回正在使用该连接的客户连接，空闲时记下对方已关闭并返回 NULL */
+    http_conn* on_event(uint32_t events);
+    /* splice 用的管道，第一次使用时创建，失败返回 false */
+    bool pipe_ready();
+
+public:
+    int m_fd;
+    int m_pipe[2];
+    upstream_server* m_server;
+    std::atomic<http_conn*> m_owner;
+    /* 空闲期间上游关闭了连接或发来了数据，不能再用 */
+    std::atomic<bool> m_broken;
+    /* 放入空闲表的时刻 */
+    long long m_idle_since;
+
+private:
+    upstream_conn() : m_fd(-1), m_server(NULL), m_owner(NULL), m_broken(false), m_idle_since(0)
+    {
+        m_pipe[0] = m_pipe[1] = -1;
+    }
+
+    static futex_mutex m_free_lock;
+    static std::vector<upstream_conn*> m_free;
+};
+
+/* 一个上游服务器：地址、保活连接池和健康状态
+   m_active 是正在转发的请求数，用于最少连接选择。
+   主动健康检查失败时 m_healthy 为 false，直到下一次检查成功；
+   转发时连接失败或应答超时（被动检查）使服务器在 fail_timeout 内不被选中 */
+class upstream_server
+{
+public:
+    explicit upstream_server(const std::string& name)
+        : m_active(0), m_name(name), m_addr_len(0), m_healthy(true), m_down_until(0), m_idle_lock("upstream_idle") { }
+
+    /* 解析 "host:port" 或 "unix:/path"，失败返回 false */
+    bool resolve();
+    /* 新建非阻塞连接并注册到 epoll，连接立即失败时返回 NULL */
+    upstream_conn* connect();
+    /* 取一个空闲的保活连接，没有时返回 NULL */
+    upstream_conn* checkout(long long now);
+    /* 归还连接：reusable 且空闲表未满时放入空闲表，否则关闭 */
+    void checkin(upstream_conn* c, bool reusable, long long now);
+    /* 关闭空闲超过期限或已失效的连接，只由主线程调用 */
+    void prune(long long now);
+    size_t idle_size();
+
+    bool usable(long long now) const
+    {
+        return m_healthy.load(std::memory_order_relaxed) && m_down_until.load(std::memory_order_relaxed) <= now;
+    }
+    /* 转发失败，暂停选中 fail_timeout 毫秒 */
+    void fail(long long now);
+    /* 主动健康检查：阻塞地连接，配置了检查路径时再请求它，应答 2xx 或 3xx 为健康 */
+    bool probe() const;
+    void set_health(bool ok);
+
+    const char* name() const { return m_name.c_str(); }
+
+public:
+    std::atomic<int> m_active;
+
+private:
+    bool check_http(int fd) const;
+
+private:
+    std::string m_name;
+    struct sockaddr_storage m_addr;
+    socklen_t m_addr_len;
+    std::atomic<bool> m_healthy;
+    std::atomic<long long> m_down_until;
+
+    /* 空闲的保活连接，后进先出，最近用过的连接最不可能已被上游关闭 */
+    futex_mutex m_idle_lock;
+    std::vector<upstream_conn*> m_idle;
+};
+
+/* 一条转发路由：路径前缀和它的上游服务器 */
+struct proxy_route
+{
+    std::string prefix;
+    std::vector<upstream_server*> servers;
+    /* 最少连接相同时轮流选择的起点 */
+    mutable std::atomic<unsigned> next;
+
+    proxy_route() : next(0) { }
+};
+
+/* 反向代理的路由表
+   配置形如 "/api/=127.0.0.1:8081,127.0.0.1:8082;/app/=unix:/run/app.sock"，
+   请求路径按最长前缀匹配，路径原样转发。同一地址出现在多条路由中时共用一个服务器对象和连接池。
+   路由表在启动时建好，之后只读。主动健康检查在一个后台线程中进行，只更新服务器的健康状态；
+   上游连接都由主线程关闭，空闲连接随主循环的定时器清理 */
+class proxy_table
+{
+public:
+    static proxy_table* get_instance()
+    {
+        static proxy_table instance;
+        return &instance;
+    }
+
+    /* 连接上游的期限（毫秒），主动健康检查的连接和应答也使用它 */
+    static int m_connect_timeout;
+    /* 转发期间两次收发进展之间的最长间隔（毫秒） */
+    static int m_timeout;
+    /* 每个上游服务器保留的空闲保活连接数 */
+    static int m_max_idle;
+    /* 空闲连接的保留期限（毫秒） */
+    static int m_idle_timeout;
+    /* 被动检查发现失败后暂停选中的时间（毫秒） */
+    static int m_fail_timeout;
+    /* 主动健康检查的间隔（毫秒），0 表示只做被动检查 */
+    static int m_health_interval;
+    /* 主动健康检查请求的路径，空串表示只检查能否建立连接 */
+    static std::string m_health_path;
+
+    /* 解析路由配置并解析地址，出错时打印原因并返回 false */
+    bool init(const char* spec);
+    /* 配置了主动健康检查时启动检查线程 */
+    void start();
+    /* 关闭各服务器空闲超时的连接，由主循环的定时处理调用 */
+    void prune(long long now);
+
+    bool empty() const { return m_routes.empty(); }
+    /* 按最长前缀匹配路由，没有匹配时返回 NULL */
+    const proxy_route* match(const char* url) const;
+    /* 按最少连接从路由中选出一个可用的服务器，都不可用时返回 NULL。只由主线程调用 */
+    upstream_server* pick(const proxy_route* route, long long now) const;
+
+    /* 输出指标时采样：健康的服务器数和空闲连接数 */
+    long healthy_count() const;
+    long idle_count() const;
+
+private:
+    proxy_table() { }
+
+    upstream_server* find_server(const std::string& name);
+    static void* health_thread(void* arg);
+
+private:
+    std::vector<proxy_route*> m_routes;
+    std::vector<upstream_server*> m_servers;
+};
+
+#endif
@@ -0,0 +1,323 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "metrics.h"
+
+std::atomic<int> metrics::m_next_slot(0);
+thread_local std::atomic<long>* metrics::t_cells = NULL;
+
+metrics::metrics() : m_slots(NULL), m_cells_used(0)
+{
+    void* mem = NULL;
+    if(posix_memalign(&mem, 64, sizeof(slot) * SLOT_COUNT) != 0)
+    {
+        abort();
+    }
+    memset(mem, 0, sizeof(slot) * SLOT_COUNT);
+    m_slots = (slot*)mem;
+}
+
+metrics::~metrics()
+{
+    free(m_slots);
+}
+
+/* 线程按首次更新的先后轮流分到槽位 */
+std::atomic<long>* metrics::assign_slot()
+{
+    int index = m_next_slot.fetch_add(1, std::memory_order_relaxed) % SLOT_COUNT;
+    return get_instance()->m_slots[index].cells;
+}
+
+int metrics::alloc_cells(int count)
+{
+    if(m_cells_used + count > CELL_COUNT)
+    {
+        fprintf(stderr, "[metrics] out of cells, metric dropped\n");
+        return -1;
+    }
+    int cell = m_cells_used;
+    m_cells_used += count;
+    return cell;
+}
+
+long metrics::sum(int cell)
+{
+    long total = 0;
+    for(int i = 0; i < SLOT_COUNT; ++i)
+    {
+        total += m_slots[i].cells[cell].load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+int metrics::add_counter(const char* name, const char* help, const char* labels)
+{
+    int cell = alloc_cells(1);
+    if(cell < 0)
+    {
+        return -1;
+    }
+    entry e;
+    e.type = COUNTER;
+    e.name = name;
+    e.help = help;
+    e.labels = labels;
+    e.cell = cell;
+    e.value = NULL;
+    e.fn = NULL;
+    e.bounds = NULL;
+    e.bound_count = 0;
+    e.scale = 1.0;
+    m_entries.push_back(e);
+    return cell;
+}
+
+int metrics::add_histogram(const char* name, const char* help, const long* bounds,
+                            int bound_count, double scale)
+{
+    /* 每个桶一个单元（含 +Inf），再加一个总和 */
+    int cell = alloc_cells(bound_count + 2);
+    if(cell < 0)
+    {
+        return -1;
+    }
+    entry e;
+    e.type = HISTOGRAM;
+    e.name = name;
+    e.help = help;
+    e.cell = cell;
+    e.value = NULL;
+    e.fn = NULL;
+    e.bounds = bounds;
+    e.bound_count = bound_count;
+    e.scale = scale;
+    m_entries.push_back(e);
+    return cell;
+}
+
+void metrics::add_gauge(const char* name, const char* help, std::atomic<long>* value,
+                        const char* labels)
+{
+    entry e;
+    e.type = GAUGE;
+    e.name = name;
+    e.help = help;
+    e.labels = labels;
+    e.cell = -1;
+    e.value = value;
+    e.fn = NULL;
+    e.bounds = NULL;
+    e.bound_count = 0;
+    e.scale = 1.0;
+    m_entries.push_back(e);
+}
+
+void metrics::add_sampled_gauge(const char* name, const char* help, sampler fn,
+                                const char* labels)
+{
+    add_gauge(name, help, NULL, labels);
+    m_entries.back().fn = fn;
+}
+
+void metrics::render(std::string& out)
+{
+    static const char* type_names[] = {"counter", "gauge", "histogram"};
+    char line[256];
+
+    for(size_t i = 0; i < m_entries.size(); ++i)
+    {
+        const entry& e = m_entries[i];
+
+        /* 同名指标（只是标签不同）只输出一次说明 */
+        if(i == 0 || m_entries[i - 1].name != e.name)
+        {
+            out += "# HELP " + e.name + " " + e.help + "\n";
+            out += "# TYPE " + e.name + " " + type_names[e.type] + "\n";
+        }
+
+        switch (e.type)
+        {
+        case COUNTER:
+        case GAUGE:
+        {
+            long value;
+            if(e.type == COUNTER)
+            {
+                value = sum(e.cell);
+            }
+            else
+            {
+                value = e.fn ? e.fn() : e.value->load(std::memory_order_relaxed);
+            }
+            if(e.labels.empty())
+            {
+                snprintf(line, sizeof(line), "%s %ld\n", e.name.c_str(), value);
+            }
+            else
+            {
+                snprintf(line, sizeof(line), "%s{%s} %ld\n", e.name.c_str(), e.labels.c_str(),
+                            value);
+            }
+            out += line;
+            break;
+        }
+        case HISTOGRAM:
+        {
+            /* 桶计数按上界累加 */
+            long cumulative = 0;
+            for(int b = 0; b <= e.bound_count; ++b)
+            {
+                cumulative += sum(e.cell + b);
+                if(b < e.bound_count)
+                {
+                    snprintf(line, sizeof(line), "%s_bucket{le=\"%g\"} %ld\n", e.name.c_str(),
+                                e.bounds[b] * e.scale, cumulative);
+                }
+                else
+                {
+                    snprintf(line, sizeof(line), "%s_bucket{le=\"+Inf\"} %ld\n", e.name.c_str(),
+                                cumulative);
+                }
+                out += line;
+            }
+            snprintf(line, sizeof(line), "%s_sum %g\n%s_count %ld\n", e.name.c_str(),
+                        sum(e.cell + e.bound_count + 1) * e.scale, e.name.c_str(), cumulative);
+            out += line;
+            break;
+        }
+        }
+    }
+}
+
+metric_counter server_metrics::accepts;
+metric_counter server_metrics::bytes_sent;
+metric_counter server_metrics::log_overflows;
+metric_counter server_metrics::buffer_hits;
+metric_counter server_metrics::buffer_refills;
+metric_counter server_metrics::buffer_mallocs;
+metric_histogram server_metrics::queue_wait;
+metric_histogram server_metrics::service_time;
+metric_counter server_metrics::worker_busy;
+metric_counter server_metrics::tls_full_handshakes;
+metric_counter server_metrics::tls_resumed;
+metric_counter server_metrics::tls_failed;
+metric_counter server_metrics::tls_ktls;
+metric_counter server_metrics::h2_sessions;
+metric_counter server_metrics::h2_streams;
+metric_counter server_metrics::ws_sessions;
+metric_counter server_metrics::ws_messages;
+metric_counter server_metrics::ws_broadcasts;
+metric_counter server_metrics::ws_dropped;
+metric_counter server_metrics::proxy_requests;
+metric_counter server_metrics::proxy_failures;
+metric_counter server_metrics::proxy_retries;
+metric_counter server_metrics::proxy_connects_new;
+metric_counter server_metrics::proxy_connects_pooled;
+std::atomic<long> server_metrics::active_conns(0);
+std::atomic<long> server_metrics::timer_count(0);
+std::atomic<long> server_metrics::worker_threads(0);
+
+const int server_metrics::m_statuses[STATUS_COUNT] = {200, 400, 403, 404, 408, 429, 500, 502, 503, 504};
+metric_counter server_metrics::m_responses[STATUS_COUNT + 1];
+
+/* 排队时间和处理时间的桶上界（微秒） */
+static const long queue_wait_bounds[] = {
+    10, 50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 1000000
+};
+
+void server_metrics::init()
+{
+    metrics* reg = metrics::get_instance();
+
+    accepts.attach(reg->add_counter("tws_connections_accepted_total",
+                                    "Connections accepted."));
+    reg->add_gauge("tws_connections_active", "Open client connections.", &active_conns);
+    reg->add_gauge("tws_timers", "Timers in the timer heap.", &timer_count);
+
+    char labels[32];
+    for(int i = 0; i <= STATUS_COUNT; ++i)
+    {
+        if(i < STATUS_COUNT)
+        {
+            snprintf(labels, sizeof(labels), "code=\"%d\"", m_statuses[i]);
+        }
+        else
+        {
+            snprintf(labels, sizeof(labels), "code=\"other\"");
+        }
+        m_responses[i].attach(reg->add_counter("tws_http_responses_total",
+                                                "HTTP responses by status code.", labels));
+    }
+    bytes_sent.attach(reg->add_counter("tws_http_response_bytes_total",
+                                        "Response bytes written to clients."));
+
+    queue_wait.attach(reg->add_histogram("tws_threadpool_queue_wait_seconds",
+                                            "Time requests spent in the threadpool queue.",
+                                            queue_wait_bounds,
+                                            sizeof(queue_wait_bounds) / sizeof(long), 1e-6),
+                        queue_wait_bounds, sizeof(queue_wait_bounds) / sizeof(long));
+    service_time.attach(reg->add_histogram("tws_threadpool_service_seconds",
+                                            "Time workers spent processing a request.",
+                                            queue_wait_bounds,
+                                            sizeof(queue_wait_bounds) / sizeof(long), 1e-6),
+                        queue_wait_bounds, sizeof(queue_wait_bounds) / sizeof(long));
+    worker_busy.attach(reg->add_counter("tws_threadpool_busy_microseconds_total",
+                                        "Time workers spent processing requests, summed over workers."));
+    reg->add_gauge("tws_threadpool_threads", "Worker threads.", &worker_threads);
+
+    log_overflows.attach(reg->add_counter("tws_log_queue_overflows_total",
+                                            "Log lines written synchronously because the queue was full."));
+
+    buffer_hits.attach(reg->add_counter("tws_buffer_pool_acquires_total",
+                                        "Buffer acquisitions by source.", "source=\"thread_cache\""));
+    buffer_refills.attach(reg->add_counter("tws_buffer_pool_acquires_total",
+                                            "Buffer acquisitions by source.", "source=\"depot\""));
+    buffer_mallocs.attach(reg->add_counter("tws_buffer_pool_acquires_total",
+                                            "Buffer acquisitions by source.", "source=\"malloc\""));
+
+    tls_full_handshakes.attach(reg->add_counter("tws_tls_handshakes_total",
+                                                "TLS handshakes by result.", "result=\"full\""));
+    tls_resumed.attach(reg->add_counter("tws_tls_handshakes_total",
+                                        "TLS handshakes by result.", "result=\"resumed\""));
+    tls_failed.attach(reg->add_counter("tws_tls_handshakes_total",
+                                        "TLS handshakes by result.", "result=\"failed\""));
+    tls_ktls.attach(reg->add_counter("tws_tls_ktls_connections_total",
+                                        "TLS connections whose record encryption was offloaded to the kernel."));
+
+    h2_sessions.attach(reg->add_counter("tws_http2_connections_total",
+                                        "Connections switched to HTTP/2."));
+    h2_streams.attach(reg->add_counter("tws_http2_streams_total",
+                                        "Requests answered on HTTP/2 connections."));
+
+    ws_sessions.attach(reg->add_counter("tws_websocket_connections_total",
+                                        "Connections switched to WebSocket."));
+    ws_messages.attach(reg->add_counter("tws_websocket_messages_received_total",
+                                        "Data messages received from WebSocket clients."));
+    ws_broadcasts.attach(reg->add_counter("tws_websocket_broadcasts_total",
+                                            "Messages broadcast to WebSocket subscribers."));
+    ws_dropped.attach(reg->add_counter("tws_websocket_slow_subscribers_total",
+                                        "WebSocket subscribers closed because they fell too far behind."));
+
+    proxy_requests.attach(reg->add_counter("tws_proxy_requests_total",
+                                            "Requests forwarded to upstream servers."));
+    proxy_failures.attach(reg->add_counter("tws_proxy_failures_total",
+                                            "Forwarded requests that failed or timed out upstream."));
+    proxy_retries.attach(reg->add_counter("tws_proxy_retries_total",
+                                            "Forwarded requests resent on another upstream connection."));
+    proxy_connects_new.attach(reg->add_counter("tws_proxy_upstream_connections_total",
+                                                "Upstream connections used by source.", "source=\"new\""));
+    proxy_connects_pooled.attach(reg->add_counter("tws_proxy_upstream_connections_total",
+                                                    "Upstream connections used by source.", "source=\"pool\""));
+}
+
+void server_metrics::count_response(int status)
+{
+    int i = 0;
+    while (i < STATUS_COUNT && m_statuses[i] != status)
+    {
+        ++i;
+    }
+    m_responses[i].add();
+}
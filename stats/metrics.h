@@ -0,0 +1,201 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+/* 运行时指标注册表，以 Prometheus 文本格式输出
+   计数器和直方图按线程分片：每个线程第一次更新时分到一个槽位，更新只是对本线程槽位的一次 relaxed 原子加，
+   各槽位独占缓存行，线程之间互不争用；输出时把所有槽位相加。
+   仪表有两种：由持有者直接设置的原子值，以及输出时调用采样函数得到的值（采样函数必须线程安全）。
+   指标只能在启动阶段（创建工作线程之前）注册，之后注册表只读 */
+class metrics
+{
+public:
+    /* 槽位数，线程数超过后多个线程共用一个槽位，结果仍然正确 */
+    static const int SLOT_COUNT = 64;
+    /* 每个槽位的计数单元数，计数器占一个，直方图占桶数 + 2 个 */
+    static const int CELL_COUNT = 256;
+
+    typedef long (*sampler)();
+
+public:
+    static metrics* get_instance()
+    {
+        static metrics instance;
+        return &instance;
+    }
+
+    /* 注册计数器，返回计数单元下标，单元用完时返回 -1。labels 形如 code="200"，可为空 */
+    int add_counter(const char* name, const char* help, const char* labels = "");
+    /* 注册直方图，bounds 为升序的桶上界（不含 +Inf），输出时桶上界和总和都乘以 scale */
+    int add_histogram(const char* name, const char* help, const long* bounds, int bound_count,
+                        double scale = 1.0);
+    /* 注册由持有者设置的仪表 */
+    void add_gauge(const char* name, const char* help, std::atomic<long>* value,
+                    const char* labels = "");
+    /* 注册输出时采样的仪表 */
+    void add_sampled_gauge(const char* name, const char* help, sampler fn,
+                            const char* labels = "");
+
+    /* 按 Prometheus 文本格式输出所有指标 */
+    void render(std::string& out);
+
+    /* 本线程槽位的计数单元 */
+    static std::atomic<long>* local_cells()
+    {
+        if(!t_cells)
+        {
+            t_cells = assign_slot();
+        }
+        return t_cells;
+    }
+
+private:
+    metrics();
+    ~metrics();
+
+    static std::atomic<long>* assign_slot();
+    /* 所有槽位中某个计数单元的和 */
+    long sum(int cell);
+    int alloc_cells(int count);
+
+private:
+    enum TYPE
+    {
+        COUNTER = 0,
+        GAUGE,
+        HISTOGRAM
+    };
+
+    /* 一个指标的描述，输出时按它读取数值 */
+    struct entry
+    {
+        TYPE type;
+        std::string name;
+        std::string help;
+        std::string labels;
+        int cell;                   /* 计数器和直方图的首个计数单元 */
+        std::atomic<long>* value;   /* 持有者设置的仪表 */
+        sampler fn;                 /* 采样的仪表 */
+        const long* bounds;         /* 直方图的桶上界 */
+        int bound_count;
+        double scale;
+    };
+
+    struct alignas(64) slot
+    {
+        std::atomic<long> cells[CELL_COUNT];
+    };
+
+    slot* m_slots;
+    int m_cells_used;
+    std::vector<entry> m_entries;
+
+    static std::atomic<int> m_next_slot;
+    static thread_local std::atomic<long>* t_cells;
+};
+
+/* 计数器句柄，未注册时更新是空操作 */
+class metric_counter
+{
+public:
+    metric_counter() : m_cell(-1) {}
+
+    void add(long n = 1) const
+    {
+        if(m_cell >= 0)
+        {
+            metrics::local_cells()[m_cell].fetch_add(n, std::memory_order_relaxed);
+        }
+    }
+
+    void attach(int cell) { m_cell = cell; }
+
+private:
+    int m_cell;
+};
+
+/* 固定桶直方图句柄，未注册时记录是空操作 */
+class metric_histogram
+{
+public:
+    metric_histogram() : m_cell(-1), m_bounds(NULL), m_bound_count(0) {}
+
+    void observe(long value) const
+    {
+        if(m_cell < 0)
+        {
+            return;
+        }
+        int i = 0;
+        while (i < m_bound_count && value > m_bounds[i])
+        {
+            ++i;
+        }
+        std::atomic<long>* cells = metrics::local_cells() + m_cell;
+        cells[i].fetch_add(1, std::memory_order_relaxed);
+        /* 最后一个单元是总和 */
+        cells[m_bound_count + 1].fetch_add(value, std::memory_order_relaxed);
+    }
+
+    void attach(int cell, const long* bounds, int bound_count)
+    {
+        m_cell = cell;
+        m_bounds = bounds;
+        m_bound_count = bound_count;
+    }
+
+private:
+    int m_cell;
+    const long* m_bounds;
+    int m_bound_count;
+};
+
+/* 服务器各模块更新的指标，由 init() 统一注册。
+   bench 下的工具不调用 init()，这些更新都是空操作 */
+class server_metrics
+{
+public:
+    static void init();
+
+    /* 按状态码计数应答 */
+    static void count_response(int status);
+
+    static metric_counter accepts;          /* 接受的连接数 */
+    static metric_counter bytes_sent;       /* 发送的应答字节数 */
+    static metric_counter log_overflows;    /* 异步日志队列已满改为同步写入的次数 */
+    static metric_counter buffer_hits;      /* 缓冲区池：线程缓存命中 */
+    static metric_counter buffer_refills;   /* 缓冲区池：从公共仓库补充 */
+    static metric_counter buffer_mallocs;   /* 缓冲区池：缓存和仓库都为空，直接分配 */
+    static metric_histogram queue_wait;     /* 请求在线程池队列中等待的时间（微秒） */
+    static metric_histogram service_time;   /* 工作线程处理一个请求的时间（微秒） */
+    static metric_counter worker_busy;      /* 工作线程处理请求的累计时间（微秒） */
+    static metric_counter tls_full_handshakes;  /* TLS 完整握手次数 */
+    static metric_counter tls_resumed;      /* TLS 会话恢复次数 */
+    static metric_counter tls_failed;       /* TLS 握手失败次数 */
+    static metric_counter tls_ktls;         /* 发送方向交给内核 TLS 的连接数 */
+    static metric_counter h2_sessions;      /* 切换到 HTTP/2 的连接数 */
+    static metric_counter h2_streams;       /* HTTP/2 连接上应答的请求数 */
+    static metric_counter ws_sessions;      /* 切换到 WebSocket 的连接数 */
+    static metric_counter ws_messages;      /* WebSocket 客户端发来的消息数 */
+    static metric_counter ws_broadcasts;    /* 广播的消息数 */
+    static metric_counter ws_dropped;       /* 收件箱已满或发送积压超限、作为慢速订阅者关闭的连接数 */
+    static metric_counter proxy_requests;   /* 转发到上游服务器的请求数 */
+    static metric_counter proxy_failures;   /* 上游不可用、失败或超时的转发数 */
+    static metric_counter proxy_retries;    /* 换一个上游连接重新发送的次数 */
+    static metric_counter proxy_connects_new;       /* 转发新建的上游连接数 */
+    static metric_counter proxy_connects_pooled;    /* 转发取用的空闲保活连接数 */
+
+    static std::atomic<long> active_conns;  /* 当前连接数，由主线程设置 */
+    static std::atomic<long> timer_count;   /* 时间堆中的定时器数，由主线程设置 */
+    static std::atomic<long> worker_threads;    /* 线程池的工作线程数，由主线程设置 */
+
+private:
+    static const int STATUS_COUNT = 10;
+    static const int m_statuses[STATUS_COUNT];
+    static metric_counter m_responses[STATUS_COUNT + 1];    /* 最后一个统计其他状态码 */
+};
+
+#endif
@@ -0,0 +1,30 @@
+#include <stdio.h>
+
+#include "syscall_stats.h"
+
+#ifdef SYSCALL_STATS
+
+std::atomic<long> syscall_stats::m_counters[syscall_stats::COUNT];
+
+void syscall_stats::dump()
+{
+    static const char* names[COUNT] = {
+        "epoll_wait", "epoll_ctl", "accept", "recv", "writev", "close", "other", "requests"
+    };
+
+    long requests = m_counters[REQUESTS].exchange(0);
+    long total = 0;
+    printf("[syscall_stats] requests: %ld\n", requests);
+    for(int i = 0; i < REQUESTS; ++i)
+    {
+        long n = m_counters[i].exchange(0);
+        total += n;
+        printf("[syscall_stats] %-10s %10ld  %6.2f/request\n", names[i], n,
+                requests ? (double)n / requests : 0.0);
+    }
+    printf("[syscall_stats] %-10s %10ld  %6.2f/request\n", "total", total,
+            requests ? (double)total / requests : 0.0);
+    fflush(stdout);
+}
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef SYSCALL_STATS_H
+#define SYSCALL_STATS_H
+
+/* 系统调用计数，用于衡量每个请求的系统调用开销
+   只有以 SYSCALL_STATS 编译（make SYSCALL_STATS=1）时才计数，否则 COUNT_SYSCALL 为空操作 */
+#ifdef SYSCALL_STATS
+
+#include <atomic>
+
+class syscall_stats
+{
+public:
+    enum SYSCALL
+    {
+        EPOLL_WAIT = 0,
+        EPOLL_CTL,
+        ACCEPT,
+        RECV,
+        WRITEV,
+        CLOSE,
+        OTHER,      /* timerfd、signalfd、eventfd 等的读写 */
+        REQUESTS,   /* 已生成应答的请求数，不是系统调用 */
+        COUNT
+    };
+
+    static void add(SYSCALL which)
+    {
+        m_counters[which].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /* 打印各系统调用的总次数和平均每个请求的次数，然后清零 */
+    static void dump();
+
+private:
+    static std::atomic<long> m_counters[COUNT];
+};
+
+#define COUNT_SYSCALL(which) syscall_stats::add(syscall_stats::which)
+
+#else
+
+#define COUNT_SYSCALL(which)
+
+#endif
+
+#endif
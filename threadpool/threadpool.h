@@ -4,52 +4,183 @@
 #include <list>
 #include <cstdio>
 #include <exception>
+#include <atomic>
+#include <climits>
 #include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
 #include "../lock/locker.h"
 #include "../CGImysql/sql_connection_pool.h"
 #include "../log/log.h"
+#include "../stats/metrics.h"
+#include "../affinity/cpu_topology.h"
 
-/* 线程池类，将它定义为模板类是为了代码复用。模板参数 T 是任务类 */
+/* 线程池类，将它定义为模板类是为了代码复用。模板参数 T 是任务类
+   每个请求记录入队和出队时间，每个工作线程统计忙碌和空闲时间。
+   可选的自适应调节（set_adaptive）仿照 CoDel：一个统计周期内最短的排队时间仍超过目标延迟，
+   说明队列在持续积压，增加一个线程；工作线程大部分时间空闲则减少一个线程。
+   进程已经用满所有 CPU 时不再增加线程，避免在小机器上过度订阅。
+   指定 cpus 时每个工作线程（包括自适应调节新增的）启动后先绑定到这组 CPU。
+   请求按调度类别进入不同的通道（set_lane），空闲线程按权重在有请求的通道之间平滑加权轮询，
+   可以限制一个通道同时占用的线程数和排队长度，慢请求堆积时不会拖慢其他通道。
+   只有声明需要数据库的通道才为请求取数据库连接 */
 template<typename T>
 class threadpool
 {
 public:
-    threadpool(connection_pool* connPool, int thread_number = 8, int max_requests = 10000);
+    /* 自适应调节时线程数的上限，也是工作线程统计槽位的数量 */
+    static const int MAX_THREADS = 256;
+    /* 最多的通道数 */
+    static const int MAX_LANES = 4;
+
+    threadpool(connection_pool* connPool, int thread_number = 8, int max_requests = 10000,
+                const cpu_set_t* cpus = NULL);
     ~threadpool();
 
-    /* 往请求队列中添加任务 */
-    bool append(T* request);
+    /* 配置通道 index：调度权重 weight，同时处理的请求数上限 max_running 和排队长度上限 max_queued
+        （0 表示不限，排队总数仍受 max_requests 限制），use_db 为处理前是否取数据库连接。
+        必须在添加任务之前调用。未配置时只有通道 0，权重 1，不限制，取数据库连接 */
+    void set_lane(int index, const char* name, int weight, int max_running, int max_queued,
+                    bool use_db);
+
+    /* 往通道 lane 的请求队列中添加任务，队列已满时返回 false */
+    bool append(T* request, int lane = 0);
+
+    /* 请求队列中等待处理的请求数 */
+    int queue_size();
+    /* 通道 lane 中等待处理的请求数 */
+    int queue_size(int lane);
+    /* 请求队列中允许的最大请求数 */
+    int max_requests() const { return m_max_requests; }
+    /* 当前工作线程数 */
+    int thread_number() const { return m_thread_number; }
+
+    /* 开启自适应调节：线程数在 [min_threads, max_threads] 之间，
+        目标排队延迟为 target_delay 微秒，每 interval 毫秒评估一次 */
+    void set_adaptive(int min_threads, int max_threads, int target_delay, int interval);
+    /* 评估并调整线程数，只能由同一个线程（主循环）周期性调用，now 为单调时钟毫秒 */
+    void adjust(long long now);
+    /* 把每个工作线程的统计写入日志 */
+    void log_stats();
 
 private:
     /* 工作线程运行的函数，它不断的从工作队列中取出任务并执行 */
     static void* worker(void* arg);
-    void run();
+    void run(int index);
+    /* 单调时钟微秒 */
+    static long long now_us();
+    /* 在空闲槽位上创建一个工作线程 */
+    bool spawn();
+    /* 按权重挑选一个有请求且未达并发上限的通道，没有时返回 -1，调用者持有队列锁 */
+    int pick_lane();
+    /* 是否有可以立即处理的请求，调用者持有队列锁 */
+    bool runnable();
 
 private:
+    /* 请求及其入队时间，用于统计排队时间 */
+    struct task
+    {
+        T* request;
+        long long enqueued;
+    };
+
+    /* 一个调度通道，除名字和配置外都由队列锁保护 */
+    struct lane
+    {
+        const char* name;
+        int weight;
+        int max_running;
+        int max_queued;
+        bool use_db;
+        std::list<task> queue;
+        int running;            /* 正在处理的请求数 */
+        int current;            /* 平滑加权轮询的当前权值 */
+        long served;            /* 出队的请求数 */
+        long long wait_us;      /* 出队请求的排队时间之和 */
+        long long max_wait_us;  /* 最长的排队时间 */
+    };
+
+    /* 一个工作线程的统计，只由该线程更新 */
+    struct worker_slot
+    {
+        threadpool* pool;
+        int index;
+        std::atomic<bool> active;           /* 槽位上是否有线程 */
+        std::atomic<long long> busy_us;     /* 处理请求的时间 */
+        std::atomic<long long> idle_us;     /* 等待请求的时间 */
+        std::atomic<long> requests;         /* 处理的请求数 */
+    };
+
     int m_thread_number;        /* 线程池中的线程数 */
     int m_max_requests;         /* 请求队列中允许的最大请求数 */
-    pthread_t* m_threads;       /* 描述线程池的数组，其大小为 m_thread_number */
-    std::list<T*> m_workqueue;  /* 请求队列 */
+    lane m_lanes[MAX_LANES];    /* 各通道的请求队列 */
+    int m_lane_count;           /* 配置的通道数 */
+    int m_queued;               /* 所有通道中等待处理的请求数 */
     locker m_queuelocker;       /* 保护请求队列的互斥锁 */
-    sem m_queuestat;            /* 是否有任务需要处理 */
+    cond m_queuecond;           /* 有可以处理的任务或需要退出线程时唤醒工作线程 */
     bool m_stop;                /* 是否结束线程 */
     connection_pool* m_connPool;/* 数据库 */
+    worker_slot* m_workers;     /* 工作线程的统计槽位，共 MAX_THREADS 个 */
+    std::atomic<int> m_retire;  /* 需要退出的线程数 */
+    bool m_pinned;              /* 工作线程是否绑定 CPU */
+    cpu_set_t m_cpus;           /* 工作线程绑定的 CPU */
+
+    /* 自适应调节的参数和状态 */
+    bool m_adaptive;
+    int m_min_threads;
+    int m_max_threads;
+    int m_target_delay;
+    int m_interval;
+    long long m_interval_start;     /* 当前统计周期的开始时间（毫秒） */
+    long long m_interval_busy;      /* 周期开始时所有线程的忙碌时间之和 */
+    long long m_interval_cpu;       /* 周期开始时进程的 CPU 时间（微秒） */
+    /* 以下两项只统计不限并发的通道，受限通道的排队由其上限造成，增加线程并不能缓解 */
+    std::atomic<long long> m_min_wait;  /* 本周期内最短的排队时间 */
+    std::atomic<long> m_dequeued;       /* 本周期内出队的请求数 */
 };
 
 template<typename T>
-threadpool<T>::threadpool(connection_pool* connPool, int thread_number, int max_requests)
-    : m_thread_number(thread_number), m_max_requests(max_requests),
-        m_threads(NULL), m_stop(false), m_connPool(connPool)
+threadpool<T>::threadpool(connection_pool* connPool, int thread_number, int max_requests,
+                            const cpu_set_t* cpus)
+    : m_thread_number(0), m_max_requests(max_requests), m_lane_count(1), m_queued(0),
+        m_queuelocker("threadpool"), m_stop(false), m_connPool(connPool),
+        m_workers(NULL), m_retire(0), m_pinned(cpus != NULL), m_adaptive(false), m_min_threads(thread_number),
+        m_max_threads(thread_number), m_target_delay(0), m_interval(0), m_interval_start(0),
+        m_interval_busy(0), m_interval_cpu(0), m_min_wait(LLONG_MAX), m_dequeued(0)
 {
-    if((thread_number <= 0) || (max_requests <= 0))
+    if((thread_number <= 0) || (thread_number > MAX_THREADS) || (max_requests <= 0))
     {
         throw std::exception();
     }
+    if(cpus)
+    {
+        m_cpus = *cpus;
+    }
 
-    m_threads = new pthread_t[m_thread_number];
-    if(!m_threads)
+    for(int i = 0; i < MAX_LANES; ++i)
     {
-        throw std::exception();
+        m_lanes[i].name = "default";
+        m_lanes[i].weight = 1;
+        m_lanes[i].max_running = 0;
+        m_lanes[i].max_queued = 0;
+        m_lanes[i].use_db = true;
+        m_lanes[i].running = 0;
+        m_lanes[i].current = 0;
+        m_lanes[i].served = 0;
+        m_lanes[i].wait_us = 0;
+        m_lanes[i].max_wait_us = 0;
+    }
+
+    m_workers = new worker_slot[MAX_THREADS];
+    for(int i = 0; i < MAX_THREADS; ++i)
+    {
+        m_workers[i].pool = this;
+        m_workers[i].index = i;
+        m_workers[i].active = false;
+        m_workers[i].busy_us = 0;
+        m_workers[i].idle_us = 0;
+        m_workers[i].requests = 0;
     }
 
     /* 创建 thread_number 线程，并将它们设置为脱离线程 */
@@ -58,15 +189,8 @@ threadpool<T>::threadpool(connection_pool* connPool, int thread_number, int max_
         // printf("create the %dth thread\n", i);
         LOG_INFO("[threadpool] create the %dth thread\n", i);
         Log::get_instance()->flush();
-        if(pthread_create(m_threads + i, NULL, worker, this) != 0)
-        {
-            delete [] m_threads;
-            throw std::exception();
-        }
-        /* 将线程进行分离后，不用单独对工作线程进行回收 */
-        if(pthread_detach(m_threads[i]))
+        if(!spawn())
         {
-            delete [] m_threads;
             throw std::exception();
         }
     }
@@ -75,64 +199,370 @@ threadpool<T>::threadpool(connection_pool* connPool, int thread_number, int max_
 template<typename T>
 threadpool<T>::~threadpool()
 {
-    delete [] m_threads;
+    /* 脱离线程可能仍在访问统计槽位，槽位不释放 */
+    m_queuelocker.lock();
     m_stop = true;
+    m_queuecond.broadcast();
+    m_queuelocker.unlock();
 }
 
 template<typename T>
-bool threadpool<T>::append(T* request)
+bool threadpool<T>::spawn()
 {
+    int index = 0;
+    while (index < MAX_THREADS && m_workers[index].active)
+    {
+        ++index;
+    }
+    if(index == MAX_THREADS)
+    {
+        return false;
+    }
+
+    m_workers[index].active = true;
+    pthread_t tid;
+    if(pthread_create(&tid, NULL, worker, &m_workers[index]) != 0)
+    {
+        m_workers[index].active = false;
+        return false;
+    }
+    /* 将线程进行分离后，不用单独对工作线程进行回收 */
+    pthread_detach(tid);
+    ++m_thread_number;
+    return true;
+}
+
+template<typename T>
+void threadpool<T>::set_lane(int index, const char* name, int weight, int max_running,
+                                int max_queued, bool use_db)
+{
+    if(index < 0 || index >= MAX_LANES)
+    {
+        return;
+    }
+    lane& l = m_lanes[index];
+    l.name = name;
+    l.weight = weight > 0 ? weight : 1;
+    l.max_running = max_running > 0 ? max_running : 0;
+    l.max_queued = max_queued > 0 ? max_queued : 0;
+    l.use_db = use_db;
+    if(index >= m_lane_count)
+    {
+        m_lane_count = index + 1;
+    }
+}
+
+template<typename T>
+bool threadpool<T>::append(T* request, int index)
+{
+    if(index < 0 || index >= m_lane_count)
+    {
+        index = 0;
+    }
+    lane& l = m_lanes[index];
+
     /* 操作工作队列时一定要加锁，因为它被所有线程共享 */
     m_queuelocker.lock();
 
-    if(m_workqueue.size() > m_max_requests)
+    if(m_queued >= m_max_requests || (l.max_queued > 0 && (int)l.queue.size() >= l.max_queued))
     {
         m_queuelocker.unlock();
         return false;
     }
 
-    m_workqueue.push_back(request);
+    task t = {request, now_us()};
+    l.queue.push_back(t);
+    ++m_queued;
+    /* 通道已达并发上限时被唤醒的线程会重新等待，该通道有请求处理完时再唤醒 */
+    m_queuecond.signal();
     m_queuelocker.unlock();
-    /* 信号量提醒有任务要处理 */
-    m_queuestat.post();
     return true;
 }
 
 template<typename T>
-void* threadpool<T>::worker(void* arg)
+int threadpool<T>::queue_size()
 {
-    threadpool* pool = (threadpool*) arg;
-    pool->run();
-    return pool;
+    m_queuelocker.lock();
+    int size = m_queued;
+    m_queuelocker.unlock();
+    return size;
 }
 
 template<typename T>
-void threadpool<T>::run()
+int threadpool<T>::queue_size(int index)
 {
-    while (!m_stop)
+    if(index < 0 || index >= m_lane_count)
     {
-        /* 信号量等待 */
-        m_queuestat.wait();
-        m_queuelocker.lock();
+        return 0;
+    }
+    m_queuelocker.lock();
+    int size = m_lanes[index].queue.size();
+    m_queuelocker.unlock();
+    return size;
+}
 
-        if(m_workqueue.empty())
+template<typename T>
+int threadpool<T>::pick_lane()
+{
+    /* 平滑加权轮询（与 nginx 的 upstream 相同）：每次所有候选通道的当前权值加上各自的权重，
+        选当前权值最大的，再减去候选通道的权重之和。权重 4:1 时调度顺序为 A A B A A，不会连续选 B */
+    int total = 0;
+    int best = -1;
+    for(int i = 0; i < m_lane_count; ++i)
+    {
+        lane& l = m_lanes[i];
+        if(l.queue.empty() || (l.max_running > 0 && l.running >= l.max_running))
         {
-            m_queuelocker.unlock();
             continue;
         }
+        l.current += l.weight;
+        total += l.weight;
+        if(best < 0 || l.current > m_lanes[best].current)
+        {
+            best = i;
+        }
+    }
+    if(best >= 0)
+    {
+        m_lanes[best].current -= total;
+    }
+    return best;
+}
 
-        T* request = m_workqueue.front();
-        m_workqueue.pop_front();
+template<typename T>
+bool threadpool<T>::runnable()
+{
+    for(int i = 0; i < m_lane_count; ++i)
+    {
+        lane& l = m_lanes[i];
+        if(!l.queue.empty() && (l.max_running == 0 || l.running < l.max_running))
+        {
+            return true;
+        }
+    }
+    return false;
+}
 
+template<typename T>
+long long threadpool<T>::now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+template<typename T>
+void threadpool<T>::set_adaptive(int min_threads, int max_threads, int target_delay, int interval)
+{
+    if(min_threads < 1)
+    {
+        min_threads = 1;
+    }
+    if(max_threads > MAX_THREADS)
+    {
+        max_threads = MAX_THREADS;
+    }
+    if(max_threads < min_threads)
+    {
+        max_threads = min_threads;
+    }
+    m_adaptive = true;
+    m_min_threads = min_threads;
+    m_max_threads = max_threads;
+    m_target_delay = target_delay;
+    m_interval = interval;
+    m_interval_start = 0;
+}
+
+template<typename T>
+void threadpool<T>::adjust(long long now)
+{
+    if(!m_adaptive || now - m_interval_start < m_interval)
+    {
+        return;
+    }
+
+    long long busy = 0;
+    for(int i = 0; i < MAX_THREADS; ++i)
+    {
+        busy += m_workers[i].busy_us.load(std::memory_order_relaxed);
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    long long cpu = (long long)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 +
+                    usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+
+    long long elapsed = now - m_interval_start;
+    long long busy_delta = busy - m_interval_busy;
+    long long cpu_delta = cpu - m_interval_cpu;
+    bool first = m_interval_start == 0;
+    m_interval_start = now;
+    m_interval_busy = busy;
+    m_interval_cpu = cpu;
+    long long min_wait = m_min_wait.exchange(LLONG_MAX);
+    long dequeued = m_dequeued.exchange(0);
+    if(first)
+    {
+        return;
+    }
+
+    /* 线程平均的忙碌比例和进程占用的 CPU 比例，单位为百分之一 */
+    long long capacity = elapsed * 1000 * m_thread_number;
+    int busy_pct = capacity > 0 ? (int)(busy_delta * 100 / capacity) : 0;
+    static const long cpus = sysconf(_SC_NPROCESSORS_ONLN) > 0 ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+    int cpu_pct = (int)(cpu_delta * 100 / (elapsed * 1000 * cpus));
+
+    /* 周期内没有请求出队但有可以处理的请求，说明所有线程都被阻塞，同样视为积压 */
+    bool standing = min_wait > m_target_delay;
+    if(dequeued == 0)
+    {
+        m_queuelocker.lock();
+        standing = runnable();
         m_queuelocker.unlock();
-        if(!request)
+    }
+
+    if(standing && m_thread_number < m_max_threads && cpu_pct < 90)
+    {
+        if(spawn())
+        {
+            LOG_INFO("[threadpool] queue delay %lld us, busy %d%%, cpu %d%%, grow to %d threads\n",
+                        dequeued > 0 ? min_wait : -1, busy_pct, cpu_pct, m_thread_number);
+        }
+    }
+    else if(!standing && busy_pct < 25 && m_thread_number > m_min_threads)
+    {
+        /* 让一个线程退出：唤醒空闲线程，第一个看到退出请求的结束 */
+        m_queuelocker.lock();
+        m_retire.fetch_add(1);
+        m_queuecond.broadcast();
+        m_queuelocker.unlock();
+        --m_thread_number;
+        LOG_INFO("[threadpool] busy %d%%, shrink to %d threads\n", busy_pct, m_thread_number);
+    }
+}
+
+template<typename T>
+void threadpool<T>::log_stats()
+{
+    for(int i = 0; i < MAX_THREADS; ++i)
+    {
+        worker_slot& w = m_workers[i];
+        if(w.requests.load(std::memory_order_relaxed) == 0 && !w.active)
         {
             continue;
         }
-        connectionRAII mysqlcon(&request->mysql, m_connPool);
+        LOG_INFO("[threadpool] worker %d%s: %ld requests, busy %lld ms, idle %lld ms\n", i,
+                    w.active ? "" : " (exited)", w.requests.load(std::memory_order_relaxed),
+                    w.busy_us.load(std::memory_order_relaxed) / 1000,
+                    w.idle_us.load(std::memory_order_relaxed) / 1000);
+    }
+
+    m_queuelocker.lock();
+    for(int i = 0; i < m_lane_count; ++i)
+    {
+        lane& l = m_lanes[i];
+        LOG_INFO("[threadpool] lane %s: %ld requests, %d queued, %d running, "
+                    "wait avg %lld us max %lld us\n", l.name, l.served, (int)l.queue.size(),
+                    l.running, l.served ? l.wait_us / l.served : 0, l.max_wait_us);
+    }
+    m_queuelocker.unlock();
+}
+
+template<typename T>
+void* threadpool<T>::worker(void* arg)
+{
+    worker_slot* slot = (worker_slot*) arg;
+    threadpool* pool = slot->pool;
+    pool->run(slot->index);
+    return pool;
+}
+
+template<typename T>
+void threadpool<T>::run(int index)
+{
+    worker_slot& self = m_workers[index];
+    if(m_pinned)
+    {
+        cpu_topology::get_instance()->bind_self(m_cpus);
+    }
+    while (true)
+    {
+        /* 等待可以处理的请求，等待的时间计为空闲 */
+        long long wait_start = now_us();
+        m_queuelocker.lock();
+        int picked;
+        while ((picked = pick_lane()) < 0)
+        {
+            /* 自适应调节要求减少线程，本线程退出 */
+            if(m_stop || m_retire.load() > 0)
+            {
+                if(!m_stop)
+                {
+                    m_retire.fetch_sub(1);
+                }
+                m_queuelocker.unlock();
+                self.active = false;
+                return;
+            }
+            m_queuecond.wait(m_queuelocker);
+        }
+
+        lane& l = m_lanes[picked];
+        task t = l.queue.front();
+        l.queue.pop_front();
+        --m_queued;
+        ++l.running;
+
+        long long start = now_us();
+        long long wait = start - t.enqueued;
+        ++l.served;
+        l.wait_us += wait;
+        if(wait > l.max_wait_us)
+        {
+            l.max_wait_us = wait;
+        }
+        m_queuelocker.unlock();
+        T* request = t.request;
+
+        self.idle_us.fetch_add(start - wait_start, std::memory_order_relaxed);
+        server_metrics::queue_wait.observe(wait);
+        if(l.max_running == 0)
+        {
+            long long min_wait = m_min_wait.load(std::memory_order_relaxed);
+            while (wait < min_wait && !m_min_wait.compare_exchange_weak(min_wait, wait))
+            {
+            }
+            m_dequeued.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        if(request)
+        {
+            if(l.use_db)
+            {
+                connectionRAII mysqlcon(&request->mysql, m_connPool);
+                request->process();
+            }
+            else
+            {
+                request->process();
+            }
+        }
+
+        m_queuelocker.lock();
+        --l.running;
+        /* 受限通道空出了名额，唤醒可能因它已满而等待的线程 */
+        if(l.max_running > 0 && !l.queue.empty())
+        {
+            m_queuecond.signal();
+        }
+        m_queuelocker.unlock();
 
-        request->process();
+        long long service = now_us() - start;
+        self.busy_us.fetch_add(service, std::memory_order_relaxed);
+        self.requests.fetch_add(1, std::memory_order_relaxed);
+        server_metrics::service_time.observe(service);
+        server_metrics::worker_busy.add(service);
     }
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,80 @@
+#include <string.h>
+
+#include "coarse_clock.h"
+
+coarse_clock::coarse_clock() : m_mono_ms(0), m_wall_sec(0), m_seq(0)
+{
+    memset(&m_snap, '\0', sizeof(m_snap));
+    m_snap.sec = -1;
+    update();
+}
+
+void coarse_clock::update()
+{
+    /* 顺序锁写端：序号先变为奇数，写完快照后再变为偶数 */
+    unsigned seq = m_seq.load(std::memory_order_relaxed);
+    m_seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    refresh(seq);
+}
+
+void coarse_clock::try_update()
+{
+    /* 用比较交换把序号从偶数变为奇数，成功的线程成为唯一的写者 */
+    unsigned seq = m_seq.load(std::memory_order_relaxed);
+    if((seq & 1) || !m_seq.compare_exchange_strong(seq, seq + 1, std::memory_order_relaxed))
+    {
+        return;
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+    refresh(seq);
+}
+
+void coarse_clock::refresh(unsigned seq)
+{
+    struct timespec mono, wall;
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    clock_gettime(CLOCK_REALTIME, &wall);
+
+    m_mono_ms.store((long long)mono.tv_sec * 1000 + mono.tv_nsec / 1000000,
+                    std::memory_order_relaxed);
+
+    m_snap.usec = wall.tv_nsec / 1000;
+    /* 秒数变化时才重新格式化字符串，每秒最多一次 localtime/gmtime */
+    if(wall.tv_sec != m_snap.sec)
+    {
+        struct tm gmt;
+        m_snap.sec = wall.tv_sec;
+        localtime_r(&wall.tv_sec, &m_snap.local);
+        gmtime_r(&wall.tv_sec, &gmt);
+        strftime(m_snap.timestamp, TIMESTAMP_LEN, "%Y-%m-%d %H:%M:%S", &m_snap.local);
+        strftime(m_snap.http_date, HTTP_DATE_LEN, "%a, %d %b %Y %H:%M:%S GMT", &gmt);
+    }
+
+    m_seq.store(seq + 2, std::memory_order_release);
+    m_wall_sec.store(wall.tv_sec, std::memory_order_relaxed);
+}
+
+void coarse_clock::timestamp(char* buf, struct tm* tm, long* usec) const
+{
+    unsigned seq;
+    do
+    {
+        seq = m_seq.load(std::memory_order_acquire);
+        memcpy(buf, m_snap.timestamp, TIMESTAMP_LEN);
+        *tm = m_snap.local;
+        *usec = m_snap.usec;
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((seq & 1) || seq != m_seq.load(std::memory_order_relaxed));
+}
+
+void coarse_clock::http_date(char* buf) const
+{
+    unsigned seq;
+    do
+    {
+        seq = m_seq.load(std::memory_order_acquire);
+        memcpy(buf, m_snap.http_date, HTTP_DATE_LEN);
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((seq & 1) || seq != m_seq.load(std::memory_order_relaxed));
+}
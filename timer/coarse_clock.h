@@ -0,0 +1,72 @@
+#ifndef COARSE_CLOCK_H
+#define COARSE_CLOCK_H
+
+#include <time.h>
+#include <atomic>
+
+/* 粗粒度时钟服务
+   由主循环每轮调用一次 update() 刷新，定时器、日志和 HTTP 响应头等热路径直接读取缓存值，
+   从而避免逐事件的 time()/gettimeofday() 调用以及逐行的 localtime() 调用 */
+class coarse_clock
+{
+public:
+    /* "YYYY-MM-DD HH:MM:SS" 的长度（含 \0）*/
+    static const int TIMESTAMP_LEN = 20;
+    /* "Sun, 06 Nov 1994 08:49:37 GMT" 的长度（含 \0）*/
+    static const int HTTP_DATE_LEN = 30;
+
+public:
+    static coarse_clock* get_instance()
+    {
+        static coarse_clock instance;
+        return &instance;
+    }
+
+    /* 刷新缓存时间，只允许一个线程（主循环）调用 */
+    void update();
+    /* 多个线程各自驱动事件循环时使用（协程引擎）：其他线程正在刷新时直接返回 */
+    void try_update();
+
+    /* 单调时间，单位毫秒，用于定时器 */
+    long long now_ms() const
+    {
+        return m_mono_ms.load(std::memory_order_relaxed);
+    }
+
+    /* 墙上时间，单位秒 */
+    time_t now() const
+    {
+        return m_wall_sec.load(std::memory_order_relaxed);
+    }
+
+    /* 读取预先格式化好的秒级时间戳，以及对应的本地时间和微秒部分 */
+    void timestamp(char* buf, struct tm* tm, long* usec) const;
+
+    /* 读取缓存的 HTTP Date 头的值 */
+    void http_date(char* buf) const;
+
+private:
+    coarse_clock();
+    ~coarse_clock() { }
+
+    /* 已经持有顺序锁（序号为奇数 seq + 1）时写入快照 */
+    void refresh(unsigned seq);
+
+private:
+    /* 一次刷新发布的墙上时间快照，读写通过 m_seq 顺序锁保护 */
+    struct snapshot
+    {
+        time_t sec;
+        long usec;
+        struct tm local;
+        char timestamp[TIMESTAMP_LEN];
+        char http_date[HTTP_DATE_LEN];
+    };
+
+    std::atomic<long long> m_mono_ms;   /* 单调时间（毫秒） */
+    std::atomic<time_t> m_wall_sec;     /* 墙上时间（秒） */
+    std::atomic<unsigned> m_seq;        /* 顺序锁序号，奇数表示正在写 */
+    snapshot m_snap;
+};
+
+#endif
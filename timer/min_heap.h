@@ -4,6 +4,7 @@
 #include <iostream>
 #include <netinet/in.h>
 #include <time.h>
+#include "coarse_clock.h"
 using std::exception;
 
 /* 前向声明 */
@@ -18,23 +19,29 @@ struct clinet_data
     int sockfd;
     /* 定时器 */
     heap_timer* timer;
+    /* 所属的连接对象 */
+    void* conn;
 };
 
-/* 定时器类 */
+/* 定时器类
+   定时器由使用者持有（通常内嵌在连接对象中），时间堆只保存指针，不负责释放 */
 class heap_timer
 {
 public:
-    heap_timer(int delay)
+    /* delay 单位为毫秒 */
+    heap_timer(int delay = 0) : cb_func(NULL), user_data(NULL), index(-1)
     {
-        expire = time(NULL) + delay;
+        expire = coarse_clock::get_instance()->now_ms() + delay;
     }
 public:
-    /* 定时器生效的绝对时间 */
-    time_t expire;
+    /* 定时器生效的绝对时间，单调时钟，单位毫秒 */
+    long long expire;
     /* 定时器的回调函数 */
     void (*cb_func)(clinet_data*);
     /* 用户数据 */
     clinet_data* user_data;
+    /* 在堆数组中的下标，不在堆中时为 -1 */
+    int index;
 };
 
 /* 时间堆类*/
@@ -78,6 +85,7 @@ public:
             for(int i = 0; i < size; ++i)
             {
                 array[i] = init_array[i];
+                array[i]->index = i;
             }
             for(int i = (cur_size - 1) / 2; i >= 0; --i)
             {
@@ -87,12 +95,12 @@ public:
         }
     }
 
-    /* 销毁时间堆 */
+    /* 销毁时间堆，定时器本身由使用者释放 */
     ~time_heap()
     {
         for(int i = 0; i < cur_size; ++i)
         {
-            delete array[i];
+            array[i]->index = -1;
         }
         delete [] array;
     }
@@ -101,7 +109,7 @@ public:
     /* 添加目标定时器 */
     void add_timer(heap_timer* timer)
     {
-        if(!timer)
+        if(!timer || timer->index >= 0)
         {
             return;
         }
@@ -110,32 +118,22 @@ public:
         {
             resize();
         }
-        /* hole 是新建空穴的位置 */
+        /* 在新建空穴处对从空穴到根节点的路径上所有节点执行上虑操作 */
         int hole = cur_size++;
-        int parent = 0;
-        /* 对从空穴到根节点的路径上所有节点执行上虑操作 */
-        for(; hole > 0; hole = parent)
-        {
-            parent = (hole - 1) / 2;
-            if(array[parent]->expire <= timer->expire)
-            {
-                break;
-            }
-            array[hole] = array[parent];
-        }
         array[hole] = timer;
+        percolate_up(hole);
     }
 
     /* 删除目标定时器 timer */
     void del_timer(heap_timer* timer)
     {
-        if(!timer)
+        if(!timer || timer->index < 0)
         {
             return;
         }
-        /* 仅将目标定时器的回调函数设置为空，即所谓的延迟销毁。
-            这将节省真正删除该定时器造成的开销，但容易使堆数组膨胀 */
-        timer->cb_func = NULL;
+        /* 定时器内嵌在会被复用的连接对象中，不能延迟销毁，
+            借助记录的下标直接将其从堆中移除，用最后一个元素填补空穴 */
+        remove(timer->index);
     }
 
     /* 获得堆顶部的定时器 */
@@ -155,13 +153,7 @@ public:
         {
             return;
         }
-        if(array[0])
-        {
-            delete array[0];
-            /* 将原来的堆顶元素替换为堆数组中最后一个元素 */
-            array[0] = array[--cur_size];
-            percolate_down(0);
-        }
+        remove(0);
     }
 
     /* 调整指定的定时器 */
@@ -172,61 +164,59 @@ public:
             return;
         }
 
-        int id = find(timer);
+        int id = timer->index;
         if(id < 0)
         {
             return;
         }
+        /* 不同阶段的期限长短不一，调整后的到期时间可能提前，也可能推迟 */
+        percolate_up(id);
         percolate_down(id);
     }
 
 
-    /* 查找指定的定时器 */
-    int find(heap_timer* timer)
-    {
-        if(!timer)
-        {
-            return -1;
-        }
-        for(int i = 0; i < cur_size; i++)
-        {
-            if(array[i] == timer)
-            {
-                return i;
-            }
-        }
-        return -1;
-    }
-
     void tick()
     {
-        heap_timer* tmp = array[0];
-        time_t cur = time(NULL);
+        long long cur = coarse_clock::get_instance()->now_ms();
         while (!empty())
         {
-            if(!tmp)
-            {
-                break;
-            }
+            heap_timer* tmp = array[0];
             /* 如果堆顶定时器没到期，则退出循环 */
             if(tmp->expire > cur)
             {
                 break;
             }
-            /* 否则执行堆顶定时器中的任务 */
-            if(array[0]->cb_func)
+            /* 先将堆顶定时器移出堆，回调中可以释放或重新添加该定时器 */
+            pop_timer();
+            if(tmp->cb_func)
             {
-                array[0]->cb_func(array[0]->user_data);
+                tmp->cb_func(tmp->user_data);
             }
-            /* 将堆顶元素删除，同时生成新的堆顶定时器 */
-            pop_timer();
-            tmp = array[0];
         } 
     }
 
     bool empty() const {return cur_size == 0;}
 
+    /* 堆中定时器的个数 */
+    int size() const {return cur_size;}
+
 private:
+    /* 移除第 hole 个定时器，用最后一个元素填补空穴后重新调整 */
+    void remove(int hole)
+    {
+        array[hole]->index = -1;
+        heap_timer* last = array[--cur_size];
+        array[cur_size] = NULL;
+        if(hole == cur_size)
+        {
+            return;
+        }
+        array[hole] = last;
+        last->index = hole;
+        percolate_up(hole);
+        percolate_down(last->index);
+    }
+
     /* 最小堆的下虑操作，它确保堆数组中以第 hole 个节点为根的子树拥有最小堆性质 */
     void percolate_down(int hole)
     {
@@ -243,6 +233,7 @@ private:
             if(array[child]->expire < temp->expire)
             {
                 array[hole] = array[child];
+                array[hole]->index = hole;
             }
             else
             {
@@ -250,6 +241,26 @@ private:
             }
         }
         array[hole] = temp;
+        temp->index = hole;
+    }
+
+    /* 最小堆的上虑操作，将第 hole 个节点沿到根节点的路径上移到合适位置 */
+    void percolate_up(int hole)
+    {
+        heap_timer* temp = array[hole];
+        int parent = 0;
+        for(; hole > 0; hole = parent)
+        {
+            parent = (hole - 1) / 2;
+            if(array[parent]->expire <= temp->expire)
+            {
+                break;
+            }
+            array[hole] = array[parent];
+            array[hole]->index = hole;
+        }
+        array[hole] = temp;
+        temp->index = hole;
     }
 
     /* 将堆数组容量扩大 1 倍 */
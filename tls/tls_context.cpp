@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <string.h>
+#include <openssl/err.h>
+
+#include "tls_context.h"
+#include "../log/log.h"
+#include "../stats/metrics.h"
+
+/* 会话缓存按该标识区分不同的服务，恢复时客户端提交的会话必须属于同一标识 */
+static const unsigned char session_id_context[] = "tinywebserver";
+
+/* ALPN 协议列表（长度前缀的字符串），按优先顺序排列 */
+static const unsigned char alpn_h2[] = "\x02h2\x08http/1.1";
+static const unsigned char alpn_http1[] = "\x08http/1.1";
+
+tls_context::~tls_context()
+{
+    if(m_ctx)
+    {
+        SSL_CTX_free(m_ctx);
+    }
+}
+
+bool tls_context::kernel_tls_available()
+{
+    FILE* fp = fopen("/proc/sys/net/ipv4/tcp_available_ulp", "r");
+    if(!fp)
+    {
+        return false;
+    }
+    char ulp[256] = {0};
+    bool found = fgets(ulp, sizeof(ulp), fp) && strstr(ulp, "tls") != NULL;
+    fclose(fp);
+    return found;
+}
+
+int tls_context::select_alpn(SSL*, const unsigned char** out, unsigned char* outlen,
+                                const unsigned char* in, unsigned int inlen, void* arg)
+{
+    const unsigned char* protos = (const unsigned char*)arg;
+    unsigned int len = protos == alpn_h2 ? sizeof(alpn_h2) - 1 : sizeof(alpn_http1) - 1;
+    if(SSL_select_next_proto((unsigned char**)out, outlen, protos, len, in, inlen) != OPENSSL_NPN_NEGOTIATED)
+    {
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+    return SSL_TLSEXT_ERR_OK;
+}
+
+bool tls_context::init(const char* cert, const char* key, int cache_size, int session_timeout,
+                        bool tickets, bool ktls, bool http2)
+{
+    m_ctx = SSL_CTX_new(TLS_server_method());
+    if(!m_ctx)
+    {
+        printf("tls: cannot create SSL_CTX\n");
+        ERR_print_errors_fp(stdout);
+        return false;
+    }
+    SSL_CTX_set_min_proto_version(m_ctx, TLS1_2_VERSION);
+
+    if(SSL_CTX_use_certificate_chain_file(m_ctx, cert) != 1)
+    {
+        printf("tls: cannot load certificate %s\n", cert);
+        ERR_print_errors_fp(stdout);
+        return false;
+    }
+    if(SSL_CTX_use_PrivateKey_file(m_ctx, key, SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(m_ctx) != 1)
+    {
+        printf("tls: cannot load private key %s\n", key);
+        ERR_print_errors_fp(stdout);
+        return false;
+    }
+
+    /* 对方不发 close_notify 直接断开按正常关闭处理，浏览器大多如此 */
+    long options = SSL_OP_NO_RENEGOTIATION | SSL_OP_IGNORE_UNEXPECTED_EOF |
+                    SSL_OP_CIPHER_SERVER_PREFERENCE;
+    if(!tickets)
+    {
+        options |= SSL_OP_NO_TICKET;
+    }
+    m_ktls = ktls;
+#ifdef SSL_OP_ENABLE_KTLS
+    if(m_ktls)
+    {
+        options |= SSL_OP_ENABLE_KTLS;
+    }
+#else
+    m_ktls = false;
+#endif
+    SSL_CTX_set_options(m_ctx, options);
+
+    /* 部分写入：SSL_write 每写出一条记录就可以返回，与 writev 的语义一致；
+        重试时的缓冲区地址可以不同，连接可能换到另一个工作线程上继续发送；
+        空闲的保活连接释放 OpenSSL 内部的读写缓冲区 */
+    SSL_CTX_set_mode(m_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER |
+                            SSL_MODE_RELEASE_BUFFERS);
+
+    /* 客户端经 ALPN 选择 h2 后直接以 HTTP/2 的连接前言开始，由 http_conn 识别 */
+    SSL_CTX_set_alpn_select_cb(m_ctx, select_alpn, (void*)(http2 ? alpn_h2 : alpn_http1));
+
+    SSL_CTX_set_session_id_context(m_ctx, session_id_context, sizeof(session_id_context) - 1);
+    SSL_CTX_set_timeout(m_ctx, session_timeout);
+    if(cache_size > 0)
+    {
+        SSL_CTX_set_session_cache_mode(m_ctx, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_sess_set_cache_size(m_ctx, cache_size);
+    }
+    else
+    {
+        SSL_CTX_set_session_cache_mode(m_ctx, SSL_SESS_CACHE_OFF);
+    }
+
+    if(m_ktls && !kernel_tls_available())
+    {
+        LOG_WARN("[tls] kernel TLS unavailable (load the tls module), records are encrypted in user space\n");
+    }
+    LOG_INFO("[tls] %s, session cache %d, tickets %s, ktls %s, alpn %s\n", OpenSSL_version(OPENSSL_VERSION),
+                cache_size, tickets ? "on" : "off", m_ktls ? "on" : "off", http2 ? "h2,http/1.1" : "http/1.1");
+    return true;
+}
+
+SSL* tls_context::new_ssl(int fd)
+{
+    SSL* ssl = SSL_new(m_ctx);
+    if(!ssl)
+    {
+        ERR_clear_error();
+        return NULL;
+    }
+    SSL_set_fd(ssl, fd);
+    SSL_set_accept_state(ssl);
+    return ssl;
+}
+
+bool tls_context::established(SSL* ssl)
+{
+    if(SSL_session_reused(ssl))
+    {
+        server_metrics::tls_resumed.add();
+    }
+    else
+    {
+        server_metrics::tls_full_handshakes.add();
+    }
+
+    bool ktls_tx = false;
+#ifdef BIO_get_ktls_send
+    ktls_tx = m_ktls && BIO_get_ktls_send(SSL_get_wbio(ssl));
+#endif
+    if(ktls_tx)
+    {
+        server_metrics::tls_ktls.add();
+    }
+    return ktls_tx;
+}
+
+void tls_context::failed()
+{
+    server_metrics::tls_failed.add();
+}
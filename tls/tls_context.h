@@ -0,0 +1,49 @@
+#ifndef TLS_CONTEXT_H
+#define TLS_CONTEXT_H
+
+#include <openssl/ssl.h>
+
+/* TLS 服务端配置（SSL_CTX），所有 TLS 连接共用
+   会话恢复有两种方式，都在这里配置：服务端会话缓存按会话 ID 查找，会话票据把加密的会话状态交给客户端保存，
+   服务端不必存储。票据密钥由 OpenSSL 在启动时随机生成，重启后旧票据失效，客户端退回完整握手。
+   开启 kTLS 时，握手完成后 OpenSSL 把记录层的加解密交给内核（需要加载内核的 tls 模块），
+   之后应答可以直接 writev 到 socket，由内核加密，见 tls_transport.h */
+class tls_context
+{
+public:
+    static tls_context* get_instance()
+    {
+        static tls_context instance;
+        return &instance;
+    }
+
+    /* 加载证书链和私钥并配置会话缓存、会话票据、kTLS 和 ALPN，出错时打印原因并返回 false。
+        cache_size 为服务端会话缓存的容量，0 表示不缓存；session_timeout 为会话的有效期（秒）；
+        http2 为 true 时 ALPN 优先协商 h2 */
+    bool init(const char* cert, const char* key, int cache_size, int session_timeout,
+                bool tickets, bool ktls, bool http2);
+
+    /* 为新接受的连接创建服务端 SSL 对象，失败返回 NULL */
+    SSL* new_ssl(int fd);
+    /* 握手完成后调用，记录统计，返回发送方向是否已交给内核加密 */
+    bool established(SSL* ssl);
+    /* 握手失败后调用，记录统计 */
+    void failed();
+
+private:
+    tls_context() : m_ctx(NULL), m_ktls(false) { }
+    ~tls_context();
+    tls_context(const tls_context&);
+    tls_context& operator=(const tls_context&);
+
+    /* 内核是否支持 TLS 上层协议，不支持时 kTLS 不会生效 */
+    static bool kernel_tls_available();
+    /* ALPN 回调：按服务端的顺序选出双方都支持的协议，没有共同的协议时不协商 */
+    static int select_alpn(SSL* ssl, const unsigned char** out, unsigned char* outlen,
+                            const unsigned char* in, unsigned int inlen, void* arg);
+
+    SSL_CTX* m_ctx;
+    bool m_ktls;
+};
+
+#endif
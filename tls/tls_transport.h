@@ -0,0 +1,280 @@
+#ifndef TLS_TRANSPORT_H
+#define TLS_TRANSPORT_H
+
+#include <errno.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <vector>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+#include "tls_context.h"
+#include "../http/transport.h"
+#include "../stats/syscall_stats.h"
+
+/* TLS 传输层
+   事件注册和 socket 的关闭交给同一触发模式的 socket_transport，这里只在收发时加解密，http_conn 的读写流程不变。
+   握手在第一次 recv 时开始，未完成时 recv 返回 EAGAIN，等下一个读事件继续；握手完成后在同一次 recv 中继续读出
+   随握手一起到达的请求数据。握手需要写而发送缓冲区已满的情况只在新连接上出现，几乎不会发生，不单独等待写事件，
+   由客户端后续的数据或请求头超时推进。
+   发送方向已交给内核 TLS 时，writev 直接写 socket，文件内容从 mmap 的页面直接交给内核加密，不经过 OpenSSL 的缓冲区。
+   每个连接的状态按 fd 索引，同一时刻只有占有连接的线程访问，不需要加锁 */
+template <trigger_mode M>
+class tls_transport : public transport
+{
+public:
+    static tls_transport* get_instance()
+    {
+        static tls_transport instance;
+        return &instance;
+    }
+
+    /* 连接 fd 的上限，连接状态按 fd 预先分配 */
+    void init(int max_fd) { m_conns.assign(max_fd, tls_conn()); }
+
+    void attach(int fd, void* owner);
+    void rearm(int fd, void* owner, int ev) { m_socket->rearm(fd, owner, ev); }
+    ssize_t recv(int fd, char* buf, size_t len);
+    ssize_t writev(int fd, const struct iovec* iov, int count);
+    void send_nowait(int fd, const char* buf, size_t len);
+    void close(int fd);
+
+private:
+    /* 单条 TLS 记录的最大明文长度，小块数据合并到一条记录中发送 */
+    static const size_t RECORD_SIZE = 16384;
+
+    struct tls_conn
+    {
+        SSL* ssl;
+        bool established;   /* 握手已完成 */
+        bool broken;        /* 出现过协议或系统错误，关闭时不再发送 close_notify */
+        bool ktls_tx;       /* 发送方向由内核加密 */
+
+        tls_conn() : ssl(NULL), established(false), broken(false), ktls_tx(false) { }
+    };
+
+    tls_transport() : m_socket(socket_transport<M>::get_instance()) { }
+
+    bool handshake(tls_conn& c);
+    /* SSL_read/SSL_write 失败后按 SSL 的错误设置 errno：需要等待时为 EAGAIN，否则为 ECONNRESET */
+    static void set_errno(tls_conn& c, int ret);
+
+    socket_transport<M>* m_socket;
+    std::vector<tls_conn> m_conns;
+};
+
+template <trigger_mode M>
+void tls_transport<M>::attach(int fd, void* owner)
+{
+    tls_conn& c = m_conns[fd];
+    c = tls_conn();
+    c.ssl = tls_context::get_instance()->new_ssl(fd);
+    m_socket->attach(fd, owner);
+}
+
+template <trigger_mode M>
+void tls_transport<M>::set_errno(tls_conn& c, int ret)
+{
+    int err = SSL_get_error(c.ssl, ret);
+    if(err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE)
+    {
+        errno = EAGAIN;
+        return;
+    }
+    c.broken = err != SSL_ERROR_ZERO_RETURN;
+    ERR_clear_error();
+    errno = ECONNRESET;
+}
+
+template <trigger_mode M>
+bool tls_transport<M>::handshake(tls_conn& c)
+{
+    ERR_clear_error();
+    int ret = SSL_do_handshake(c.ssl);
+    COUNT_SYSCALL(RECV);
+    if(ret == 1)
+    {
+        c.established = true;
+        c.ktls_tx = tls_context::get_instance()->established(c.ssl);
+        return true;
+    }
+    set_errno(c, ret);
+    if(errno != EAGAIN)
+    {
+        tls_context::get_instance()->failed();
+    }
+    return false;
+}
+
+template <trigger_mode M>
+ssize_t tls_transport<M>::recv(int fd, char* buf, size_t len)
+{
+    tls_conn& c = m_conns[fd];
+    if(!c.ssl)
+    {
+        errno = ECONNRESET;
+        return -1;
+    }
+    if(!c.established && !handshake(c))
+    {
+        return -1;
+    }
+
+    /* 一次 SSL_read 最多取出一条记录，记录中剩余的明文留在 OpenSSL 内部，socket 上不会再有读事件，
+        所以要读到没有剩余明文或缓冲区已满为止 */
+    size_t total = 0;
+    while (total < len)
+    {
+        ERR_clear_error();
+        int n = SSL_read(c.ssl, buf + total, len - total > INT_MAX ? INT_MAX : (int)(len - total));
+        COUNT_SYSCALL(RECV);
+        if(n > 0)
+        {
+            total += n;
+            if(SSL_pending(c.ssl) == 0)
+            {
+                break;
+            }
+            continue;
+        }
+        /* 先交出已读到的数据，错误留到下一次调用 */
+        if(total > 0)
+        {
+            break;
+        }
+        if(SSL_get_error(c.ssl, n) == SSL_ERROR_ZERO_RETURN)
+        {
+            return 0;
+        }
+        set_errno(c, n);
+        return -1;
+    }
+    return total;
+}
+
+template <trigger_mode M>
+ssize_t tls_transport<M>::writev(int fd, const struct iovec* iov, int count)
+{
+    tls_conn& c = m_conns[fd];
+    if(!c.ssl || !c.established)
+    {
+        errno = ECONNRESET;
+        return -1;
+    }
+    if(c.ktls_tx)
+    {
+        return m_socket->writev(fd, iov, count);
+    }
+
+    /* 应答头和正文的开头合并成一条整记录，正文中的整块直接交给 SSL_write，不再复制。
+        SSL_write 失败后调用者会从同一位置重试，分块方式只取决于位置，重试时的数据与上次相同 */
+    static thread_local char record[RECORD_SIZE];
+    ssize_t total = 0;
+    int i = 0;
+    size_t off = 0;
+    while (i < count)
+    {
+        if(off == iov[i].iov_len)
+        {
+            ++i;
+            off = 0;
+            continue;
+        }
+
+        const char* data = (const char*)iov[i].iov_base + off;
+        size_t size = iov[i].iov_len - off;
+        if(size < RECORD_SIZE && i + 1 < count)
+        {
+            size = 0;
+            for(int j = i; j < count && size < RECORD_SIZE; ++j)
+            {
+                size_t from = j == i ? off : 0;
+                size_t n = iov[j].iov_len - from;
+                if(n > RECORD_SIZE - size)
+                {
+                    n = RECORD_SIZE - size;
+                }
+                memcpy(record + size, (const char*)iov[j].iov_base + from, n);
+                size += n;
+            }
+            data = record;
+        }
+        else if(size > INT_MAX)
+        {
+            size = INT_MAX;
+        }
+
+        ERR_clear_error();
+        int n = SSL_write(c.ssl, data, (int)size);
+        COUNT_SYSCALL(WRITEV);
+        if(n <= 0)
+        {
+            if(total > 0)
+            {
+                return total;
+            }
+            set_errno(c, n);
+            return -1;
+        }
+
+        total += n;
+        size_t left = n;
+        while (left > 0)
+        {
+            size_t step = iov[i].iov_len - off;
+            if(left < step)
+            {
+                off += left;
+                break;
+            }
+            left -= step;
+            ++i;
+            off = 0;
+        }
+    }
+    return total;
+}
+
+template <trigger_mode M>
+void tls_transport<M>::send_nowait(int fd, const char* buf, size_t len)
+{
+    tls_conn& c = m_conns[fd];
+    /* 握手完成之前无法发送应答 */
+    if(!c.ssl || !c.established)
+    {
+        return;
+    }
+    if(c.ktls_tx)
+    {
+        m_socket->send_nowait(fd, buf, len);
+        return;
+    }
+    ERR_clear_error();
+    SSL_write(c.ssl, buf, (int)len);
+    COUNT_SYSCALL(WRITEV);
+    ERR_clear_error();
+}
+
+template <trigger_mode M>
+void tls_transport<M>::close(int fd)
+{
+    tls_conn& c = m_conns[fd];
+    if(c.ssl)
+    {
+        /* 尽力发送 close_notify，不等待对方的回应 */
+        if(c.established && !c.broken)
+        {
+            ERR_clear_error();
+            SSL_shutdown(c.ssl);
+            COUNT_SYSCALL(WRITEV);
+        }
+        ERR_clear_error();
+        SSL_free(c.ssl);
+        c.ssl = NULL;
+    }
+    m_socket->close(fd);
+}
+
+#endif
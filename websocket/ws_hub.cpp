@@ -0,0 +1,93 @@
+#include "ws_hub.h"
+#include "../stats/metrics.h"
+
+bool ws_hub::m_relay = false;
+
+void ws_hub::subscribe(ws_session* s)
+{
+    m_lock.lock();
+    s->m_hub_slot = (int)m_subscribers.size();
+    m_subscribers.push_back(s);
+    m_lock.unlock();
+}
+
+void ws_hub::unsubscribe(ws_session* s)
+{
+    m_lock.lock();
+    int slot = s->m_hub_slot;
+    if(slot >= 0)
+    {
+        /* 与最后一个订阅者交换后删除 */
+        ws_session* last = m_subscribers.back();
+        m_subscribers[slot] = last;
+        last->m_hub_slot = slot;
+        m_subscribers.pop_back();
+        s->m_hub_slot = -1;
+    }
+    m_lock.unlock();
+}
+
+size_t ws_hub::broadcast(int opcode, const char* data, size_t len, const ws_session* except)
+{
+    ws_message* msg = ws_message::frame(opcode, data, len);
+    /* 本线程占有成功的订阅者，锁外再写出 */
+    std::vector<http_conn*> acquired;
+    size_t delivered = 0;
+
+    m_lock.lock();
+    acquired.reserve(m_subscribers.size());
+    for(size_t i = 0; i < m_subscribers.size(); ++i)
+    {
+        ws_session* s = m_subscribers[i];
+        if(s == except)
+        {
+            continue;
+        }
+        msg->ref();
+        if(s->deliver(msg))
+        {
+            ++delivered;
+        }
+        else
+        {
+            /* 收件箱已满，连接作为慢速订阅者关闭，写事件的处理者看到积压超限后关闭连接 */
+            msg->unref();
+        }
+        /* 先记录事件再尝试占有，与主线程转发 epoll 事件的顺序相同，占有者释放时不会漏掉 */
+        http_conn* conn = s->conn();
+        conn->post_event(http_conn::EV_WRITE);
+        if(conn->try_acquire())
+        {
+            acquired.push_back(conn);
+        }
+    }
+    m_lock.unlock();
+
+    /* 编码时的引用，所有收件箱都已持有各自的引用 */
+    msg->unref();
+
+    /* 占有期间连接不会被关闭，也就不会退订，锁外访问是安全的 */
+    for(size_t i = 0; i < acquired.size(); ++i)
+    {
+        acquired[i]->flush_broadcast();
+    }
+    server_metrics::ws_broadcasts.add();
+    return delivered;
+}
+
+void ws_hub::on_message(ws_session* from, int opcode, const char* data, size_t len)
+{
+    server_metrics::ws_messages.add();
+    if(m_relay)
+    {
+        broadcast(opcode, data, len, from);
+    }
+}
+
+size_t ws_hub::size()
+{
+    m_lock.lock();
+    size_t n = m_subscribers.size();
+    m_lock.unlock();
+    return n;
+}
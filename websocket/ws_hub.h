@@ -0,0 +1,48 @@
+#ifndef WS_HUB_H
+#define WS_HUB_H
+
+#include <stddef.h>
+#include <vector>
+
+#include "ws_session.h"
+#include "../lock/locker.h"
+
+/* WebSocket 订阅者表和广播
+   升级完成的连接都订阅在这里，关闭时退订。broadcast 把消息编码成一个 ws_message，
+   持锁依次放入每个订阅者的收件箱并记录写事件，然后尝试占有订阅者连接：
+   占有成功的在锁外由广播线程直接写出（立即发送模式）或交还给主线程写出，
+   占有失败说明连接正由其他线程处理，占有者释放前会看到写事件，由它写出。
+   锁内只有入队和原子操作，不做系统调用，一万个订阅者的广播持锁时间在毫秒以内 */
+class ws_hub
+{
+public:
+    static ws_hub* get_instance()
+    {
+        static ws_hub instance;
+        return &instance;
+    }
+
+    /* 客户端发来的数据消息是否转发给其他所有订阅者 */
+    static bool m_relay;
+
+    /* 由占有连接的线程调用 */
+    void subscribe(ws_session* s);
+    void unsubscribe(ws_session* s);
+
+    /* 把一个消息广播给所有订阅者，except 不为 NULL 时跳过它（通常是消息的发送者，调用者正占有它），
+        返回送达的订阅者数。任意线程可调用 */
+    size_t broadcast(int opcode, const char* data, size_t len, const ws_session* except = NULL);
+    /* 订阅者发来一个完整的数据消息，由占有该连接的线程调用 */
+    void on_message(ws_session* from, int opcode, const char* data, size_t len);
+
+    /* 当前订阅者数 */
+    size_t size();
+
+private:
+    ws_hub() : m_lock("ws_hub") { }
+
+    futex_mutex m_lock;
+    std::vector<ws_session*> m_subscribers;
+};
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef WS_MESSAGE_H
+#define WS_MESSAGE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include <atomic>
+
+/* 编码好的一个 WebSocket 帧（或握手应答等原样发送的字节），带引用计数。
+   广播时消息只编码一次，每个订阅者的发送队列各持有一个引用，writev 的 iovec 直接指向这里的字节，
+   最后一个发送完的连接释放它。帧头和载荷与对象头在同一块内存中，一次 malloc */
+class ws_message
+{
+public:
+    /* 服务端发出的帧不加掩码，FIN 置位 */
+    static ws_message* frame(int opcode, const char* payload, size_t len)
+    {
+        char header[10];
+        size_t hlen = 2;
+        header[0] = (char)(0x80 | (opcode & 0x0f));
+        if(len < 126)
+        {
+            header[1] = (char)len;
+        }
+        else if(len <= 0xffff)
+        {
+            header[1] = 126;
+            header[2] = (char)(len >> 8);
+            header[3] = (char)len;
+            hlen = 4;
+        }
+        else
+        {
+            header[1] = 127;
+            for(int i = 0; i < 8; ++i)
+            {
+                header[2 + i] = (char)((uint64_t)len >> (56 - 8 * i));
+            }
+            hlen = 10;
+        }
+        ws_message* m = alloc(hlen + len);
+        memcpy(m->m_data, header, hlen);
+        if(len > 0)
+        {
+            memcpy(m->m_data + hlen, payload, len);
+        }
+        return m;
+    }
+
+    /* 原样发送的字节 */
+    static ws_message* raw(const char* data, size_t len)
+    {
+        ws_message* m = alloc(len);
+        memcpy(m->m_data, data, len);
+        return m;
+    }
+
+    void ref(int n = 1) { m_refs.fetch_add(n, std::memory_order_relaxed); }
+    void unref()
+    {
+        if(m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            this->~ws_message();
+            free(this);
+        }
+    }
+
+    const char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+private:
+    ws_message(size_t size) : m_refs(1), m_size(size), m_data((char*)(this + 1)) { }
+    ~ws_message() { }
+
+    static ws_message* alloc(size_t size)
+    {
+        void* p = malloc(sizeof(ws_message) + size);
+        if(!p)
+        {
+            throw std::bad_alloc();
+        }
+        return new (p) ws_message(size);
+    }
+
+    std::atomic<int> m_refs;
+    size_t m_size;
+    char* m_data;
+};
+
+#endif
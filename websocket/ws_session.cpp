@@ -0,0 +1,508 @@
+#include <string.h>
+#include <stdio.h>
+
+#include "ws_session.h"
+#include "ws_hub.h"
+#include "../timer/coarse_clock.h"
+#include "../stats/metrics.h"
+
+int ws_session::m_ping_interval = 30000;
+int ws_session::m_pong_timeout = 10000;
+size_t ws_session::m_max_backlog = 1048576;
+size_t ws_session::m_max_message = 65536;
+
+/* 握手时拼在 Sec-WebSocket-Key 之后求 SHA-1 的固定 GUID */
+static const char WS_GUID[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+static uint32_t rol(uint32_t v, int n)
+{
+    return (v << n) | (v >> (32 - n));
+}
+
+/* SHA-1（RFC 3174），只用于计算 Sec-WebSocket-Accept，不依赖 OpenSSL */
+static void sha1(const uint8_t* data, size_t len, uint8_t digest[20])
+{
+    uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    /* 补位：0x80、若干 0 和 64 位的消息比特数，凑成 64 字节的整数倍 */
+    size_t total = (len + 9 + 63) / 64 * 64;
+    std::string msg((const char*)data, len);
+    msg.resize(total, '\0');
+    msg[len] = (char)0x80;
+    uint64_t bits = (uint64_t)len * 8;
+    for(int i = 0; i < 8; ++i)
+    {
+        msg[total - 1 - i] = (char)(bits >> (8 * i));
+    }
+
+    for(size_t off = 0; off < total; off += 64)
+    {
+        const uint8_t* p = (const uint8_t*)msg.data() + off;
+        uint32_t w[80];
+        for(int i = 0; i < 16; ++i)
+        {
+            w[i] = ((uint32_t)p[4 * i] << 24) | ((uint32_t)p[4 * i + 1] << 16) |
+                    ((uint32_t)p[4 * i + 2] << 8) | p[4 * i + 3];
+        }
+        for(int i = 16; i < 80; ++i)
+        {
+            w[i] = rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+        }
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for(int i = 0; i < 80; ++i)
+        {
+            uint32_t f, k;
+            if(i < 20)
+            {
+                f = (b & c) | (~b & d);
+                k = 0x5A827999;
+            }
+            else if(i < 40)
+            {
+                f = b ^ c ^ d;
+                k = 0x6ED9EBA1;
+            }
+            else if(i < 60)
+            {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8F1BBCDC;
+            }
+            else
+            {
+                f = b ^ c ^ d;
+                k = 0xCA62C1D6;
+            }
+            uint32_t t = rol(a, 5) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = rol(b, 30);
+            b = a;
+            a = t;
+        }
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+    }
+
+    for(int i = 0; i < 5; ++i)
+    {
+        digest[4 * i] = (uint8_t)(h[i] >> 24);
+        digest[4 * i + 1] = (uint8_t)(h[i] >> 16);
+        digest[4 * i + 2] = (uint8_t)(h[i] >> 8);
+        digest[4 * i + 3] = (uint8_t)h[i];
+    }
+}
+
+static std::string base64_encode(const uint8_t* data, size_t len)
+{
+    static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    for(size_t i = 0; i < len; i += 3)
+    {
+        uint32_t v = (uint32_t)data[i] << 16;
+        if(i + 1 < len)
+            v |= (uint32_t)data[i + 1] << 8;
+        if(i + 2 < len)
+            v |= data[i + 2];
+        out.push_back(table[(v >> 18) & 0x3f]);
+        out.push_back(table[(v >> 12) & 0x3f]);
+        out.push_back(i + 1 < len ? table[(v >> 6) & 0x3f] : '=');
+        out.push_back(i + 2 < len ? table[v & 0x3f] : '=');
+    }
+    return out;
+}
+
+/* 文本消息必须是合法的 UTF-8：拒绝过长编码、代理区码点和超出 U+10FFFF 的码点 */
+static bool valid_utf8(const uint8_t* p, size_t len)
+{
+    size_t i = 0;
+    while (i < len)
+    {
+        uint8_t c = p[i];
+        if(c < 0x80)
+        {
+            ++i;
+            continue;
+        }
+        int n;
+        uint32_t cp;
+        if(c >= 0xc2 && c <= 0xdf)
+        {
+            n = 1;
+            cp = c & 0x1f;
+        }
+        else if(c >= 0xe0 && c <= 0xef)
+        {
+            n = 2;
+            cp = c & 0x0f;
+        }
+        else if(c >= 0xf0 && c <= 0xf4)
+        {
+            n = 3;
+            cp = c & 0x07;
+        }
+        else
+        {
+            return false;
+        }
+        if(i + n >= len)
+        {
+            return false;
+        }
+        for(int k = 1; k <= n; ++k)
+        {
+            if((p[i + k] & 0xc0) != 0x80)
+            {
+                return false;
+            }
+            cp = (cp << 6) | (p[i + k] & 0x3f);
+        }
+        if((n == 2 && (cp < 0x800 || (cp >= 0xd800 && cp <= 0xdfff))) ||
+            (n == 3 && (cp < 0x10000 || cp > 0x10ffff)))
+        {
+            return false;
+        }
+        i += n + 1;
+    }
+    return true;
+}
+
+ws_session::ws_session(http_conn* conn)
+    : m_conn(conn), m_message_op(0), m_last_active(coarse_clock::get_instance()->now_ms()), m_ping_sent(0),
+      m_front_off(0), m_queued(0), m_closing(false), m_overflow(false), m_inbox(INBOX_SIZE), m_hub_slot(-1)
+{
+}
+
+ws_session::~ws_session()
+{
+    /* 已从 ws_hub 退订，不会再有新消息放入收件箱 */
+    ws_message* msg;
+    while (m_inbox.try_pop(msg))
+    {
+        msg->unref();
+    }
+    for(size_t i = 0; i < m_out.size(); ++i)
+    {
+        m_out[i]->unref();
+    }
+}
+
+void ws_session::start(const char* key)
+{
+    std::string text(key);
+    text += WS_GUID;
+    uint8_t digest[20];
+    sha1((const uint8_t*)text.data(), text.size(), digest);
+
+    char response[160];
+    int len = snprintf(response, sizeof(response),
+                        "HTTP/1.1 101 Switching Protocols\r\n"
+                        "Upgrade: websocket\r\n"
+                        "Connection: Upgrade\r\n"
+                        "Sec-WebSocket-Accept: %s\r\n\r\n",
+                        base64_encode(digest, sizeof(digest)).c_str());
+    append(ws_message::raw(response, len));
+}
+
+bool ws_session::on_data(const char* data, size_t len)
+{
+    if(m_closing)
+    {
+        return false;
+    }
+    m_last_active = coarse_clock::get_instance()->now_ms();
+
+    /* 有不完整的帧时拼接到它后面，否则直接在读缓冲区上解析 */
+    const char* p = data;
+    size_t avail = len;
+    bool buffered = !m_in.empty();
+    if(buffered)
+    {
+        m_in.append(data, len);
+        p = m_in.data();
+        avail = m_in.size();
+    }
+
+    size_t off = 0;
+    bool ok = true;
+    std::string payload;
+    while (ok && avail - off >= 2)
+    {
+        const uint8_t* h = (const uint8_t*)p + off;
+        bool fin = (h[0] & 0x80) != 0;
+        int opcode = h[0] & 0x0f;
+        /* 没有协商扩展，RSV 位必须为 0；客户端发来的帧必须带掩码 */
+        if((h[0] & 0x70) != 0 || (h[1] & 0x80) == 0)
+        {
+            ok = fail(CLOSE_PROTOCOL_ERROR);
+            break;
+        }
+        uint64_t plen = h[1] & 0x7f;
+        size_t hlen = 2;
+        if(plen == 126)
+        {
+            hlen = 4;
+            if(avail - off < hlen)
+            {
+                break;
+            }
+            plen = ((uint64_t)h[2] << 8) | h[3];
+        }
+        else if(plen == 127)
+        {
+            hlen = 10;
+            if(avail - off < hlen)
+            {
+                break;
+            }
+            plen = 0;
+            for(int i = 0; i < 8; ++i)
+            {
+                plen = (plen << 8) | h[2 + i];
+            }
+        }
+        /* 控制帧不能分片，载荷不超过 125 字节 */
+        if((opcode & 0x8) && (!fin || plen > 125))
+        {
+            ok = fail(CLOSE_PROTOCOL_ERROR);
+            break;
+        }
+        /* 消息在收完之前就能判断是否超过上限，不必缓存整个超大的帧 */
+        if(!(opcode & 0x8) && (plen > m_max_message || m_message.size() + plen > m_max_message))
+        {
+            ok = fail(CLOSE_TOO_BIG);
+            break;
+        }
+        hlen += 4;
+        if(avail - off < hlen + plen)
+        {
+            break;
+        }
+
+        const uint8_t* mask = h + hlen - 4;
+        payload.assign((const char*)h + hlen, plen);
+        for(size_t i = 0; i < plen; ++i)
+        {
+            payload[i] ^= mask[i & 3];
+        }
+        off += hlen + plen;
+        ok = process_frame(fin, opcode, payload.data(), payload.size());
+    }
+
+    if(!ok)
+    {
+        std::string().swap(m_in);
+        return false;
+    }
+    if(buffered)
+    {
+        m_in.erase(0, off);
+    }
+    else
+    {
+        m_in.assign(p + off, avail - off);
+    }
+    return true;
+}
+
+bool ws_session::process_frame(bool fin, int opcode, const char* payload, size_t len)
+{
+    switch (opcode)
+    {
+    case OP_TEXT:
+    case OP_BINARY:
+    case OP_CONTINUATION:
+    {
+        /* 分片消息中间不能开始新消息，没有分片消息时不能出现延续帧 */
+        if((opcode == OP_CONTINUATION) != (m_message_op != 0))
+        {
+            return fail(CLOSE_PROTOCOL_ERROR);
+        }
+        if(opcode != OP_CONTINUATION)
+        {
+            m_message_op = opcode;
+        }
+        if(!fin)
+        {
+            m_message.append(payload, len);
+            return true;
+        }
+
+        /* 没有分片的消息直接使用帧的载荷，不经过 m_message */
+        const char* data = payload;
+        size_t size = len;
+        if(!m_message.empty())
+        {
+            m_message.append(payload, len);
+            data = m_message.data();
+            size = m_message.size();
+        }
+        if(m_message_op == OP_TEXT && !valid_utf8((const uint8_t*)data, size))
+        {
+            return fail(CLOSE_INVALID_DATA);
+        }
+        ws_hub::get_instance()->on_message(this, m_message_op, data, size);
+        m_message_op = 0;
+        m_message.clear();
+        return true;
+    }
+    case OP_PING:
+        send_control(OP_PONG, payload, len);
+        return true;
+    case OP_PONG:
+        m_ping_sent = 0;
+        return true;
+    case OP_CLOSE:
+    {
+        /* 回应对方的关闭帧，带状态码时原样回应；状态码之后的原因必须是合法的 UTF-8 */
+        uint16_t code = CLOSE_NORMAL;
+        if(len == 1 || (len > 2 && !valid_utf8((const uint8_t*)payload + 2, len - 2)))
+        {
+            return fail(CLOSE_PROTOCOL_ERROR);
+        }
+        if(len >= 2)
+        {
+            code = ((uint8_t)payload[0] << 8) | (uint8_t)payload[1];
+            /* 1005、1006、1015 等保留的状态码不能出现在关闭帧中 */
+            if(code < 1000 || (code > 1003 && code < 1007) || (code > 1014 && code < 3000) || code >= 5000)
+            {
+                return fail(CLOSE_PROTOCOL_ERROR);
+            }
+        }
+        send_close(code);
+        m_closing = true;
+        return false;
+    }
+    default:
+        return fail(CLOSE_PROTOCOL_ERROR);
+    }
+}
+
+bool ws_session::fail(CLOSE_CODE code)
+{
+    send_close(code);
+    m_closing = true;
+    return false;
+}
+
+void ws_session::send_control(int opcode, const char* payload, size_t len)
+{
+    append(ws_message::frame(opcode, payload, len));
+}
+
+void ws_session::send_close(uint16_t code)
+{
+    char payload[2] = { (char)(code >> 8), (char)code };
+    send_control(OP_CLOSE, payload, sizeof(payload));
+}
+
+int ws_session::close_frame(char* frame, uint16_t code) const
+{
+    frame[0] = (char)(0x80 | OP_CLOSE);
+    frame[1] = 2;
+    frame[2] = (char)(code >> 8);
+    frame[3] = (char)code;
+    return 4;
+}
+
+void ws_session::append(ws_message* msg)
+{
+    m_out.push_back(msg);
+    m_queued += msg->size();
+}
+
+bool ws_session::deliver(ws_message* msg)
+{
+    if(m_inbox.try_push(msg))
+    {
+        return true;
+    }
+    set_overflow();
+    return false;
+}
+
+void ws_session::set_overflow()
+{
+    if(!m_overflow.exchange(true))
+    {
+        server_metrics::ws_dropped.add();
+    }
+}
+
+bool ws_session::drain()
+{
+    ws_message* batch[32];
+    int n;
+    while ((n = m_inbox.pop_batch(batch, sizeof(batch) / sizeof(batch[0]))) > 0)
+    {
+        for(int i = 0; i < n; ++i)
+        {
+            /* 关闭帧之后不能再发送数据帧 */
+            if(m_closing)
+            {
+                batch[i]->unref();
+            }
+            else
+            {
+                append(batch[i]);
+            }
+        }
+    }
+    if(m_queued > m_max_backlog)
+    {
+        set_overflow();
+    }
+    return !m_overflow.load(std::memory_order_relaxed);
+}
+
+bool ws_session::ping(long long now)
+{
+    if(m_ping_sent != 0 || m_closing)
+    {
+        return false;
+    }
+    send_control(OP_PING, NULL, 0);
+    m_ping_sent = now;
+    return true;
+}
+
+long long ws_session::deadline() const
+{
+    if(m_ping_sent != 0)
+    {
+        return m_ping_sent + m_pong_timeout;
+    }
+    return m_last_active + m_ping_interval;
+}
+
+int ws_session::gather(struct iovec* iov, int max) const
+{
+    int n = 0;
+    for(size_t i = 0; i < m_out.size() && n < max; ++i, ++n)
+    {
+        size_t skip = i == 0 ? m_front_off : 0;
+        iov[n].iov_base = (char*)m_out[i]->data() + skip;
+        iov[n].iov_len = m_out[i]->size() - skip;
+    }
+    return n;
+}
+
+void ws_session::consume(size_t n)
+{
+    m_queued -= n;
+    while (n > 0)
+    {
+        ws_message* front = m_out.front();
+        size_t left = front->size() - m_front_off;
+        if(n < left)
+        {
+            m_front_off += n;
+            return;
+        }
+        n -= left;
+        m_front_off = 0;
+        m_out.pop_front();
+        front->unref();
+    }
+}
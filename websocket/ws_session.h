@@ -0,0 +1,139 @@
+#ifndef WS_SESSION_H
+#define WS_SESSION_H
+
+#include <stdint.h>
+#include <sys/uio.h>
+#include <atomic>
+#include <deque>
+#include <string>
+
+#include "ws_message.h"
+#include "../lock/ring_queue.h"
+#include "../http/http_conn.h"
+
+/* WebSocket 连接（RFC 6455）
+   HTTP/1.1 的 GET 请求带 Upgrade: websocket 且路径为 ws_path 时，http_conn 应答 101 后创建本对象，
+   之后该连接上读到的数据都交给 on_data 按帧处理，发出的帧由 gather/consume 写出。
+   客户端发来的帧必须带掩码，分片的消息拼接完整后交给 ws_hub；控制帧（ping/pong/close）在这里直接应答。
+   发送队列中的每一段都是一个带引用计数的 ws_message，广播的消息由所有订阅者共享同一份编码。
+   其他线程广播的消息先放入无锁的收件箱，由占有连接的线程 drain 到发送队列，
+   除收件箱外，对象只由占有连接的线程访问，不需要加锁 */
+class ws_session
+{
+    friend class ws_hub;
+
+public:
+    /* 帧的操作码 */
+    enum OPCODE
+    {
+        OP_CONTINUATION = 0x0,
+        OP_TEXT = 0x1,
+        OP_BINARY = 0x2,
+        OP_CLOSE = 0x8,
+        OP_PING = 0x9,
+        OP_PONG = 0xa
+    };
+    /* 关闭帧的状态码 */
+    enum CLOSE_CODE
+    {
+        CLOSE_NORMAL = 1000,
+        CLOSE_GOING_AWAY = 1001,
+        CLOSE_PROTOCOL_ERROR = 1002,
+        CLOSE_INVALID_DATA = 1007,
+        CLOSE_TOO_BIG = 1009
+    };
+
+    /* 空闲多久发送 ping，以及等待 pong 的期限（毫秒） */
+    static int m_ping_interval;
+    static int m_pong_timeout;
+    /* 单个连接发送队列积压的上限（字节），超过时作为慢速订阅者关闭 */
+    static size_t m_max_backlog;
+    /* 客户端消息（拼接所有分片后）的上限 */
+    static size_t m_max_message;
+
+public:
+    explicit ws_session(http_conn* conn);
+    ~ws_session();
+
+    /* 按请求头 Sec-WebSocket-Key 排入 101 应答 */
+    void start(const char* key);
+    /* 处理收到的数据，不完整的帧留到下次。出错时已排入关闭帧，返回 false，之后的数据都被忽略 */
+    bool on_data(const char* data, size_t len);
+
+    /* 广播方调用，任意线程：把消息放入收件箱，收件箱已满返回 false（调用者保留消息的引用） */
+    bool deliver(ws_message* msg);
+    /* 收件箱中的消息移入发送队列，积压超过上限返回 false */
+    bool drain();
+    /* 空闲到期时发送 ping，已有 ping 在等待 pong 时返回 false */
+    bool ping(long long now);
+    /* 空闲连接的期限：等待 pong 时为 pong 的期限，否则为发送下一个 ping 的时刻 */
+    long long deadline() const;
+
+    /* 把发送队列开头最多 max 段填入 iov，返回段数 */
+    int gather(struct iovec* iov, int max) const;
+    /* 已写出 n 字节 */
+    void consume(size_t n);
+
+    /* 发送队列中的字节数 */
+    size_t queued() const { return m_queued; }
+    /* 是否有未收完的帧 */
+    bool partial() const { return !m_in.empty(); }
+    /* 是否有等待写出的数据：发送队列或收件箱非空，或积压超限等待关闭 */
+    bool pending() const
+    {
+        return m_queued > 0 || m_inbox.size() > 0 || m_overflow.load(std::memory_order_relaxed);
+    }
+    /* 连接可以关闭：关闭帧已发出，或积压超限 */
+    bool finished() const
+    {
+        return (m_closing && m_queued == 0) || m_overflow.load(std::memory_order_relaxed);
+    }
+    /* 生成一个关闭帧，超时关闭前尽力发送，frame 至少 4 字节，返回帧长度 */
+    int close_frame(char* frame, uint16_t code) const;
+
+    http_conn* conn() const { return m_conn; }
+
+private:
+    /* 收件箱的容量，广播速度超过连接的发送速度时积压在发送队列中，收件箱只需容纳两次 drain 之间的消息 */
+    static const size_t INBOX_SIZE = 128;
+
+    /* 处理一个完整的帧，payload 已去掉掩码 */
+    bool process_frame(bool fin, int opcode, const char* payload, size_t len);
+    /* 连接错误：排入关闭帧，之后不再处理任何帧 */
+    bool fail(CLOSE_CODE code);
+    /* 排入控制帧或关闭帧 */
+    void send_control(int opcode, const char* payload, size_t len);
+    void send_close(uint16_t code);
+    void append(ws_message* msg);
+    /* 标记为慢速订阅者，只在第一次标记时计数 */
+    void set_overflow();
+
+private:
+    http_conn* m_conn;
+
+    /* 跨越多次读取的不完整帧 */
+    std::string m_in;
+    /* 正在拼接的分片消息的操作码（0 表示没有）和内容 */
+    int m_message_op;
+    std::string m_message;
+
+    /* 最近一次收到数据的时间，以及已发出、等待 pong 的 ping 的发送时间（0 表示没有） */
+    long long m_last_active;
+    long long m_ping_sent;
+
+    /* 发送队列，m_front_off 为队首消息已写出的字节数 */
+    std::deque<ws_message*> m_out;
+    size_t m_front_off;
+    size_t m_queued;
+
+    /* 已排入关闭帧，之后不再发送数据帧、不再处理收到的帧 */
+    bool m_closing;
+    /* 收件箱已满或发送队列积压超限 */
+    std::atomic<bool> m_overflow;
+    mpsc_ring<ws_message*> m_inbox;
+
+    /* 在 ws_hub 订阅者表中的下标，由 ws_hub 在持锁时维护，-1 表示未订阅 */
+    int m_hub_slot;
+};
+
+#endif